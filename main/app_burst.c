@@ -0,0 +1,117 @@
+#include "app_burst.h"
+
+#include <string.h>
+#include "esp_heap_caps.h"
+#include "freertos/task.h"
+
+esp_err_t app_burst_init(burst_pool_t *pool, size_t size, size_t reserve)
+{
+    memset(pool, 0, sizeof(burst_pool_t));
+    pool->lock = xSemaphoreCreateMutex();
+    pool->changed = xSemaphoreCreateBinary();
+    if (pool->lock == NULL || pool->changed == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    for (size_t s = size; s >= size / 8 && s > 0; s /= 2) {
+        if (heap_caps_get_free_size(MALLOC_CAP_SPIRAM) < s + reserve) {
+            continue;
+        }
+        pool->buf = heap_caps_malloc(s, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (pool->buf != NULL) {
+            pool->cap = s;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+esp_err_t app_burst_start(burst_pool_t *pool, uint8_t camera, uint16_t frames)
+{
+    esp_err_t err = ESP_OK;
+
+    if (frames == 0 || frames > BURST_MAX_FRAMES) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    xSemaphoreTake(pool->lock, portMAX_DELAY);
+    if (pool->busy) {
+        err = ESP_ERR_INVALID_STATE;
+    } else {
+        pool->busy = true;
+        pool->armed = true;
+        pool->camera = camera;
+        pool->wanted = frames;
+        pool->captured = 0;
+        pool->used = 0;
+        pool->truncated = false;
+        pool->bursts++;
+        xSemaphoreTake(pool->changed, 0);
+    }
+    xSemaphoreGive(pool->lock);
+    return err;
+}
+
+void app_burst_offer(burst_pool_t *pool, uint8_t camera, const uint8_t *data, size_t len, size_t dht_insert_pos,
+                     uint32_t seq, int64_t time_us)
+{
+    // Unlocked peek: the capture path pays nothing while no burst runs
+    if (!pool->armed || pool->camera != camera) {
+        return;
+    }
+
+    // The copy is done under the lock so stop cannot hand the memory to the next burst
+    // mid-copy; the reader only takes the lock to look at the counters
+    xSemaphoreTake(pool->lock, portMAX_DELAY);
+    if (pool->armed && pool->camera == camera) {
+        if (len > pool->cap - pool->used) {
+            pool->truncated = true;
+            pool->truncations++;
+            pool->armed = false;
+        } else {
+            memcpy(pool->buf + pool->used, data, len);
+            pool->frames[pool->captured++] = (burst_frame_t){
+                .pos = pool->used, .len = len, .dht_insert_pos = dht_insert_pos, .seq = seq, .time_us = time_us,
+            };
+            pool->used += len;
+            pool->frames_total++;
+            if (pool->captured == pool->wanted) {
+                pool->armed = false;
+            }
+        }
+        xSemaphoreGive(pool->changed);
+    }
+    xSemaphoreGive(pool->lock);
+}
+
+esp_err_t app_burst_wait(burst_pool_t *pool, uint16_t n, TickType_t timeout, burst_frame_t *frame)
+{
+    TickType_t start = xTaskGetTickCount();
+
+    for (;;) {
+        xSemaphoreTake(pool->lock, portMAX_DELAY);
+        bool have = (n < pool->captured);
+        bool ended = !pool->armed;
+        if (have) {
+            *frame = pool->frames[n];
+        }
+        xSemaphoreGive(pool->lock);
+        if (have) {
+            return ESP_OK;
+        }
+        if (ended) {
+            return ESP_ERR_NOT_FOUND;
+        }
+        // A give after the check above leaves the semaphore set, so no wakeup is lost
+        TickType_t waited = xTaskGetTickCount() - start;
+        if (waited >= timeout || xSemaphoreTake(pool->changed, timeout - waited) != pdTRUE) {
+            return ESP_ERR_TIMEOUT;
+        }
+    }
+}
+
+void app_burst_stop(burst_pool_t *pool)
+{
+    xSemaphoreTake(pool->lock, portMAX_DELAY);
+    pool->armed = false;
+    pool->busy = false;
+    xSemaphoreGive(pool->lock);
+}
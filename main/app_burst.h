@@ -0,0 +1,113 @@
+#pragma once
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Longest burst, 4 s at 30 fps
+#define BURST_MAX_FRAMES    120
+
+/**
+ * @brief One frame of a burst, data at pool->buf + pos
+ */
+typedef struct {
+    uint32_t pos;
+    uint32_t len;
+    uint32_t dht_insert_pos;    // Non-zero if the frame lacks Huffman tables, as frame_slot_t
+    uint32_t seq;               // Capture sequence number, consecutive unless the capture path dropped one
+    int64_t time_us;
+} burst_frame_t;
+
+/**
+ * @brief Reserved memory for a lossless burst of consecutive frames
+ *
+ * The buffer is allocated once and kept, so a burst never competes with other
+ * consumers for PSRAM. One burst runs at a time: the capture path copies every
+ * frame of the chosen camera in until the burst is complete or the buffer is full,
+ * and the reader takes them out in order while the burst goes on. Frames already
+ * captured are not touched again until the burst is stopped.
+ */
+typedef struct {
+    SemaphoreHandle_t lock;
+    SemaphoreHandle_t changed;  // Given whenever a frame is added or the burst ends
+    uint8_t *buf;
+    size_t cap;
+    size_t used;
+    bool busy;                  // Reserved by a reader, between start and stop
+    bool armed;                 // Frames are being captured
+    uint8_t camera;
+    uint16_t wanted;
+    uint16_t captured;
+    bool truncated;             // The buffer filled up before all wanted frames came
+    burst_frame_t frames[BURST_MAX_FRAMES];
+    uint32_t bursts;
+    uint32_t frames_total;
+    uint32_t truncations;
+} burst_pool_t;
+
+/**
+ * @brief Allocate a burst pool
+ *
+ * @param pool Pool
+ * @param size Bytes to reserve, 0 for none; halved down to an eighth when PSRAM is short
+ * @param reserve Bytes of PSRAM a pool size must leave free to be taken
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if nothing could be reserved
+ */
+esp_err_t app_burst_init(burst_pool_t *pool, size_t size, size_t reserve);
+
+/**
+ * @brief Reserve the pool and capture the next frames of a camera
+ *
+ * @param pool Pool
+ * @param camera Camera
+ * @param frames Frames to capture, 1 to BURST_MAX_FRAMES
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG for a bad frame count,
+ *         ESP_ERR_INVALID_STATE if another burst holds the pool
+ */
+esp_err_t app_burst_start(burst_pool_t *pool, uint8_t camera, uint16_t frames);
+
+/**
+ * @brief Offer a captured frame, called from the capture path for every frame
+ *
+ * Returns at once when no burst wants the frame.
+ *
+ * @param pool Pool
+ * @param camera Camera the frame came from
+ * @param data JPEG frame
+ * @param len Frame length
+ * @param dht_insert_pos Where the standard Huffman tables go, 0 if the frame has its own
+ * @param seq Capture sequence number
+ * @param time_us Capture time
+ */
+void app_burst_offer(burst_pool_t *pool, uint8_t camera, const uint8_t *data, size_t len, size_t dht_insert_pos,
+                     uint32_t seq, int64_t time_us);
+
+/**
+ * @brief Wait for a frame of the running burst
+ *
+ * @param pool Pool
+ * @param n Frame number in the burst, from 0
+ * @param timeout Ticks to wait for the frame to be captured
+ * @param[out] frame Frame, valid until app_burst_stop()
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if the burst ended before frame n
+ *         (complete or pool full), ESP_ERR_TIMEOUT if no frame came in time
+ */
+esp_err_t app_burst_wait(burst_pool_t *pool, uint16_t n, TickType_t timeout, burst_frame_t *frame);
+
+/**
+ * @brief End the running burst and release the pool
+ *
+ * @param pool Pool
+ */
+void app_burst_stop(burst_pool_t *pool);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,243 @@
+#include "app_clip.h"
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+static const char *TAG = "app_clip";
+
+// Read size, a multiple of the 32 KB FAT cluster so one read is one contiguous run
+// on the card; halved down to CLIP_BLOCK_MIN when internal DMA memory is short
+#define CLIP_BLOCK_MAX      (64 * 1024)
+#define CLIP_BLOCK_MIN      (8 * 1024)
+#define CLIP_SECTOR         512
+// A stalled card ends the transfer
+#define CLIP_READ_TIMEOUT_MS 10000
+
+typedef struct {
+    int fd;
+    uint64_t pos;                       // Next read, sector aligned
+    uint64_t end;
+    size_t block;
+    uint8_t *buf[2];
+    size_t len[2];
+    SemaphoreHandle_t free;             // Buffers the reader may fill
+    SemaphoreHandle_t full;             // Buffers the sender may send
+    SemaphoreHandle_t done;
+    volatile bool abort;
+    bool failed;
+    uint32_t read_us;
+} clip_reader_t;
+
+esp_err_t app_clip_parse_range(const char *range, uint64_t size, uint64_t *first, uint64_t *last)
+{
+    if (strncmp(range, "bytes=", 6) != 0 || strchr(range, ',') != NULL) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    const char *p = range + 6;
+    while (*p == ' ') {
+        p++;
+    }
+
+    char *end;
+    if (*p == '-') {
+        if (!isdigit((unsigned char)p[1])) {
+            return ESP_ERR_NOT_SUPPORTED;
+        }
+        uint64_t suffix = strtoull(p + 1, &end, 10);
+        if (*end != '\0') {
+            return ESP_ERR_NOT_SUPPORTED;
+        }
+        if (suffix == 0 || size == 0) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        *first = (suffix >= size) ? 0 : size - suffix;
+        *last = size - 1;
+        return ESP_OK;
+    }
+
+    if (!isdigit((unsigned char)*p)) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    uint64_t a = strtoull(p, &end, 10);
+    if (*end != '-') {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    p = end + 1;
+    uint64_t b = UINT64_MAX;
+    if (*p != '\0') {
+        if (!isdigit((unsigned char)*p)) {
+            return ESP_ERR_NOT_SUPPORTED;
+        }
+        b = strtoull(p, &end, 10);
+        if (*end != '\0' || b < a) {
+            return ESP_ERR_NOT_SUPPORTED;
+        }
+    }
+    if (a >= size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    *first = a;
+    *last = (b >= size) ? size - 1 : b;
+    return ESP_OK;
+}
+
+void app_clip_validators(const struct stat *st, char *etag, size_t etag_len, char *last_modified,
+                         size_t last_modified_len)
+{
+    struct tm tm;
+    time_t mtime = st->st_mtime;
+    gmtime_r(&mtime, &tm);
+    snprintf(etag, etag_len, "\"%llx-%llx\"", (unsigned long long)st->st_size, (unsigned long long)mtime);
+    strftime(last_modified, last_modified_len, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+static void clip_read_task(void *arg)
+{
+    clip_reader_t *r = (clip_reader_t *)arg;
+
+    for (int i = 0; !r->abort; i ^= 1) {
+        xSemaphoreTake(r->free, portMAX_DELAY);
+        if (r->abort) {
+            break;
+        }
+        int64_t t0 = esp_timer_get_time();
+        size_t n = 0;
+        while (n < r->block && r->pos + n < r->end) {
+            ssize_t got = read(r->fd, r->buf[i] + n, r->block - n);
+            if (got <= 0) {
+                r->failed = (got < 0);
+                break;
+            }
+            n += got;
+        }
+        r->read_us += esp_timer_get_time() - t0;
+        r->pos += n;
+        r->len[i] = n;
+        xSemaphoreGive(r->full);
+        if (n == 0) {
+            break;
+        }
+    }
+    xSemaphoreGive(r->done);
+    vTaskDelete(NULL);
+}
+
+static void reader_free(clip_reader_t *r)
+{
+    free(r->buf[0]);
+    free(r->buf[1]);
+    if (r->free) {
+        vSemaphoreDelete(r->free);
+    }
+    if (r->full) {
+        vSemaphoreDelete(r->full);
+    }
+    if (r->done) {
+        vSemaphoreDelete(r->done);
+    }
+}
+
+esp_err_t app_clip_send(httpd_handle_t server, int socket_fd, int fd, uint64_t offset, uint64_t len,
+                        clip_send_stats_t *stats)
+{
+    clip_reader_t r = { .fd = fd };
+    int64_t start_us = esp_timer_get_time();
+    uint32_t send_us = 0;
+    uint64_t sent = 0;
+    esp_err_t err = ESP_OK;
+
+    if (len == 0) {
+        return ESP_OK;
+    }
+    for (r.block = CLIP_BLOCK_MAX; r.block >= CLIP_BLOCK_MIN; r.block /= 2) {
+        r.buf[0] = heap_caps_aligned_alloc(64, r.block, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+        r.buf[1] = heap_caps_aligned_alloc(64, r.block, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+        if (r.buf[0] != NULL && r.buf[1] != NULL) {
+            break;
+        }
+        free(r.buf[0]);
+        free(r.buf[1]);
+        r.buf[0] = r.buf[1] = NULL;
+    }
+    r.free = xSemaphoreCreateCounting(2, 2);
+    r.full = xSemaphoreCreateCounting(2, 0);
+    r.done = xSemaphoreCreateBinary();
+    if (r.buf[0] == NULL || r.free == NULL || r.full == NULL || r.done == NULL) {
+        reader_free(&r);
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Reads start on a sector; the bytes before offset are skipped when sending
+    r.pos = offset & ~(uint64_t)(CLIP_SECTOR - 1);
+    r.end = offset + len;
+    size_t skip = offset - r.pos;
+    if (lseek(fd, (off_t)r.pos, SEEK_SET) != (off_t)r.pos) {
+        reader_free(&r);
+        return ESP_FAIL;
+    }
+    if (xTaskCreate(clip_read_task, "clip_read", 3072, &r, uxTaskPriorityGet(NULL), NULL) != pdPASS) {
+        reader_free(&r);
+        return ESP_ERR_NO_MEM;
+    }
+
+    for (int i = 0; sent < len && err == ESP_OK; i ^= 1) {
+        if (xSemaphoreTake(r.full, pdMS_TO_TICKS(CLIP_READ_TIMEOUT_MS)) != pdTRUE) {
+            err = ESP_FAIL;
+            break;
+        }
+        if (r.len[i] <= skip) {
+            err = r.failed ? ESP_FAIL : ESP_ERR_INVALID_SIZE;
+            break;
+        }
+        const uint8_t *p = r.buf[i] + skip;
+        size_t n = r.len[i] - skip;
+        skip = 0;
+        if (n > len - sent) {
+            n = len - sent;
+        }
+        int64_t t0 = esp_timer_get_time();
+        while (n > 0) {
+            int out = httpd_socket_send(server, socket_fd, (const char *)p, n, 0);
+            if (out <= 0) {
+                err = ESP_FAIL;
+                break;
+            }
+            p += out;
+            n -= out;
+            sent += out;
+        }
+        send_us += esp_timer_get_time() - t0;
+        xSemaphoreGive(r.free);
+    }
+
+    // Let the reader see the abort whether it waits for a buffer or is reading
+    r.abort = true;
+    xSemaphoreGive(r.free);
+    xSemaphoreTake(r.done, portMAX_DELAY);
+
+    if (stats != NULL) {
+        *stats = (clip_send_stats_t){
+            .bytes = sent,
+            .block = r.block,
+            .read_us = r.read_us,
+            .send_us = send_us,
+            .elapsed_us = (uint32_t)(esp_timer_get_time() - start_us),
+        };
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Transfer ended after %llu of %llu bytes", sent, len);
+    }
+    reader_free(&r);
+    return err;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "esp_err.h"
+#include "esp_http_server.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Cost of one clip transfer
+ */
+typedef struct {
+    uint64_t bytes;         // Body bytes sent
+    uint32_t block;         // Read size used
+    uint32_t read_us;       // Time in read(), overlapped with sending
+    uint32_t send_us;       // Time in send()
+    uint32_t elapsed_us;
+} clip_send_stats_t;
+
+/**
+ * @brief Parse a single-range Range header ("bytes=a-b", "bytes=a-" or "bytes=-n")
+ *
+ * @param range Header value
+ * @param size File size
+ * @param[out] first First byte of the range
+ * @param[out] last Last byte of the range, inclusive
+ * @return ESP_OK for a satisfiable range, ESP_ERR_NOT_SUPPORTED for a header that is
+ *         ignored (other units, several ranges, bad syntax: send the whole file),
+ *         ESP_ERR_INVALID_SIZE if the range lies past the end (416)
+ */
+esp_err_t app_clip_parse_range(const char *range, uint64_t size, uint64_t *first, uint64_t *last);
+
+/**
+ * @brief Build the validators of a file: a strong ETag from size and modification
+ *        time, and Last-Modified as an HTTP date
+ *
+ * @param st File status
+ * @param[out] etag Quoted ETag, at least 40 bytes
+ * @param etag_len Size of etag
+ * @param[out] last_modified HTTP date, at least 30 bytes
+ * @param last_modified_len Size of last_modified
+ */
+void app_clip_validators(const struct stat *st, char *etag, size_t etag_len, char *last_modified,
+                         size_t last_modified_len);
+
+/**
+ * @brief Send part of a file to a socket
+ *
+ * Reads whole sectors in large blocks into two DMA-capable buffers; a reader task at
+ * the caller's priority fills one while the other is sent, so the card and the
+ * network work at the same time.
+ *
+ * @param server Server owning the socket; writes go through its session, so TLS works
+ * @param socket_fd Connected socket, the response header already sent
+ * @param fd Open file
+ * @param offset First byte
+ * @param len Bytes to send
+ * @param[out] stats Cost of the transfer, may be NULL
+ * @return ESP_OK on success, ESP_ERR_NO_MEM, ESP_ERR_INVALID_SIZE if the file ended
+ *         early, ESP_FAIL on a read or socket error
+ */
+esp_err_t app_clip_send(httpd_handle_t server, int socket_fd, int fd, uint64_t offset, uint64_t len,
+                        clip_send_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
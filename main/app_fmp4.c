@@ -0,0 +1,334 @@
+#include "app_fmp4.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+// Sample flags (ISO/IEC 14496-12 8.8.3.1): sync samples depend on nothing,
+// the others depend on earlier samples and are not sync samples
+#define SAMPLE_FLAGS_SYNC       0x02000000
+#define SAMPLE_FLAGS_NON_SYNC   0x01010000
+
+// Byte writer with box nesting; a failed write (out of room) sticks
+typedef struct {
+    uint8_t *buf;
+    size_t cap;
+    size_t pos;
+    bool overflow;
+    size_t stack[8];
+    int depth;
+} box_writer_t;
+
+static void put_bytes(box_writer_t *w, const void *data, size_t len)
+{
+    if (w->overflow || w->pos + len > w->cap) {
+        w->overflow = true;
+        return;
+    }
+    if (data != NULL) {
+        memcpy(w->buf + w->pos, data, len);
+    } else {
+        memset(w->buf + w->pos, 0, len);
+    }
+    w->pos += len;
+}
+
+static void put_u8(box_writer_t *w, uint8_t v)
+{
+    put_bytes(w, &v, 1);
+}
+
+static void put_u16(box_writer_t *w, uint16_t v)
+{
+    uint8_t b[2] = { v >> 8, v };
+    put_bytes(w, b, 2);
+}
+
+static void put_u32(box_writer_t *w, uint32_t v)
+{
+    uint8_t b[4] = { v >> 24, v >> 16, v >> 8, v };
+    put_bytes(w, b, 4);
+}
+
+static void put_u64(box_writer_t *w, uint64_t v)
+{
+    put_u32(w, (uint32_t)(v >> 32));
+    put_u32(w, (uint32_t)v);
+}
+
+static void put_zeros(box_writer_t *w, size_t len)
+{
+    put_bytes(w, NULL, len);
+}
+
+static void box_begin(box_writer_t *w, const char type[4])
+{
+    w->stack[w->depth++] = w->pos;
+    put_u32(w, 0);
+    put_bytes(w, type, 4);
+}
+
+// Full box: version and 24-bit flags follow the type
+static void full_box_begin(box_writer_t *w, const char type[4], uint8_t version, uint32_t flags)
+{
+    box_begin(w, type);
+    put_u32(w, ((uint32_t)version << 24) | flags);
+}
+
+static void box_end(box_writer_t *w)
+{
+    size_t start = w->stack[--w->depth];
+    if (!w->overflow) {
+        uint32_t size = w->pos - start;
+        uint8_t *p = w->buf + start;
+        p[0] = size >> 24;
+        p[1] = size >> 16;
+        p[2] = size >> 8;
+        p[3] = size;
+    }
+}
+
+// Unity transformation matrix of mvhd / tkhd
+static void put_matrix(box_writer_t *w)
+{
+    static const uint32_t matrix[9] = { 0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000 };
+    for (int i = 0; i < 9; i++) {
+        put_u32(w, matrix[i]);
+    }
+}
+
+esp_err_t app_fmp4_write_init(const uint8_t *sps, size_t sps_len, const uint8_t *pps, size_t pps_len,
+                              uint8_t *out, size_t cap, size_t *out_len)
+{
+    h264_sps_info_t info;
+    if (app_h264_parse_sps(sps, sps_len, &info) != ESP_OK || pps_len == 0) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+
+    box_writer_t w = { .buf = out, .cap = cap };
+
+    box_begin(&w, "ftyp");
+    put_bytes(&w, "iso6", 4);                           // major brand
+    put_u32(&w, 0);
+    put_bytes(&w, "iso6cmfcavc1mp41", 16);              // compatible brands
+    box_end(&w);
+
+    box_begin(&w, "moov");
+    full_box_begin(&w, "mvhd", 0, 0);
+    put_zeros(&w, 8);                                   // creation, modification time
+    put_u32(&w, 1000);                                  // timescale
+    put_u32(&w, 0);                                     // duration: unknown, fragmented
+    put_u32(&w, 0x00010000);                            // rate 1.0
+    put_u16(&w, 0x0100);                                // volume 1.0
+    put_zeros(&w, 10);
+    put_matrix(&w);
+    put_zeros(&w, 24);
+    put_u32(&w, 2);                                     // next track ID
+    box_end(&w);
+
+    box_begin(&w, "trak");
+    full_box_begin(&w, "tkhd", 0, 0x000003);            // enabled, in movie
+    put_zeros(&w, 8);
+    put_u32(&w, 1);                                     // track ID
+    put_zeros(&w, 4);
+    put_u32(&w, 0);                                     // duration
+    put_zeros(&w, 8);
+    put_zeros(&w, 8);                                   // layer, alternate group, volume, reserved
+    put_matrix(&w);
+    put_u32(&w, (uint32_t)info.width << 16);
+    put_u32(&w, (uint32_t)info.height << 16);
+    box_end(&w);
+
+    box_begin(&w, "mdia");
+    full_box_begin(&w, "mdhd", 0, 0);
+    put_zeros(&w, 8);
+    put_u32(&w, FMP4_TIMESCALE);
+    put_u32(&w, 0);
+    put_u16(&w, 0x55C4);                                // language "und"
+    put_u16(&w, 0);
+    box_end(&w);
+
+    full_box_begin(&w, "hdlr", 0, 0);
+    put_u32(&w, 0);
+    put_bytes(&w, "vide", 4);
+    put_zeros(&w, 12);
+    put_bytes(&w, "VideoHandler", 13);
+    box_end(&w);
+
+    box_begin(&w, "minf");
+    full_box_begin(&w, "vmhd", 0, 0x000001);
+    put_zeros(&w, 8);                                   // graphics mode, opcolor
+    box_end(&w);
+
+    box_begin(&w, "dinf");
+    full_box_begin(&w, "dref", 0, 0);
+    put_u32(&w, 1);
+    full_box_begin(&w, "url ", 0, 0x000001);            // media is in this file
+    box_end(&w);
+    box_end(&w);
+    box_end(&w);
+
+    box_begin(&w, "stbl");
+    full_box_begin(&w, "stsd", 0, 0);
+    put_u32(&w, 1);
+    box_begin(&w, "avc1");
+    put_zeros(&w, 6);
+    put_u16(&w, 1);                                     // data reference index
+    put_zeros(&w, 16);
+    put_u16(&w, info.width);
+    put_u16(&w, info.height);
+    put_u32(&w, 0x00480000);                            // 72 dpi
+    put_u32(&w, 0x00480000);
+    put_u32(&w, 0);
+    put_u16(&w, 1);                                     // frame count
+    put_zeros(&w, 32);                                  // compressor name
+    put_u16(&w, 0x0018);                                // depth
+    put_u16(&w, 0xFFFF);
+    box_begin(&w, "avcC");
+    put_u8(&w, 1);                                      // configuration version
+    put_u8(&w, info.profile_idc);
+    put_u8(&w, info.constraint_flags);
+    put_u8(&w, info.level_idc);
+    put_u8(&w, 0xFF);                                   // 4-byte NAL lengths
+    put_u8(&w, 0xE1);                                   // one SPS
+    put_u16(&w, sps_len);
+    put_bytes(&w, sps, sps_len);
+    put_u8(&w, 1);                                      // one PPS
+    put_u16(&w, pps_len);
+    put_bytes(&w, pps, pps_len);
+    box_end(&w);
+    box_end(&w);
+    box_end(&w);
+
+    // Sample tables are empty, samples are described by the fragments
+    const char *empty[] = { "stts", "stsc", "stco" };
+    for (int i = 0; i < 3; i++) {
+        full_box_begin(&w, empty[i], 0, 0);
+        put_u32(&w, 0);
+        box_end(&w);
+    }
+    full_box_begin(&w, "stsz", 0, 0);
+    put_u32(&w, 0);
+    put_u32(&w, 0);
+    box_end(&w);
+    box_end(&w);                                        // stbl
+    box_end(&w);                                        // minf
+    box_end(&w);                                        // mdia
+    box_end(&w);                                        // trak
+
+    box_begin(&w, "mvex");
+    full_box_begin(&w, "trex", 0, 0);
+    put_u32(&w, 1);                                     // track ID
+    put_u32(&w, 1);                                     // sample description index
+    put_zeros(&w, 12);                                  // default duration, size, flags
+    box_end(&w);
+    box_end(&w);
+    box_end(&w);                                        // moov
+
+    if (w.overflow) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    *out_len = w.pos;
+    return ESP_OK;
+}
+
+void app_fmp4_codec_string(const uint8_t *sps, size_t sps_len, char *out, size_t size)
+{
+    if (sps_len < 4) {
+        snprintf(out, size, "avc1");
+        return;
+    }
+    snprintf(out, size, "avc1.%02X%02X%02X", sps[1], sps[2], sps[3]);
+}
+
+static bool nal_in_sample(uint8_t type)
+{
+    return type != H264_NAL_AUD && type != H264_NAL_SPS && type != H264_NAL_PPS;
+}
+
+esp_err_t app_fmp4_write_fragment(fmp4_muxer_t *mux, const uint8_t *data, const h264_index_t *index,
+                                  int64_t timestamp_us, uint8_t *hdr, struct iovec *iov, int *iovcnt,
+                                  size_t *frag_len)
+{
+    if (index->total_nals > index->num_nals) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    uint32_t sample_size = 0;
+    bool has_slice = false;
+    for (int i = 0; i < index->num_nals; i++) {
+        if (nal_in_sample(index->nals[i].type)) {
+            sample_size += 4 + index->nals[i].len;
+            has_slice |= (index->nals[i].type >= H264_NAL_SLICE && index->nals[i].type <= H264_NAL_IDR);
+        }
+    }
+    if (!has_slice) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    // Decode time from the capture clock; the duration is a guess (the previous
+    // interval), the next fragment's decode time corrects it
+    if (mux->sequence == 0) {
+        mux->first_us = timestamp_us;
+        mux->last_us = timestamp_us;
+    }
+    uint64_t decode_time = (uint64_t)(timestamp_us - mux->first_us) * FMP4_TIMESCALE / 1000000;
+    uint32_t duration = (timestamp_us > mux->last_us) ?
+                        (uint32_t)((timestamp_us - mux->last_us) * FMP4_TIMESCALE / 1000000) : FMP4_TIMESCALE / 30;
+    mux->last_us = timestamp_us;
+    mux->sequence++;
+
+    box_writer_t w = { .buf = hdr, .cap = FMP4_FRAGMENT_HDR_MAX };
+    box_begin(&w, "moof");
+    full_box_begin(&w, "mfhd", 0, 0);
+    put_u32(&w, mux->sequence);
+    box_end(&w);
+    box_begin(&w, "traf");
+    full_box_begin(&w, "tfhd", 0, 0x020000);            // default-base-is-moof
+    put_u32(&w, 1);
+    box_end(&w);
+    full_box_begin(&w, "tfdt", 1, 0);
+    put_u64(&w, decode_time);
+    box_end(&w);
+    full_box_begin(&w, "trun", 0, 0x000701);            // data offset, duration, size, flags
+    put_u32(&w, 1);
+    size_t data_offset_pos = w.pos;
+    put_u32(&w, 0);
+    put_u32(&w, duration);
+    put_u32(&w, sample_size);
+    put_u32(&w, index->keyframe ? SAMPLE_FLAGS_SYNC : SAMPLE_FLAGS_NON_SYNC);
+    box_end(&w);
+    box_end(&w);                                        // traf
+    box_end(&w);                                        // moof
+
+    // The sample starts right after the mdat header
+    size_t moof_len = w.pos;
+    put_u32(&w, 8 + sample_size);
+    put_bytes(&w, "mdat", 4);
+    w.buf[data_offset_pos] = (moof_len + 8) >> 24;
+    w.buf[data_offset_pos + 1] = (moof_len + 8) >> 16;
+    w.buf[data_offset_pos + 2] = (moof_len + 8) >> 8;
+    w.buf[data_offset_pos + 3] = (moof_len + 8);
+
+    // NAL units go out in place, each behind its length prefix; the first prefix
+    // shares the segment of the box headers
+    int n = 0;
+    size_t seg_start = 0;
+    for (int i = 0; i < index->num_nals; i++) {
+        const h264_nal_t *nal = &index->nals[i];
+        if (!nal_in_sample(nal->type)) {
+            continue;
+        }
+        put_u32(&w, nal->len);
+        iov[n++] = (struct iovec){ .iov_base = hdr + seg_start, .iov_len = w.pos - seg_start };
+        iov[n++] = (struct iovec){ .iov_base = (void *)(data + nal->pos), .iov_len = nal->len };
+        seg_start = w.pos;
+    }
+    if (w.overflow) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    *iovcnt = n;
+    *frag_len = moof_len + 8 + sample_size;
+    return ESP_OK;
+}
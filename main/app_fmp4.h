@@ -0,0 +1,87 @@
+#pragma once
+
+#include "esp_err.h"
+#include "app_h264.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Fragmented MP4 (CMAF) muxer for H.264 access units, playable by a browser
+ * MediaSource. The init segment carries SPS/PPS in an avcC box; every access unit
+ * then becomes one moof + mdat fragment. The mdat is not assembled: its NAL units
+ * are referenced in place through iovecs, only the box headers and the 4-byte
+ * length prefixes are written.
+ */
+
+// Media timescale, 90 kHz as in RTP
+#define FMP4_TIMESCALE          90000
+
+// Room needed for the box headers and length prefixes of one fragment
+#define FMP4_FRAGMENT_HDR_MAX   (128 + 4 * H264_INDEX_MAX_NALS)
+
+// iovecs needed for one fragment
+#define FMP4_FRAGMENT_MAX_IOV   (2 * H264_INDEX_MAX_NALS)
+
+/**
+ * @brief Muxer state of one output stream
+ */
+typedef struct {
+    uint32_t sequence;          // mfhd sequence number of the last fragment
+    int64_t first_us;           // Capture time of the first sample
+    int64_t last_us;            // Capture time of the previous sample
+} fmp4_muxer_t;
+
+/**
+ * @brief Write the init segment (ftyp + moov)
+ *
+ * @param sps SPS NAL unit, starting with the NAL header
+ * @param sps_len SPS length
+ * @param pps PPS NAL unit
+ * @param pps_len PPS length
+ * @param out Output buffer
+ * @param cap Capacity of out
+ * @param[out] out_len Bytes written
+ * @return ESP_OK on success, ESP_ERR_INVALID_RESPONSE if the SPS cannot be parsed,
+ *         ESP_ERR_INVALID_SIZE if out is too small
+ */
+esp_err_t app_fmp4_write_init(const uint8_t *sps, size_t sps_len, const uint8_t *pps, size_t pps_len,
+                              uint8_t *out, size_t cap, size_t *out_len);
+
+/**
+ * @brief RFC 6381 codec string of the stream, e.g. "avc1.64001F"
+ *
+ * @param sps SPS NAL unit
+ * @param sps_len SPS length
+ * @param out Output string, at least 12 bytes
+ * @param size Size of out
+ */
+void app_fmp4_codec_string(const uint8_t *sps, size_t sps_len, char *out, size_t size);
+
+/**
+ * @brief Describe one access unit as a moof + mdat fragment
+ *
+ * AUD, SPS and PPS NAL units are left out of the sample, they are in the init segment.
+ *
+ * @param mux Muxer state, zero-initialized before the first fragment
+ * @param data Access unit (Annex B)
+ * @param index Structure of the access unit
+ * @param timestamp_us Capture time of the access unit
+ * @param hdr Buffer for box headers and length prefixes, FMP4_FRAGMENT_HDR_MAX bytes
+ * @param iov Output segments, FMP4_FRAGMENT_MAX_IOV entries; they point into hdr and data
+ * @param[out] iovcnt Segments used
+ * @param[out] frag_len Total fragment length
+ * @return ESP_OK on success, ESP_ERR_NOT_SUPPORTED if the access unit has more NAL units
+ *         than the index holds, ESP_ERR_NOT_FOUND if it has no slice
+ */
+esp_err_t app_fmp4_write_fragment(fmp4_muxer_t *mux, const uint8_t *data, const h264_index_t *index,
+                                  int64_t timestamp_us, uint8_t *hdr, struct iovec *iov, int *iovcnt,
+                                  size_t *frag_len);
+
+#ifdef __cplusplus
+}
+#endif
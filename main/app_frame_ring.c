@@ -0,0 +1,175 @@
+#include "app_frame_ring.h"
+
+#include <string.h>
+#include "esp_heap_caps.h"
+
+esp_err_t app_frame_ring_init(frame_ring_t *ring, size_t budget, size_t reserve)
+{
+    memset(ring, 0, sizeof(frame_ring_t));
+    ring->budget = budget;
+    ring->reserve = reserve;
+    ring->first_seq = 1;
+    ring->next_seq = 1;
+    ring->lock = xSemaphoreCreateMutex();
+    return ring->lock ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+// Allocate the buffer, settling for less than the budget when PSRAM is short
+static void ring_alloc(frame_ring_t *ring)
+{
+    ring->entries = ring->budget == 0 ? NULL :
+                    heap_caps_malloc(FRAME_RING_MAX_FRAMES * sizeof(frame_ring_entry_t),
+                                     MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    for (size_t size = ring->budget; ring->entries != NULL && size >= ring->budget / 8 && size > 0; size /= 2) {
+        // Viewers allocate their frame buffers when they connect; leave them room
+        if (heap_caps_get_free_size(MALLOC_CAP_SPIRAM) < size + ring->reserve) {
+            continue;
+        }
+        ring->buf = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (ring->buf != NULL) {
+            ring->cap = size;
+            return;
+        }
+    }
+    free(ring->entries);
+    ring->entries = NULL;
+    ring->failed = true;
+}
+
+esp_err_t app_frame_ring_push(frame_ring_t *ring, const uint8_t *data, size_t len, uint16_t width,
+                              uint16_t height, int64_t time_us, uint32_t *seq)
+{
+    esp_err_t err = ESP_OK;
+
+    xSemaphoreTake(ring->lock, portMAX_DELAY);
+
+    if (ring->buf == NULL && !ring->failed) {
+        ring_alloc(ring);
+    }
+    if (ring->buf == NULL) {
+        err = ESP_ERR_NO_MEM;
+    } else if (len > ring->cap) {
+        err = ESP_ERR_INVALID_SIZE;
+    } else {
+        // Frames are never split: one that does not fit before the end goes to the start
+        size_t pos = ring->head;
+        bool wrap = (pos + len > ring->cap);
+        if (wrap) {
+            pos = 0;
+        }
+        // Drop from the oldest end: the frames past the old head when wrapping (they are
+        // older than the ones at the start), then whatever the new frame overlaps
+        while (ring->first_seq != ring->next_seq) {
+            const frame_ring_entry_t *e = &ring->entries[ring->first_seq % FRAME_RING_MAX_FRAMES];
+            bool overlaps = (e->pos < pos + len && pos < e->pos + e->len);
+            bool passed = (wrap && e->pos >= ring->head);
+            bool table_full = (ring->next_seq - ring->first_seq >= FRAME_RING_MAX_FRAMES);
+            if (!overlaps && !passed && !table_full) {
+                break;
+            }
+            ring->first_seq++;
+        }
+        memcpy(ring->buf + pos, data, len);
+        ring->entries[ring->next_seq % FRAME_RING_MAX_FRAMES] = (frame_ring_entry_t){
+            .pos = pos, .len = len, .time_us = time_us, .width = width, .height = height,
+        };
+        if (seq != NULL) {
+            *seq = ring->next_seq;
+        }
+        ring->next_seq++;
+        ring->head = pos + len;
+    }
+
+    xSemaphoreGive(ring->lock);
+    return err;
+}
+
+uint32_t app_frame_ring_seek(frame_ring_t *ring, int64_t time_us)
+{
+    xSemaphoreTake(ring->lock, portMAX_DELAY);
+    uint32_t lo = ring->first_seq;
+    uint32_t hi = ring->next_seq;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (ring->entries[mid % FRAME_RING_MAX_FRAMES].time_us < time_us) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    xSemaphoreGive(ring->lock);
+    return lo;
+}
+
+esp_err_t app_frame_ring_read(frame_ring_t *ring, uint32_t seq, uint8_t *out, size_t cap, size_t *out_len,
+                              int64_t *time_us)
+{
+    esp_err_t err = ESP_OK;
+
+    xSemaphoreTake(ring->lock, portMAX_DELAY);
+    if (seq >= ring->next_seq) {
+        err = ESP_ERR_NOT_FOUND;
+    } else if (seq < ring->first_seq) {
+        err = ESP_ERR_INVALID_STATE;
+    } else {
+        const frame_ring_entry_t *e = &ring->entries[seq % FRAME_RING_MAX_FRAMES];
+        if (e->len > cap) {
+            err = ESP_ERR_INVALID_SIZE;
+        } else {
+            memcpy(out, ring->buf + e->pos, e->len);
+            *out_len = e->len;
+            if (time_us != NULL) {
+                *time_us = e->time_us;
+            }
+        }
+    }
+    xSemaphoreGive(ring->lock);
+    return err;
+}
+
+void app_frame_ring_stats(frame_ring_t *ring, frame_ring_stats_t *stats)
+{
+    int64_t first_us[FRAME_RING_MAX_RES];
+    int64_t last_us[FRAME_RING_MAX_RES];
+
+    memset(stats, 0, sizeof(frame_ring_stats_t));
+    xSemaphoreTake(ring->lock, portMAX_DELAY);
+    stats->cap = ring->cap;
+    stats->frames = ring->next_seq - ring->first_seq;
+    for (uint32_t seq = ring->first_seq; seq != ring->next_seq; seq++) {
+        const frame_ring_entry_t *e = &ring->entries[seq % FRAME_RING_MAX_FRAMES];
+        stats->bytes += e->len;
+        int r = 0;
+        while (r < stats->num_res && (stats->res[r].width != e->width || stats->res[r].height != e->height)) {
+            r++;
+        }
+        if (r == stats->num_res) {
+            if (r == FRAME_RING_MAX_RES) {
+                r--;    // Further resolutions are folded into the last entry
+            } else {
+                stats->num_res++;
+                stats->res[r].width = e->width;
+                stats->res[r].height = e->height;
+                first_us[r] = e->time_us;
+            }
+        }
+        stats->res[r].frames++;
+        stats->res[r].bytes += e->len;
+        last_us[r] = e->time_us;
+    }
+    if (stats->frames > 1) {
+        const frame_ring_entry_t *oldest = &ring->entries[ring->first_seq % FRAME_RING_MAX_FRAMES];
+        const frame_ring_entry_t *newest = &ring->entries[(ring->next_seq - 1) % FRAME_RING_MAX_FRAMES];
+        stats->span_ms = (uint32_t)((newest->time_us - oldest->time_us) / 1000);
+    }
+    xSemaphoreGive(ring->lock);
+
+    // Average frame size times frame rate, so a single frame does not count as a full second
+    for (int r = 0; r < stats->num_res; r++) {
+        frame_ring_res_t *res = &stats->res[r];
+        int64_t span_us = last_us[r] - first_us[r];
+        if (res->frames > 1 && span_us > 0) {
+            res->bytes_per_s = (uint32_t)((uint64_t)res->bytes * (res->frames - 1) * 1000000 / res->frames / span_us);
+        }
+    }
+}
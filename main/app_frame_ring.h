@@ -0,0 +1,136 @@
+#pragma once
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Frames indexed per ring, about half a minute at 30 fps
+#define FRAME_RING_MAX_FRAMES   1024
+// Resolutions broken out in app_frame_ring_stats()
+#define FRAME_RING_MAX_RES      4
+
+/**
+ * @brief One frame in the ring
+ */
+typedef struct {
+    uint32_t pos;
+    uint32_t len;
+    int64_t time_us;
+    uint16_t width;
+    uint16_t height;
+} frame_ring_entry_t;
+
+/**
+ * @brief Time-indexed history of JPEG frames in PSRAM
+ *
+ * Frames are stored back to back in one buffer and get consecutive sequence
+ * numbers; a new frame overwrites the oldest ones it overlaps. Capture times only
+ * grow, so a point in time is found by binary search over the frames kept.
+ */
+typedef struct {
+    SemaphoreHandle_t lock;
+    size_t budget;              // Bytes wanted, allocated on the first push
+    size_t reserve;             // PSRAM the buffer must leave free
+    uint8_t *buf;
+    size_t cap;                 // Bytes allocated, smaller than the budget if PSRAM is short
+    frame_ring_entry_t *entries;
+    size_t head;                // Where the next frame goes
+    uint32_t first_seq;         // Oldest frame kept
+    uint32_t next_seq;          // Sequence number of the next frame, starts at 1
+    bool failed;                // No memory, frames are not kept
+} frame_ring_t;
+
+/**
+ * @brief Memory use of one resolution in the ring
+ */
+typedef struct {
+    uint16_t width;
+    uint16_t height;
+    uint32_t frames;
+    uint32_t bytes;
+    uint32_t bytes_per_s;       // Over the time span of those frames
+} frame_ring_res_t;
+
+/**
+ * @brief Ring occupancy
+ */
+typedef struct {
+    size_t cap;
+    size_t bytes;
+    uint32_t frames;
+    uint32_t span_ms;           // Oldest to newest frame
+    uint8_t num_res;
+    frame_ring_res_t res[FRAME_RING_MAX_RES];
+} frame_ring_stats_t;
+
+/**
+ * @brief Initialize a ring
+ *
+ * @param ring Ring
+ * @param budget Bytes of frame data to keep, 0 to keep none; the buffer is allocated
+ *               on the first push, halving the size down to an eighth when PSRAM is short
+ * @param reserve Bytes of PSRAM a buffer size must leave free to be taken
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if the lock cannot be created
+ */
+esp_err_t app_frame_ring_init(frame_ring_t *ring, size_t budget, size_t reserve);
+
+/**
+ * @brief Append a frame, dropping the oldest ones to make room
+ *
+ * @param ring Ring
+ * @param data JPEG frame
+ * @param len Frame length
+ * @param width Frame width
+ * @param height Frame height
+ * @param time_us Capture time, not older than the previous frame
+ * @param[out] seq Sequence number of the frame (may be NULL)
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if the ring has no buffer,
+ *         ESP_ERR_INVALID_SIZE if the frame is larger than the ring
+ */
+esp_err_t app_frame_ring_push(frame_ring_t *ring, const uint8_t *data, size_t len, uint16_t width,
+                              uint16_t height, int64_t time_us, uint32_t *seq);
+
+/**
+ * @brief First frame captured at or after a point in time
+ *
+ * @param ring Ring
+ * @param time_us Capture time
+ * @return Sequence number; the oldest frame if time_us is before it, the next
+ *         frame to come if time_us is after the newest
+ */
+uint32_t app_frame_ring_seek(frame_ring_t *ring, int64_t time_us);
+
+/**
+ * @brief Copy a frame out of the ring
+ *
+ * @param ring Ring
+ * @param seq Sequence number
+ * @param out Output buffer
+ * @param cap Capacity of out
+ * @param[out] out_len Frame length
+ * @param[out] time_us Capture time (may be NULL)
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if the frame has not arrived yet,
+ *         ESP_ERR_INVALID_STATE if it was overwritten (continue at app_frame_ring_seek()),
+ *         ESP_ERR_INVALID_SIZE if out is too small
+ */
+esp_err_t app_frame_ring_read(frame_ring_t *ring, uint32_t seq, uint8_t *out, size_t cap, size_t *out_len,
+                              int64_t *time_us);
+
+/**
+ * @brief Current occupancy, with bytes per second of history for each resolution
+ *
+ * @param ring Ring
+ * @param[out] stats Occupancy
+ */
+void app_frame_ring_stats(frame_ring_t *ring, frame_ring_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
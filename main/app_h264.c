@@ -0,0 +1,322 @@
+#include "app_h264.h"
+
+#include <string.h>
+#include "esp_heap_caps.h"
+
+// Find the next 00 00 01 start code at or after pos, returns len if there is none
+static size_t find_start_code(const uint8_t *data, size_t len, size_t pos)
+{
+    while (pos + 3 <= len) {
+        const uint8_t *one = memchr(&data[pos + 2], 0x01, len - pos - 2);
+        if (one == NULL) {
+            break;
+        }
+        size_t p = one - data;
+        if (data[p - 1] == 0x00 && data[p - 2] == 0x00) {
+            return p - 2;
+        }
+        pos = p - 1;
+    }
+    return len;
+}
+
+esp_err_t app_h264_build_index(const uint8_t *data, size_t len, h264_index_t *index)
+{
+    memset(index, 0, offsetof(h264_index_t, nals));
+    index->sps = -1;
+    index->pps = -1;
+
+    // A 4 byte start code is a zero byte followed by the 3 byte one
+    size_t pos = find_start_code(data, len, 0);
+    if (pos + 4 > len || (pos > 0 && !(pos == 1 && data[0] == 0x00))) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+
+    bool has_slice = false;
+    while (pos < len) {
+        size_t nal = pos + 3;
+        size_t next = find_start_code(data, len, nal);
+        size_t end = next;
+        while (end > nal && data[end - 1] == 0x00) {
+            end--;
+        }
+        if (end == nal || (data[nal] & 0x80)) {
+            // Empty NAL unit or forbidden_zero_bit set
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+
+        uint8_t type = data[nal] & 0x1F;
+        if (type >= H264_NAL_SLICE && type <= H264_NAL_IDR) {
+            has_slice = true;
+        }
+        if (type == H264_NAL_IDR) {
+            index->keyframe = true;
+        }
+        if (index->num_nals < H264_INDEX_MAX_NALS) {
+            if (type == H264_NAL_SPS) {
+                index->sps = index->num_nals;
+            } else if (type == H264_NAL_PPS) {
+                index->pps = index->num_nals;
+            }
+            index->nals[index->num_nals++] = (h264_nal_t){ .pos = nal, .len = end - nal, .type = type };
+        }
+        index->total_nals++;
+        pos = next;
+    }
+    return has_slice ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+// Exp-Golomb reader over the RBSP, emulation prevention bytes are skipped on the fly
+typedef struct {
+    const uint8_t *data;
+    size_t len;
+    size_t pos;
+    int bit;
+    int zeros;
+    bool overrun;
+} rbsp_reader_t;
+
+static uint32_t read_bit(rbsp_reader_t *br)
+{
+    if (br->bit == 0) {
+        if (br->zeros >= 2 && br->pos < br->len && br->data[br->pos] == 0x03) {
+            br->pos++;
+            br->zeros = 0;
+        }
+        if (br->pos >= br->len) {
+            br->overrun = true;
+            return 0;
+        }
+        br->zeros = (br->data[br->pos] == 0x00) ? br->zeros + 1 : 0;
+    }
+    uint32_t v = (br->data[br->pos] >> (7 - br->bit)) & 1;
+    if (++br->bit == 8) {
+        br->bit = 0;
+        br->pos++;
+    }
+    return v;
+}
+
+static uint32_t read_bits(rbsp_reader_t *br, int n)
+{
+    uint32_t v = 0;
+    while (n-- > 0) {
+        v = (v << 1) | read_bit(br);
+    }
+    return v;
+}
+
+static uint32_t read_ue(rbsp_reader_t *br)
+{
+    int zeros = 0;
+    while (read_bit(br) == 0 && !br->overrun) {
+        if (++zeros > 31) {
+            br->overrun = true;
+            return 0;
+        }
+    }
+    return ((1u << zeros) - 1) + read_bits(br, zeros);
+}
+
+static int32_t read_se(rbsp_reader_t *br)
+{
+    uint32_t v = read_ue(br);
+    return (v & 1) ? (int32_t)((v + 1) / 2) : -(int32_t)(v / 2);
+}
+
+esp_err_t app_h264_parse_sps(const uint8_t *sps, size_t len, h264_sps_info_t *info)
+{
+    if (len < 4 || (sps[0] & 0x1F) != H264_NAL_SPS) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    info->profile_idc = sps[1];
+    info->constraint_flags = sps[2];
+    info->level_idc = sps[3];
+
+    rbsp_reader_t br = { .data = sps, .len = len, .pos = 4 };
+    read_ue(&br);                                       // seq_parameter_set_id
+    uint32_t chroma_format_idc = 1;
+    switch (info->profile_idc) {
+    case 100: case 110: case 122: case 244: case 44: case 83: case 86: case 118: case 128: case 138: case 139: case 134: case 135:
+        chroma_format_idc = read_ue(&br);
+        if (chroma_format_idc == 3) {
+            read_bit(&br);                              // separate_colour_plane_flag
+        }
+        read_ue(&br);                                   // bit_depth_luma_minus8
+        read_ue(&br);                                   // bit_depth_chroma_minus8
+        read_bit(&br);                                  // qpprime_y_zero_transform_bypass_flag
+        if (read_bit(&br)) {                            // seq_scaling_matrix_present_flag
+            for (int i = 0; i < (chroma_format_idc != 3 ? 8 : 12); i++) {
+                if (!read_bit(&br)) {
+                    continue;
+                }
+                int last = 8;
+                int next = 8;
+                for (int j = 0; j < (i < 6 ? 16 : 64) && next != 0; j++) {
+                    next = (last + read_se(&br) + 256) % 256;
+                    last = next ? next : last;
+                }
+            }
+        }
+        break;
+    default:
+        break;
+    }
+
+    read_ue(&br);                                       // log2_max_frame_num_minus4
+    uint32_t poc_type = read_ue(&br);
+    if (poc_type == 0) {
+        read_ue(&br);                                   // log2_max_pic_order_cnt_lsb_minus4
+    } else if (poc_type == 1) {
+        read_bit(&br);                                  // delta_pic_order_always_zero_flag
+        read_se(&br);                                   // offset_for_non_ref_pic
+        read_se(&br);                                   // offset_for_top_to_bottom_field
+        uint32_t n = read_ue(&br);
+        for (uint32_t i = 0; i < n && !br.overrun; i++) {
+            read_se(&br);
+        }
+    }
+    read_ue(&br);                                       // max_num_ref_frames
+    read_bit(&br);                                      // gaps_in_frame_num_value_allowed_flag
+    uint32_t width_mbs = read_ue(&br) + 1;
+    uint32_t height_units = read_ue(&br) + 1;
+    uint32_t frame_mbs_only = read_bit(&br);
+    if (!frame_mbs_only) {
+        read_bit(&br);                                  // mb_adaptive_frame_field_flag
+    }
+    read_bit(&br);                                      // direct_8x8_inference_flag
+    uint32_t crop[4] = {0};
+    if (read_bit(&br)) {
+        for (int i = 0; i < 4; i++) {
+            crop[i] = read_ue(&br);                     // left, right, top, bottom
+        }
+    }
+    if (br.overrun) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+
+    // Crop offsets are in chroma samples (and field lines for interlaced streams)
+    uint32_t crop_x = (chroma_format_idc == 1 || chroma_format_idc == 2) ? 2 : 1;
+    uint32_t crop_y = ((chroma_format_idc == 1) ? 2 : 1) * (2 - frame_mbs_only);
+    uint32_t width = width_mbs * 16;
+    uint32_t height = height_units * 16 * (2 - frame_mbs_only);
+    if (crop_x * (crop[0] + crop[1]) >= width || crop_y * (crop[2] + crop[3]) >= height) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    width -= crop_x * (crop[0] + crop[1]);
+    height -= crop_y * (crop[2] + crop[3]);
+    if (width > UINT16_MAX || height > UINT16_MAX) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    info->width = width;
+    info->height = height;
+    return ESP_OK;
+}
+
+esp_err_t app_h264_gop_init(h264_gop_t *gop, size_t cap)
+{
+    memset(gop, 0, sizeof(h264_gop_t));
+    gop->cap = cap;
+    gop->lock = xSemaphoreCreateMutex();
+    return gop->lock ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+static void store_param(uint8_t *dst, uint16_t *dst_len, const uint8_t *data, const h264_index_t *index, int8_t i)
+{
+    if (i >= 0 && index->nals[i].len <= H264_MAX_PARAM_LEN) {
+        memcpy(dst, data + index->nals[i].pos, index->nals[i].len);
+        *dst_len = index->nals[i].len;
+    }
+}
+
+esp_err_t app_h264_gop_push(h264_gop_t *gop, const uint8_t *data, size_t len, const h264_index_t *index,
+                            int64_t timestamp_us)
+{
+    esp_err_t err = ESP_OK;
+
+    xSemaphoreTake(gop->lock, portMAX_DELAY);
+
+    store_param(gop->sps, &gop->sps_len, data, index, index->sps);
+    store_param(gop->pps, &gop->pps_len, data, index, index->pps);
+
+    if (index->keyframe) {
+        if (gop->buf == NULL) {
+            gop->buf = heap_caps_malloc(gop->cap, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        }
+        gop->gop_id++;
+        gop->used = 0;
+        gop->num_aus = 0;
+        gop->full = false;
+    }
+
+    if (gop->gop_id == 0) {
+        err = ESP_ERR_INVALID_STATE;
+    } else if (gop->full || gop->buf == NULL || gop->num_aus >= H264_GOP_MAX_AUS || gop->used + len > gop->cap) {
+        // The rest of this GOP cannot be decoded without the missing access unit
+        gop->full = true;
+        gop->overflows++;
+        err = ESP_ERR_NO_MEM;
+    } else {
+        memcpy(gop->buf + gop->used, data, len);
+        gop->au_pos[gop->num_aus] = gop->used;
+        gop->au_len[gop->num_aus] = len;
+        gop->au_time_us[gop->num_aus] = timestamp_us;
+        gop->num_aus++;
+        gop->used += len;
+    }
+
+    xSemaphoreGive(gop->lock);
+    return err;
+}
+
+static size_t put_param(uint8_t *out, const uint8_t *param, uint16_t len)
+{
+    static const uint8_t start_code[4] = { 0x00, 0x00, 0x00, 0x01 };
+    if (len == 0) {
+        return 0;
+    }
+    memcpy(out, start_code, 4);
+    memcpy(out + 4, param, len);
+    return 4 + len;
+}
+
+esp_err_t app_h264_gop_read(h264_gop_t *gop, h264_cursor_t *cursor, uint8_t *out, size_t cap, size_t *out_len,
+                            int64_t *timestamp_us)
+{
+    esp_err_t err = ESP_OK;
+    size_t n = 0;
+
+    xSemaphoreTake(gop->lock, portMAX_DELAY);
+
+    // Behind a GOP boundary (or new): continue at the newest IDR
+    bool enter = (cursor->gop_id != gop->gop_id);
+    if (enter) {
+        cursor->gop_id = gop->gop_id;
+        cursor->next = 0;
+    }
+
+    if (gop->gop_id == 0 || cursor->next >= gop->num_aus) {
+        err = ESP_ERR_NOT_FOUND;
+    } else {
+        uint32_t au_len = gop->au_len[cursor->next];
+        if (au_len + H264_GOP_READ_OVERHEAD > cap) {
+            cursor->next = H264_GOP_MAX_AUS;
+            err = ESP_ERR_INVALID_SIZE;
+        } else {
+            if (cursor->next == 0) {
+                n += put_param(out + n, gop->sps, gop->sps_len);
+                n += put_param(out + n, gop->pps, gop->pps_len);
+            }
+            memcpy(out + n, gop->buf + gop->au_pos[cursor->next], au_len);
+            n += au_len;
+            if (timestamp_us != NULL) {
+                *timestamp_us = gop->au_time_us[cursor->next];
+            }
+            cursor->next++;
+        }
+    }
+
+    xSemaphoreGive(gop->lock);
+    *out_len = n;
+    return err;
+}
@@ -0,0 +1,168 @@
+#pragma once
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// NAL unit types used by the pipeline (ITU-T H.264 Table 7-1)
+#define H264_NAL_SLICE      1
+#define H264_NAL_IDR        5
+#define H264_NAL_SEI        6
+#define H264_NAL_SPS        7
+#define H264_NAL_PPS        8
+#define H264_NAL_AUD        9
+
+// NAL units recorded per access unit, further ones are counted but not indexed
+#define H264_INDEX_MAX_NALS 32
+
+// Largest SPS / PPS kept for new viewers
+#define H264_MAX_PARAM_LEN  128
+
+/**
+ * @brief One NAL unit of an Annex B byte stream
+ */
+typedef struct {
+    uint32_t pos;       // First byte after the start code (the NAL header)
+    uint32_t len;       // Up to the next start code, trailing zero bytes excluded
+    uint8_t type;
+} h264_nal_t;
+
+/**
+ * @brief Structure of one access unit (one UVC frame), built once at ingest
+ */
+typedef struct {
+    uint16_t num_nals;          // Entries in nals
+    uint16_t total_nals;        // NAL units in the access unit
+    bool keyframe;              // Contains an IDR slice
+    int8_t sps;                 // Index into nals of the last SPS, -1 if none
+    int8_t pps;                 // Index into nals of the last PPS, -1 if none
+    h264_nal_t nals[H264_INDEX_MAX_NALS];
+} h264_index_t;
+
+/**
+ * @brief Stream parameters from a sequence parameter set
+ */
+typedef struct {
+    uint8_t profile_idc;
+    uint8_t constraint_flags;   // constraint_set0..5 flags, as in the SPS byte
+    uint8_t level_idc;
+    uint16_t width;             // Display size, cropping applied
+    uint16_t height;
+} h264_sps_info_t;
+
+/**
+ * @brief Split an Annex B access unit into NAL units
+ *
+ * @param data Access unit, starting with a 3 or 4 byte start code
+ * @param len Length in bytes
+ * @param[out] index Access unit structure
+ * @return ESP_OK if the access unit has at least one slice;
+ *         ESP_ERR_NOT_FOUND if it holds only non-VCL NAL units (e.g. parameter sets);
+ *         ESP_ERR_INVALID_RESPONSE if it does not start with a start code or a NAL
+ *         header is invalid
+ */
+esp_err_t app_h264_build_index(const uint8_t *data, size_t len, h264_index_t *index);
+
+/**
+ * @brief Parse the fields of an SPS needed to describe the stream
+ *
+ * @param sps SPS NAL unit, starting with the NAL header
+ * @param len Length of the NAL unit
+ * @param[out] info Profile, level and picture size
+ * @return ESP_OK on success, ESP_ERR_INVALID_RESPONSE if the SPS is malformed or truncated
+ */
+esp_err_t app_h264_parse_sps(const uint8_t *sps, size_t len, h264_sps_info_t *info);
+
+// Access units kept per GOP
+#define H264_GOP_MAX_AUS    256
+
+/**
+ * @brief Cache of the current group of pictures
+ *
+ * Holds the latest SPS and PPS plus every access unit since the last IDR, so a
+ * new viewer can start decoding at once instead of waiting for the next IDR.
+ * The same store feeds live viewers: they read access units in order and jump
+ * to the newest IDR when they fall behind a GOP boundary.
+ */
+typedef struct {
+    SemaphoreHandle_t lock;
+    uint8_t *buf;               // Access unit data of the GOP, allocated on first use
+    size_t cap;
+    size_t used;
+    uint32_t gop_id;            // Incremented at every IDR, 0 before the first one
+    uint16_t num_aus;
+    bool full;                  // Access units after this point were not cached
+    uint32_t au_pos[H264_GOP_MAX_AUS];
+    uint32_t au_len[H264_GOP_MAX_AUS];
+    int64_t au_time_us[H264_GOP_MAX_AUS];
+    uint8_t sps[H264_MAX_PARAM_LEN];
+    uint8_t pps[H264_MAX_PARAM_LEN];
+    uint16_t sps_len;
+    uint16_t pps_len;
+    uint32_t overflows;         // Access units lost because the GOP did not fit
+} h264_gop_t;
+
+/**
+ * @brief Read position of one viewer in a h264_gop_t
+ */
+typedef struct {
+    uint32_t gop_id;            // GOP being read, 0 before the first read
+    uint16_t next;              // Next access unit of that GOP
+} h264_cursor_t;
+
+// Room app_h264_gop_read() needs on top of the access unit, for SPS and PPS
+#define H264_GOP_READ_OVERHEAD  (2 * (4 + H264_MAX_PARAM_LEN))
+
+/**
+ * @brief Initialize a GOP cache
+ *
+ * @param gop Cache
+ * @param cap Bytes of access unit data to keep, allocated in PSRAM on the first IDR
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if the lock cannot be created
+ */
+esp_err_t app_h264_gop_init(h264_gop_t *gop, size_t cap);
+
+/**
+ * @brief Add an access unit to the cache
+ *
+ * An IDR starts a new GOP. Access units before the first IDR are not cached.
+ *
+ * @param gop Cache
+ * @param data Access unit
+ * @param len Length of the access unit
+ * @param index Structure of the access unit
+ * @param timestamp_us Capture time of the access unit
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if no IDR has been seen yet,
+ *         ESP_ERR_NO_MEM if the GOP is full (counted in overflows)
+ */
+esp_err_t app_h264_gop_push(h264_gop_t *gop, const uint8_t *data, size_t len, const h264_index_t *index,
+                            int64_t timestamp_us);
+
+/**
+ * @brief Copy the next access unit for a viewer
+ *
+ * The first access unit of every GOP a cursor enters is preceded by the cached
+ * SPS and PPS.
+ *
+ * @param gop Cache
+ * @param cursor Viewer position, zero-initialized for a new viewer
+ * @param out Output buffer, at least the access unit size + H264_GOP_READ_OVERHEAD
+ * @param cap Capacity of out
+ * @param[out] out_len Bytes written
+ * @param[out] timestamp_us Capture time of the access unit (may be NULL)
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if there is nothing new yet,
+ *         ESP_ERR_INVALID_SIZE if out is too small (the viewer resumes at the next IDR)
+ */
+esp_err_t app_h264_gop_read(h264_gop_t *gop, h264_cursor_t *cursor, uint8_t *out, size_t cap, size_t *out_len,
+                            int64_t *timestamp_us);
+
+#ifdef __cplusplus
+}
+#endif
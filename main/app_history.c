@@ -0,0 +1,256 @@
+#include "app_history.h"
+#include "app_uvc.h"
+#include "app_http.h"
+#include "app_wifi.h"
+
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+static const char *TAG = "app_history";
+
+// Fields of history_sample_t in encoding order. uptime_s is implicit:
+// samples of a block are consecutive seconds starting at block start_s.
+#define HISTORY_FIELDS (9 + DROP_REASON_COUNT)
+
+// Worst case for one sample: every field a full 5-byte varint
+#define SAMPLE_MAX_BYTES (HISTORY_FIELDS * 5)
+
+typedef struct {
+    uint32_t start_s;
+    uint16_t count;
+    uint16_t used;
+    uint8_t data[HISTORY_BLOCK_BYTES];
+} history_block_t;
+
+// The ring lives in internal RAM: it is tiny and must survive PSRAM pressure
+static history_block_t g_blocks[HISTORY_BLOCKS];
+static uint8_t g_head = 0;              // Block currently being written
+static uint8_t g_num_blocks = 0;        // Blocks holding data, including head
+static history_sample_t g_prev_sample;  // Last sample encoded into the head block
+static SemaphoreHandle_t g_history_mutex = NULL;
+
+static void sample_to_fields(const history_sample_t *s, uint32_t *f)
+{
+    int i = 0;
+    f[i++] = s->frames_in;
+    f[i++] = s->frames_out;
+    f[i++] = s->bytes_in;
+    f[i++] = s->bytes_out;
+    for (int r = 0; r < DROP_REASON_COUNT; r++) {
+        f[i++] = s->drops[r];
+    }
+    f[i++] = s->queue_depth;
+    f[i++] = s->heap_free;
+    f[i++] = s->psram_free;
+    f[i++] = (uint32_t)s->rssi;
+    f[i++] = s->viewers;
+}
+
+static void fields_to_sample(const uint32_t *f, history_sample_t *s)
+{
+    int i = 0;
+    s->frames_in = f[i++];
+    s->frames_out = f[i++];
+    s->bytes_in = f[i++];
+    s->bytes_out = f[i++];
+    for (int r = 0; r < DROP_REASON_COUNT; r++) {
+        s->drops[r] = f[i++];
+    }
+    s->queue_depth = f[i++];
+    s->heap_free = f[i++];
+    s->psram_free = f[i++];
+    s->rssi = (int32_t)f[i++];
+    s->viewers = f[i++];
+}
+
+// Zigzag + LEB128 varint of a signed delta
+static size_t put_delta(uint8_t *out, uint32_t value, uint32_t prev)
+{
+    int32_t delta = (int32_t)(value - prev);
+    uint32_t zz = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+    size_t n = 0;
+    while (zz >= 0x80) {
+        out[n++] = (uint8_t)(zz | 0x80);
+        zz >>= 7;
+    }
+    out[n++] = (uint8_t)zz;
+    return n;
+}
+
+static size_t get_delta(const uint8_t *in, size_t avail, uint32_t prev, uint32_t *value)
+{
+    uint32_t zz = 0;
+    size_t n = 0;
+    for (int shift = 0; n < avail && shift < 35; shift += 7) {
+        uint8_t b = in[n++];
+        zz |= (uint32_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            int32_t delta = (int32_t)(zz >> 1) ^ -(int32_t)(zz & 1);
+            *value = prev + (uint32_t)delta;
+            return n;
+        }
+    }
+    return 0;
+}
+
+static void history_append(const history_sample_t *sample)
+{
+    history_block_t *blk = &g_blocks[g_head];
+
+    if (g_num_blocks == 0 || blk->count >= HISTORY_BLOCK_SAMPLES ||
+        blk->used + SAMPLE_MAX_BYTES > HISTORY_BLOCK_BYTES) {
+        if (g_num_blocks > 0) {
+            g_head = (g_head + 1) % HISTORY_BLOCKS;
+        }
+        if (g_num_blocks < HISTORY_BLOCKS) {
+            g_num_blocks++;
+        }
+        blk = &g_blocks[g_head];
+        blk->start_s = sample->uptime_s;
+        blk->count = 0;
+        blk->used = 0;
+        // First sample of a block is coded against zero, so blocks decode independently
+        memset(&g_prev_sample, 0, sizeof(g_prev_sample));
+    }
+
+    uint32_t cur[HISTORY_FIELDS];
+    uint32_t prev[HISTORY_FIELDS];
+    sample_to_fields(sample, cur);
+    sample_to_fields(&g_prev_sample, prev);
+    for (int i = 0; i < HISTORY_FIELDS; i++) {
+        blk->used += put_delta(&blk->data[blk->used], cur[i], prev[i]);
+    }
+    blk->count++;
+    g_prev_sample = *sample;
+}
+
+static void history_task(void *arg)
+{
+    stream_stats_snapshot_t ingest;
+    http_counters_t out;
+    uint32_t last_frames_in = 0, last_frames_out = 0;
+    uint64_t last_bytes_in = 0, last_bytes_out = 0;
+    uint32_t last_drops[DROP_REASON_COUNT] = {0};
+
+    TickType_t last_wake = xTaskGetTickCount();
+    while (true) {
+        xTaskDelayUntil(&last_wake, pdMS_TO_TICKS(1000));
+
+        history_sample_t sample = {0};
+        app_http_get_counters(&out);
+        // Ingest and queue depth are summed over all cameras
+        uint32_t frames_in = 0;
+        uint64_t bytes_in = 0;
+        for (uint8_t c = 0; c < APP_UVC_MAX_CAMERAS; c++) {
+            app_uvc_get_stats(c, &ingest);
+            frames_in += ingest.frames_total;
+            bytes_in += ingest.bytes_total;
+            sample.queue_depth += app_uvc_get_queue_depth(c);
+        }
+
+        sample.uptime_s = (uint32_t)(esp_timer_get_time() / 1000000);
+        sample.frames_in = frames_in - last_frames_in;
+        sample.frames_out = out.frames_sent - last_frames_out;
+        sample.bytes_in = (uint32_t)(bytes_in - last_bytes_in);
+        sample.bytes_out = (uint32_t)(out.bytes_sent - last_bytes_out);
+        for (int r = 0; r < DROP_REASON_COUNT; r++) {
+            uint32_t drops = app_stats_get_drops((drop_reason_t)r);
+            sample.drops[r] = drops - last_drops[r];
+            last_drops[r] = drops;
+        }
+        sample.heap_free = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+        sample.psram_free = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+        sample.rssi = app_wifi_get_rssi();
+        sample.viewers = out.viewers;
+
+        last_frames_in = frames_in;
+        last_frames_out = out.frames_sent;
+        last_bytes_in = bytes_in;
+        last_bytes_out = out.bytes_sent;
+
+        xSemaphoreTake(g_history_mutex, portMAX_DELAY);
+        history_append(&sample);
+        xSemaphoreGive(g_history_mutex);
+    }
+}
+
+esp_err_t app_history_init(void)
+{
+    g_history_mutex = xSemaphoreCreateMutex();
+    if (g_history_mutex == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    BaseType_t task_created = xTaskCreate(history_task, "history", 3072, NULL, tskIDLE_PRIORITY + 2, NULL);
+    if (task_created != pdTRUE) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    ESP_LOGI(TAG, "Metrics history: %d blocks x %d s, %u bytes",
+             HISTORY_BLOCKS, HISTORY_BLOCK_SAMPLES, (unsigned)sizeof(g_blocks));
+    return ESP_OK;
+}
+
+size_t app_history_foreach(history_sample_cb_t cb, void *ctx)
+{
+    history_block_t *blk = heap_caps_malloc(sizeof(history_block_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (blk == NULL) {
+        blk = malloc(sizeof(history_block_t));
+        if (blk == NULL) {
+            return 0;
+        }
+    }
+
+    size_t visited = 0;
+    uint8_t num_blocks;
+    uint8_t oldest;
+    uint32_t last_start_s = 0;
+
+    xSemaphoreTake(g_history_mutex, portMAX_DELAY);
+    num_blocks = g_num_blocks;
+    oldest = (g_head + HISTORY_BLOCKS - (num_blocks ? num_blocks - 1 : 0)) % HISTORY_BLOCKS;
+    xSemaphoreGive(g_history_mutex);
+
+    for (uint8_t b = 0; b < num_blocks; b++) {
+        xSemaphoreTake(g_history_mutex, portMAX_DELAY);
+        *blk = g_blocks[(oldest + b) % HISTORY_BLOCKS];
+        xSemaphoreGive(g_history_mutex);
+
+        // The sampler may have wrapped around while the previous block was being
+        // consumed; never go back in time
+        if (b > 0 && blk->start_s < last_start_s) {
+            break;
+        }
+        last_start_s = blk->start_s;
+
+        uint32_t prev[HISTORY_FIELDS] = {0};
+        uint32_t cur[HISTORY_FIELDS];
+        size_t pos = 0;
+        for (uint16_t n = 0; n < blk->count; n++) {
+            for (int i = 0; i < HISTORY_FIELDS; i++) {
+                size_t used = get_delta(&blk->data[pos], blk->used - pos, prev[i], &cur[i]);
+                if (used == 0) {
+                    goto done;
+                }
+                pos += used;
+            }
+            history_sample_t sample;
+            fields_to_sample(cur, &sample);
+            sample.uptime_s = blk->start_s + n;
+            memcpy(prev, cur, sizeof(prev));
+            visited++;
+            if (!cb(&sample, ctx)) {
+                goto done;
+            }
+        }
+    }
+
+done:
+    free(blk);
+    return visited;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "esp_err.h"
+#include "app_stats.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// One sample per second, blocks of up to one minute each
+#define HISTORY_BLOCK_SAMPLES   60
+// Compressed bytes per block. Samples are usually 10-15 bytes after delta
+// encoding; a block that fills up early is closed and the next one started.
+#define HISTORY_BLOCK_BYTES     1024
+// Number of blocks kept, i.e. roughly the number of minutes of history
+#define HISTORY_BLOCKS          11
+
+/**
+ * @brief One per-second metrics sample
+ *
+ * Rates and byte counts are deltas over the second ending at uptime_s. Ingest
+ * counters and queue depth cover all cameras.
+ */
+typedef struct {
+    uint32_t uptime_s;
+    uint32_t frames_in;
+    uint32_t frames_out;
+    uint32_t bytes_in;
+    uint32_t bytes_out;
+    uint32_t drops[DROP_REASON_COUNT];
+    uint32_t queue_depth;
+    uint32_t heap_free;
+    uint32_t psram_free;
+    int32_t rssi;
+    uint32_t viewers;
+} history_sample_t;
+
+/**
+ * @brief Callback for app_history_foreach
+ *
+ * @param sample Decoded sample
+ * @param ctx User context
+ * @return true to continue, false to stop iterating
+ */
+typedef bool (*history_sample_cb_t)(const history_sample_t *sample, void *ctx);
+
+/**
+ * @brief Start the 1 Hz metrics sampler
+ *
+ * @return ESP_OK on success
+ */
+esp_err_t app_history_init(void);
+
+/**
+ * @brief Walk the recorded history, oldest sample first
+ *
+ * The ring is only locked while a block is copied out, so the callback may block
+ * (e.g. on a socket) without stalling the sampler.
+ *
+ * @param cb Callback called for every sample
+ * @param ctx User context passed to cb
+ * @return Number of samples visited
+ */
+size_t app_history_foreach(history_sample_cb_t cb, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
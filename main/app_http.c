@@ -1,17 +1,40 @@
 #include "app_http.h"
 #include "app_uvc.h"
 #include "app_wifi.h"
+#include "app_history.h"
+#include "app_json_diff.h"
+#include "app_jpeg.h"
+#include "app_jpeg_codec.h"
+#include "app_jpeg_decode.h"
+#include "app_jpeg_encode.h"
+#include "app_jpeg_entropy.h"
+#include "app_jpeg_xform.h"
+#include "app_fmp4.h"
+#include "app_frame_ring.h"
+#include "app_burst.h"
+#include "app_clip.h"
+#include "app_storage.h"
+#include "app_timelapse.h"
 
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdarg.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "esp_log.h"
 #include "esp_http_server.h"
 #include "esp_random.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/semphr.h"
 #include "freertos/queue.h"
 #include "freertos/event_groups.h"
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/tcp.h>
 
 static const char *TAG = "app_http";
@@ -22,85 +45,227 @@ static const char *TAG = "app_http";
 typedef struct {
     uint8_t *buffer;
     size_t len;
+    size_t dht_insert_pos;  // Non-zero if the frame lacks Huffman tables: where to splice them in
     bool ready;
+    jpeg_index_t index;     // Structure parsed at ingest, offsets are relative to buffer
+    uint32_t seq;           // Sequence number in the camera's frame ring, 0 if not kept there
 } frame_slot_t;
 
-static frame_slot_t g_frame_buffer[2] = {0};
-static uint8_t g_write_index = 0;
-static uint8_t g_read_index = 0;
-static SemaphoreHandle_t g_frame_mutex = NULL;
 static const size_t MAX_FRAME_SIZE = 512 * 1024; // 512KB buffer
 
+// H.264 access units since the last IDR, replayed to new viewers
+#define H264_GOP_CAP (2 * 1024 * 1024)
+
+// Recent MJPEG frames per camera for rewound viewers (?from=-10s), and memory reserved
+// at boot for /burst, both in PSRAM and sized in menuconfig. Neither takes PSRAM below
+// the viewer reserve: a stream viewer allocates its frame and work buffers on connect.
+#define FRAME_RING_BUDGET ((size_t)CONFIG_APP_FRAME_RING_KB * 1024)
+#define BURST_POOL_SIZE ((size_t)CONFIG_APP_BURST_POOL_KB * 1024)
+#define PSRAM_VIEWER_RESERVE ((size_t)CONFIG_APP_PSRAM_VIEWER_RESERVE_KB * 1024)
+#define BURST_BOUNDARY "burstframe"
+// A burst ends early if the camera sends nothing for this long
+#define BURST_FRAME_TIMEOUT_MS 2000
+
+// /still waits this long for the still and for live frames to come back
+#define STILL_TIMEOUT_MS 10000
+
+// /clips/ downloads run in their own task at this priority, below the stream tasks and
+// the timelapse writer, so a download only gets the CPU nobody else wants
+#define CLIP_TASK_PRIORITY (tskIDLE_PRIORITY + 1)
+#define CLIP_PATH_MAX 64
+// Each download holds two DMA read buffers in internal RAM
+#define CLIP_MAX_DOWNLOADS 2
+
+// HTTPS instead of HTTP (CONFIG_APP_HTTPS): every endpoint moves to port 443 behind
+// TLS, with the certificate and key embedded from the paths set in menuconfig.
+// Session tickets let browsers resume instead of redoing the handshake for each
+// request. Encrypted fps and CPU against plaintext are not measured: the host tests
+// have no mbedTLS to run send_all()/send_iov() through, so that waits for the boards.
+#if CONFIG_APP_HTTPS
+#include "esp_https_server.h"
+#include "mbedtls/ssl.h"
+
+// Plaintext per TLS record (CONFIG_MBEDTLS_SSL_OUT_CONTENT_LEN). Frames are written in
+// record-sized pieces straight from their buffers; pieces up to TLS_GATHER_LEN (part
+// headers, Huffman tables, trailers) are gathered so they share one record.
+#define TLS_RECORD_LEN MBEDTLS_SSL_OUT_CONTENT_LEN
+#define TLS_GATHER_LEN 1024
+
+extern const uint8_t servercert_pem_start[] asm("_binary_servercert_pem_start");
+extern const uint8_t servercert_pem_end[] asm("_binary_servercert_pem_end");
+extern const uint8_t prvtkey_pem_start[] asm("_binary_prvtkey_pem_start");
+extern const uint8_t prvtkey_pem_end[] asm("_binary_prvtkey_pem_end");
+#endif
+
+// Per-viewer frame work runs on the core that does not service USB
+#define STREAM_TASK_CORE (portNUM_PROCESSORS - 1)
+// Viewer tasks do the CPU-heavy transforms (Huffman optimize, crop, gray, overlay,
+// mosaic), so they sit below Wi-Fi, lwIP, the USB tasks and the server task
+// (tskIDLE_PRIORITY + 5) and only take the CPU the network stack leaves over
+#define STREAM_TASK_PRIORITY (tskIDLE_PRIORITY + 4)
+
+// Privacy masks burned into every stream, in camera pixels (at most JPEG_OVERLAY_MAX_MASKS)
+static const jpeg_rect_t g_privacy_masks[] = {
+    { 0, 0, 0, 0 },     // e.g. { 1040, 0, 240, 160 } to hide the top-right corner
+};
+
 // Frame notification using event group
-static EventGroupHandle_t g_frame_events = NULL;
 #define FRAME_READY_BIT BIT0
 
-// Session management
-static uint32_t g_active_session = 0;
+// Session management, guards active_session of every camera
 static SemaphoreHandle_t g_session_mutex = NULL;
 
+// What a stream endpoint sends, stored as user_ctx of its URI handler
+typedef enum {
+    STREAM_MJPEG = 0,       // /stream: multipart JPEG
+    STREAM_H264,            // /stream.h264: Annex B elementary stream
+    STREAM_FMP4,            // /stream.mp4: chunked fragmented MP4 for MediaSource
+} stream_kind_t;
+
 // Stream task management
 typedef struct {
+    httpd_req_t *req;       // Async copy of the request, completed when the task ends
     int socket_fd;
     uint32_t session_id;
     bool active;
+    stream_kind_t kind;
+    bool optimize_huffman;  // ?optimize=1: re-encode frames with per-frame optimal Huffman tables
+    bool crop;              // ?crop=x,y,w,h: send only this region, snapped to MCUs
+    jpeg_rect_t crop_rect;
+    bool gray;              // ?gray=1: drop the chroma components
+    bool timestamp;         // ?ts=1: burn in the wall clock time
+    jpeg_overlay_t overlay; // Privacy masks (global ones plus ?mask=x,y,w,h[,x,y,w,h...]), text set per frame
+    bool rewind;            // ?from=-Ns: start N seconds back in the frame ring, then join live
+    int64_t rewind_us;
+    uint8_t speed;          // ?speed=: playback rate of the rewound part, 1 is real time
+    stream_stats_t stats;
 } stream_context_t;
 
-static stream_context_t g_stream_ctx = {0};
-static TaskHandle_t g_stream_task_handle = NULL;
+// Frame store, GOP cache and viewer of one camera
+typedef struct {
+    uint8_t index;
+    frame_slot_t frame_buffer[2];
+    uint8_t write_index;
+    uint8_t read_index;
+    SemaphoreHandle_t frame_mutex;
+    EventGroupHandle_t frame_events;
+    h264_gop_t h264_gop;
+    frame_ring_t ring;
+    uint32_t active_session;
+    stream_context_t stream_ctx;
+    TaskHandle_t stream_task_handle;
+    uint32_t frames_received;
+    uint32_t frames_dropped;
+    uint32_t frames_dht_missing;
+} camera_t;
+
+static camera_t g_cameras[APP_UVC_MAX_CAMERAS];
 static SemaphoreHandle_t g_stream_start_mutex = NULL;
 
+// Mosaic viewer (/mosaic): tiles from several cameras, or from one camera at increasing age
+typedef struct {
+    httpd_req_t *req;       // Async copy of the request, completed when the task ends
+    int socket_fd;
+    uint32_t session_id;
+    bool active;
+    uint8_t cols;
+    uint8_t rows;
+    uint8_t scale_shift;
+    uint8_t fps;
+    uint8_t num_sources;
+    uint8_t sources[JPEG_MOSAIC_MAX_TILES];     // Camera of every cell, cells past num_sources stay empty
+    uint32_t every_ms;                          // Non-zero: cell n is about n * every_ms old
+    stream_stats_t stats;
+} mosaic_context_t;
+
+static mosaic_context_t g_mosaic_ctx;
+static uint32_t g_mosaic_session = 0;           // Guarded by g_session_mutex
+static TaskHandle_t g_mosaic_task_handle = NULL;
+
+// Delta viewer (/delta): keyframes and changed bands over a WebSocket, see app_jpeg_delta()
+typedef struct {
+    httpd_handle_t server;
+    int socket_fd;
+    uint32_t session_id;
+    bool active;
+    bool want_key;                              // The client could not decode a band
+    uint8_t camera;
+    uint32_t key_ms;                            // Keyframe period
+    jpeg_delta_ref_t ref;
+    uint32_t keyframes;
+    uint32_t deltas;
+    uint32_t unchanged;                         // Frames with nothing to send
+    stream_stats_t stats;
+    SemaphoreHandle_t frame_ready;              // Given by the frame store for the delta camera
+} delta_context_t;
+
+static delta_context_t g_delta_ctx;
+static uint32_t g_delta_session = 0;            // Guarded by g_session_mutex
+static TaskHandle_t g_delta_task_handle = NULL;
+
+// Delta messages exceed the frame by a header per band
+#define DELTA_HEADROOM (16 * 1024)
+// Longest the delta task sleeps between frames before it looks at its session again
+#define DELTA_WAIT_MS 200
+
+// Lossless burst capture (/burst), fed by the frame callback
+static burst_pool_t g_burst;
+
+// Clip downloads (/clips/), for /stats
+static uint32_t g_clip_downloads = 0;
+static uint64_t g_clip_bytes = 0;
+static uint32_t g_clip_last_kbps = 0;
+static uint32_t g_clip_active = 0;
+
+// The running server; viewer tasks write through it so TLS sessions are honoured
+static httpd_handle_t g_server = NULL;
+
 // Statistics
-static uint32_t g_frames_received = 0;
 static uint32_t g_frames_sent = 0;
-static uint32_t g_frames_dropped = 0;
-
-// Minimal HTML page
-static const char *index_html = 
-    "<!DOCTYPE html>"
-    "<html>"
-    "<head>"
-    "<title>ESP32-P4 Camera</title>"
-    "<meta name='viewport' content='width=device-width, initial-scale=1'>"
-    "<style>"
-    "body{margin:0;padding:20px;font-family:Arial;background:#f0f0f0}"
-    ".container{max-width:1200px;margin:0 auto}"
-    ".stats{background:white;padding:15px;border-radius:8px;margin-bottom:20px}"
-    ".stats h2{margin-top:0}"
-    ".stats p{margin:5px 0}"
-    ".video-container{background:black;border-radius:8px;overflow:hidden}"
-    "img{width:100%;height:auto;display:block}"
-    "</style>"
-    "<script>"
-    "setInterval(async()=>{"
-    "try{"
-    "const r=await fetch('/stats');"
-    "const d=await r.json();"
-    "document.getElementById('rx').textContent=d.frames_received;"
-    "document.getElementById('tx').textContent=d.frames_sent;"
-    "document.getElementById('drop').textContent=d.frames_dropped;"
-    "const fps=d.frames_sent-parseInt(document.getElementById('tx').dataset.prev||0);"
-    "document.getElementById('tx').dataset.prev=d.frames_sent;"
-    "document.getElementById('fps').textContent=fps;"
-    "}catch(e){}"
-    "},1000);"
-    "</script>"
-    "</head>"
-    "<body>"
-    "<div class='container'>"
-    "<div class='stats'>"
-    "<h2>ESP32-P4 Camera Stream</h2>"
-    "<p>Frames Received: <strong id='rx'>0</strong></p>"
-    "<p>Frames Sent: <strong id='tx' data-prev='0'>0</strong></p>"
-    "<p>Frames Dropped: <strong id='drop'>0</strong></p>"
-    "<p>FPS: <strong id='fps'>0</strong></p>"
-    "</div>"
-    "<div class='video-container'>"
-    "<img src='/stream' alt='Camera Stream'/>"
-    "</div>"
-    "</div>"
-    "</body>"
-    "</html>";
+static uint64_t g_bytes_sent = 0;
+static xform_stats_t g_huffman_opt_stats;
+static xform_stats_t g_crop_stats;
+static xform_stats_t g_gray_stats;
+static xform_stats_t g_overlay_stats;
+static xform_stats_t g_fmp4_stats;
+static xform_stats_t g_mosaic_stats;
+static xform_stats_t g_delta_stats;
+
+// Per-transform sections of /stats
+static const struct {
+    const char *name;
+    xform_stats_t *stats;
+} g_xform_stats[] = {
+    { "huffman_opt", &g_huffman_opt_stats },
+    { "overlay", &g_overlay_stats },
+    { "crop", &g_crop_stats },
+    { "gray", &g_gray_stats },
+    { "fmp4", &g_fmp4_stats },
+    { "mosaic", &g_mosaic_stats },
+    { "delta", &g_delta_stats },
+};
+
+// Web UI, gzipped at build time from www/ (see CMakeLists.txt) and sent from flash as
+// is. The ETag is a hash of the compressed bytes, taken once at startup.
+extern const uint8_t index_html_gz_start[] asm("_binary_index_html_gz_start");
+extern const uint8_t index_html_gz_end[] asm("_binary_index_html_gz_end");
+
+typedef struct {
+    const char *uri;
+    const uint8_t *start;
+    const uint8_t *end;
+    const char *type;
+    const char *cache_control;
+    char etag[12];
+} web_asset_t;
+
+// The page is revalidated on every load (a 304 without a body while the firmware
+// is unchanged), so a firmware update never leaves a stale page behind. Assets
+// with versioned names can be cached for good instead.
+static web_asset_t g_assets[] = {
+    { "/", index_html_gz_start, index_html_gz_end, "text/html", "no-cache" },
+    { "/index.html", index_html_gz_start, index_html_gz_end, "text/html", "no-cache" },
+};
 
 // Generate unique session token
 static uint32_t generate_session_token(void)
@@ -111,50 +276,343 @@ static uint32_t generate_session_token(void)
 // ============================================================================
 // FIXED: Frame callback with proper task-level API and minimal locking
 // ============================================================================
-static void frame_received_callback(const uint8_t *data, size_t len, void *user_ctx)
+static void frame_received_callback(const app_frame_t *frame, void *user_ctx)
 {
+    const uint8_t *data = frame->data;
+    size_t len = frame->len;
+    camera_t *cam = &g_cameras[frame->camera];
+    
     if (len > MAX_FRAME_SIZE || len == 0) {
-        g_frames_dropped++;
+        cam->frames_dropped++;
+        app_stats_count_drop(DROP_OVERSIZE);
         return;
     }
 
-    g_frames_received++;
+    cam->frames_received++;
+    
+    if (frame->format == APP_FRAME_H264) {
+        // Every access unit is kept (a lost one breaks the rest of the GOP), viewers read them in order
+        if (app_h264_gop_push(&cam->h264_gop, data, len, &frame->h264, frame->timestamp_us) == ESP_ERR_NO_MEM) {
+            cam->frames_dropped++;
+            app_stats_count_drop(DROP_GOP_FULL);
+        }
+        xEventGroupSetBits(cam->frame_events, FRAME_READY_BIT);
+        return;
+    }
+    
+    // Outputs splice in the standard Huffman tables in front of SOS when the frame has none
+    size_t dht_pos = 0;
+    if (frame->index.sos_pos != 0 && frame->index.num_dht == 0) {
+        dht_pos = frame->index.sos_pos;
+        cam->frames_dht_missing++;
+    }
+    
+    // History for rewound viewers; a ring that cannot be allocated just keeps nothing
+    uint32_t seq = 0;
+    app_frame_ring_push(&cam->ring, data, len, frame->index.width, frame->index.height, frame->timestamp_us, &seq);
+    
+    // Every frame goes to a running burst, the ping-pong slots below may skip some
+    app_burst_offer(&g_burst, cam->index, data, len, dht_pos, frame->seq, frame->timestamp_us);
+    app_timelapse_offer(frame, dht_pos);
     
     // Copy data to the write slot WITHOUT holding the mutex
-    uint8_t write_slot = g_write_index;
-    memcpy(g_frame_buffer[write_slot].buffer, data, len);
-    g_frame_buffer[write_slot].len = len;
-    g_frame_buffer[write_slot].ready = true;
+    uint8_t write_slot = cam->write_index;
+    frame_slot_t *slot = &cam->frame_buffer[write_slot];
+    memcpy(slot->buffer, data, len);
+    slot->len = len;
+    slot->dht_insert_pos = dht_pos;
+    slot->index = frame->index;
+    slot->seq = seq;
+    slot->ready = true;
     
     // Briefly take mutex to swap the ping-pong buffers
-    if (xSemaphoreTake(g_frame_mutex, pdMS_TO_TICKS(10)) == pdTRUE) {
-        g_read_index = write_slot;
-        g_write_index = 1 - write_slot;
-        xSemaphoreGive(g_frame_mutex);
+    if (xSemaphoreTake(cam->frame_mutex, pdMS_TO_TICKS(10)) == pdTRUE) {
+        cam->read_index = write_slot;
+        cam->write_index = 1 - write_slot;
+        xSemaphoreGive(cam->frame_mutex);
         
         // This callback is called from a Task, not an ISR, so we use the standard API
-        xEventGroupSetBits(g_frame_events, FRAME_READY_BIT);
+        xEventGroupSetBits(cam->frame_events, FRAME_READY_BIT);
+        if (g_delta_ctx.active && g_delta_ctx.camera == cam->index) {
+            xSemaphoreGive(g_delta_ctx.frame_ready);
+        }
+    } else {
+        cam->frames_dropped++;
+        app_stats_count_drop(DROP_STORE_BUSY);
+    }
+}
+
+// Describe a frame as scatter-gather segments for send_iov(). Frames without Huffman
+// tables get the standard DHT segment spliced in front of SOS, without moving the frame body.
+// Returns the number of iovecs used (at most 3).
+static int frame_to_iov(const uint8_t *frame, size_t len, size_t dht_insert_pos, struct iovec *iov)
+{
+    if (dht_insert_pos == 0 || dht_insert_pos >= len) {
+        iov[0] = (struct iovec){ .iov_base = (void *)frame, .iov_len = len };
+        return 1;
+    }
+    iov[0] = (struct iovec){ .iov_base = (void *)frame, .iov_len = dht_insert_pos };
+    iov[1] = (struct iovec){ .iov_base = (void *)app_jpeg_std_dht, .iov_len = JPEG_STD_DHT_LEN };
+    iov[2] = (struct iovec){ .iov_base = (void *)(frame + dht_insert_pos), .iov_len = len - dht_insert_pos };
+    return 3;
+}
+
+// Wall clock if SNTP has synced, uptime otherwise
+static void format_timestamp(char *buf, size_t len)
+{
+    time_t now = time(NULL);
+    struct tm tm;
+    localtime_r(&now, &tm);
+    if (tm.tm_year + 1900 >= 2024) {
+        strftime(buf, len, "%Y-%m-%d %H:%M:%S", &tm);
     } else {
-        g_frames_dropped++;
+        uint32_t up = (uint32_t)(esp_timer_get_time() / 1000000);
+        snprintf(buf, len, "UP %02lu:%02lu:%02lu", up / 3600, (up / 60) % 60, up % 60);
+    }
+}
+
+// Account a frame sent to any viewer; stream tasks of all cameras do this concurrently
+static inline void count_sent(size_t len)
+{
+    __atomic_fetch_add(&g_frames_sent, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&g_bytes_sent, (uint64_t)len, __ATOMIC_RELAXED);
+}
+
+// Send a buffer, retrying partial writes. Returns false on socket error.
+static bool send_all(int socket_fd, const void *buf, size_t len)
+{
+    const char *p = (const char *)buf;
+    while (len > 0) {
+#if CONFIG_APP_HTTPS
+        // Through the session's TLS layer, one record per call
+        int sent = httpd_socket_send(g_server, socket_fd, p, len < TLS_RECORD_LEN ? len : TLS_RECORD_LEN, 0);
+#else
+        ssize_t sent = send(socket_fd, p, len, 0);
+#endif
+        if (sent <= 0) {
+            return false;
+        }
+        p += sent;
+        len -= sent;
+    }
+    return true;
+}
+
+// Send all segments, retrying partial writes. Returns false on socket error.
+static bool send_iov(int socket_fd, struct iovec *iov, int iovcnt)
+{
+#if CONFIG_APP_HTTPS
+    // No sendmsg() under TLS: small segments are gathered, large ones are encrypted
+    // from where they are, so a frame is never copied into a plaintext staging buffer
+    uint8_t gather[TLS_GATHER_LEN];
+    size_t gather_len = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len <= sizeof(gather) - gather_len) {
+            memcpy(gather + gather_len, iov[i].iov_base, iov[i].iov_len);
+            gather_len += iov[i].iov_len;
+            continue;
+        }
+        if ((gather_len > 0 && !send_all(socket_fd, gather, gather_len)) ||
+            !send_all(socket_fd, iov[i].iov_base, iov[i].iov_len)) {
+            return false;
+        }
+        gather_len = 0;
+    }
+    return gather_len == 0 || send_all(socket_fd, gather, gather_len);
+#else
+    while (iovcnt > 0) {
+        struct msghdr msg = { .msg_iov = iov, .msg_iovlen = iovcnt };
+        ssize_t sent = sendmsg(socket_fd, &msg, 0);
+        if (sent < 0) {
+            return false;
+        }
+        while (iovcnt > 0 && (size_t)sent >= iov->iov_len) {
+            sent -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (uint8_t *)iov->iov_base + sent;
+            iov->iov_len -= sent;
+        }
     }
+    return true;
+#endif
 }
 
 // ============================================================================
 // OPTIMIZED: Streaming task - direct send from frame buffer
 // ============================================================================
+static bool session_is_active(const camera_t *cam, uint32_t session)
+{
+    bool is_active = false;
+    if (xSemaphoreTake(g_session_mutex, 0) == pdTRUE) {
+        is_active = (cam->active_session == session);
+        xSemaphoreGive(g_session_mutex);
+    }
+    return is_active;
+}
+
+// Send the HTTP response header and the fMP4 init segment, built from the SPS/PPS
+// in front of the first access unit. Returns false on socket error.
+static bool fmp4_send_init(int socket_fd, const uint8_t *au, const h264_index_t *index, h264_sps_info_t *info)
+{
+    const h264_nal_t *sps = &index->nals[index->sps];
+    const h264_nal_t *pps = &index->nals[index->pps];
+    uint8_t init[1024];
+    size_t init_len = 0;
+    if (app_h264_parse_sps(au + sps->pos, sps->len, info) != ESP_OK ||
+        app_fmp4_write_init(au + sps->pos, sps->len, au + pps->pos, pps->len, init, sizeof(init), &init_len) != ESP_OK) {
+        ESP_LOGE(TAG, "Cannot build fMP4 init segment from SPS/PPS");
+        return false;
+    }
+    
+    // The codec string lets the page create its SourceBuffer from the response alone
+    char codec[16];
+    char headers[320];
+    app_fmp4_codec_string(au + sps->pos, sps->len, codec, sizeof(codec));
+    int hlen = snprintf(headers, sizeof(headers),
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: video/mp4; codecs=\"%s\"\r\n"
+        "Transfer-Encoding: chunked\r\n"
+        "Access-Control-Allow-Origin: *\r\n"
+        "Cache-Control: no-cache, no-store, must-revalidate\r\n"
+        "\r\n"
+        "%zx\r\n", codec, init_len);
+    struct iovec iov[3] = {
+        { .iov_base = headers, .iov_len = hlen },
+        { .iov_base = init, .iov_len = init_len },
+        { .iov_base = "\r\n", .iov_len = 2 },
+    };
+    return send_iov(socket_fd, iov, 3);
+}
+
+// Send access units from the GOP cache in order, as an Annex B byte stream or as
+// chunked fMP4 fragments. A new viewer starts with the cached SPS/PPS and IDR
+// followed by the rest of the GOP, so decoding starts at once.
+static uint32_t h264_stream_loop(camera_t *cam, int socket_fd, uint32_t my_session, bool fmp4)
+{
+    const size_t au_cap = MAX_FRAME_SIZE + H264_GOP_READ_OVERHEAD;
+    uint8_t *au_buf = heap_caps_malloc(au_cap, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    h264_index_t *index = malloc(sizeof(h264_index_t));
+    if (au_buf == NULL || index == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate access unit buffer");
+        free(au_buf);
+        free(index);
+        return 0;
+    }
+    
+    h264_cursor_t cursor = {0};
+    fmp4_muxer_t mux = {0};
+    h264_sps_info_t sps_info = {0};
+    bool init_sent = false;
+    uint8_t frag_hdr[FMP4_FRAGMENT_HDR_MAX];
+    char chunk_hdr[12];
+    struct iovec iov[FMP4_FRAGMENT_MAX_IOV + 2];
+    uint32_t sent = 0;
+    while (cam->stream_ctx.active && session_is_active(cam, my_session)) {
+        size_t len = 0;
+        int64_t timestamp_us = 0;
+        esp_err_t err = app_h264_gop_read(&cam->h264_gop, &cursor, au_buf, au_cap, &len, &timestamp_us);
+        if (err == ESP_ERR_NOT_FOUND) {
+            xEventGroupWaitBits(cam->frame_events, FRAME_READY_BIT, pdTRUE, pdFALSE, pdMS_TO_TICKS(1000));
+            continue;
+        }
+        if (err != ESP_OK) {
+            continue;
+        }
+        
+        int iovcnt = 1;
+        iov[0] = (struct iovec){ .iov_base = au_buf, .iov_len = len };
+        if (fmp4) {
+            app_h264_build_index(au_buf, len, index);
+            if (!init_sent) {
+                // The first access unit read is an IDR with the parameter sets in front
+                if (index->sps < 0 || index->pps < 0) {
+                    continue;
+                }
+                if (!fmp4_send_init(socket_fd, au_buf, index, &sps_info)) {
+                    break;
+                }
+                init_sent = true;
+            }
+            
+            // One chunk per fragment, the mdat points into au_buf
+            int frag_iovcnt = 0;
+            size_t frag_len = 0;
+            int64_t t0 = esp_timer_get_time();
+            err = app_fmp4_write_fragment(&mux, au_buf, index, timestamp_us, frag_hdr, &iov[1], &frag_iovcnt, &frag_len);
+            uint32_t elapsed = (uint32_t)(esp_timer_get_time() - t0);
+            if (err != ESP_OK) {
+                app_stats_xform_fail(&g_fmp4_stats);
+                continue;
+            }
+            app_stats_xform_record(&g_fmp4_stats, sps_info.width, sps_info.height, len, frag_len, elapsed);
+            int clen = snprintf(chunk_hdr, sizeof(chunk_hdr), "%zx\r\n", frag_len);
+            iov[0] = (struct iovec){ .iov_base = chunk_hdr, .iov_len = clen };
+            iov[frag_iovcnt + 1] = (struct iovec){ .iov_base = "\r\n", .iov_len = 2 };
+            iovcnt = frag_iovcnt + 2;
+            len = clen + frag_len + 2;
+        }
+        
+        if (!send_iov(socket_fd, iov, iovcnt)) {
+            break;
+        }
+        sent++;
+        count_sent(len);
+        app_stats_record(&cam->stream_ctx.stats, len, esp_timer_get_time());
+    }
+    
+    free(au_buf);
+    free(index);
+    return sent;
+}
+
+// Hand a viewer's request back to the server. The body was written straight to the
+// socket and never ends, so the connection is closed rather than reused.
+static void viewer_request_end(httpd_req_t *req)
+{
+    if (req == NULL) {
+        return;
+    }
+    int socket_fd = httpd_req_to_sockfd(req);
+    httpd_req_async_handler_complete(req);
+    httpd_sess_trigger_close(g_server, socket_fd);
+}
+
+// Release the session and end the calling stream task
+static void stream_task_finish(camera_t *cam, uint32_t my_session, uint32_t frames_sent)
+{
+    cam->stream_ctx.active = false;
+    
+    if (xSemaphoreTake(g_session_mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
+        if (cam->active_session == my_session) {
+            cam->active_session = 0;
+        }
+        xSemaphoreGive(g_session_mutex);
+    }
+    
+    ESP_LOGI(TAG, "Camera %u: stream task terminated (sent %lu frames)", cam->index, frames_sent);
+    httpd_req_t *req = cam->stream_ctx.req;
+    cam->stream_ctx.req = NULL;
+    viewer_request_end(req);
+    cam->stream_task_handle = NULL;
+    vTaskDelete(NULL);
+}
+
 static void stream_task(void *arg)
 {
-    ESP_LOGI(TAG, "Stream task started on core %d", xPortGetCoreID());
+    camera_t *cam = (camera_t *)arg;
+    stream_context_t *ctx = &cam->stream_ctx;
+    ESP_LOGI(TAG, "Camera %u: stream task started on core %d", cam->index, xPortGetCoreID());
     
-    int socket_fd = g_stream_ctx.socket_fd;
-    uint32_t my_session = g_stream_ctx.session_id;
+    int socket_fd = ctx->socket_fd;
+    uint32_t my_session = ctx->session_id;
     
     char *header_buf = malloc(512);
     if (header_buf == NULL) {
         ESP_LOGE(TAG, "Failed to allocate header buffer");
-        g_stream_ctx.active = false;
-        g_stream_task_handle = NULL;
-        vTaskDelete(NULL);
+        stream_task_finish(cam, my_session, 0);
         return;
     }
     
@@ -168,7 +626,15 @@ static void stream_task(void *arg)
     timeout.tv_usec = 0;
     setsockopt(socket_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
     
-    const char *headers = 
+    // fMP4 headers name the codec, they are sent once the SPS is known
+    const char *headers = (ctx->kind == STREAM_FMP4) ? NULL :
+        (ctx->kind == STREAM_H264) ?
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: video/h264\r\n"
+        "Access-Control-Allow-Origin: *\r\n"
+        "Cache-Control: no-cache, no-store, must-revalidate\r\n"
+        "Pragma: no-cache\r\n"
+        "\r\n" :
         "HTTP/1.1 200 OK\r\n"
         "Content-Type: multipart/x-mixed-replace; boundary=frame\r\n"
         "Access-Control-Allow-Origin: *\r\n"
@@ -177,267 +643,2410 @@ static void stream_task(void *arg)
         "X-Framerate: 30\r\n"
         "\r\n";
     
-    if (send(socket_fd, headers, strlen(headers), 0) < 0) {
+    if (headers != NULL && !send_all(socket_fd, headers, strlen(headers))) {
         ESP_LOGE(TAG, "Failed to send headers");
         free(header_buf);
-        g_stream_ctx.active = false;
-        g_stream_task_handle = NULL;
-        vTaskDelete(NULL);
+        stream_task_finish(cam, my_session, 0);
         return;
     }
     
     ESP_LOGI(TAG, "Stream headers sent, starting frame delivery");
     
+    if (ctx->kind != STREAM_MJPEG) {
+        free(header_buf);
+        stream_task_finish(cam, my_session, h264_stream_loop(cam, socket_fd, my_session, ctx->kind == STREAM_FMP4));
+        return;
+    }
+    
     uint32_t local_frames_sent = 0;
     uint32_t consecutive_waits = 0;
+    jpeg_index_t *local_index = malloc(sizeof(jpeg_index_t));
     
     uint8_t *local_frame_buf = heap_caps_malloc(MAX_FRAME_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
     if (local_frame_buf == NULL) {
         local_frame_buf = malloc(MAX_FRAME_SIZE);
-        if (local_frame_buf == NULL) {
-            ESP_LOGE(TAG, "Failed to allocate local frame buffer");
-            free(header_buf);
-            g_stream_ctx.active = false;
-            g_stream_task_handle = NULL;
-            vTaskDelete(NULL);
-            return;
-        }
+    }
+    if (local_frame_buf == NULL || local_index == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate local frame buffer");
+        free(local_frame_buf);
+        free(local_index);
+        free(header_buf);
+        stream_task_finish(cam, my_session, 0);
+        return;
     }
     
-    while (g_stream_ctx.active) {
-        bool is_active = false;
-        if (xSemaphoreTake(g_session_mutex, 0) == pdTRUE) {
-            is_active = (g_active_session == my_session);
-            xSemaphoreGive(g_session_mutex);
+    // Outputs of the optional transform stages, each stage writes into the buffer its
+    // input is not in. Re-encoded frames may exceed the input by a DHT segment on tiny
+    // frames, so keep some headroom.
+    const size_t work_cap = MAX_FRAME_SIZE + 1024;
+    uint8_t *work_buf[2] = {NULL, NULL};
+    bool overlay = ctx->timestamp || ctx->overlay.num_masks > 0;
+    jpeg_overlay_cache_t overlay_cache = {0};
+    int num_stages = (overlay ? 1 : 0) + (ctx->crop ? 1 : 0) + (ctx->gray ? 1 : 0) +
+                     (ctx->optimize_huffman ? 1 : 0);
+    for (int i = 0; i < num_stages && i < 2; i++) {
+        work_buf[i] = heap_caps_malloc(work_cap, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (work_buf[i] == NULL) {
+            ESP_LOGW(TAG, "No memory for frame transforms, streaming frames as-is");
+            free(work_buf[0]);
+            work_buf[0] = NULL;
+            break;
         }
-        
-        if (!is_active) {
+    }
+    if ((overlay || ctx->crop || ctx->gray) && work_buf[0] == NULL) {
+        // A masked, cropped or grayscale view must never turn into the full frame
+        ESP_LOGE(TAG, "No memory for frame transforms, closing stream");
+        ctx->active = false;
+    }
+    
+    // Rewound viewers play the ring from ring_seq, paced against the capture times,
+    // until they reach the newest frame and continue live from there
+    bool playback = ctx->rewind;
+    uint32_t ring_seq = playback ? app_frame_ring_seek(&cam->ring, esp_timer_get_time() - ctx->rewind_us) : 0;
+    uint32_t last_seq = 0;
+    int64_t play_start_us = 0;
+    int64_t play_origin_us = 0;
+    
+    while (ctx->active) {
+        if (!session_is_active(cam, my_session)) {
             ESP_LOGI(TAG, "Session 0x%08lX terminated by newer viewer", my_session);
             break;
         }
         
-        EventBits_t bits = xEventGroupWaitBits(
-            g_frame_events,
-            FRAME_READY_BIT,
-            pdTRUE,
-            pdFALSE,
-            pdMS_TO_TICKS(1000)
-        );
+        size_t frame_len = 0;
+        size_t dht_pos = 0;
         
-        if (!(bits & FRAME_READY_BIT)) {
-            consecutive_waits++;
-            if (consecutive_waits >= 3) {
-                ESP_LOGW(TAG, "No frames received for %lu seconds", consecutive_waits);
+        if (playback) {
+            int64_t frame_us = 0;
+            esp_err_t err = app_frame_ring_read(&cam->ring, ring_seq, local_frame_buf, MAX_FRAME_SIZE,
+                                                &frame_len, &frame_us);
+            if (err == ESP_ERR_INVALID_STATE) {
+                // Overwritten before it was played, skip ahead to the oldest frame left
+                ring_seq = app_frame_ring_seek(&cam->ring, INT64_MIN);
+                continue;
             }
-            continue;
+            if (err != ESP_OK) {
+                // At the live edge (or nothing recorded): frames from here on come from the live slots
+                ESP_LOGI(TAG, "Camera %u: rewound viewer caught up with live", cam->index);
+                playback = false;
+                continue;
+            }
+            if (play_start_us == 0) {
+                play_start_us = esp_timer_get_time();
+                play_origin_us = frame_us;
+            }
+            int64_t wait_us = play_start_us + (frame_us - play_origin_us) / ctx->speed - esp_timer_get_time();
+            if (wait_us > 1000) {
+                vTaskDelay(pdMS_TO_TICKS(wait_us / 1000));
+            }
+            if (app_jpeg_build_index(local_frame_buf, frame_len, local_index) != ESP_OK) {
+                ring_seq++;
+                continue;
+            }
+            if (local_index->sos_pos != 0 && local_index->num_dht == 0) {
+                dht_pos = local_index->sos_pos;
+            }
+            last_seq = ring_seq++;
+        } else {
+            EventBits_t bits = xEventGroupWaitBits(
+                cam->frame_events,
+                FRAME_READY_BIT,
+                pdTRUE,
+                pdFALSE,
+                pdMS_TO_TICKS(1000)
+            );
+            
+            if (!(bits & FRAME_READY_BIT)) {
+                consecutive_waits++;
+                if (consecutive_waits >= 3) {
+                    ESP_LOGW(TAG, "No frames received for %lu seconds", consecutive_waits);
+                }
+                continue;
+            }
+            
+            consecutive_waits = 0;
+            
+            uint8_t read_slot;
+            uint32_t seq = 0;
+            
+            // Briefly take mutex to find out which buffer to read from
+            if (xSemaphoreTake(cam->frame_mutex, pdMS_TO_TICKS(10)) == pdTRUE) {
+                read_slot = cam->read_index;
+                if (cam->frame_buffer[read_slot].ready && cam->frame_buffer[read_slot].len > 0) {
+                    frame_len = cam->frame_buffer[read_slot].len;
+                    dht_pos = cam->frame_buffer[read_slot].dht_insert_pos;
+                    seq = cam->frame_buffer[read_slot].seq;
+                    cam->frame_buffer[read_slot].ready = false;
+                }
+                xSemaphoreGive(cam->frame_mutex);
+            } else {
+                continue;
+            }
+            
+            // After a rewind, the frame the playback ended on may still be the newest
+            if (frame_len == 0 || frame_len > MAX_FRAME_SIZE || (seq != 0 && seq <= last_seq)) {
+                continue;
+            }
+
+            // Copy data outside the mutex lock to prevent blocking the receiver task
+            memcpy(local_frame_buf, cam->frame_buffer[read_slot].buffer, frame_len);
+            memcpy(local_index, &cam->frame_buffer[read_slot].index, sizeof(jpeg_index_t));
         }
         
-        consecutive_waits = 0;
+        const uint8_t *send_buf = local_frame_buf;
+        size_t send_len = frame_len;
+        const jpeg_index_t *send_index = local_index;   // Only valid for the unmodified frame
+        uint16_t width = local_index->width;
+        uint16_t height = local_index->height;
         
-        size_t frame_len = 0;
-        uint8_t read_slot;
+        if (overlay && work_buf[0] != NULL) {
+            // Runs first: masks are in full-frame coordinates and the ingest index is still valid
+            uint8_t *dst = work_buf[0];
+            size_t ov_len = 0;
+            if (ctx->timestamp) {
+                format_timestamp(ctx->overlay.text, sizeof(ctx->overlay.text));
+            }
+            int64_t t0 = esp_timer_get_time();
+            esp_err_t err = app_jpeg_overlay(send_buf, send_len, send_index, &ctx->overlay,
+                                             &overlay_cache, dst, work_cap, &ov_len);
+            uint32_t elapsed = (uint32_t)(esp_timer_get_time() - t0);
+            if (err != ESP_OK) {
+                app_stats_xform_fail(&g_overlay_stats);
+                continue;
+            }
+            app_stats_xform_record(&g_overlay_stats, width, height,
+                                   send_len + (dht_pos ? JPEG_STD_DHT_LEN : 0), ov_len, elapsed);
+            send_buf = dst;
+            send_len = ov_len;
+            send_index = NULL;
+            dht_pos = 0;
+        }
         
-        // Briefly take mutex to find out which buffer to read from
-        if (xSemaphoreTake(g_frame_mutex, pdMS_TO_TICKS(10)) == pdTRUE) {
-            read_slot = g_read_index;
-            if (g_frame_buffer[read_slot].ready && g_frame_buffer[read_slot].len > 0) {
-                frame_len = g_frame_buffer[read_slot].len;
-                g_frame_buffer[read_slot].ready = false;
-            }
-            xSemaphoreGive(g_frame_mutex);
-        } else {
-            continue;
+        if (ctx->crop && work_buf[0] != NULL) {
+            // Lossless crop, the output carries its own DHT
+            uint8_t *dst = (send_buf == work_buf[0]) ? work_buf[1] : work_buf[0];
+            size_t crop_len = 0;
+            jpeg_rect_t kept;
+            int64_t t0 = esp_timer_get_time();
+            esp_err_t err = app_jpeg_crop(send_buf, send_len, send_index, &ctx->crop_rect,
+                                          dst, work_cap, &crop_len, &kept);
+            uint32_t elapsed = (uint32_t)(esp_timer_get_time() - t0);
+            if (err != ESP_OK) {
+                // Never fall back to the full frame, the viewer asked for a region only
+                app_stats_xform_fail(&g_crop_stats);
+                continue;
+            }
+            app_stats_xform_record(&g_crop_stats, width, height,
+                                   send_len + (dht_pos ? JPEG_STD_DHT_LEN : 0), crop_len, elapsed);
+            send_buf = dst;
+            send_len = crop_len;
+            send_index = NULL;
+            width = kept.w;
+            height = kept.h;
+            dht_pos = 0;
         }
         
-        if (frame_len == 0 || frame_len > MAX_FRAME_SIZE) {
-            continue;
+        if (ctx->gray && work_buf[0] != NULL) {
+            // Luma only, the output carries its own DHT
+            uint8_t *dst = (send_buf == work_buf[0]) ? work_buf[1] : work_buf[0];
+            size_t gray_len = 0;
+            int64_t t0 = esp_timer_get_time();
+            esp_err_t err = app_jpeg_to_gray(send_buf, send_len, send_index, dst, work_cap, &gray_len);
+            uint32_t elapsed = (uint32_t)(esp_timer_get_time() - t0);
+            if (err != ESP_OK) {
+                app_stats_xform_fail(&g_gray_stats);
+                continue;
+            }
+            app_stats_xform_record(&g_gray_stats, width, height,
+                                   send_len + (dht_pos ? JPEG_STD_DHT_LEN : 0), gray_len, elapsed);
+            send_buf = dst;
+            send_len = gray_len;
+            send_index = NULL;
+            dht_pos = 0;
         }
-
-        // Copy data outside the mutex lock to prevent blocking the receiver task
-        memcpy(local_frame_buf, g_frame_buffer[read_slot].buffer, frame_len);
+        
+        if (ctx->optimize_huffman && work_buf[0] != NULL) {
+            // Lossless re-encode with per-frame optimal tables (always carries its own DHT)
+            uint8_t *dst = (send_buf == work_buf[0]) ? work_buf[1] : work_buf[0];
+            size_t opt_len = 0;
+            int64_t t0 = esp_timer_get_time();
+            esp_err_t err = app_jpeg_optimize_huffman(send_buf, send_len, send_index,
+                                                      dst, work_cap, &opt_len);
+            uint32_t elapsed = (uint32_t)(esp_timer_get_time() - t0);
+            size_t orig_len = send_len + (dht_pos ? JPEG_STD_DHT_LEN : 0);
+            if (err == ESP_OK && opt_len < orig_len) {
+                app_stats_xform_record(&g_huffman_opt_stats, width, height, orig_len, opt_len, elapsed);
+                send_buf = dst;
+                send_len = opt_len;
+                dht_pos = 0;
+            } else {
+                app_stats_xform_fail(&g_huffman_opt_stats);
+            }
+        }
+        
+        // Part header, frame (possibly with spliced DHT) and trailer go out in one sendmsg()
+        struct iovec iov[5];
+        int iovcnt = 1;
+        iovcnt += frame_to_iov(send_buf, send_len, dht_pos, &iov[1]);
+        size_t jpeg_len = send_len + (iovcnt > 2 ? JPEG_STD_DHT_LEN : 0);
         
         int hlen = snprintf(header_buf, 512,
             "--frame\r\n"
             "Content-Type: image/jpeg\r\n"
             "Content-Length: %zu\r\n\r\n",
-            frame_len);
-        
-        if (send(socket_fd, header_buf, hlen, 0) < 0) {
-            break;
-        }
-        
-        ssize_t sent = send(socket_fd, local_frame_buf, frame_len, 0);
+            jpeg_len);
+        iov[0] = (struct iovec){ .iov_base = header_buf, .iov_len = hlen };
+        iov[iovcnt++] = (struct iovec){ .iov_base = "\r\n", .iov_len = 2 };
         
-        if (sent != (ssize_t)frame_len) {
-            break;
-        }
-        
-        if (send(socket_fd, "\r\n", 2, 0) < 0) {
+        if (!send_iov(socket_fd, iov, iovcnt)) {
             break;
         }
         
         local_frames_sent++;
-        g_frames_sent++;
+        count_sent(hlen + jpeg_len + 2);
+        app_stats_record(&ctx->stats, hlen + jpeg_len + 2, esp_timer_get_time());
         
         if (local_frames_sent % 100 == 0) {
-            ESP_LOGI(TAG, "Stats - Received: %lu, Sent: %lu, Dropped: %lu",
-                     g_frames_received, g_frames_sent, g_frames_dropped);
+            ESP_LOGI(TAG, "Camera %u stats - Received: %lu, Sent: %lu, Dropped: %lu",
+                     cam->index, cam->frames_received, __atomic_load_n(&g_frames_sent, __ATOMIC_RELAXED),
+                     cam->frames_dropped);
         }
         
         taskYIELD();
     }
     
+    free(work_buf[0]);
+    free(work_buf[1]);
+    app_jpeg_overlay_cache_free(&overlay_cache);
     free(local_frame_buf);
+    free(local_index);
     free(header_buf);
-    g_stream_ctx.active = false;
+    stream_task_finish(cam, my_session, local_frames_sent);
+}
+
+// HTTP handler for the web UI (g_assets): gzip from flash, or 304 when the browser's
+// copy is current
+static esp_err_t asset_handler(httpd_req_t *req)
+{
+    const web_asset_t *asset = (const web_asset_t *)req->user_ctx;
+    char value[64];
     
-    if (xSemaphoreTake(g_session_mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
-        if (g_active_session == my_session) {
-            g_active_session = 0;
-        }
-        xSemaphoreGive(g_session_mutex);
+    httpd_resp_set_hdr(req, "ETag", asset->etag);
+    httpd_resp_set_hdr(req, "Cache-Control", asset->cache_control);
+    httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+    if (httpd_req_get_hdr_value_str(req, "If-None-Match", value, sizeof(value)) == ESP_OK &&
+        (strstr(value, asset->etag) != NULL || strcmp(value, "*") == 0)) {
+        httpd_resp_set_status(req, "304 Not Modified");
+        return httpd_resp_send(req, NULL, 0);
     }
     
-    ESP_LOGI(TAG, "Stream task terminated (sent %lu frames)", local_frames_sent);
-    g_stream_task_handle = NULL;
-    vTaskDelete(NULL);
+    // Every browser takes gzip, so there is no uncompressed copy to fall back to
+    httpd_resp_set_type(req, asset->type);
+    httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+    return httpd_resp_send(req, (const char *)asset->start, asset->end - asset->start);
 }
 
-// HTTP handler for root page
-static esp_err_t index_handler(httpd_req_t *req)
+// HTTP handler for statistics (JSON). The top level describes camera 0 as before,
+// "cameras" has the same fields for every camera.
+#define STATS_JSON_SIZE 16384
+
+// Append to a JSON reply. Once the text no longer fits, pos stays at size and later
+// appends write nothing, so the caller checks for pos >= size once at the end.
+static void json_appendf(char *json, int size, int *pos, const char *fmt, ...)
 {
-    httpd_resp_set_type(req, "text/html");
-    httpd_resp_set_hdr(req, "Cache-Control", "no-store, no-cache, must-revalidate");
-    return httpd_resp_send(req, index_html, HTTPD_RESP_USE_STRLEN);
+    if (*pos >= size) {
+        return;
+    }
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(json + *pos, size - *pos, fmt, args);
+    va_end(args);
+    *pos = (n < 0 || n >= size - *pos) ? size : *pos + n;
 }
 
-// HTTP handler for statistics (JSON)
-static esp_err_t stats_handler(httpd_req_t *req)
+// The same for the JSON objects app_stats formats
+static void json_append_stats(char *json, int size, int *pos, const stream_stats_snapshot_t *snap)
 {
-    char json[256];
-    snprintf(json, sizeof(json),
-        "{\"frames_received\":%lu,\"frames_sent\":%lu,\"frames_dropped\":%lu,\"active_session\":\"0x%08lX\"}",
-        g_frames_received, g_frames_sent, g_frames_dropped, g_active_session);
-    
-    httpd_resp_set_type(req, "application/json");
-    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
-    return httpd_resp_sendstr(req, json);
+    if (*pos >= size) {
+        return;
+    }
+    int n = app_stats_to_json(snap, json + *pos, size - *pos);
+    *pos = (n < 0 || n >= size - *pos) ? size : *pos + n;
 }
 
-// HTTP handler for MJPEG stream
-static esp_err_t stream_handler(httpd_req_t *req)
+static void json_append_xform(char *json, int size, int *pos, xform_stats_t *stats)
 {
-    uint32_t my_session = 0;
-    
-    if (xSemaphoreTake(g_stream_start_mutex, pdMS_TO_TICKS(5000)) != pdTRUE) {
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Stream busy");
-        return ESP_FAIL;
-    }
-    
-    if (g_stream_task_handle != NULL) {
-        g_stream_ctx.active = false;
-        int wait_count = 0;
-        while (g_stream_task_handle != NULL && wait_count < 200) {
-            vTaskDelay(pdMS_TO_TICKS(10));
-            wait_count++;
-        }
-        if (g_stream_task_handle != NULL) {
-            vTaskDelete(g_stream_task_handle);
-            g_stream_task_handle = NULL;
-        }
-    }
-    
-    if (xSemaphoreTake(g_session_mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
-        my_session = generate_session_token();
-        g_active_session = my_session;
-        xSemaphoreGive(g_session_mutex);
-    } else {
-        xSemaphoreGive(g_stream_start_mutex);
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Session manager busy");
-        return ESP_FAIL;
+    if (*pos >= size) {
+        return;
     }
+    int n = app_stats_xform_to_json(stats, json + *pos, size - *pos);
+    *pos = (n < 0 || n >= size - *pos) ? size : *pos + n;
+}
+
+// Per-camera fields of /stats, without the enclosing braces
+static void camera_to_json(camera_t *cam, int64_t now, char *json, int size, int *pos)
+{
+    stream_stats_snapshot_t snap;
+    uvc_camera_info_t info;
+    app_frame_format_t format = app_uvc_get_format(cam->index);
     
-    int socket_fd = httpd_req_to_sockfd(req);
-    g_stream_ctx.socket_fd = socket_fd;
-    g_stream_ctx.session_id = my_session;
-    g_stream_ctx.active = true;
-    
-    BaseType_t ret = xTaskCreate(
-        stream_task,
-        "stream_task",
-        16384,
-        NULL,
-        configMAX_PRIORITIES - 2,
-        &g_stream_task_handle
-    );
+    json_appendf(json, size, pos,
+                 "\"frames_received\":%lu,\"frames_dropped\":%lu,\"active_session\":\"0x%08lX\",\"ingest\":",
+                 cam->frames_received, cam->frames_dropped, cam->active_session);
+    app_uvc_get_stats(cam->index, &snap);
+    json_append_stats(json, size, pos, &snap);
+    json_appendf(json, size, pos, ",\"viewer\":");
+    app_stats_snapshot(&cam->stream_ctx.stats, now, &snap);
+    json_append_stats(json, size, pos, &snap);
     
-    if (ret != pdPASS) {
-        g_stream_ctx.active = false;
-        xSemaphoreGive(g_stream_start_mutex);
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to start stream");
-        return ESP_FAIL;
-    }
+    app_uvc_get_camera_info(cam->index, &info);
+    json_appendf(json, size, pos,
+                 ",\"format\":\"%s\",\"capture\":\"%s\","
+                 "\"usb\":{\"connected\":%s,\"width\":%u,\"height\":%u,\"fps\":%u,\"bytes\":%lu,\"queue_depth\":%lu},"
+                 "\"jpeg\":{\"dht_missing\":%lu,\"index_us_per_mb\":%lu},"
+                 "\"h264\":{\"gops\":%lu,\"gop_frames\":%u,\"gop_bytes\":%u,\"gop_overflows\":%lu},\"encode\":",
+                 format == APP_FRAME_H264 ? "h264" : "mjpeg",
+                 format == APP_FRAME_H264 ? "h264" : (app_uvc_is_encoding(cam->index) ? "yuy2" : "mjpeg"),
+                 info.connected ? "true" : "false", info.width, info.height, info.fps, info.usb_bytes,
+                 app_uvc_get_queue_depth(cam->index),
+                 cam->frames_dht_missing, app_uvc_get_index_us_per_mb(cam->index),
+                 cam->h264_gop.gop_id, cam->h264_gop.num_aus, (unsigned)cam->h264_gop.used, cam->h264_gop.overflows);
+    json_append_xform(json, size, pos, app_uvc_get_encode_stats(cam->index));
     
-    xSemaphoreGive(g_stream_start_mutex);
+    app_still_stats_t still;
+    app_uvc_get_still_stats(cam->index, &still);
+    json_appendf(json, size, pos,
+                 ",\"still\":{\"taken\":%lu,\"failed\":%lu,\"last_outage_ms\":%lu,\"max_outage_ms\":%lu}",
+                 still.taken, still.failed, still.last_outage_us / 1000, still.max_outage_us / 1000);
     
-    while (g_stream_task_handle != NULL) {
-        vTaskDelay(pdMS_TO_TICKS(100));
+    // Rewind history: what it holds and what a second of it costs at each resolution
+    frame_ring_stats_t ring;
+    app_frame_ring_stats(&cam->ring, &ring);
+    json_appendf(json, size, pos,
+                 ",\"ring\":{\"cap\":%u,\"bytes\":%u,\"frames\":%lu,\"span_ms\":%lu,\"resolutions\":[",
+                 (unsigned)ring.cap, (unsigned)ring.bytes, ring.frames, ring.span_ms);
+    for (int r = 0; r < ring.num_res; r++) {
+        json_appendf(json, size, pos,
+                     "%s{\"width\":%u,\"height\":%u,\"frames\":%lu,\"bytes_per_s\":%lu}", r ? "," : "",
+                     ring.res[r].width, ring.res[r].height, ring.res[r].frames, ring.res[r].bytes_per_s);
     }
-    
-    return ESP_OK;
+    json_appendf(json, size, pos, "]}");
 }
 
-esp_err_t app_http_init(void)
+static int stats_to_json(char *json, size_t size)
 {
-    ESP_LOGI(TAG, "Initializing HTTP streaming server");
+    int64_t now = esp_timer_get_time();
+    int pos = 0;
     
-    for (int i = 0; i < 2; i++) {
-        g_frame_buffer[i].buffer = heap_caps_malloc(MAX_FRAME_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
-        if (g_frame_buffer[i].buffer == NULL) {
-            g_frame_buffer[i].buffer = malloc(MAX_FRAME_SIZE);
-            if (g_frame_buffer[i].buffer == NULL) {
-                return ESP_ERR_NO_MEM;
-            }
-        }
-        g_frame_buffer[i].len = 0;
-        g_frame_buffer[i].ready = false;
+    json_appendf(json, size, &pos, "{\"frames_sent\":%lu,", __atomic_load_n(&g_frames_sent, __ATOMIC_RELAXED));
+    camera_to_json(&g_cameras[0], now, json, size, &pos);
+    json_appendf(json, size, &pos, ",\"usb_budget\":%lu,\"drops\":{", app_uvc_get_usb_budget());
+    for (int r = 0; r < DROP_REASON_COUNT; r++) {
+        json_appendf(json, size, &pos, "%s\"%s\":%lu", r ? "," : "",
+                     app_stats_drop_reason_name((drop_reason_t)r), app_stats_get_drops((drop_reason_t)r));
     }
+    json_appendf(json, size, &pos, "}");
     
-    g_frame_mutex = xSemaphoreCreateMutex();
-    g_session_mutex = xSemaphoreCreateMutex();
-    g_stream_start_mutex = xSemaphoreCreateMutex();
-    g_frame_events = xEventGroupCreate();
-    
-    if (!g_frame_mutex || !g_session_mutex || !g_stream_start_mutex || !g_frame_events) {
-        return ESP_ERR_NO_MEM;
+    for (size_t i = 0; i < sizeof(g_xform_stats) / sizeof(g_xform_stats[0]); i++) {
+        json_appendf(json, size, &pos, ",\"%s\":", g_xform_stats[i].name);
+        json_append_xform(json, size, &pos, g_xform_stats[i].stats);
     }
     
-    esp_err_t ret = app_uvc_register_frame_callback(frame_received_callback, NULL);
-    if (ret != ESP_OK) return ret;
-    
-    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
-    config.server_port = 80;
-    config.ctrl_port = 32768;
-    config.max_uri_handlers = 8;
-    config.max_open_sockets = 5;
-    config.lru_purge_enable = true;
-    config.stack_size = 6144;
-    config.send_wait_timeout = 5;
-    config.recv_wait_timeout = 5;
+    stream_stats_snapshot_t snap;
+    app_stats_snapshot(&g_mosaic_ctx.stats, now, &snap);
+    json_appendf(json, size, &pos, ",\"mosaic_viewer\":");
+    json_append_stats(json, size, &pos, &snap);
     
-    httpd_handle_t server = NULL;
-    ret = httpd_start(&server, &config);
-    if (ret != ESP_OK) return ret;
+    app_stats_snapshot(&g_delta_ctx.stats, now, &snap);
+    json_appendf(json, size, &pos, ",\"delta_frames\":{\"key\":%lu,\"delta\":%lu,\"unchanged\":%lu},\"delta_viewer\":",
+                 g_delta_ctx.keyframes, g_delta_ctx.deltas, g_delta_ctx.unchanged);
+    json_append_stats(json, size, &pos, &snap);
     
-    httpd_uri_t index_uri = { .uri = "/", .method = HTTP_GET, .handler = index_handler, .user_ctx = NULL };
-    httpd_register_uri_handler(server, &index_uri);
+    json_appendf(json, size, &pos,
+                 ",\"burst\":{\"pool\":%u,\"busy\":%s,\"bursts\":%lu,\"frames\":%lu,\"truncated\":%lu}",
+                 (unsigned)g_burst.cap, g_burst.busy ? "true" : "false",
+                 g_burst.bursts, g_burst.frames_total, g_burst.truncations);
+    json_appendf(json, size, &pos, ",\"clips\":{\"downloads\":%lu,\"bytes\":%llu,\"last_kbps\":%lu}",
+                 g_clip_downloads, g_clip_bytes, g_clip_last_kbps);
+    json_appendf(json, size, &pos, ",\"cameras\":[");
+    for (int i = 0; i < APP_UVC_MAX_CAMERAS; i++) {
+        json_appendf(json, size, &pos, "%s{", i ? "," : "");
+        camera_to_json(&g_cameras[i], now, json, size, &pos);
+        json_appendf(json, size, &pos, "}");
+    }
+    json_appendf(json, size, &pos, "]}");
+    return pos < (int)size ? pos : -1;
+}
+
+static esp_err_t stats_handler(httpd_req_t *req)
+{
+    char *json = malloc(STATS_JSON_SIZE);
+    if (json == NULL) {
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+    }
+    if (stats_to_json(json, STATS_JSON_SIZE) < 0) {
+        free(json);
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Stats too large");
+    }
     
-    httpd_uri_t stream_uri = { .uri = "/stream", .method = HTTP_GET, .handler = stream_handler, .user_ctx = NULL };
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    esp_err_t err = httpd_resp_sendstr(req, json);
+    free(json);
+    return err;
+}
+
+// Stats push (/events): Server-Sent Events over one long-lived connection per
+// dashboard. The events task formats /stats once per tick for all listeners, then
+// sends each listener the top-level members that changed since its last event; the
+// first event carries all of them.
+#define EVENTS_MAX_LISTENERS 3          // Of the server's 5 sockets
+#define EVENTS_TICK_MS 100
+#define EVENTS_DEFAULT_MS 1000
+#define EVENTS_MAX_MS 60000
+#define EVENTS_KEEPALIVE_MS 15000       // A comment when nothing changed, to notice dead peers
+
+typedef struct {
+    httpd_req_t *req;                   // Async copy of the request, NULL when the slot is free
+    uint32_t interval_ms;
+    int64_t next_us;
+    int64_t last_send_us;
+    json_diff_t sent;                   // Members as last sent to this listener
+} events_listener_t;
+
+static events_listener_t g_events[EVENTS_MAX_LISTENERS];
+static SemaphoreHandle_t g_events_mutex = NULL;
+
+static uint32_t fnv1a(const char *s, size_t len)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (uint8_t)s[i]) * 16777619u;
+    }
+    return h;
+}
+
+static void events_drop(events_listener_t *l)
+{
+    httpd_req_t *req = l->req;
+    xSemaphoreTake(g_events_mutex, portMAX_DELAY);
+    l->req = NULL;
+    xSemaphoreGive(g_events_mutex);
+    httpd_req_async_handler_complete(req);
+}
+
+static void events_task(void *arg)
+{
+    char *json = heap_caps_malloc(STATS_JSON_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    char *event = heap_caps_malloc(STATS_JSON_SIZE + 16, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (json == NULL || event == NULL) {
+        ESP_LOGE(TAG, "No memory for stats events");
+        free(json);
+        free(event);
+        vTaskDelete(NULL);
+        return;
+    }
+    
+    TickType_t wake = xTaskGetTickCount();
+    while (true) {
+        xTaskDelayUntil(&wake, pdMS_TO_TICKS(EVENTS_TICK_MS));
+        int64_t now = esp_timer_get_time();
+        
+        // Only the handler fills slots and only this task empties them
+        bool due = false;
+        xSemaphoreTake(g_events_mutex, portMAX_DELAY);
+        for (int i = 0; i < EVENTS_MAX_LISTENERS; i++) {
+            due |= (g_events[i].req != NULL && now >= g_events[i].next_us);
+        }
+        xSemaphoreGive(g_events_mutex);
+        int json_len = due ? stats_to_json(json, STATS_JSON_SIZE) : -1;
+        if (json_len < 0) {
+            continue;
+        }
+        
+        for (int i = 0; i < EVENTS_MAX_LISTENERS; i++) {
+            events_listener_t *l = &g_events[i];
+            if (l->req == NULL || now < l->next_us) {
+                continue;
+            }
+            l->next_us = now + (int64_t)l->interval_ms * 1000;
+            
+            int pos = snprintf(event, 16, "data: {");
+            int n = app_json_diff(&l->sent, json, json_len, event + pos, STATS_JSON_SIZE + 16 - pos - 4);
+            if (n < 0) {
+                continue;
+            }
+            if (n > 0) {
+                pos += n;
+                memcpy(event + pos, "}\n\n", 3);
+                pos += 3;
+            } else if (now - l->last_send_us >= EVENTS_KEEPALIVE_MS * 1000LL) {
+                pos = snprintf(event, 16, ":\n\n");
+            } else {
+                continue;
+            }
+            if (httpd_resp_send_chunk(l->req, event, pos) != ESP_OK) {
+                ESP_LOGI(TAG, "Events listener %d left", i);
+                events_drop(l);
+                continue;
+            }
+            l->last_send_us = now;
+        }
+    }
+}
+
+// HTTP handler for stats events (/events, ?rate_ms=100-60000, default 1000). The
+// request is handed to the events task, which answers it for as long as it lasts.
+static esp_err_t events_handler(httpd_req_t *req)
+{
+    unsigned rate_ms = EVENTS_DEFAULT_MS;
+    char query[32];
+    char value[8];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "rate_ms", value, sizeof(value)) == ESP_OK &&
+        sscanf(value, "%u", &rate_ms) == 1) {
+        rate_ms = (rate_ms < EVENTS_TICK_MS) ? EVENTS_TICK_MS : (rate_ms > EVENTS_MAX_MS) ? EVENTS_MAX_MS : rate_ms;
+    }
+    
+    events_listener_t *l = NULL;
+    httpd_req_t *async = NULL;
+    xSemaphoreTake(g_events_mutex, portMAX_DELAY);
+    for (int i = 0; i < EVENTS_MAX_LISTENERS && l == NULL; i++) {
+        if (g_events[i].req == NULL) {
+            l = &g_events[i];
+        }
+    }
+    if (l != NULL && httpd_req_async_handler_begin(req, &async) == ESP_OK) {
+        httpd_resp_set_type(async, "text/event-stream");
+        httpd_resp_set_hdr(async, "Cache-Control", "no-store");
+        httpd_resp_set_hdr(async, "Access-Control-Allow-Origin", "*");
+        l->interval_ms = rate_ms;
+        l->next_us = 0;
+        l->last_send_us = esp_timer_get_time();
+        memset(&l->sent, 0, sizeof(l->sent));
+        l->req = async;
+    }
+    xSemaphoreGive(g_events_mutex);
+    if (async == NULL) {
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR,
+                                   l == NULL ? "Too many event listeners" : "Cannot keep the request");
+    }
+    return ESP_OK;
+}
+
+// History output state, one line is formatted at a time and flushed in chunks
+typedef struct {
+    httpd_req_t *req;
+    bool csv;
+    bool first;
+    bool failed;
+    size_t len;
+    char buf[1024];
+} history_writer_t;
+
+static bool history_flush(history_writer_t *w)
+{
+    if (w->len > 0 && httpd_resp_send_chunk(w->req, w->buf, w->len) != ESP_OK) {
+        w->failed = true;
+    }
+    w->len = 0;
+    return !w->failed;
+}
+
+static bool history_write_sample(const history_sample_t *s, void *ctx)
+{
+    history_writer_t *w = (history_writer_t *)ctx;
+    char line[256];
+    int n;
+    
+    if (w->csv) {
+        n = snprintf(line, sizeof(line), "%lu,%lu,%lu,%lu,%lu",
+                     s->uptime_s, s->frames_in, s->frames_out, s->bytes_in, s->bytes_out);
+        for (int r = 0; r < DROP_REASON_COUNT; r++) {
+            n += snprintf(line + n, sizeof(line) - n, ",%lu", s->drops[r]);
+        }
+        n += snprintf(line + n, sizeof(line) - n, ",%lu,%lu,%lu,%ld,%lu\n",
+                      s->queue_depth, s->heap_free, s->psram_free, s->rssi, s->viewers);
+    } else {
+        n = snprintf(line, sizeof(line), "%s[%lu,%lu,%lu,%lu,%lu", w->first ? "" : ",",
+                     s->uptime_s, s->frames_in, s->frames_out, s->bytes_in, s->bytes_out);
+        for (int r = 0; r < DROP_REASON_COUNT; r++) {
+            n += snprintf(line + n, sizeof(line) - n, ",%lu", s->drops[r]);
+        }
+        n += snprintf(line + n, sizeof(line) - n, ",%lu,%lu,%lu,%ld,%lu]",
+                      s->queue_depth, s->heap_free, s->psram_free, s->rssi, s->viewers);
+    }
+    w->first = false;
+    
+    if (n >= (int)sizeof(line)) {
+        return true;
+    }
+    if (w->len + n > sizeof(w->buf) && !history_flush(w)) {
+        return false;
+    }
+    memcpy(w->buf + w->len, line, n);
+    w->len += n;
+    return true;
+}
+
+// HTTP handler for per-second metrics history (JSON, or CSV with ?format=csv)
+static esp_err_t history_handler(httpd_req_t *req)
+{
+    history_writer_t *w = calloc(1, sizeof(history_writer_t));
+    if (w == NULL) {
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+    }
+    w->req = req;
+    w->first = true;
+    
+    char query[32];
+    char format[8];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "format", format, sizeof(format)) == ESP_OK) {
+        w->csv = (strcmp(format, "csv") == 0);
+    }
+    
+    // Column names are shared by both formats
+    int n = snprintf(w->buf, sizeof(w->buf), w->csv ? "" : "{\"interval_s\":1,\"columns\":[");
+    const char *cols[] = { "uptime_s", "frames_in", "frames_out", "bytes_in", "bytes_out" };
+    for (int i = 0; i < 5; i++) {
+        n += snprintf(w->buf + n, sizeof(w->buf) - n, w->csv ? "%s%s" : "%s\"%s\"", i ? "," : "", cols[i]);
+    }
+    for (int r = 0; r < DROP_REASON_COUNT; r++) {
+        n += snprintf(w->buf + n, sizeof(w->buf) - n, w->csv ? ",drop_%s" : ",\"drop_%s\"",
+                      app_stats_drop_reason_name((drop_reason_t)r));
+    }
+    n += snprintf(w->buf + n, sizeof(w->buf) - n, w->csv ?
+                  ",queue_depth,heap_free,psram_free,rssi,viewers\n" :
+                  ",\"queue_depth\",\"heap_free\",\"psram_free\",\"rssi\",\"viewers\"],\"samples\":[");
+    w->len = n;
+    
+    httpd_resp_set_type(req, w->csv ? "text/csv" : "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    
+    app_history_foreach(history_write_sample, w);
+    
+    if (!w->csv && !w->failed) {
+        if (w->len + 2 > sizeof(w->buf)) {
+            history_flush(w);
+        }
+        memcpy(w->buf + w->len, "]}", 2);
+        w->len += 2;
+    }
+    history_flush(w);
+    
+    esp_err_t ret = w->failed ? ESP_FAIL : httpd_resp_send_chunk(req, NULL, 0);
+    free(w);
+    return ret;
+}
+
+// Copy a camera's newest frame and its index, without waiting for a new one.
+// Returns the frame length, 0 if there is no frame yet.
+static size_t copy_latest_frame(camera_t *cam, uint8_t *buf, jpeg_index_t *index)
+{
+    size_t len = 0;
+    uint8_t read_slot;
+    
+    if (xSemaphoreTake(cam->frame_mutex, pdMS_TO_TICKS(100)) != pdTRUE) {
+        return 0;
+    }
+    read_slot = cam->read_index;
+    len = cam->frame_buffer[read_slot].len;
+    xSemaphoreGive(cam->frame_mutex);
+    
+    if (len == 0 || len > MAX_FRAME_SIZE) {
+        return 0;
+    }
+    memcpy(buf, cam->frame_buffer[read_slot].buffer, len);
+    memcpy(index, &cam->frame_buffer[read_slot].index, sizeof(jpeg_index_t));
+    return len;
+}
+
+// HTTP handler for decoded pixels of the newest frame: PGM/PPM image (?codec= picks
+// the backend), or with ?bench=N a JSON comparison of single-core and all-core
+// software decode times over N runs
+static esp_err_t decode_handler(httpd_req_t *req)
+{
+    jpeg_decode_config_t config = { .format = JPEG_DECODE_GRAY, .scale_shift = 3, .max_workers = 0 };
+    const jpeg_codec_t *codec = app_jpeg_codec_get(NULL);
+    int runs = 0;
+    
+    char query[64];
+    char value[16];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        if (httpd_query_key_value(query, "codec", value, sizeof(value)) == ESP_OK) {
+            codec = app_jpeg_codec_get(value);
+            if (codec == NULL) {
+                return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Unknown codec");
+            }
+        }
+        if (httpd_query_key_value(query, "scale", value, sizeof(value)) == ESP_OK) {
+            int scale = atoi(value);
+            if (scale < 0 || scale > 3) {
+                return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "scale must be 0-3");
+            }
+            config.scale_shift = scale;
+        }
+        if (httpd_query_key_value(query, "format", value, sizeof(value)) == ESP_OK) {
+            config.format = (strcmp(value, "rgb") == 0) ? JPEG_DECODE_RGB888 : JPEG_DECODE_GRAY;
+        }
+        if (httpd_query_key_value(query, "bench", value, sizeof(value)) == ESP_OK) {
+            runs = atoi(value);
+            runs = runs < 1 ? 1 : (runs > 50 ? 50 : runs);
+        }
+    }
+    
+    uint8_t *frame = heap_caps_malloc(MAX_FRAME_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    jpeg_index_t *index = malloc(sizeof(jpeg_index_t));
+    size_t len = (frame && index) ? copy_latest_frame(&g_cameras[0], frame, index) : 0;
+    if (len == 0) {
+        free(frame);
+        free(index);
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "No frame available");
+    }
+    
+    // Image header goes in front of the pixels so they are sent in one piece
+    char header[32];
+    int header_len = snprintf(header, sizeof(header), "P%c\n%u %u\n255\n",
+                              config.format == JPEG_DECODE_RGB888 ? '6' : '5',
+                              (index->width + (1 << config.scale_shift) - 1) >> config.scale_shift,
+                              (index->height + (1 << config.scale_shift) - 1) >> config.scale_shift);
+    size_t out_size = app_jpeg_decode_out_size(index->width, index->height, &config);
+    uint8_t *out = heap_caps_malloc(header_len + out_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (out == NULL) {
+        free(frame);
+        free(index);
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+    }
+    memcpy(out, header, header_len);
+    
+    jpeg_decode_result_t result = {0};
+    esp_err_t err = ESP_OK;
+    uint64_t single_us = 0;
+    uint64_t parallel_us = 0;
+    uint8_t workers = 1;
+    if (runs > 0) {
+        for (int i = 0; i < runs && err == ESP_OK; i++) {
+            config.max_workers = 1;
+            err = app_jpeg_decode(frame, len, index, &config, out + header_len, out_size, &result);
+            single_us += result.decode_us;
+            config.max_workers = 0;
+            if (err == ESP_OK) {
+                err = app_jpeg_decode(frame, len, index, &config, out + header_len, out_size, &result);
+                parallel_us += result.decode_us;
+                workers = result.workers;
+            }
+        }
+    } else {
+        jpeg_codec_image_t image = {
+            .data = out + header_len,
+            .format = config.format == JPEG_DECODE_RGB888 ? JPEG_CODEC_RGB888 : JPEG_CODEC_GRAY,
+        };
+        err = app_jpeg_codec_decode(codec, frame, len, index, config.scale_shift, &image, out_size);
+    }
+    uint16_t restart_interval = index->restart_interval;
+    free(frame);
+    free(index);
+    
+    if (err != ESP_OK) {
+        free(out);
+        ESP_LOGW(TAG, "Decode failed: %s", esp_err_to_name(err));
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Decode failed");
+    }
+    
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    if (runs > 0) {
+        free(out);
+        char json[256];
+        snprintf(json, sizeof(json),
+                 "{\"width\":%u,\"height\":%u,\"restart_interval\":%u,\"runs\":%d,\"workers\":%u,"
+                 "\"single_us\":%lu,\"parallel_us\":%lu,\"speedup\":%.2f}",
+                 result.width, result.height, restart_interval, runs, workers,
+                 (unsigned long)(single_us / runs), (unsigned long)(parallel_us / runs),
+                 parallel_us ? (double)single_us / parallel_us : 0.0);
+        httpd_resp_set_type(req, "application/json");
+        return httpd_resp_sendstr(req, json);
+    }
+    
+    httpd_resp_set_type(req, config.format == JPEG_DECODE_RGB888 ? "image/x-portable-pixmap" : "image/x-portable-graymap");
+    err = httpd_resp_send(req, (const char *)out, header_len + out_size);
+    free(out);
+    return err;
+}
+
+#define CODEC_BENCH_MAX_FRAMES 8
+#define CODEC_JSON_SIZE 1024
+
+// HTTP handler for the codec backends: lists them, ?select=name switches the
+// default, ?bench=N times every backend on the same N consecutive camera frames
+static esp_err_t codec_handler(httpd_req_t *req)
+{
+    int frames = 0;
+    int quality = 80;
+    
+    char query[64];
+    char value[16];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        if (httpd_query_key_value(query, "select", value, sizeof(value)) == ESP_OK &&
+            app_jpeg_codec_select(value) != ESP_OK) {
+            return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Unknown codec");
+        }
+        if (httpd_query_key_value(query, "bench", value, sizeof(value)) == ESP_OK) {
+            frames = atoi(value);
+            frames = frames < 1 ? 1 : (frames > CODEC_BENCH_MAX_FRAMES ? CODEC_BENCH_MAX_FRAMES : frames);
+        }
+        if (httpd_query_key_value(query, "quality", value, sizeof(value)) == ESP_OK) {
+            quality = atoi(value);
+            quality = quality < 1 ? 1 : (quality > 100 ? 100 : quality);
+        }
+    }
+    
+    char *json = malloc(CODEC_JSON_SIZE);
+    if (json == NULL) {
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+    }
+    int pos = 0;
+    json_appendf(json, CODEC_JSON_SIZE, &pos, "{\"selected\":\"%s\",\"backends\":[", app_jpeg_codec_get(NULL)->name);
+    for (size_t i = 0; i < app_jpeg_codec_count(); i++) {
+        json_appendf(json, CODEC_JSON_SIZE, &pos, "%s\"%s\"", i ? "," : "", app_jpeg_codec_at(i)->name);
+    }
+    json_appendf(json, CODEC_JSON_SIZE, &pos, "]");
+    
+    esp_err_t err = ESP_OK;
+    if (frames > 0) {
+        if (app_uvc_get_format(0) != APP_FRAME_MJPEG) {
+            free(json);
+            return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Needs an MJPEG or YUY2 camera");
+        }
+        // Corpus: consecutive frames from the camera
+        uint8_t *bufs[CODEC_BENCH_MAX_FRAMES] = {0};
+        jpeg_index_t *indexes = malloc(frames * sizeof(jpeg_index_t));
+        jpeg_codec_frame_t corpus[CODEC_BENCH_MAX_FRAMES];
+        int count = 0;
+        camera_t *cam = &g_cameras[0];
+        uint32_t last = cam->frames_received - 1;
+        for (int i = 0; i < frames && indexes != NULL; i++) {
+            for (int wait = 0; wait < 200 && cam->frames_received == last; wait++) {
+                vTaskDelay(pdMS_TO_TICKS(10));
+            }
+            last = cam->frames_received;
+            bufs[i] = heap_caps_malloc(MAX_FRAME_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+            size_t len = bufs[i] ? copy_latest_frame(cam, bufs[i], &indexes[i]) : 0;
+            if (len == 0) {
+                break;
+            }
+            corpus[count++] = (jpeg_codec_frame_t) { .data = bufs[i], .len = len, .index = &indexes[i] };
+        }
+        
+        json_appendf(json, CODEC_JSON_SIZE, &pos, ",\"frames\":%d,\"quality\":%d,\"results\":[", count, quality);
+        for (size_t i = 0; i < app_jpeg_codec_count() && count > 0 && err == ESP_OK; i++) {
+            jpeg_codec_bench_t r;
+            err = app_jpeg_codec_bench(app_jpeg_codec_at(i), corpus, count, quality, &r);
+            if (err == ESP_OK) {
+                json_appendf(json, CODEC_JSON_SIZE, &pos,
+                             "%s{\"name\":\"%s\",\"frames\":%lu,\"decode_us\":%lu,\"decode_quarter_us\":%lu,"
+                             "\"encode_us\":%lu,\"encode_bytes\":%lu,\"error\":\"%s\"}",
+                             i ? "," : "", r.name, r.frames, r.decode_us, r.decode_small_us,
+                             r.encode_us, r.encode_bytes, r.result == ESP_OK ? "" : esp_err_to_name(r.result));
+            }
+        }
+        json_appendf(json, CODEC_JSON_SIZE, &pos, "]");
+        for (int i = 0; i < frames; i++) {
+            free(bufs[i]);
+        }
+        free(indexes);
+        if (count == 0) {
+            err = ESP_ERR_NOT_FOUND;
+        }
+    }
+    
+    if (err != ESP_OK || pos >= CODEC_JSON_SIZE - 2) {
+        free(json);
+        ESP_LOGW(TAG, "Codec benchmark failed: %s", esp_err_to_name(err));
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR,
+                                   err == ESP_ERR_NOT_FOUND ? "No frame available" : "Benchmark failed");
+    }
+    json[pos++] = '}';
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    httpd_resp_set_type(req, "application/json");
+    err = httpd_resp_send(req, json, pos);
+    free(json);
+    return err;
+}
+
+// HTTP handler for encoder throughput: the newest frame is decoded, resampled to
+// 640x480 and 1280x720 YUY2 and encoded N times per quality, on one core and on all
+#define ENCODE_JSON_SIZE 2048
+
+static esp_err_t encode_handler(httpd_req_t *req)
+{
+    static const uint16_t sizes[][2] = { { 640, 480 }, { 1280, 720 } };
+    static const uint8_t qualities[] = { 50, 75, 90 };
+    int runs = 3;
+    
+    char query[32];
+    char value[16];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "bench", value, sizeof(value)) == ESP_OK) {
+        runs = atoi(value);
+        runs = runs < 1 ? 1 : (runs > 20 ? 20 : runs);
+    }
+    if (app_uvc_get_format(0) != APP_FRAME_MJPEG) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Needs an MJPEG or YUY2 camera");
+    }
+    
+    const jpeg_decode_config_t dec = { .format = JPEG_DECODE_RGB888, .scale_shift = 0, .max_workers = 0 };
+    uint8_t *frame = heap_caps_malloc(MAX_FRAME_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    jpeg_index_t *index = malloc(sizeof(jpeg_index_t));
+    uint8_t *rgb = NULL;
+    uint8_t *yuy2 = heap_caps_malloc(1280 * 720 * 2, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    char *json = malloc(ENCODE_JSON_SIZE);
+    size_t len = (frame && index && yuy2 && json) ? copy_latest_frame(&g_cameras[0], frame, index) : 0;
+    esp_err_t err = (len > 0) ? ESP_OK : ESP_ERR_NOT_FOUND;
+    jpeg_decode_result_t decoded = {0};
+    if (err == ESP_OK) {
+        size_t rgb_size = app_jpeg_decode_out_size(index->width, index->height, &dec);
+        rgb = heap_caps_malloc(rgb_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        err = rgb ? app_jpeg_decode(frame, len, index, &dec, rgb, rgb_size, &decoded) : ESP_ERR_NO_MEM;
+    }
+    free(index);
+    
+    int pos = 0;
+    if (err == ESP_OK) {
+        json_appendf(json, ENCODE_JSON_SIZE, &pos, "{\"source\":\"%ux%u\",\"runs\":%d,\"results\":[",
+                     decoded.width, decoded.height, runs);
+    }
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]) && err == ESP_OK; s++) {
+        uint16_t w = sizes[s][0];
+        uint16_t h = sizes[s][1];
+        // Nearest-neighbour resample and JFIF RGB to YCbCr, chroma averaged over pixel pairs
+        for (int y = 0; y < h; y++) {
+            const uint8_t *src = rgb + (size_t)(y * decoded.height / h) * decoded.width * 3;
+            uint8_t *dst = yuy2 + (size_t)y * w * 2;
+            for (int x = 0; x < w; x += 2) {
+                const uint8_t *p0 = src + (x * decoded.width / w) * 3;
+                const uint8_t *p1 = src + ((x + 1) * decoded.width / w) * 3;
+                int r = p0[0] + p1[0];
+                int g = p0[1] + p1[1];
+                int b = p0[2] + p1[2];
+                dst[2 * x] = (19595 * p0[0] + 38470 * p0[1] + 7471 * p0[2] + 32768) >> 16;
+                dst[2 * x + 1] = (-11059 * r - 21709 * g + 32768 * b + (256 << 16)) >> 17;
+                dst[2 * x + 2] = (19595 * p1[0] + 38470 * p1[1] + 7471 * p1[2] + 32768) >> 16;
+                dst[2 * x + 3] = (32768 * r - 27439 * g - 5329 * b + (256 << 16)) >> 17;
+            }
+        }
+        for (size_t q = 0; q < sizeof(qualities) && err == ESP_OK; q++) {
+            for (int workers = 1; workers >= 0 && err == ESP_OK; workers--) {
+                jpeg_encode_config_t config = { .quality = qualities[q], .max_workers = workers };
+                jpeg_encode_result_t result = {0};
+                uint64_t total_us = 0;
+                for (int i = 0; i < runs && err == ESP_OK; i++) {
+                    err = app_jpeg_encode_yuy2(yuy2, w, h, &config, frame, MAX_FRAME_SIZE, &result);
+                    total_us += result.encode_us;
+                }
+                uint32_t us = (uint32_t)(total_us / runs);
+                json_appendf(json, ENCODE_JSON_SIZE, &pos,
+                             "%s{\"width\":%u,\"height\":%u,\"quality\":%u,\"workers\":%u,"
+                             "\"us\":%lu,\"fps\":%.1f,\"bytes\":%u}",
+                             pos > 0 && json[pos - 1] == '}' ? "," : "", w, h, qualities[q], result.workers,
+                             (unsigned long)us, us ? 1e6 / us : 0.0, (unsigned)result.len);
+            }
+        }
+    }
+    free(frame);
+    free(rgb);
+    free(yuy2);
+    
+    if (err != ESP_OK || pos >= ENCODE_JSON_SIZE - 2) {
+        free(json);
+        ESP_LOGW(TAG, "Encode benchmark failed: %s", esp_err_to_name(err));
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR,
+                                   err == ESP_ERR_NOT_FOUND ? "No frame available" : "Encode failed");
+    }
+    json[pos++] = ']';
+    json[pos++] = '}';
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    httpd_resp_set_type(req, "application/json");
+    err = httpd_resp_send(req, json, pos);
+    free(json);
+    return err;
+}
+
+// Serve one camera's stream on the request's socket until the viewer leaves or is
+// replaced by a newer one. Each camera has its own viewer.
+static esp_err_t stream_serve(httpd_req_t *req, camera_t *cam, stream_kind_t kind)
+{
+    uint32_t my_session = 0;
+    stream_context_t *ctx = &cam->stream_ctx;
+    bool h264 = (kind != STREAM_MJPEG);
+    
+    if (h264 != (app_uvc_get_format(cam->index) == APP_FRAME_H264)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                            h264 ? "Camera streams MJPEG, use stream" : "Camera streams H.264, use stream.h264");
+        return ESP_FAIL;
+    }
+    
+    bool optimize = false;
+    bool crop = false;
+    bool gray = false;
+    bool timestamp = false;
+    bool rewind = false;
+    int64_t rewind_us = 0;
+    unsigned speed = 2;
+    jpeg_rect_t crop_rect = {0};
+    jpeg_overlay_t overlay = {0};
+    for (size_t i = 0; i < sizeof(g_privacy_masks) / sizeof(g_privacy_masks[0]); i++) {
+        if (g_privacy_masks[i].w > 0 && g_privacy_masks[i].h > 0 && overlay.num_masks < JPEG_OVERLAY_MAX_MASKS) {
+            overlay.masks[overlay.num_masks++] = g_privacy_masks[i];
+        }
+    }
+    // Room for every option with four masks; a query cut short could drop a mask or the
+    // crop and show the full frame, so it is refused instead
+    char query[256];
+    char value[32];
+    esp_err_t qerr = httpd_req_get_url_query_str(req, query, sizeof(query));
+    if (qerr != ESP_OK && qerr != ESP_ERR_NOT_FOUND) {
+        httpd_resp_send_err(req, HTTPD_414_URI_TOO_LONG, "Query too long");
+        return ESP_FAIL;
+    }
+    if (qerr == ESP_OK) {
+        if (httpd_query_key_value(query, "optimize", value, sizeof(value)) == ESP_OK) {
+            optimize = (strcmp(value, "1") == 0);
+        }
+        if (httpd_query_key_value(query, "gray", value, sizeof(value)) == ESP_OK) {
+            gray = (strcmp(value, "1") == 0);
+        }
+        if (httpd_query_key_value(query, "ts", value, sizeof(value)) == ESP_OK) {
+            timestamp = (strcmp(value, "1") == 0);
+        }
+        if (httpd_query_key_value(query, "from", value, sizeof(value)) == ESP_OK) {
+            int secs = 0;
+            char unit = 's';
+            if (h264 || sscanf(value, "%d%c", &secs, &unit) < 1 || unit != 's' || secs >= 0 || secs < -3600) {
+                httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "from must be -Ns on an MJPEG stream, e.g. -10s");
+                return ESP_FAIL;
+            }
+            if (cam->ring.budget == 0) {
+                httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Rewind is off (APP_FRAME_RING_KB)");
+                return ESP_FAIL;
+            }
+            rewind = true;
+            rewind_us = (int64_t)-secs * 1000000;
+        }
+        // Faster than real time so a rewound viewer catches up with live; 1 stays behind
+        if (httpd_query_key_value(query, "speed", value, sizeof(value)) == ESP_OK &&
+            (sscanf(value, "%u", &speed) != 1 || speed == 0 || speed > 8)) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "speed must be 1-8");
+            return ESP_FAIL;
+        }
+        char masks[JPEG_OVERLAY_MAX_MASKS * 24];    // "65535,65535,65535,65535," each
+        qerr = httpd_query_key_value(query, "mask", masks, sizeof(masks));
+        if (qerr == ESP_ERR_HTTPD_RESULT_TRUNC) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "mask must be x,y,w,h[,x,y,w,h...]");
+            return ESP_FAIL;
+        }
+        if (qerr == ESP_OK) {
+            const char *p = masks;
+            unsigned x, y, w, h;
+            int used = 0;
+            while (sscanf(p, "%u,%u,%u,%u%n", &x, &y, &w, &h, &used) == 4) {
+                if (overlay.num_masks >= JPEG_OVERLAY_MAX_MASKS || w == 0 || h == 0 ||
+                    x > UINT16_MAX || y > UINT16_MAX || w > UINT16_MAX || h > UINT16_MAX) {
+                    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "mask must be x,y,w,h[,x,y,w,h...]");
+                    return ESP_FAIL;
+                }
+                overlay.masks[overlay.num_masks++] = (jpeg_rect_t){ .x = x, .y = y, .w = w, .h = h };
+                p += used;
+                if (*p != ',') {
+                    break;
+                }
+                p++;
+            }
+            if (*p != '\0') {
+                httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "mask must be x,y,w,h[,x,y,w,h...]");
+                return ESP_FAIL;
+            }
+        }
+        qerr = httpd_query_key_value(query, "crop", value, sizeof(value));
+        if (qerr == ESP_OK || qerr == ESP_ERR_HTTPD_RESULT_TRUNC) {
+            unsigned x, y, w, h;
+            if (qerr != ESP_OK || sscanf(value, "%u,%u,%u,%u", &x, &y, &w, &h) != 4 ||
+                w == 0 || h == 0 || x > UINT16_MAX || y > UINT16_MAX || w > UINT16_MAX || h > UINT16_MAX) {
+                httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "crop must be x,y,w,h");
+                return ESP_FAIL;
+            }
+            crop = true;
+            crop_rect = (jpeg_rect_t){ .x = x, .y = y, .w = w, .h = h };
+        }
+    }
+    
+    if (xSemaphoreTake(g_stream_start_mutex, pdMS_TO_TICKS(5000)) != pdTRUE) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Stream busy");
+        return ESP_FAIL;
+    }
+    
+    if (cam->stream_task_handle != NULL) {
+        ctx->active = false;
+        int wait_count = 0;
+        while (cam->stream_task_handle != NULL && wait_count < 200) {
+            vTaskDelay(pdMS_TO_TICKS(10));
+            wait_count++;
+        }
+        if (cam->stream_task_handle != NULL) {
+            vTaskDelete(cam->stream_task_handle);
+            cam->stream_task_handle = NULL;
+            viewer_request_end(ctx->req);
+            ctx->req = NULL;
+        }
+    }
+    
+    if (xSemaphoreTake(g_session_mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
+        my_session = generate_session_token();
+        cam->active_session = my_session;
+        xSemaphoreGive(g_session_mutex);
+    } else {
+        xSemaphoreGive(g_stream_start_mutex);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Session manager busy");
+        return ESP_FAIL;
+    }
+    
+    // The stream task answers the request for as long as the viewer stays, the
+    // server task goes back to serving everyone else
+    httpd_req_t *async = NULL;
+    if (httpd_req_async_handler_begin(req, &async) != ESP_OK) {
+        xSemaphoreGive(g_stream_start_mutex);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Cannot keep the request");
+        return ESP_FAIL;
+    }
+    ctx->req = async;
+    ctx->socket_fd = httpd_req_to_sockfd(async);
+    ctx->session_id = my_session;
+    ctx->kind = kind;
+    ctx->optimize_huffman = optimize;
+    ctx->crop = crop;
+    ctx->crop_rect = crop_rect;
+    ctx->gray = gray;
+    ctx->timestamp = timestamp;
+    ctx->overlay = overlay;
+    ctx->rewind = rewind;
+    ctx->rewind_us = rewind_us;
+    ctx->speed = speed;
+    app_stats_reset(&ctx->stats);
+    ctx->active = true;
+    
+    BaseType_t ret = xTaskCreatePinnedToCore(
+        stream_task,
+        "stream_task",
+        16384,
+        cam,
+        STREAM_TASK_PRIORITY,
+        &cam->stream_task_handle,
+        STREAM_TASK_CORE
+    );
+    
+    if (ret != pdPASS) {
+        ctx->active = false;
+        ctx->req = NULL;
+        xSemaphoreGive(g_stream_start_mutex);
+        httpd_resp_send_err(async, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to start stream");
+        httpd_req_async_handler_complete(async);
+        return ESP_FAIL;
+    }
+    
+    xSemaphoreGive(g_stream_start_mutex);
+    return ESP_OK;
+}
+
+// HTTP handler for camera 0's MJPEG stream (/stream) and H.264 streams (/stream.h264, /stream.mp4)
+static esp_err_t stream_handler(httpd_req_t *req)
+{
+    return stream_serve(req, &g_cameras[0], (stream_kind_t)(intptr_t)req->user_ctx);
+}
+
+// HTTP handler for the streams of every camera: /cam/<n>/stream, /cam/<n>/stream.h264
+// and /cam/<n>/stream.mp4, n counted from 0
+static esp_err_t cam_stream_handler(httpd_req_t *req)
+{
+    static const char *const suffixes[] = {
+        [STREAM_MJPEG] = "stream",
+        [STREAM_H264] = "stream.h264",
+        [STREAM_FMP4] = "stream.mp4",
+    };
+    unsigned n = 0;
+    int used = 0;
+    if (sscanf(req->uri, "/cam/%u/%n", &n, &used) != 1 || used == 0 || n >= APP_UVC_MAX_CAMERAS) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "No such camera");
+        return ESP_FAIL;
+    }
+    const char *suffix = req->uri + used;
+    size_t suffix_len = strcspn(suffix, "?");
+    for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++) {
+        if (strlen(suffixes[i]) == suffix_len && strncmp(suffix, suffixes[i], suffix_len) == 0) {
+            return stream_serve(req, &g_cameras[n], (stream_kind_t)i);
+        }
+    }
+    httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Use stream, stream.h264 or stream.mp4");
+    return ESP_FAIL;
+}
+
+// HTTP handler for a lossless burst: /burst?n=30 (1-120, ?cam=n) returns the next n
+// frames of an MJPEG camera, every one of them, as multipart/mixed. Each part carries
+// the capture sequence number and time; a final JSON part sums up the burst. Frames
+// are copied into the reserved pool by the capture path and sent while the burst goes
+// on, so live viewers keep their own frames and a slow client cannot lose any.
+static esp_err_t burst_handler(httpd_req_t *req)
+{
+    unsigned n = 30;
+    unsigned cam = 0;
+    char query[64];
+    char value[16];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        if (httpd_query_key_value(query, "n", value, sizeof(value)) == ESP_OK &&
+            (sscanf(value, "%u", &n) != 1 || n == 0 || n > BURST_MAX_FRAMES)) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "n must be 1-120 frames");
+            return ESP_FAIL;
+        }
+        if (httpd_query_key_value(query, "cam", value, sizeof(value)) == ESP_OK &&
+            (sscanf(value, "%u", &cam) != 1 || cam >= APP_UVC_MAX_CAMERAS)) {
+            httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "No such camera");
+            return ESP_FAIL;
+        }
+    }
+    if (app_uvc_get_format(cam) == APP_FRAME_H264) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Camera streams H.264, bursts are MJPEG only");
+        return ESP_FAIL;
+    }
+    if (g_burst.cap == 0) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "No memory for bursts");
+        return ESP_FAIL;
+    }
+    if (app_burst_start(&g_burst, cam, n) != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Burst busy");
+        return ESP_FAIL;
+    }
+    
+    httpd_resp_set_type(req, "multipart/mixed; boundary=" BURST_BOUNDARY);
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    
+    char part[256];
+    burst_frame_t frame;
+    esp_err_t err = ESP_OK;
+    esp_err_t wait_err = ESP_OK;
+    uint16_t sent = 0;
+    uint32_t first_seq = 0;
+    uint32_t gaps = 0;
+    int64_t first_us = 0;
+    int64_t last_us = 0;
+    while (err == ESP_OK &&
+           (wait_err = app_burst_wait(&g_burst, sent, pdMS_TO_TICKS(BURST_FRAME_TIMEOUT_MS), &frame)) == ESP_OK) {
+        if (sent == 0) {
+            first_seq = frame.seq;
+            first_us = frame.time_us;
+        }
+        // Frames the capture path dropped before the callback show up as skipped numbers
+        gaps = frame.seq - first_seq - sent;
+        last_us = frame.time_us;
+        
+        struct iovec iov[3];
+        int iovcnt = frame_to_iov(g_burst.buf + frame.pos, frame.len, frame.dht_insert_pos, iov);
+        size_t len = 0;
+        for (int i = 0; i < iovcnt; i++) {
+            len += iov[i].iov_len;
+        }
+        int plen = snprintf(part, sizeof(part),
+                            "%s--" BURST_BOUNDARY "\r\n"
+                            "Content-Type: image/jpeg\r\n"
+                            "Content-Length: %u\r\n"
+                            "X-Burst-Index: %u\r\n"
+                            "X-Sequence: %lu\r\n"
+                            "X-Timestamp-Us: %lld\r\n"
+                            "\r\n",
+                            sent ? "\r\n" : "", (unsigned)len, sent, frame.seq, frame.time_us);
+        err = httpd_resp_send_chunk(req, part, plen);
+        for (int i = 0; i < iovcnt && err == ESP_OK; i++) {
+            err = httpd_resp_send_chunk(req, iov[i].iov_base, iov[i].iov_len);
+        }
+        sent++;
+    }
+    bool truncated = g_burst.truncated;
+    app_burst_stop(&g_burst);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Burst client went away after %u frames", sent);
+        return ESP_FAIL;
+    }
+    
+    int plen = snprintf(part, sizeof(part),
+                        "%s--" BURST_BOUNDARY "\r\n"
+                        "Content-Type: application/json\r\n"
+                        "\r\n"
+                        "{\"camera\":%u,\"requested\":%u,\"frames\":%u,\"gaps\":%lu,\"span_us\":%lld,"
+                        "\"pool_full\":%s,\"timed_out\":%s}\r\n"
+                        "--" BURST_BOUNDARY "--\r\n",
+                        sent ? "\r\n" : "", cam, n, sent, gaps, last_us - first_us,
+                        truncated ? "true" : "false", wait_err == ESP_ERR_TIMEOUT ? "true" : "false");
+    err = httpd_resp_send_chunk(req, part, plen);
+    if (err == ESP_OK) {
+        err = httpd_resp_send_chunk(req, NULL, 0);
+    }
+    return err;
+}
+
+// HTTP handler for a full-resolution still (/still, ?cam=n). The camera switches to its
+// largest still format for one frame and back; live viewers stay connected and see a
+// gap, reported as X-Outage-Ms along with the time to the still (X-Switch-Ms).
+static esp_err_t still_handler(httpd_req_t *req)
+{
+    unsigned cam = 0;
+    char query[32];
+    char value[8];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "cam", value, sizeof(value)) == ESP_OK &&
+        (sscanf(value, "%u", &cam) != 1 || cam >= APP_UVC_MAX_CAMERAS)) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "No such camera");
+        return ESP_FAIL;
+    }
+    
+    app_still_t still;
+    esp_err_t err = app_uvc_capture_still(cam, pdMS_TO_TICKS(STILL_TIMEOUT_MS), &still);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Still failed: %s", esp_err_to_name(err));
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR,
+                                   err == ESP_ERR_NOT_SUPPORTED ? "Camera accepts no still format" :
+                                   err == ESP_ERR_INVALID_STATE ? "Camera not connected or busy" : "Still failed");
+    }
+    
+    char size_hdr[16];
+    char switch_hdr[12];
+    char outage_hdr[12];
+    char time_hdr[24];
+    snprintf(size_hdr, sizeof(size_hdr), "%ux%u", still.width, still.height);
+    snprintf(switch_hdr, sizeof(switch_hdr), "%lu", still.switch_us / 1000);
+    snprintf(outage_hdr, sizeof(outage_hdr), "%lu", still.outage_us / 1000);
+    snprintf(time_hdr, sizeof(time_hdr), "%lld", still.timestamp_us);
+    httpd_resp_set_type(req, "image/jpeg");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    httpd_resp_set_hdr(req, "X-Still-Size", size_hdr);
+    httpd_resp_set_hdr(req, "X-Switch-Ms", switch_hdr);
+    httpd_resp_set_hdr(req, "X-Outage-Ms", outage_hdr);
+    httpd_resp_set_hdr(req, "X-Timestamp-Us", time_hdr);
+    
+    struct iovec iov[3];
+    int iovcnt = frame_to_iov(still.data, still.len, still.dht_insert_pos, iov);
+    for (int i = 0; i < iovcnt && err == ESP_OK; i++) {
+        err = httpd_resp_send_chunk(req, iov[i].iov_base, iov[i].iov_len);
+    }
+    if (err == ESP_OK) {
+        err = httpd_resp_send_chunk(req, NULL, 0);
+    }
+    app_uvc_release_still(cam);
+    return err;
+}
+
+// HTTP handler for the timelapse recorder (/timelapse). ?start=1 with cam, every=N
+// (frames) or interval=S (seconds), pick=first|still|sharp, format=avi|mjpeg, fps
+// (playback) and idle=1 (lowest camera rate while nobody watches); ?stop=1. Always
+// answers with the recorder state.
+static esp_err_t timelapse_handler(httpd_req_t *req)
+{
+    char query[160];
+    char value[8];
+    esp_err_t err = ESP_OK;
+    
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        if (httpd_query_key_value(query, "start", value, sizeof(value)) == ESP_OK) {
+            timelapse_config_t config = { .interval_s = 10, .pick = TIMELAPSE_PICK_FIRST, .format = TIMELAPSE_AVI, .play_fps = 25 };
+            unsigned n;
+            if (httpd_query_key_value(query, "cam", value, sizeof(value)) == ESP_OK) {
+                if (sscanf(value, "%u", &n) != 1 || n >= APP_UVC_MAX_CAMERAS) {
+                    httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "No such camera");
+                    return ESP_FAIL;
+                }
+                config.camera = n;
+            }
+            if (httpd_query_key_value(query, "every", value, sizeof(value)) == ESP_OK && sscanf(value, "%u", &n) == 1) {
+                config.every_frames = n;
+            }
+            if (httpd_query_key_value(query, "interval", value, sizeof(value)) == ESP_OK && sscanf(value, "%u", &n) == 1) {
+                config.interval_s = n;
+            }
+            if (httpd_query_key_value(query, "fps", value, sizeof(value)) == ESP_OK && sscanf(value, "%u", &n) == 1) {
+                config.play_fps = (n > 0 && n <= 120) ? n : 0;
+            }
+            if (httpd_query_key_value(query, "pick", value, sizeof(value)) == ESP_OK) {
+                config.pick = strcmp(value, "still") == 0 ? TIMELAPSE_PICK_STILL :
+                              strcmp(value, "sharp") == 0 ? TIMELAPSE_PICK_SHARP : TIMELAPSE_PICK_FIRST;
+            }
+            if (httpd_query_key_value(query, "format", value, sizeof(value)) == ESP_OK) {
+                config.format = strcmp(value, "mjpeg") == 0 ? TIMELAPSE_MJPEG : TIMELAPSE_AVI;
+            }
+            config.low_rate = (httpd_query_key_value(query, "idle", value, sizeof(value)) == ESP_OK && value[0] == '1');
+            err = app_timelapse_start(&config);
+        } else if (httpd_query_key_value(query, "stop", value, sizeof(value)) == ESP_OK) {
+            err = app_timelapse_stop();
+        }
+    }
+    if (err != ESP_OK) {
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR,
+                                   err == ESP_ERR_INVALID_ARG ? "Bad timelapse settings" :
+                                   err == ESP_ERR_NO_MEM ? "Out of memory" :
+                                   !app_storage_is_mounted() ? "No SD card" :
+                                   err == ESP_ERR_INVALID_STATE ? "Recording already running or stopped" : "Timelapse failed");
+    }
+    
+    static const char *picks[] = { "first", "still", "sharp" };
+    timelapse_status_t s;
+    uint64_t total = 0;
+    uint64_t free_bytes = 0;
+    app_timelapse_get_status(&s);
+    app_storage_get_space(&total, &free_bytes);
+    
+    char json[640];
+    int n = 0;
+    json_appendf(json, sizeof(json), &n,
+                 "{\"running\":%s,\"camera\":%u,\"every\":%lu,\"interval_s\":%lu,\"pick\":\"%s\","
+                 "\"format\":\"%s\",\"fps\":%u,\"idle\":%s,\"path\":\"%s\",\"frames\":%lu,"
+                 "\"segment_frames\":%lu,\"files\":%lu,\"skipped\":%lu,\"errors\":%lu,\"bytes\":%llu,"
+                 "\"write_ms\":%lu,\"write_bytes_per_s\":%lu,\"avg_bytes_per_s\":%lu,\"syncs\":%lu,"
+                 "\"card_bytes\":%llu,\"card_free_bytes\":%llu,\"idle_pct\":[",
+                 s.running ? "true" : "false", s.config.camera, s.config.every_frames, s.config.interval_s,
+                 picks[s.config.pick], s.config.format == TIMELAPSE_MJPEG ? "mjpeg" : "avi", s.config.play_fps,
+                 s.config.low_rate ? "true" : "false", s.path, s.frames, s.segment_frames, s.files, s.skipped,
+                 s.errors, s.bytes, s.write_ms, s.write_bytes_per_s, s.avg_bytes_per_s, s.syncs, total, free_bytes);
+    for (int core = 0; core < s.num_cores; core++) {
+        json_appendf(json, sizeof(json), &n, "%s%u", core ? "," : "", s.idle_pct[core]);
+    }
+    json_appendf(json, sizeof(json), &n, "]}");
+    if (n >= (int)sizeof(json)) {
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Status too long");
+    }
+    
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    return httpd_resp_sendstr(req, json);
+}
+
+// Names that can be served: FAT 8.3 characters and directory separators, nothing
+// that climbs out of the card
+static bool clip_path_is_valid(const char *rel, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        char c = rel[i];
+        if (!isalnum((unsigned char)c) && c != '.' && c != '_' && c != '-' && c != '/') {
+            return false;
+        }
+        if (c == '.' && i > 0 && rel[i - 1] == '.') {
+            return false;
+        }
+    }
+    return true;
+}
+
+static const char *clip_content_type(const char *path)
+{
+    static const struct {
+        const char *ext;
+        const char *type;
+    } types[] = {
+        { ".avi", "video/x-msvideo" },
+        { ".mjp", "video/x-motion-jpeg" },
+        { ".jpg", "image/jpeg" },
+        { ".mp4", "video/mp4" },
+        { ".h264", "video/h264" },
+        { ".json", "application/json" },
+        { ".csv", "text/csv" },
+    };
+    const char *ext = strrchr(path, '.');
+    for (size_t i = 0; ext != NULL && i < sizeof(types) / sizeof(types[0]); i++) {
+        if (strcasecmp(ext, types[i].ext) == 0) {
+            return types[i].type;
+        }
+    }
+    return "application/octet-stream";
+}
+
+// Directory listing as JSON, one entry per chunk
+static esp_err_t clips_list(httpd_req_t *req, const char *path, const char *rel)
+{
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Cannot read directory");
+    }
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    
+    char line[160];
+    snprintf(line, sizeof(line), "{\"path\":\"%s\",\"entries\":[", rel[0] ? rel : "/");
+    esp_err_t err = httpd_resp_send_chunk(req, line, HTTPD_RESP_USE_STRLEN);
+    bool first = true;
+    struct dirent *e;
+    while (err == ESP_OK && (e = readdir(dir)) != NULL) {
+        char entry[CLIP_PATH_MAX + 16];
+        struct stat st;
+        size_t name_len = strlen(e->d_name);
+        if (e->d_name[0] == '.' || !clip_path_is_valid(e->d_name, name_len) ||
+            snprintf(entry, sizeof(entry), "%s/%s", path, e->d_name) >= (int)sizeof(entry) || stat(entry, &st) != 0) {
+            continue;
+        }
+        snprintf(line, sizeof(line), "%s{\"name\":\"%s\",\"dir\":%s,\"size\":%llu,\"mtime\":%lld}",
+                 first ? "" : ",", e->d_name, S_ISDIR(st.st_mode) ? "true" : "false",
+                 (unsigned long long)st.st_size, (long long)st.st_mtime);
+        err = httpd_resp_send_chunk(req, line, HTTPD_RESP_USE_STRLEN);
+        first = false;
+    }
+    closedir(dir);
+    if (err == ESP_OK) {
+        err = httpd_resp_send_chunk(req, "]}", 2);
+    }
+    if (err == ESP_OK) {
+        err = httpd_resp_send_chunk(req, NULL, 0);
+    }
+    return err;
+}
+
+// A download handed from the server task to its own task
+typedef struct {
+    httpd_req_t *req;       // Async copy of the request
+    int fd;
+    uint64_t first;
+    uint64_t len;
+    int headers_len;
+    char headers[512];
+    char path[CLIP_PATH_MAX];
+} clip_job_t;
+
+static void clip_task(void *arg)
+{
+    clip_job_t *job = (clip_job_t *)arg;
+    int socket_fd = httpd_req_to_sockfd(job->req);
+    clip_send_stats_t stats = { 0 };
+    esp_err_t err = send_all(socket_fd, job->headers, job->headers_len) ? ESP_OK : ESP_FAIL;
+    if (err == ESP_OK) {
+        err = app_clip_send(job->req->handle, socket_fd, job->fd, job->first, job->len, &stats);
+    }
+    close(job->fd);
+    
+    g_clip_downloads++;
+    g_clip_bytes += stats.bytes;
+    g_clip_last_kbps = stats.elapsed_us ? (uint32_t)(stats.bytes * 1000 / stats.elapsed_us) : 0;
+    ESP_LOGI(TAG, "Clip %s: %llu bytes from %llu in %lu ms (%lu KB/s), %lu KB reads: %lu ms reading, %lu ms sending",
+             job->path, stats.bytes, job->first, stats.elapsed_us / 1000, g_clip_last_kbps, stats.block / 1024,
+             stats.read_us / 1000, stats.send_us / 1000);
+    
+    httpd_req_async_handler_complete(job->req);
+    if (err != ESP_OK) {
+        // A short body leaves the connection out of step
+        httpd_sess_trigger_close(g_server, socket_fd);
+    }
+    __atomic_sub_fetch(&g_clip_active, 1, __ATOMIC_RELAXED);
+    free(job);
+    vTaskDelete(NULL);
+}
+
+// One file, whole or a single byte range. The header goes out through the socket
+// with an exact Content-Length and the body follows from app_clip_send(), both in
+// a clip task.
+static esp_err_t clips_send_file(httpd_req_t *req, const char *path, const struct stat *st)
+{
+    char etag[40];
+    char last_modified[32];
+    char value[64];
+    uint64_t size = st->st_size;
+    uint64_t first = 0;
+    uint64_t last = size ? size - 1 : 0;
+    bool partial = false;
+    
+    app_clip_validators(st, etag, sizeof(etag), last_modified, sizeof(last_modified));
+    // If-None-Match wins over If-Modified-Since when both are sent
+    bool not_modified = (httpd_req_get_hdr_value_str(req, "If-None-Match", value, sizeof(value)) == ESP_OK) ?
+        (strcmp(value, etag) == 0 || strcmp(value, "*") == 0) :
+        (httpd_req_get_hdr_value_str(req, "If-Modified-Since", value, sizeof(value)) == ESP_OK &&
+         strcmp(value, last_modified) == 0);
+    if (not_modified) {
+        httpd_resp_set_status(req, "304 Not Modified");
+        httpd_resp_set_hdr(req, "ETag", etag);
+        httpd_resp_set_hdr(req, "Last-Modified", last_modified);
+        return httpd_resp_send(req, NULL, 0);
+    }
+    
+    // A Range with a stale If-Range gets the whole (changed) file
+    char if_range[40];
+    if (httpd_req_get_hdr_value_str(req, "Range", value, sizeof(value)) == ESP_OK &&
+        (httpd_req_get_hdr_value_str(req, "If-Range", if_range, sizeof(if_range)) != ESP_OK ||
+         strcmp(if_range, etag) == 0 || strcmp(if_range, last_modified) == 0)) {
+        esp_err_t range_err = app_clip_parse_range(value, size, &first, &last);
+        if (range_err == ESP_ERR_INVALID_SIZE) {
+            char content_range[32];
+            snprintf(content_range, sizeof(content_range), "bytes */%llu", size);
+            httpd_resp_set_status(req, "416 Range Not Satisfiable");
+            httpd_resp_set_hdr(req, "Content-Range", content_range);
+            return httpd_resp_send(req, NULL, 0);
+        }
+        partial = (range_err == ESP_OK);
+    }
+    
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Cannot open file");
+    }
+    
+    clip_job_t *job = malloc(sizeof(*job));
+    if (job == NULL || __atomic_add_fetch(&g_clip_active, 1, __ATOMIC_RELAXED) > CLIP_MAX_DOWNLOADS) {
+        if (job != NULL) {
+            __atomic_sub_fetch(&g_clip_active, 1, __ATOMIC_RELAXED);
+        }
+        free(job);
+        close(fd);
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_hdr(req, "Retry-After", "5");
+        return httpd_resp_send(req, "Too many downloads", HTTPD_RESP_USE_STRLEN);
+    }
+    
+    char content_range[64] = "";
+    uint64_t len = size ? last - first + 1 : 0;
+    if (partial) {
+        snprintf(content_range, sizeof(content_range), "Content-Range: bytes %llu-%llu/%llu\r\n", first, last, size);
+    }
+    job->headers_len = snprintf(job->headers, sizeof(job->headers),
+        "HTTP/1.1 %s\r\n"
+        "Content-Type: %s\r\n"
+        "Content-Length: %llu\r\n"
+        "%s"
+        "Accept-Ranges: bytes\r\n"
+        "ETag: %s\r\n"
+        "Last-Modified: %s\r\n"
+        "Cache-Control: no-cache\r\n"
+        "Access-Control-Allow-Origin: *\r\n"
+        "\r\n",
+        partial ? "206 Partial Content" : "200 OK", clip_content_type(path), len, content_range, etag, last_modified);
+    snprintf(job->path, sizeof(job->path), "%s", path);
+    job->fd = fd;
+    job->first = first;
+    job->len = len;
+    
+    // The transfer runs in its own low-priority task, the server task goes on serving
+    job->req = NULL;
+    if (httpd_req_async_handler_begin(req, &job->req) != ESP_OK) {
+        __atomic_sub_fetch(&g_clip_active, 1, __ATOMIC_RELAXED);
+        close(fd);
+        free(job);
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Cannot keep the request");
+    }
+    if (xTaskCreate(clip_task, "clip_send", 4096, job, CLIP_TASK_PRIORITY, NULL) != pdPASS) {
+        httpd_resp_send_err(job->req, HTTPD_500_INTERNAL_SERVER_ERROR, "Cannot start the download");
+        httpd_req_async_handler_complete(job->req);
+        __atomic_sub_fetch(&g_clip_active, 1, __ATOMIC_RELAXED);
+        close(fd);
+        free(job);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+// HTTP handler for the SD card (/clips/<path>): a directory is listed as JSON, a file
+// is downloaded with Range (one range per request), ETag and Last-Modified
+static esp_err_t clips_handler(httpd_req_t *req)
+{
+    const char *rel = req->uri + strlen("/clips");
+    size_t rel_len = strcspn(rel, "?");
+    while (rel_len > 0 && rel[rel_len - 1] == '/') {
+        rel_len--;
+    }
+    if (!app_storage_is_mounted()) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "No SD card");
+        return ESP_FAIL;
+    }
+    
+    char path[CLIP_PATH_MAX];
+    struct stat st;
+    if ((rel_len > 0 && rel[0] != '/') || !clip_path_is_valid(rel, rel_len) ||
+        snprintf(path, sizeof(path), "%s%.*s", APP_STORAGE_ROOT, (int)rel_len, rel) >= (int)sizeof(path) ||
+        stat(path, &st) != 0) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "No such file");
+        return ESP_FAIL;
+    }
+    return S_ISDIR(st.st_mode) ? clips_list(req, path, path + strlen(APP_STORAGE_ROOT)) :
+                                 clips_send_file(req, path, &st);
+}
+
+static bool mosaic_session_is_active(uint32_t session)
+{
+    bool active = false;
+    if (xSemaphoreTake(g_session_mutex, pdMS_TO_TICKS(10)) == pdTRUE) {
+        active = (g_mosaic_session == session);
+        xSemaphoreGive(g_session_mutex);
+    }
+    return active;
+}
+
+static void mosaic_task_finish(uint32_t my_session, uint32_t frames_sent)
+{
+    g_mosaic_ctx.active = false;
+    if (xSemaphoreTake(g_session_mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
+        if (g_mosaic_session == my_session) {
+            g_mosaic_session = 0;
+        }
+        xSemaphoreGive(g_session_mutex);
+    }
+    ESP_LOGI(TAG, "Mosaic task terminated (sent %lu frames)", frames_sent);
+    httpd_req_t *req = g_mosaic_ctx.req;
+    g_mosaic_ctx.req = NULL;
+    viewer_request_end(req);
+    g_mosaic_task_handle = NULL;
+    vTaskDelete(NULL);
+}
+
+static void mosaic_task(void *arg)
+{
+    mosaic_context_t *ctx = (mosaic_context_t *)arg;
+    int socket_fd = ctx->socket_fd;
+    uint32_t my_session = ctx->session_id;
+    int num_tiles = ctx->cols * ctx->rows;
+    ESP_LOGI(TAG, "Mosaic task started on core %d: %ux%u cells at 1/%u", xPortGetCoreID(),
+             ctx->cols, ctx->rows, 1 << ctx->scale_shift);
+    
+    // One frame buffer per cell plus the output; in time mode buffer 0 is the live frame
+    // and the others are snapshots that shift one cell along every every_ms
+    uint8_t *frames[JPEG_MOSAIC_MAX_TILES] = {NULL};
+    size_t lens[JPEG_MOSAIC_MAX_TILES] = {0};
+    jpeg_index_t *indexes = malloc(JPEG_MOSAIC_MAX_TILES * sizeof(jpeg_index_t));
+    uint8_t *out = heap_caps_malloc(MAX_FRAME_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    bool ok = (indexes != NULL && out != NULL);
+    for (int i = 0; i < num_tiles && ok; i++) {
+        frames[i] = heap_caps_malloc(MAX_FRAME_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        ok = (frames[i] != NULL);
+    }
+    const char *headers =
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: multipart/x-mixed-replace; boundary=frame\r\n"
+        "Access-Control-Allow-Origin: *\r\n"
+        "Cache-Control: no-cache, no-store, must-revalidate\r\n"
+        "Pragma: no-cache\r\n"
+        "\r\n";
+    int flag = 1;
+    setsockopt(socket_fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    struct timeval timeout = { .tv_sec = 5, .tv_usec = 0 };
+    setsockopt(socket_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    if (!ok) {
+        ESP_LOGE(TAG, "Failed to allocate mosaic buffers");
+        ctx->active = false;
+    } else if (!send_all(socket_fd, headers, strlen(headers))) {
+        ESP_LOGE(TAG, "Failed to send headers");
+        ctx->active = false;
+    }
+    
+    uint32_t last_received[APP_UVC_MAX_CAMERAS];
+    for (int c = 0; c < APP_UVC_MAX_CAMERAS; c++) {
+        last_received[c] = g_cameras[c].frames_received;
+    }
+    uint32_t frames_sent = 0;
+    int64_t last_snapshot = esp_timer_get_time();
+    TickType_t last_wake = xTaskGetTickCount();
+    TickType_t period = pdMS_TO_TICKS(1000 / ctx->fps) ? pdMS_TO_TICKS(1000 / ctx->fps) : 1;
+    char header_buf[96];
+    
+    while (ctx->active) {
+        if (!mosaic_session_is_active(my_session)) {
+            ESP_LOGI(TAG, "Mosaic session 0x%08lX terminated by newer viewer", my_session);
+            break;
+        }
+        // Poll instead of waiting on frame_events, which belong to the per-camera viewers
+        xTaskDelayUntil(&last_wake, period);
+        bool fresh = false;
+        for (int i = 0; i < ctx->num_sources; i++) {
+            camera_t *cam = &g_cameras[ctx->sources[i]];
+            if (cam->frames_received != last_received[cam->index]) {
+                last_received[cam->index] = cam->frames_received;
+                fresh = true;
+            }
+        }
+        if (!fresh) {
+            continue;
+        }
+        
+        int64_t now = esp_timer_get_time();
+        if (ctx->every_ms != 0 && now - last_snapshot >= (int64_t)ctx->every_ms * 1000) {
+            // Oldest snapshot is recycled for the newest, which is the live frame so far
+            uint8_t *oldest = frames[num_tiles - 1];
+            for (int i = num_tiles - 1; i > 1; i--) {
+                frames[i] = frames[i - 1];
+                lens[i] = lens[i - 1];
+                indexes[i] = indexes[i - 1];
+            }
+            if (num_tiles > 1) {
+                frames[1] = oldest;
+                memcpy(frames[1], frames[0], lens[0]);
+                indexes[1] = indexes[0];
+                lens[1] = lens[0];
+            }
+            last_snapshot = now;
+        }
+        
+        jpeg_mosaic_tile_t tiles[JPEG_MOSAIC_MAX_TILES] = {0};
+        size_t in_bytes = 0;
+        for (int i = 0; i < ctx->num_sources; i++) {
+            if (ctx->every_ms == 0 || i == 0) {
+                camera_t *cam = &g_cameras[ctx->sources[i]];
+                // H.264 cameras have no JPEG to cut tiles from, their cells stay grey
+                lens[i] = (app_uvc_get_format(cam->index) == APP_FRAME_H264) ? 0 :
+                          copy_latest_frame(cam, frames[i], &indexes[i]);
+            }
+            if (lens[i] > 0) {
+                tiles[i] = (jpeg_mosaic_tile_t){ .data = frames[i], .len = lens[i], .index = &indexes[i] };
+                in_bytes += lens[i];
+            }
+        }
+        
+        jpeg_mosaic_result_t result;
+        int64_t t0 = esp_timer_get_time();
+        esp_err_t err = app_jpeg_mosaic(tiles, ctx->cols, ctx->rows, ctx->scale_shift, out, MAX_FRAME_SIZE, &result);
+        uint32_t elapsed = (uint32_t)(esp_timer_get_time() - t0);
+        if (err != ESP_OK) {
+            if (err != ESP_ERR_NOT_FOUND) {
+                app_stats_xform_fail(&g_mosaic_stats);
+            }
+            continue;
+        }
+        app_stats_xform_record(&g_mosaic_stats, result.width, result.height, in_bytes, result.len, elapsed);
+        
+        int hlen = snprintf(header_buf, sizeof(header_buf),
+            "--frame\r\n"
+            "Content-Type: image/jpeg\r\n"
+            "Content-Length: %zu\r\n\r\n",
+            result.len);
+        struct iovec iov[3] = {
+            { .iov_base = header_buf, .iov_len = hlen },
+            { .iov_base = out, .iov_len = result.len },
+            { .iov_base = "\r\n", .iov_len = 2 },
+        };
+        if (!send_iov(socket_fd, iov, 3)) {
+            break;
+        }
+        frames_sent++;
+        count_sent(hlen + result.len + 2);
+        app_stats_record(&ctx->stats, hlen + result.len + 2, esp_timer_get_time());
+    }
+    
+    for (int i = 0; i < JPEG_MOSAIC_MAX_TILES; i++) {
+        free(frames[i]);
+    }
+    free(indexes);
+    free(out);
+    mosaic_task_finish(my_session, frames_sent);
+}
+
+// HTTP handler for the mosaic stream. ?cams=0,1,... picks the camera of every cell
+// (default: each camera once), ?cam=n&every=s shows one camera now and s, 2s, ...
+// seconds ago instead. ?scale=1|2|4|8 reduces each tile (default 2), ?fps= caps the rate.
+static esp_err_t mosaic_handler(httpd_req_t *req)
+{
+    uint8_t sources[JPEG_MOSAIC_MAX_TILES];
+    int num_tiles = 0;
+    unsigned scale = 2;
+    unsigned fps = 10;
+    unsigned every = 0;
+    unsigned cam = 0;
+    bool time_mode = false;
+    
+    char query[128];
+    char value[32];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        if (httpd_query_key_value(query, "cams", value, sizeof(value)) == ESP_OK) {
+            const char *p = value;
+            unsigned c;
+            int used = 0;
+            while (sscanf(p, "%u%n", &c, &used) == 1) {
+                if (c >= APP_UVC_MAX_CAMERAS || num_tiles >= JPEG_MOSAIC_MAX_TILES) {
+                    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "cams must be up to 4 camera numbers");
+                    return ESP_FAIL;
+                }
+                sources[num_tiles++] = c;
+                p += used;
+                if (*p != ',') {
+                    break;
+                }
+                p++;
+            }
+            if (*p != '\0' || num_tiles == 0) {
+                httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "cams must be up to 4 camera numbers");
+                return ESP_FAIL;
+            }
+        }
+        if (httpd_query_key_value(query, "every", value, sizeof(value)) == ESP_OK) {
+            if (sscanf(value, "%u", &every) != 1 || every == 0 || every > 3600) {
+                httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "every must be 1-3600 seconds");
+                return ESP_FAIL;
+            }
+            time_mode = true;
+        }
+        if (httpd_query_key_value(query, "cam", value, sizeof(value)) == ESP_OK &&
+            (sscanf(value, "%u", &cam) != 1 || cam >= APP_UVC_MAX_CAMERAS)) {
+            httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "No such camera");
+            return ESP_FAIL;
+        }
+        if (httpd_query_key_value(query, "scale", value, sizeof(value)) == ESP_OK &&
+            (sscanf(value, "%u", &scale) != 1 || (scale != 1 && scale != 2 && scale != 4 && scale != 8))) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "scale must be 1, 2, 4 or 8");
+            return ESP_FAIL;
+        }
+        if (httpd_query_key_value(query, "fps", value, sizeof(value)) == ESP_OK &&
+            (sscanf(value, "%u", &fps) != 1 || fps == 0 || fps > 30)) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "fps must be 1-30");
+            return ESP_FAIL;
+        }
+    }
+    if (time_mode) {
+        num_tiles = JPEG_MOSAIC_MAX_TILES;
+        for (int i = 0; i < num_tiles; i++) {
+            sources[i] = cam;
+        }
+    } else if (num_tiles == 0) {
+        for (int i = 0; i < APP_UVC_MAX_CAMERAS && i < JPEG_MOSAIC_MAX_TILES; i++) {
+            sources[num_tiles++] = i;
+        }
+    }
+    
+    if (xSemaphoreTake(g_stream_start_mutex, pdMS_TO_TICKS(5000)) != pdTRUE) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Stream busy");
+        return ESP_FAIL;
+    }
+    
+    if (g_mosaic_task_handle != NULL) {
+        g_mosaic_ctx.active = false;
+        int wait_count = 0;
+        while (g_mosaic_task_handle != NULL && wait_count < 200) {
+            vTaskDelay(pdMS_TO_TICKS(10));
+            wait_count++;
+        }
+        if (g_mosaic_task_handle != NULL) {
+            vTaskDelete(g_mosaic_task_handle);
+            g_mosaic_task_handle = NULL;
+            viewer_request_end(g_mosaic_ctx.req);
+            g_mosaic_ctx.req = NULL;
+        }
+    }
+    
+    uint32_t my_session = 0;
+    if (xSemaphoreTake(g_session_mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
+        my_session = generate_session_token();
+        g_mosaic_session = my_session;
+        xSemaphoreGive(g_session_mutex);
+    } else {
+        xSemaphoreGive(g_stream_start_mutex);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Session manager busy");
+        return ESP_FAIL;
+    }
+    
+    httpd_req_t *async = NULL;
+    if (httpd_req_async_handler_begin(req, &async) != ESP_OK) {
+        xSemaphoreGive(g_stream_start_mutex);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Cannot keep the request");
+        return ESP_FAIL;
+    }
+    mosaic_context_t *ctx = &g_mosaic_ctx;
+    ctx->req = async;
+    ctx->socket_fd = httpd_req_to_sockfd(async);
+    ctx->session_id = my_session;
+    ctx->cols = num_tiles > 2 ? 2 : num_tiles;
+    ctx->rows = (num_tiles + ctx->cols - 1) / ctx->cols;
+    ctx->scale_shift = (scale == 8) ? 3 : (scale == 4) ? 2 : (scale == 2) ? 1 : 0;
+    ctx->fps = fps;
+    ctx->every_ms = every * 1000;
+    ctx->num_sources = num_tiles;
+    memcpy(ctx->sources, sources, num_tiles);
+    app_stats_reset(&ctx->stats);
+    ctx->active = true;
+    
+    BaseType_t ret = xTaskCreatePinnedToCore(
+        mosaic_task,
+        "mosaic_task",
+        8192,
+        ctx,
+        STREAM_TASK_PRIORITY,
+        &g_mosaic_task_handle,
+        STREAM_TASK_CORE
+    );
+    
+    if (ret != pdPASS) {
+        ctx->active = false;
+        ctx->req = NULL;
+        xSemaphoreGive(g_stream_start_mutex);
+        httpd_resp_send_err(async, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to start mosaic");
+        httpd_req_async_handler_complete(async);
+        return ESP_FAIL;
+    }
+    
+    xSemaphoreGive(g_stream_start_mutex);
+    return ESP_OK;
+}
+
+static bool delta_session_is_active(uint32_t session)
+{
+    bool active = false;
+    if (xSemaphoreTake(g_session_mutex, pdMS_TO_TICKS(10)) == pdTRUE) {
+        active = (g_delta_session == session);
+        xSemaphoreGive(g_session_mutex);
+    }
+    return active;
+}
+
+static void delta_task(void *arg)
+{
+    delta_context_t *ctx = (delta_context_t *)arg;
+    camera_t *cam = &g_cameras[ctx->camera];
+    uint32_t my_session = ctx->session_id;
+    ESP_LOGI(TAG, "Camera %u: delta task started on core %d", cam->index, xPortGetCoreID());
+    
+    const size_t out_cap = MAX_FRAME_SIZE + DELTA_HEADROOM;
+    uint8_t *frame = heap_caps_malloc(MAX_FRAME_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    uint8_t *out = heap_caps_malloc(out_cap, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    jpeg_index_t *index = malloc(sizeof(jpeg_index_t));
+    if (frame == NULL || out == NULL || index == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate delta buffers");
+        ctx->active = false;
+    }
+    
+    uint32_t frames_sent = 0;
+    uint32_t last_received = cam->frames_received - 1;  // Start with the frame at hand
+    int64_t last_key = 0;
+    
+    while (ctx->active) {
+        if (!delta_session_is_active(my_session)) {
+            ESP_LOGI(TAG, "Delta session 0x%08lX terminated by newer viewer", my_session);
+            break;
+        }
+        httpd_ws_client_info_t client = httpd_ws_get_fd_info(ctx->server, ctx->socket_fd);
+        if (client == HTTPD_WS_CLIENT_INVALID) {
+            break;
+        }
+        // frame_events belong to the camera's own viewer, the frame store gives
+        // frame_ready as well; the timeout rechecks the session and the socket
+        if (client != HTTPD_WS_CLIENT_WEBSOCKET || cam->frames_received == last_received ||
+            app_uvc_get_format(cam->index) == APP_FRAME_H264) {
+            xSemaphoreTake(ctx->frame_ready, pdMS_TO_TICKS(DELTA_WAIT_MS));
+            continue;
+        }
+        last_received = cam->frames_received;
+        size_t len = copy_latest_frame(cam, frame, index);
+        if (len == 0) {
+            continue;
+        }
+        
+        int64_t now = esp_timer_get_time();
+        bool key = ctx->want_key || now - last_key >= (int64_t)ctx->key_ms * 1000;
+        ctx->want_key = false;
+        jpeg_delta_result_t result;
+        int64_t t0 = esp_timer_get_time();
+        esp_err_t err = app_jpeg_delta(frame, len, index, &ctx->ref, key, out, out_cap, &result);
+        if (err == ESP_ERR_INVALID_SIZE && !key) {
+            // Many small bands cost more than the frame, send it whole
+            err = app_jpeg_delta(frame, len, index, &ctx->ref, true, out, out_cap, &result);
+        }
+        uint32_t elapsed = (uint32_t)(esp_timer_get_time() - t0);
+        if (err != ESP_OK) {
+            app_stats_xform_fail(&g_delta_stats);
+            continue;
+        }
+        app_stats_xform_record(&g_delta_stats, index->width, index->height, len, result.len, elapsed);
+        if (result.len == 0) {
+            ctx->unchanged++;
+            continue;
+        }
+        if (result.key) {
+            last_key = now;
+            ctx->keyframes++;
+        } else {
+            ctx->deltas++;
+        }
+        
+        httpd_ws_frame_t ws_frame = {
+            .final = true,
+            .type = HTTPD_WS_TYPE_BINARY,
+            .payload = out,
+            .len = result.len,
+        };
+        if (httpd_ws_send_frame_async(ctx->server, ctx->socket_fd, &ws_frame) != ESP_OK) {
+            break;
+        }
+        frames_sent++;
+        count_sent(result.len);
+        app_stats_record(&ctx->stats, result.len, esp_timer_get_time());
+    }
+    
+    free(frame);
+    free(out);
+    free(index);
+    ctx->active = false;
+    if (xSemaphoreTake(g_session_mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
+        if (g_delta_session == my_session) {
+            g_delta_session = 0;
+        }
+        xSemaphoreGive(g_session_mutex);
+    }
+    ESP_LOGI(TAG, "Camera %u: delta task terminated (sent %lu updates)", cam->index, frames_sent);
+    g_delta_task_handle = NULL;
+    vTaskDelete(NULL);
+}
+
+// WebSocket handler for delta streaming. The handshake starts the viewer task
+// (?cam=n, ?key=s keyframe period in seconds, default 10); afterwards the client
+// sends "key" when a band failed to decode.
+static esp_err_t delta_handler(httpd_req_t *req)
+{
+    if (req->method != HTTP_GET) {
+        httpd_ws_frame_t frame = {0};
+        uint8_t buf[8];
+        esp_err_t err = httpd_ws_recv_frame(req, &frame, 0);
+        if (err != ESP_OK || frame.len >= sizeof(buf)) {
+            return err != ESP_OK ? err : ESP_ERR_INVALID_SIZE;
+        }
+        frame.payload = buf;
+        err = httpd_ws_recv_frame(req, &frame, sizeof(buf));
+        if (err == ESP_OK && frame.type == HTTPD_WS_TYPE_TEXT && frame.len == 3 && memcmp(buf, "key", 3) == 0 &&
+            httpd_req_to_sockfd(req) == g_delta_ctx.socket_fd) {
+            g_delta_ctx.want_key = true;
+        }
+        return err;
+    }
+    
+    unsigned cam = 0;
+    unsigned key_s = 10;
+    char query[64];
+    char value[16];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        if (httpd_query_key_value(query, "cam", value, sizeof(value)) == ESP_OK &&
+            (sscanf(value, "%u", &cam) != 1 || cam >= APP_UVC_MAX_CAMERAS)) {
+            httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "No such camera");
+            return ESP_FAIL;
+        }
+        if (httpd_query_key_value(query, "key", value, sizeof(value)) == ESP_OK &&
+            (sscanf(value, "%u", &key_s) != 1 || key_s == 0 || key_s > 3600)) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "key must be 1-3600 seconds");
+            return ESP_FAIL;
+        }
+    }
+    
+    if (xSemaphoreTake(g_stream_start_mutex, pdMS_TO_TICKS(5000)) != pdTRUE) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Stream busy");
+        return ESP_FAIL;
+    }
+    
+    if (g_delta_task_handle != NULL) {
+        g_delta_ctx.active = false;
+        int wait_count = 0;
+        while (g_delta_task_handle != NULL && wait_count < 200) {
+            vTaskDelay(pdMS_TO_TICKS(10));
+            wait_count++;
+        }
+        if (g_delta_task_handle != NULL) {
+            vTaskDelete(g_delta_task_handle);
+            g_delta_task_handle = NULL;
+        }
+    }
+    
+    uint32_t my_session = 0;
+    if (xSemaphoreTake(g_session_mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
+        my_session = generate_session_token();
+        g_delta_session = my_session;
+        xSemaphoreGive(g_session_mutex);
+    } else {
+        xSemaphoreGive(g_stream_start_mutex);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Session manager busy");
+        return ESP_FAIL;
+    }
+    
+    delta_context_t *ctx = &g_delta_ctx;
+    ctx->server = req->handle;
+    ctx->socket_fd = httpd_req_to_sockfd(req);
+    ctx->session_id = my_session;
+    ctx->want_key = false;
+    ctx->camera = cam;
+    ctx->key_ms = key_s * 1000;
+    memset(&ctx->ref, 0, sizeof(ctx->ref));
+    ctx->keyframes = 0;
+    ctx->deltas = 0;
+    ctx->unchanged = 0;
+    app_stats_reset(&ctx->stats);
+    ctx->active = true;
+    
+    // The task waits for the handshake to finish before sending
+    BaseType_t ret = xTaskCreatePinnedToCore(
+        delta_task,
+        "delta_task",
+        8192,
+        ctx,
+        STREAM_TASK_PRIORITY,
+        &g_delta_task_handle,
+        STREAM_TASK_CORE
+    );
+    xSemaphoreGive(g_stream_start_mutex);
+    if (ret != pdPASS) {
+        ctx->active = false;
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to start delta stream");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t app_http_init(void)
+{
+    ESP_LOGI(TAG, "Initializing HTTP streaming server");
+    
+    for (uint8_t c = 0; c < APP_UVC_MAX_CAMERAS; c++) {
+        camera_t *cam = &g_cameras[c];
+        cam->index = c;
+        for (int i = 0; i < 2; i++) {
+            cam->frame_buffer[i].buffer = heap_caps_malloc(MAX_FRAME_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+            if (cam->frame_buffer[i].buffer == NULL) {
+                cam->frame_buffer[i].buffer = malloc(MAX_FRAME_SIZE);
+                if (cam->frame_buffer[i].buffer == NULL) {
+                    return ESP_ERR_NO_MEM;
+                }
+            }
+            cam->frame_buffer[i].len = 0;
+            cam->frame_buffer[i].ready = false;
+        }
+        cam->frame_mutex = xSemaphoreCreateMutex();
+        cam->frame_events = xEventGroupCreate();
+        if (!cam->frame_mutex || !cam->frame_events || app_h264_gop_init(&cam->h264_gop, H264_GOP_CAP) != ESP_OK ||
+            app_frame_ring_init(&cam->ring, FRAME_RING_BUDGET, PSRAM_VIEWER_RESERVE) != ESP_OK) {
+            return ESP_ERR_NO_MEM;
+        }
+        app_stats_init(&cam->stream_ctx.stats);
+    }
+    app_stats_init(&g_mosaic_ctx.stats);
+    app_stats_init(&g_delta_ctx.stats);
+    if (BURST_POOL_SIZE == 0) {
+        ESP_LOGI(TAG, "Bursts off (APP_BURST_POOL_KB)");
+    } else if (app_burst_init(&g_burst, BURST_POOL_SIZE, PSRAM_VIEWER_RESERVE) != ESP_OK) {
+        ESP_LOGW(TAG, "No memory reserved for bursts");
+    } else {
+        ESP_LOGI(TAG, "Burst pool: %u bytes", (unsigned)g_burst.cap);
+    }
+    
+    g_session_mutex = xSemaphoreCreateMutex();
+    g_stream_start_mutex = xSemaphoreCreateMutex();
+    g_events_mutex = xSemaphoreCreateMutex();
+    g_delta_ctx.frame_ready = xSemaphoreCreateBinary();
+    for (size_t i = 0; i < sizeof(g_xform_stats) / sizeof(g_xform_stats[0]); i++) {
+        app_stats_xform_init(g_xform_stats[i].stats);
+    }
+    
+    if (!g_session_mutex || !g_stream_start_mutex || !g_events_mutex || !g_delta_ctx.frame_ready) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreate(events_task, "events", 6144, NULL, tskIDLE_PRIORITY + 2, NULL) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    
+    esp_err_t ret = app_uvc_register_frame_callback(frame_received_callback, NULL);
+    if (ret != ESP_OK) return ret;
+    
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = 80;
+    config.ctrl_port = 32768;
+    config.max_uri_handlers = 20;
+    config.uri_match_fn = httpd_uri_match_wildcard;
+    // Stream, mosaic, delta and events viewers each hold a socket next to the requests
+    config.max_open_sockets = 12;
+    config.lru_purge_enable = true;
+    config.stack_size = 6144;
+    config.send_wait_timeout = 5;
+    config.recv_wait_timeout = 5;
+    
+    httpd_handle_t server = NULL;
+#if CONFIG_APP_HTTPS
+    // The handshake runs on the server task and needs the larger stack
+    httpd_ssl_config_t ssl_config = HTTPD_SSL_CONFIG_DEFAULT();
+    config.stack_size = 10240;
+    ssl_config.httpd = config;
+    ssl_config.servercert = servercert_pem_start;
+    ssl_config.servercert_len = servercert_pem_end - servercert_pem_start;
+    ssl_config.prvtkey_pem = prvtkey_pem_start;
+    ssl_config.prvtkey_len = prvtkey_pem_end - prvtkey_pem_start;
+    ssl_config.session_tickets = true;
+    ret = httpd_ssl_start(&server, &ssl_config);
+#else
+    ret = httpd_start(&server, &config);
+#endif
+    if (ret != ESP_OK) return ret;
+    g_server = server;
+    
+    for (size_t i = 0; i < sizeof(g_assets) / sizeof(g_assets[0]); i++) {
+        web_asset_t *asset = &g_assets[i];
+        snprintf(asset->etag, sizeof(asset->etag), "\"%08lx\"",
+                 fnv1a((const char *)asset->start, asset->end - asset->start));
+        httpd_uri_t asset_uri = { .uri = asset->uri, .method = HTTP_GET, .handler = asset_handler, .user_ctx = asset };
+        httpd_register_uri_handler(server, &asset_uri);
+    }
+    
+    httpd_uri_t stream_uri = { .uri = "/stream", .method = HTTP_GET, .handler = stream_handler, .user_ctx = NULL };
     httpd_register_uri_handler(server, &stream_uri);
     
+    httpd_uri_t stream_h264_uri = { .uri = "/stream.h264", .method = HTTP_GET, .handler = stream_handler, .user_ctx = (void *)STREAM_H264 };
+    httpd_register_uri_handler(server, &stream_h264_uri);
+    
+    httpd_uri_t stream_mp4_uri = { .uri = "/stream.mp4", .method = HTTP_GET, .handler = stream_handler, .user_ctx = (void *)STREAM_FMP4 };
+    httpd_register_uri_handler(server, &stream_mp4_uri);
+    
+    httpd_uri_t cam_stream_uri = { .uri = "/cam/*", .method = HTTP_GET, .handler = cam_stream_handler, .user_ctx = NULL };
+    httpd_register_uri_handler(server, &cam_stream_uri);
+    
     httpd_uri_t stats_uri = { .uri = "/stats", .method = HTTP_GET, .handler = stats_handler, .user_ctx = NULL };
     httpd_register_uri_handler(server, &stats_uri);
     
+    httpd_uri_t history_uri = { .uri = "/stats/history", .method = HTTP_GET, .handler = history_handler, .user_ctx = NULL };
+    httpd_register_uri_handler(server, &history_uri);
+    
+    httpd_uri_t events_uri = { .uri = "/events", .method = HTTP_GET, .handler = events_handler, .user_ctx = NULL };
+    httpd_register_uri_handler(server, &events_uri);
+    
+    httpd_uri_t decode_uri = { .uri = "/decode", .method = HTTP_GET, .handler = decode_handler, .user_ctx = NULL };
+    httpd_register_uri_handler(server, &decode_uri);
+    
+    httpd_uri_t encode_uri = { .uri = "/encode", .method = HTTP_GET, .handler = encode_handler, .user_ctx = NULL };
+    httpd_register_uri_handler(server, &encode_uri);
+    
+    httpd_uri_t codec_uri = { .uri = "/codec", .method = HTTP_GET, .handler = codec_handler, .user_ctx = NULL };
+    httpd_register_uri_handler(server, &codec_uri);
+    
+    httpd_uri_t mosaic_uri = { .uri = "/mosaic", .method = HTTP_GET, .handler = mosaic_handler, .user_ctx = NULL };
+    httpd_register_uri_handler(server, &mosaic_uri);
+    
+    httpd_uri_t delta_uri = { .uri = "/delta", .method = HTTP_GET, .handler = delta_handler, .user_ctx = NULL, .is_websocket = true };
+    httpd_register_uri_handler(server, &delta_uri);
+    
+    httpd_uri_t burst_uri = { .uri = "/burst", .method = HTTP_GET, .handler = burst_handler, .user_ctx = NULL };
+    httpd_register_uri_handler(server, &burst_uri);
+    
+    httpd_uri_t still_uri = { .uri = "/still", .method = HTTP_GET, .handler = still_handler, .user_ctx = NULL };
+    httpd_register_uri_handler(server, &still_uri);
+    
+    httpd_uri_t timelapse_uri = { .uri = "/timelapse", .method = HTTP_GET, .handler = timelapse_handler, .user_ctx = NULL };
+    httpd_register_uri_handler(server, &timelapse_uri);
+    
+    httpd_uri_t clips_uri = { .uri = "/clips*", .method = HTTP_GET, .handler = clips_handler, .user_ctx = NULL };
+    httpd_register_uri_handler(server, &clips_uri);
+    
     ESP_LOGI(TAG, "HTTP server started successfully");
     return ESP_OK;
+}
+
+void app_http_get_counters(http_counters_t *out)
+{
+    out->frames_sent = __atomic_load_n(&g_frames_sent, __ATOMIC_RELAXED);
+    out->bytes_sent = __atomic_load_n(&g_bytes_sent, __ATOMIC_RELAXED);
+    out->viewers = 0;
+    for (int i = 0; i < APP_UVC_MAX_CAMERAS; i++) {
+        out->viewers += (g_cameras[i].stream_task_handle != NULL) ? 1 : 0;
+    }
+    out->viewers += (g_mosaic_task_handle != NULL) ? 1 : 0;
+    out->viewers += (g_delta_task_handle != NULL) ? 1 : 0;
 }
\ No newline at end of file
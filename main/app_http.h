@@ -1,6 +1,7 @@
 #pragma once
 
 #include "esp_err.h"
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -15,6 +16,22 @@ extern "C" {
  */
 esp_err_t app_http_init(void);
 
+/**
+ * @brief Lifetime output counters of the streaming module
+ */
+typedef struct {
+    uint32_t frames_sent;
+    uint64_t bytes_sent;
+    uint32_t viewers;
+} http_counters_t;
+
+/**
+ * @brief Get the output counters
+ * 
+ * @param out Counters to fill
+ */
+void app_http_get_counters(http_counters_t *out);
+
 #ifdef __cplusplus
 }
 #endif
\ No newline at end of file
@@ -0,0 +1,172 @@
+#include "app_jpeg.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+const uint8_t app_jpeg_std_dht[JPEG_STD_DHT_LEN] = {
+    0xFF, JPEG_MARKER_DHT, 0x01, 0xA2,
+    // Luminance DC, class 0 id 0
+    0x00,
+    0x00, 0x01, 0x05, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B,
+    // Chrominance DC, class 0 id 1
+    0x01,
+    0x00, 0x03, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B,
+    // Luminance AC, class 1 id 0
+    0x10,
+    0x00, 0x02, 0x01, 0x03, 0x03, 0x02, 0x04, 0x03, 0x05, 0x05, 0x04, 0x04, 0x00, 0x00, 0x01, 0x7D,
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xA1, 0x08, 0x23, 0x42, 0xB1, 0xC1, 0x15, 0x52, 0xD1, 0xF0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0A, 0x16, 0x17, 0x18, 0x19, 0x1A, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2A, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7,
+    0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3, 0xC4, 0xC5,
+    0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA, 0xE1, 0xE2,
+    0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xF1, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8,
+    0xF9, 0xFA,
+    // Chrominance AC, class 1 id 1
+    0x11,
+    0x00, 0x02, 0x01, 0x02, 0x04, 0x04, 0x03, 0x04, 0x07, 0x05, 0x04, 0x04, 0x00, 0x01, 0x02, 0x77,
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xA1, 0xB1, 0xC1, 0x09, 0x23, 0x33, 0x52, 0xF0,
+    0x15, 0x62, 0x72, 0xD1, 0x0A, 0x16, 0x24, 0x34, 0xE1, 0x25, 0xF1, 0x17, 0x18, 0x19, 0x1A, 0x26,
+    0x27, 0x28, 0x29, 0x2A, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5,
+    0xA6, 0xA7, 0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3,
+    0xC4, 0xC5, 0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA,
+    0xE2, 0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8,
+    0xF9, 0xFA,
+};
+
+const uint8_t app_jpeg_zigzag[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10,
+    17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34,
+    27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36,
+    29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46,
+    53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+static void index_add_rst(jpeg_index_t *index, uint32_t pos)
+{
+    index->rst_total++;
+    if (index->rst_total % index->rst_stride != 0) {
+        return;
+    }
+    if (index->num_rst == JPEG_INDEX_MAX_RST) {
+        // Keep every second entry and record half as often from now on
+        for (int i = 0; i < JPEG_INDEX_MAX_RST / 2; i++) {
+            index->rst_pos[i] = index->rst_pos[2 * i + 1];
+        }
+        index->num_rst = JPEG_INDEX_MAX_RST / 2;
+        index->rst_stride *= 2;
+        if (index->rst_total % index->rst_stride != 0) {
+            return;
+        }
+    }
+    index->rst_pos[index->num_rst++] = pos;
+}
+
+esp_err_t app_jpeg_build_index(const uint8_t *data, size_t len, jpeg_index_t *index)
+{
+    // Only the fixed part, rst_pos is filled as markers are found
+    memset(index, 0, offsetof(jpeg_index_t, rst_pos));
+    index->rst_stride = 1;
+
+    if (len < 4 || data[0] != 0xFF || data[1] != JPEG_MARKER_SOI) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+
+    size_t pos = 2;
+    while (true) {
+        if (pos + 4 > len || data[pos] != 0xFF) {
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+        uint8_t marker = data[pos + 1];
+        if (marker == 0xFF) {
+            // Fill byte in front of a marker
+            pos++;
+            continue;
+        }
+        if (marker == JPEG_MARKER_EOI) {
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+        size_t seg_len = ((size_t)data[pos + 2] << 8) | data[pos + 3];
+        if (seg_len < 2 || pos + 2 + seg_len > len) {
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+
+        if (marker == JPEG_MARKER_SOS) {
+            index->sos_pos = pos;
+            index->scan_pos = pos + 2 + seg_len;
+            break;
+        } else if (marker == JPEG_MARKER_DQT) {
+            if (index->num_dqt < JPEG_INDEX_MAX_SEGS) {
+                index->dqt_pos[index->num_dqt++] = pos;
+            }
+        } else if (marker == JPEG_MARKER_DHT) {
+            if (index->num_dht < JPEG_INDEX_MAX_SEGS) {
+                index->dht_pos[index->num_dht++] = pos;
+            }
+        } else if (marker == JPEG_MARKER_DRI) {
+            if (seg_len < 4) {
+                return ESP_ERR_INVALID_RESPONSE;
+            }
+            index->dri_pos = pos;
+            index->restart_interval = (data[pos + 4] << 8) | data[pos + 5];
+        } else if (marker >= JPEG_MARKER_SOF0 && marker <= 0xCF && marker != 0xC8 && marker != 0xCC) {
+            // Any SOFn (DHT, JPG and DAC excluded above and here)
+            if (seg_len < 8) {
+                return ESP_ERR_INVALID_RESPONSE;
+            }
+            index->sof_pos = pos;
+            index->sof_marker = marker;
+            index->height = (data[pos + 5] << 8) | data[pos + 6];
+            index->width = (data[pos + 7] << 8) | data[pos + 8];
+            index->num_components = data[pos + 9];
+            if (seg_len >= 11 && index->num_components > 0) {
+                index->sampling = data[pos + 11];
+            }
+        }
+        pos += 2 + seg_len;
+    }
+
+    if (index->sof_pos == 0) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+
+    // Entropy-coded data: 0xFF is always followed by 0x00 (stuffing), RSTn, fill or a marker
+    pos = index->scan_pos;
+    while (pos < len) {
+        const uint8_t *ff = memchr(&data[pos], 0xFF, len - pos);
+        if (ff == NULL) {
+            break;
+        }
+        pos = ff - data;
+        if (pos + 1 >= len) {
+            break;
+        }
+        uint8_t marker = data[pos + 1];
+        if (marker == 0x00 || marker == 0xFF) {
+            pos += (marker == 0x00) ? 2 : 1;
+        } else if (marker >= JPEG_MARKER_RST0 && marker <= JPEG_MARKER_RST7) {
+            index_add_rst(index, pos);
+            pos += 2;
+        } else if (marker == JPEG_MARKER_EOI) {
+            index->eoi_pos = pos;
+            return ESP_OK;
+        } else {
+            // Another scan or garbage: the frame ends here as far as we are concerned
+            break;
+        }
+    }
+    return ESP_ERR_INVALID_SIZE;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "esp_err.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// JPEG markers used by the pipeline
+#define JPEG_MARKER_SOF0    0xC0
+#define JPEG_MARKER_SOF1    0xC1
+#define JPEG_MARKER_SOF2    0xC2
+#define JPEG_MARKER_DHT     0xC4
+#define JPEG_MARKER_RST0    0xD0
+#define JPEG_MARKER_RST7    0xD7
+#define JPEG_MARKER_SOI     0xD8
+#define JPEG_MARKER_EOI     0xD9
+#define JPEG_MARKER_SOS     0xDA
+#define JPEG_MARKER_DQT     0xDB
+#define JPEG_MARKER_DRI     0xDD
+#define JPEG_MARKER_APP0    0xE0
+
+// Size of the standard DHT segment, including marker and length
+#define JPEG_STD_DHT_LEN    420
+
+/**
+ * @brief Complete DHT segment with the four standard tables of ITU T.81 Annex K.3
+ *
+ * This is what MJPEG decoders assume when a frame carries no tables of its own.
+ */
+extern const uint8_t app_jpeg_std_dht[JPEG_STD_DHT_LEN];
+
+/**
+ * @brief Natural (row-major) position of each coefficient in zigzag order
+ */
+extern const uint8_t app_jpeg_zigzag[64];
+
+// Restart markers recorded per frame. Frames with more markers keep every
+// n-th one (rst_stride), which still gives evenly spaced entry points.
+#define JPEG_INDEX_MAX_RST  256
+#define JPEG_INDEX_MAX_SEGS 4
+
+/**
+ * @brief Structure of one JPEG frame, built once at ingest
+ *
+ * All positions are byte offsets of the marker (0xFF) from the start of the frame,
+ * 0 when the segment is absent (offset 0 is always SOI).
+ */
+typedef struct {
+    uint16_t width;
+    uint16_t height;
+    uint8_t sof_marker;                         // SOFn marker code, 0 if none
+    uint8_t num_components;
+    uint8_t sampling;                           // H << 4 | V of the first component
+    uint8_t num_dqt;
+    uint8_t num_dht;
+    uint16_t restart_interval;                  // From DRI, in MCUs
+    uint32_t sof_pos;
+    uint32_t dri_pos;
+    uint32_t sos_pos;
+    uint32_t scan_pos;                          // First byte of entropy-coded data
+    uint32_t eoi_pos;
+    uint32_t dqt_pos[JPEG_INDEX_MAX_SEGS];
+    uint32_t dht_pos[JPEG_INDEX_MAX_SEGS];
+    uint16_t num_rst;                           // Entries in rst_pos
+    uint16_t rst_stride;                        // rst_pos[i] is restart marker number (i + 1) * rst_stride
+    uint32_t rst_total;                         // Restart markers in the scan
+    uint32_t rst_pos[JPEG_INDEX_MAX_RST];
+} jpeg_index_t;
+
+/**
+ * @brief Parse the marker structure of a frame
+ *
+ * Header segments are walked by their length fields; the entropy-coded data is
+ * only searched for 0xFF bytes (memchr) to locate restart markers and EOI.
+ *
+ * @param data JPEG frame
+ * @param len Length of the frame in bytes
+ * @param[out] index Frame structure
+ * @return ESP_OK if the frame has SOI, SOF, SOS and EOI;
+ *         ESP_ERR_INVALID_SIZE if the scan ends without EOI (index is filled up to there);
+ *         ESP_ERR_INVALID_RESPONSE if the header is malformed
+ */
+esp_err_t app_jpeg_build_index(const uint8_t *data, size_t len, jpeg_index_t *index);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,327 @@
+#include "app_jpeg_codec.h"
+#include "app_jpeg_decode.h"
+#include "app_jpeg_encode.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "soc/soc_caps.h"
+
+static const char *TAG = "app_jpeg_codec";
+
+#if SOC_JPEG_CODEC_SUPPORTED
+extern const jpeg_codec_t app_jpeg_codec_hw;    // app_jpeg_codec_hw.c
+#endif
+
+static const jpeg_codec_t *g_codecs[2];
+static size_t g_num_codecs = 0;
+static const jpeg_codec_t *volatile g_selected = NULL;
+
+static uint8_t *alloc_psram(size_t size)
+{
+    uint8_t *p = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    return p ? p : malloc(size);
+}
+
+// ============================================================================
+// Software backend
+// ============================================================================
+
+static esp_err_t sw_init(void)
+{
+    esp_err_t err = app_jpeg_decode_init();
+    return err == ESP_OK ? app_jpeg_encode_init() : err;
+}
+
+static esp_err_t sw_decode(const uint8_t *in, size_t len, const jpeg_index_t *index, uint8_t scale_shift,
+                           jpeg_codec_image_t *out, size_t out_cap)
+{
+    static const jpeg_decode_format_t formats[] = {
+        [JPEG_CODEC_GRAY] = JPEG_DECODE_GRAY,
+        [JPEG_CODEC_YUY2] = JPEG_DECODE_YUY2,
+        [JPEG_CODEC_RGB888] = JPEG_DECODE_RGB888,
+    };
+    const jpeg_decode_config_t config = { .format = formats[out->format], .scale_shift = scale_shift };
+    jpeg_decode_result_t result;
+    esp_err_t err = app_jpeg_decode(in, len, index, &config, out->data, out_cap, &result);
+    if (err == ESP_OK) {
+        out->width = result.width;
+        out->height = result.height;
+    }
+    return err;
+}
+
+static esp_err_t sw_encode(const jpeg_codec_image_t *in, uint8_t quality, uint8_t *out, size_t out_cap,
+                           size_t *out_len)
+{
+    if (in->format != JPEG_CODEC_YUY2) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    const jpeg_encode_config_t config = { .quality = quality, .max_workers = 0 };
+    jpeg_encode_result_t result;
+    esp_err_t err = app_jpeg_encode_yuy2(in->data, in->width, in->height, &config, out, out_cap, &result);
+    if (err == ESP_OK) {
+        *out_len = result.len;
+    }
+    return err;
+}
+
+/*
+ * Area average when shrinking, nearest sample when growing. YUY2 luma is averaged
+ * like gray; chroma is taken from the nearest source pixel pair.
+ */
+static esp_err_t sw_scale(const jpeg_codec_image_t *in, jpeg_codec_image_t *out)
+{
+    if (in->format != out->format || in->width == 0 || in->height == 0) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    int bpp = app_jpeg_codec_image_size(1, 1, in->format);
+    int channels = (in->format == JPEG_CODEC_YUY2) ? 1 : bpp;
+
+    for (int y = 0; y < out->height; y++) {
+        int y0 = y * in->height / out->height;
+        int y1 = (y + 1) * in->height / out->height;
+        y1 = y1 > y0 ? y1 : y0 + 1;
+        uint8_t *dst = out->data + (size_t)y * out->width * bpp;
+        for (int x = 0; x < out->width; x++) {
+            int x0 = x * in->width / out->width;
+            int x1 = (x + 1) * in->width / out->width;
+            x1 = x1 > x0 ? x1 : x0 + 1;
+            int area = (x1 - x0) * (y1 - y0);
+            for (int c = 0; c < channels; c++) {
+                uint32_t sum = 0;
+                for (int sy = y0; sy < y1; sy++) {
+                    const uint8_t *src = in->data + ((size_t)sy * in->width + x0) * bpp + c;
+                    for (int sx = x0; sx < x1; sx++, src += bpp) {
+                        sum += *src;
+                    }
+                }
+                dst[x * bpp + c] = (sum + area / 2) / area;
+            }
+            if (in->format == JPEG_CODEC_YUY2) {
+                // Cb for even output pixels, Cr for odd ones, from the pair holding x0
+                const uint8_t *pair = in->data + ((size_t)y0 * in->width + (x0 & ~1)) * 2;
+                dst[x * 2 + 1] = (x & 1) && (x0 | 1) < in->width ? pair[3] : pair[1];
+            }
+        }
+    }
+    return ESP_OK;
+}
+
+static const jpeg_codec_t g_sw_codec = {
+    .name = "sw",
+    .init = sw_init,
+    .decode = sw_decode,
+    .encode = sw_encode,
+    .scale = sw_scale,
+};
+
+// ============================================================================
+// Registry
+// ============================================================================
+
+esp_err_t app_jpeg_codec_init(void)
+{
+    static const jpeg_codec_t *const candidates[] = {
+        &g_sw_codec,
+#if SOC_JPEG_CODEC_SUPPORTED
+        &app_jpeg_codec_hw,
+#endif
+    };
+
+    for (size_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); i++) {
+        esp_err_t err = candidates[i]->init ? candidates[i]->init() : ESP_OK;
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Codec backend %s unavailable: %s", candidates[i]->name, esp_err_to_name(err));
+            if (i == 0) {
+                return err;
+            }
+            continue;
+        }
+        g_codecs[g_num_codecs++] = candidates[i];
+        ESP_LOGI(TAG, "Codec backend %s ready", candidates[i]->name);
+    }
+    g_selected = &g_sw_codec;
+    return ESP_OK;
+}
+
+size_t app_jpeg_codec_count(void)
+{
+    return g_num_codecs;
+}
+
+const jpeg_codec_t *app_jpeg_codec_at(size_t i)
+{
+    return i < g_num_codecs ? g_codecs[i] : NULL;
+}
+
+const jpeg_codec_t *app_jpeg_codec_get(const char *name)
+{
+    if (name == NULL) {
+        return g_selected;
+    }
+    for (size_t i = 0; i < g_num_codecs; i++) {
+        if (strcmp(g_codecs[i]->name, name) == 0) {
+            return g_codecs[i];
+        }
+    }
+    return NULL;
+}
+
+esp_err_t app_jpeg_codec_select(const char *name)
+{
+    const jpeg_codec_t *codec = app_jpeg_codec_get(name);
+    if (name == NULL || codec == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    g_selected = codec;
+    ESP_LOGI(TAG, "Codec backend %s selected", codec->name);
+    return ESP_OK;
+}
+
+size_t app_jpeg_codec_image_size(uint16_t width, uint16_t height, jpeg_codec_pixel_t format)
+{
+    return (size_t)width * height * (format == JPEG_CODEC_RGB888 ? 3 : (format == JPEG_CODEC_YUY2 ? 2 : 1));
+}
+
+esp_err_t app_jpeg_codec_decode(const jpeg_codec_t *codec, const uint8_t *in, size_t len, const jpeg_index_t *index,
+                                uint8_t scale_shift, jpeg_codec_image_t *out, size_t out_cap)
+{
+    if (scale_shift > 3) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (codec->decode == NULL) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    esp_err_t err = codec->decode(in, len, index, scale_shift, out, out_cap);
+    if (err != ESP_ERR_NOT_SUPPORTED || scale_shift == 0) {
+        return err;
+    }
+
+    // Full size first, then reduce
+    if (index == NULL || index->width == 0) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    jpeg_codec_image_t full = { .format = out->format };
+    size_t full_size = app_jpeg_codec_image_size(index->width, index->height, out->format);
+    full.data = alloc_psram(full_size);
+    if (full.data == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    err = codec->decode(in, len, index, 0, &full, full_size);
+    if (err == ESP_OK) {
+        int div = 1 << scale_shift;
+        out->width = (full.width + div - 1) / div;
+        out->height = (full.height + div - 1) / div;
+        if (app_jpeg_codec_image_size(out->width, out->height, out->format) > out_cap) {
+            err = ESP_ERR_INVALID_SIZE;
+        } else {
+            err = app_jpeg_codec_scale(codec, &full, out);
+        }
+    }
+    free(full.data);
+    return err;
+}
+
+esp_err_t app_jpeg_codec_encode(const jpeg_codec_t *codec, const jpeg_codec_image_t *in, uint8_t quality,
+                                uint8_t *out, size_t out_cap, size_t *out_len)
+{
+    if (quality < 1 || quality > 100) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t err = codec->encode ? codec->encode(in, quality, out, out_cap, out_len) : ESP_ERR_NOT_SUPPORTED;
+    return (err == ESP_ERR_NOT_SUPPORTED && codec != &g_sw_codec) ?
+           sw_encode(in, quality, out, out_cap, out_len) : err;
+}
+
+esp_err_t app_jpeg_codec_scale(const jpeg_codec_t *codec, const jpeg_codec_image_t *in, jpeg_codec_image_t *out)
+{
+    esp_err_t err = codec->scale ? codec->scale(in, out) : ESP_ERR_NOT_SUPPORTED;
+    return err == ESP_ERR_NOT_SUPPORTED ? sw_scale(in, out) : err;
+}
+
+// ============================================================================
+// Benchmark
+// ============================================================================
+
+esp_err_t app_jpeg_codec_bench(const jpeg_codec_t *codec, const jpeg_codec_frame_t *frames, size_t num_frames,
+                               uint8_t quality, jpeg_codec_bench_t *result)
+{
+    memset(result, 0, sizeof(*result));
+    result->name = codec->name;
+
+    uint16_t max_w = 0;
+    uint16_t max_h = 0;
+    for (size_t i = 0; i < num_frames; i++) {
+        if (frames[i].index == NULL || frames[i].index->width == 0) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        max_w = frames[i].index->width > max_w ? frames[i].index->width : max_w;
+        max_h = frames[i].index->height > max_h ? frames[i].index->height : max_h;
+    }
+    size_t gray_size = app_jpeg_codec_image_size(max_w, max_h, JPEG_CODEC_GRAY);
+    size_t yuy2_size = app_jpeg_codec_image_size(max_w, max_h, JPEG_CODEC_YUY2);
+    uint8_t *gray = alloc_psram(gray_size);
+    uint8_t *yuy2 = alloc_psram(yuy2_size);
+    uint8_t *jpeg = alloc_psram(yuy2_size);
+    if (gray == NULL || yuy2 == NULL || jpeg == NULL) {
+        free(gray);
+        free(yuy2);
+        free(jpeg);
+        return ESP_ERR_NO_MEM;
+    }
+
+    uint64_t decode_us = 0;
+    uint64_t small_us = 0;
+    uint64_t encode_us = 0;
+    uint64_t encode_bytes = 0;
+    esp_err_t err = ESP_OK;
+    for (size_t i = 0; i < num_frames && err == ESP_OK; i++) {
+        const jpeg_codec_frame_t *f = &frames[i];
+        jpeg_codec_image_t img = { .data = gray, .format = JPEG_CODEC_GRAY };
+
+        int64_t t0 = esp_timer_get_time();
+        err = app_jpeg_codec_decode(codec, f->data, f->len, f->index, 0, &img, gray_size);
+        int64_t t1 = esp_timer_get_time();
+        if (err == ESP_OK) {
+            err = app_jpeg_codec_decode(codec, f->data, f->len, f->index, 2, &img, gray_size);
+        }
+        int64_t t2 = esp_timer_get_time();
+        if (err != ESP_OK) {
+            break;
+        }
+
+        // Encode input comes from the software decoder, the same for every backend
+        jpeg_codec_image_t src = { .data = yuy2, .format = JPEG_CODEC_YUY2 };
+        size_t len = 0;
+        err = sw_decode(f->data, f->len, f->index, 0, &src, yuy2_size);
+        int64_t t3 = esp_timer_get_time();
+        if (err == ESP_OK) {
+            err = codec->encode ? codec->encode(&src, quality, jpeg, yuy2_size, &len) : ESP_ERR_NOT_SUPPORTED;
+        }
+        int64_t t4 = esp_timer_get_time();
+        if (err != ESP_OK) {
+            break;
+        }
+
+        decode_us += t1 - t0;
+        small_us += t2 - t1;
+        encode_us += t4 - t3;
+        encode_bytes += len;
+        result->frames++;
+    }
+    if (result->frames > 0) {
+        result->decode_us = decode_us / result->frames;
+        result->decode_small_us = small_us / result->frames;
+        result->encode_us = encode_us / result->frames;
+        result->encode_bytes = encode_bytes / result->frames;
+    }
+    result->result = err;
+
+    free(gray);
+    free(yuy2);
+    free(jpeg);
+    return ESP_OK;
+}
@@ -0,0 +1,187 @@
+#pragma once
+
+#include "esp_err.h"
+#include "app_jpeg.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Pixel-domain JPEG operations behind one interface, so features that need a
+ * decode or an encode do not each pick their own codec. The software backend
+ * ("sw") is always there; targets with a JPEG engine (ESP32-P4) add "hw". The
+ * backend used by default can be switched at runtime.
+ */
+
+/**
+ * @brief Pixel layout of a codec image, rows are packed without padding
+ */
+typedef enum {
+    JPEG_CODEC_GRAY,        // 1 byte per pixel, luma
+    JPEG_CODEC_YUY2,        // 2 bytes per pixel, Y0 Cb Y1 Cr
+    JPEG_CODEC_RGB888,      // 3 bytes per pixel, R G B
+} jpeg_codec_pixel_t;
+
+/**
+ * @brief Raw image handed to or returned by a backend
+ */
+typedef struct {
+    uint8_t *data;
+    uint16_t width;
+    uint16_t height;
+    jpeg_codec_pixel_t format;
+} jpeg_codec_image_t;
+
+/**
+ * @brief Codec backend
+ *
+ * Operations a backend does not offer are NULL. They return ESP_ERR_NOT_SUPPORTED
+ * for pixel formats, sizes or reductions they cannot handle; app_jpeg_codec_decode()
+ * and app_jpeg_codec_scale() then fall back to a full-size decode plus the
+ * software scaler.
+ */
+typedef struct {
+    const char *name;
+    // Prepare the backend, called once by app_jpeg_codec_init()
+    esp_err_t (*init)(void);
+    // Decode a frame reduced by 1 << scale_shift; out->format and out->data are set
+    // by the caller, width and height by the backend
+    esp_err_t (*decode)(const uint8_t *in, size_t len, const jpeg_index_t *index, uint8_t scale_shift,
+                        jpeg_codec_image_t *out, size_t out_cap);
+    // Encode an image at quality 1-100
+    esp_err_t (*encode)(const jpeg_codec_image_t *in, uint8_t quality, uint8_t *out, size_t out_cap,
+                        size_t *out_len);
+    // Resize in to the size of out, both in the same pixel format
+    esp_err_t (*scale)(const jpeg_codec_image_t *in, jpeg_codec_image_t *out);
+} jpeg_codec_t;
+
+/**
+ * @brief Per-backend timings over a frame corpus, averages per frame
+ */
+typedef struct {
+    const char *name;
+    uint32_t frames;
+    uint32_t decode_us;         // Full size, luma
+    uint32_t decode_small_us;   // 1/4 size, luma (decode plus scale where the backend cannot reduce)
+    uint32_t encode_us;         // From the same YUY2 image for every backend
+    uint32_t encode_bytes;
+    esp_err_t result;           // First error, the timings cover the frames before it
+} jpeg_codec_bench_t;
+
+/**
+ * @brief Frame of a benchmark corpus
+ */
+typedef struct {
+    const uint8_t *data;
+    size_t len;
+    const jpeg_index_t *index;
+} jpeg_codec_frame_t;
+
+/**
+ * @brief Initialize every backend built for this target and select "sw"
+ *
+ * @return ESP_OK on success, or the error of the software backend; other
+ *         backends that fail are left out
+ */
+esp_err_t app_jpeg_codec_init(void);
+
+/**
+ * @brief Number of usable backends
+ */
+size_t app_jpeg_codec_count(void);
+
+/**
+ * @brief Backend by position, 0 is always "sw"
+ *
+ * @param i Position, below app_jpeg_codec_count()
+ * @return Backend, NULL if out of range
+ */
+const jpeg_codec_t *app_jpeg_codec_at(size_t i);
+
+/**
+ * @brief Backend by name
+ *
+ * @param name Backend name, or NULL for the selected one
+ * @return Backend, NULL if there is none by that name
+ */
+const jpeg_codec_t *app_jpeg_codec_get(const char *name);
+
+/**
+ * @brief Make a backend the one used by default
+ *
+ * @param name Backend name
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if there is no such backend
+ */
+esp_err_t app_jpeg_codec_select(const char *name);
+
+/**
+ * @brief Bytes an image of the given size and format needs
+ */
+size_t app_jpeg_codec_image_size(uint16_t width, uint16_t height, jpeg_codec_pixel_t format);
+
+/**
+ * @brief Decode a frame with a backend, reduced by 1 << scale_shift
+ *
+ * Backends that cannot reduce while decoding decode at full size into a
+ * temporary buffer and are scaled afterwards.
+ *
+ * @param codec Backend
+ * @param in JPEG frame
+ * @param len Frame length
+ * @param index Structure index of the frame, or NULL
+ * @param scale_shift Reduction, 0-3
+ * @param out Destination: format and buffer set by the caller, size set on return
+ * @param out_cap Capacity of out->data
+ * @return ESP_OK on success, ESP_ERR_INVALID_SIZE if out is too small,
+ *         ESP_ERR_NOT_SUPPORTED if the backend cannot decode to that format
+ */
+esp_err_t app_jpeg_codec_decode(const jpeg_codec_t *codec, const uint8_t *in, size_t len, const jpeg_index_t *index,
+                                uint8_t scale_shift, jpeg_codec_image_t *out, size_t out_cap);
+
+/**
+ * @brief Encode an image with a backend, in software if the backend cannot
+ *
+ * @param codec Backend
+ * @param in Image
+ * @param quality 1-100
+ * @param out Output buffer
+ * @param out_cap Capacity of out
+ * @param[out] out_len JPEG size
+ * @return ESP_OK on success, ESP_ERR_INVALID_SIZE if out is too small,
+ *         ESP_ERR_NOT_SUPPORTED if no backend can encode the pixel format
+ */
+esp_err_t app_jpeg_codec_encode(const jpeg_codec_t *codec, const jpeg_codec_image_t *in, uint8_t quality,
+                                uint8_t *out, size_t out_cap, size_t *out_len);
+
+/**
+ * @brief Resize an image with the backend's scaler, or in software if it has none
+ *
+ * @param codec Backend
+ * @param in Source image
+ * @param out Destination: size, format and buffer set by the caller
+ * @return ESP_OK on success, ESP_ERR_NOT_SUPPORTED if the formats differ
+ */
+esp_err_t app_jpeg_codec_scale(const jpeg_codec_t *codec, const jpeg_codec_image_t *in, jpeg_codec_image_t *out);
+
+/**
+ * @brief Time one backend on a corpus of frames
+ *
+ * The encode input is decoded with the software backend beforehand, so every
+ * backend encodes the same pixels.
+ *
+ * @param codec Backend
+ * @param frames Corpus
+ * @param num_frames Frames in the corpus
+ * @param quality Encode quality
+ * @param[out] result Timings
+ * @return ESP_OK on success (per-backend errors are in result), ESP_ERR_NO_MEM
+ */
+esp_err_t app_jpeg_codec_bench(const jpeg_codec_t *codec, const jpeg_codec_frame_t *frames, size_t num_frames,
+                               uint8_t quality, jpeg_codec_bench_t *result);
+
+#ifdef __cplusplus
+}
+#endif
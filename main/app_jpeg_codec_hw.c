@@ -0,0 +1,198 @@
+#include "app_jpeg_codec.h"
+#include "soc/soc_caps.h"
+
+#if SOC_JPEG_CODEC_SUPPORTED
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "driver/jpeg_decode.h"
+#include "driver/jpeg_encode.h"
+
+/*
+ * JPEG engine of the ESP32-P4. The engine reads and writes DMA buffers from the
+ * driver's allocators, so frames are copied through bounce buffers that grow to
+ * the largest frame seen. It cannot reduce while decoding; the codec layer does
+ * that with the software scaler.
+ */
+
+static const char *TAG = "app_jpeg_codec_hw";
+
+#define HW_TIMEOUT_MS   200
+
+static jpeg_decoder_handle_t g_decoder = NULL;
+static jpeg_encoder_handle_t g_encoder = NULL;
+static SemaphoreHandle_t g_lock = NULL;
+
+typedef struct {
+    uint8_t *buf;
+    size_t cap;
+} bounce_t;
+
+static bounce_t g_dec_in;
+static bounce_t g_dec_out;
+static bounce_t g_enc_in;
+static bounce_t g_enc_out;
+
+static bool bounce_reserve(bounce_t *b, size_t size, bool encoder, bool input)
+{
+    if (b->cap >= size) {
+        return true;
+    }
+    free(b->buf);
+    b->buf = NULL;
+    b->cap = 0;
+    size_t allocated = 0;
+    if (encoder) {
+        jpeg_encode_memory_alloc_cfg_t cfg = {
+            .buffer_direction = input ? JPEG_ENC_ALLOC_INPUT_BUFFER : JPEG_ENC_ALLOC_OUTPUT_BUFFER,
+        };
+        b->buf = jpeg_alloc_encoder_mem(size, &cfg, &allocated);
+    } else {
+        jpeg_decode_memory_alloc_cfg_t cfg = {
+            .buffer_direction = input ? JPEG_DEC_ALLOC_INPUT_BUFFER : JPEG_DEC_ALLOC_OUTPUT_BUFFER,
+        };
+        b->buf = jpeg_alloc_decoder_mem(size, &cfg, &allocated);
+    }
+    if (b->buf == NULL) {
+        return false;
+    }
+    b->cap = allocated;
+    return true;
+}
+
+static esp_err_t hw_init(void)
+{
+    g_lock = xSemaphoreCreateMutex();
+    if (g_lock == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    const jpeg_decode_engine_cfg_t dec_cfg = { .intr_priority = 0, .timeout_ms = HW_TIMEOUT_MS };
+    esp_err_t err = jpeg_new_decoder_engine(&dec_cfg, &g_decoder);
+    if (err != ESP_OK) {
+        return err;
+    }
+    const jpeg_encode_engine_cfg_t enc_cfg = { .intr_priority = 0, .timeout_ms = HW_TIMEOUT_MS };
+    return jpeg_new_encoder_engine(&enc_cfg, &g_encoder);
+}
+
+static esp_err_t hw_decode(const uint8_t *in, size_t len, const jpeg_index_t *index, uint8_t scale_shift,
+                           jpeg_codec_image_t *out, size_t out_cap)
+{
+    if (scale_shift != 0 || out->format == JPEG_CODEC_YUY2) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    jpeg_decode_picture_info_t info;
+    esp_err_t err = jpeg_decoder_get_info(in, len, &info);
+    if (err != ESP_OK) {
+        return err;
+    }
+    bool gray_in = (info.sample_method == JPEG_DOWN_SAMPLING_GRAY);
+    if (app_jpeg_codec_image_size(info.width, info.height, out->format) > out_cap) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // The engine writes whole MCUs: rows are padded to a multiple of 16 pixels
+    uint32_t stride = (info.width + 15) & ~15;
+    uint32_t rows = (info.height + 15) & ~15;
+    int bpp = gray_in ? 1 : 3;
+
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    if (!bounce_reserve(&g_dec_in, len, false, true) ||
+        !bounce_reserve(&g_dec_out, (size_t)stride * rows * bpp, false, false)) {
+        xSemaphoreGive(g_lock);
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(g_dec_in.buf, in, len);
+    // Color frames come out as RGB; luma is derived from it below
+    const jpeg_decode_cfg_t cfg = {
+        .output_format = gray_in ? JPEG_DECODE_OUT_FORMAT_GRAY : JPEG_DECODE_OUT_FORMAT_RGB888,
+        .rgb_order = JPEG_DEC_RGB_ELEMENT_ORDER_RGB,
+        .conv_std = JPEG_YUV_RGB_CONV_STD_BT601,
+    };
+    uint32_t out_size = 0;
+    err = jpeg_decoder_process(g_decoder, &cfg, g_dec_in.buf, len, g_dec_out.buf, g_dec_out.cap, &out_size);
+    if (err == ESP_OK) {
+        for (uint32_t y = 0; y < info.height; y++) {
+            const uint8_t *src = g_dec_out.buf + (size_t)y * stride * bpp;
+            if (out->format == JPEG_CODEC_GRAY) {
+                uint8_t *dst = out->data + (size_t)y * info.width;
+                if (gray_in) {
+                    memcpy(dst, src, info.width);
+                    continue;
+                }
+                for (uint32_t x = 0; x < info.width; x++, src += 3) {
+                    dst[x] = (19595 * src[0] + 38470 * src[1] + 7471 * src[2] + 32768) >> 16;
+                }
+            } else {
+                uint8_t *dst = out->data + (size_t)y * info.width * 3;
+                if (!gray_in) {
+                    memcpy(dst, src, info.width * 3);
+                    continue;
+                }
+                for (uint32_t x = 0; x < info.width; x++) {
+                    dst[3 * x] = dst[3 * x + 1] = dst[3 * x + 2] = src[x];
+                }
+            }
+        }
+        out->width = info.width;
+        out->height = info.height;
+    }
+    xSemaphoreGive(g_lock);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Decode failed: %s", esp_err_to_name(err));
+    }
+    return err;
+}
+
+static esp_err_t hw_encode(const jpeg_codec_image_t *in, uint8_t quality, uint8_t *out, size_t out_cap,
+                           size_t *out_len)
+{
+    // Packed YUV422 (the camera's YUY2) and gray; sizes in whole MCUs only, the engine does not pad
+    if (in->format == JPEG_CODEC_RGB888 || (in->width % 16) || (in->height % 8)) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    bool gray = (in->format == JPEG_CODEC_GRAY);
+    size_t in_size = app_jpeg_codec_image_size(in->width, in->height, in->format);
+
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    if (!bounce_reserve(&g_enc_in, in_size, true, true) || !bounce_reserve(&g_enc_out, out_cap, true, false)) {
+        xSemaphoreGive(g_lock);
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(g_enc_in.buf, in->data, in_size);
+    const jpeg_encode_cfg_t cfg = {
+        .width = in->width,
+        .height = in->height,
+        .src_type = gray ? JPEG_ENCODE_IN_FORMAT_GRAY : JPEG_ENCODE_IN_FORMAT_YUV422,
+        .sub_sample = gray ? JPEG_DOWN_SAMPLING_GRAY : JPEG_DOWN_SAMPLING_YUV422,
+        .image_quality = quality,
+    };
+    uint32_t len = 0;
+    esp_err_t err = jpeg_encoder_process(g_encoder, &cfg, g_enc_in.buf, in_size, g_enc_out.buf, g_enc_out.cap, &len);
+    if (err == ESP_OK && len > out_cap) {
+        err = ESP_ERR_INVALID_SIZE;
+    }
+    if (err == ESP_OK) {
+        memcpy(out, g_enc_out.buf, len);
+        *out_len = len;
+    }
+    xSemaphoreGive(g_lock);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Encode failed: %s", esp_err_to_name(err));
+    }
+    return err;
+}
+
+const jpeg_codec_t app_jpeg_codec_hw = {
+    .name = "hw",
+    .init = hw_init,
+    .decode = hw_decode,
+    .encode = hw_encode,
+    .scale = NULL,
+};
+
+#endif // SOC_JPEG_CODEC_SUPPORTED
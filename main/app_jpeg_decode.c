@@ -0,0 +1,485 @@
+#include "app_jpeg_decode.h"
+#include "app_jpeg_entropy.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sdkconfig.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#if CONFIG_IDF_TARGET_LINUX
+#include <pthread.h>
+#include <semaphore.h>
+#include <unistd.h>
+#endif
+
+static const char *TAG = "app_jpeg_decode";
+
+// Helpers run below the USB tasks, which preempt them on core 0
+#define DECODE_TASK_STACK       3072
+#define DECODE_TASK_PRIORITY    (tskIDLE_PRIORITY + 3)
+
+#if CONFIG_IDF_TARGET_LINUX
+// The Linux target runs FreeRTOS tasks one at a time, so pieces go to a pool of
+// pthreads instead: by default one worker per host CPU, up to this many
+#define DECODE_MAX_WORKERS      8
+#else
+#define DECODE_MAX_WORKERS      portNUM_PROCESSORS
+#endif
+
+// Fixed-point IDCT: table entries carry 11 fraction bits
+#define IDCT_BITS   11
+
+/*
+ * One piece of the scan, from first_mcu up to end_mcu. first_mcu is either 0 or
+ * the first MCU after an indexed restart marker, so pieces decode independently.
+ */
+typedef struct {
+    const jpeg_info_t *info;
+    const uint8_t *in;
+    size_t in_len;
+    const jpeg_index_t *index;
+    jpeg_decode_format_t format;
+    uint8_t scale_shift;
+    uint8_t *out;
+    uint16_t out_w;
+    uint16_t out_h;
+    uint32_t first_mcu;
+    uint32_t end_mcu;
+    esp_err_t result;
+} decode_job_t;
+
+typedef struct {
+#if CONFIG_IDF_TARGET_LINUX
+    pthread_t thread;
+    sem_t start;
+#else
+    TaskHandle_t task;
+#endif
+    decode_job_t job;
+} decode_worker_t;
+
+// Per-piece scratch, kept off the (small) task stacks
+typedef struct {
+    jpeg_block_t blocks[JPEG_MAX_BLOCKS_IN_MCU];
+    int16_t coef[64];
+    uint8_t plane[JPEG_MAX_COMPONENTS][16 * 16];   // MCU samples per component, at output scale
+} decode_scratch_t;
+
+// One helper per core, or the pool on the Linux target (the caller is the last worker)
+static decode_worker_t g_workers[DECODE_MAX_WORKERS];
+static uint32_t g_default_workers = portNUM_PROCESSORS;
+static SemaphoreHandle_t g_decode_mutex = NULL;
+#if CONFIG_IDF_TARGET_LINUX
+static sem_t g_done;
+#else
+static SemaphoreHandle_t g_done = NULL;
+#endif
+
+// c(u) * cos((2x + 1) * u * pi / 2N) for N = 8 >> shift, c(0) = 1, c(u > 0) = sqrt(2)
+static int32_t g_idct_tab[4][8][8];
+
+static void idct_tables_init(void)
+{
+    for (int s = 0; s < 4; s++) {
+        int n = 8 >> s;
+        for (int x = 0; x < n; x++) {
+            for (int u = 0; u < n; u++) {
+                double c = (u == 0) ? 1.0 : sqrt(2.0);
+                g_idct_tab[s][x][u] = (int32_t)lround(c * cos((2 * x + 1) * u * M_PI / (2 * n)) * (1 << IDCT_BITS));
+            }
+        }
+    }
+}
+
+static inline uint8_t clamp_u8(int v)
+{
+    return v < 0 ? 0 : (v > 255 ? 255 : (uint8_t)v);
+}
+
+/*
+ * Reduced-size IDCT: only the n x n low-frequency coefficients are used, which gives
+ * the block downscaled by 8 / n. Coefficients are in zigzag order, the quantization
+ * table too.
+ */
+static void idct_block(const int16_t coef[64], const uint16_t quant[64], int shift, uint8_t *dst, int stride)
+{
+    int n = 8 >> shift;
+
+    if (n == 1) {
+        dst[0] = clamp_u8(((coef[0] * quant[0] + 4) >> 3) + 128);
+        return;
+    }
+
+    const int32_t (*tab)[8] = g_idct_tab[shift];
+    int32_t f[8][8];
+    int32_t tmp[8][8];
+    uint8_t row_used = 0;
+
+    memset(f, 0, sizeof(f));
+    for (int k = 0; k < 64; k++) {
+        if (coef[k] == 0) {
+            continue;
+        }
+        int nat = app_jpeg_zigzag[k];
+        int u = nat & 7;
+        int v = nat >> 3;
+        if (u >= n || v >= n) {
+            continue;
+        }
+        // Dequantized values of a valid 8-bit JPEG fit in 12 bits, clamping keeps the sums in 32 bits
+        int32_t d = coef[k] * quant[k];
+        f[v][u] = d < -4095 ? -4095 : (d > 4095 ? 4095 : d);
+        row_used |= 1 << v;
+    }
+
+    // Rows: horizontal frequencies to pixels, result in coefficient units
+    for (int v = 0; v < n; v++) {
+        if (!(row_used & (1 << v))) {
+            memset(tmp[v], 0, n * sizeof(int32_t));
+            continue;
+        }
+        for (int x = 0; x < n; x++) {
+            int32_t sum = 0;
+            for (int u = 0; u < n; u++) {
+                sum += tab[x][u] * f[v][u];
+            }
+            tmp[v][x] = (sum + (1 << (IDCT_BITS - 1))) >> IDCT_BITS;
+        }
+    }
+
+    // Columns, then the 1/8 normalization and the level shift
+    for (int y = 0; y < n; y++) {
+        for (int x = 0; x < n; x++) {
+            int32_t sum = 0;
+            for (int v = 0; v < n; v++) {
+                if (row_used & (1 << v)) {
+                    sum += tab[y][v] * tmp[v][x];
+                }
+            }
+            dst[y * stride + x] = clamp_u8(((sum + (1 << (IDCT_BITS + 2))) >> (IDCT_BITS + 3)) + 128);
+        }
+    }
+}
+
+static esp_err_t decode_range(decode_job_t *job)
+{
+    const jpeg_info_t *info = job->info;
+    int n = 8 >> job->scale_shift;
+    bool single = (info->num_components == 1);
+    int h_max = single ? 1 : info->h_max;
+    int v_max = single ? 1 : info->v_max;
+    int mcu_w = h_max * n;
+    int mcu_h = v_max * n;
+    int bpp = (job->format == JPEG_DECODE_RGB888) ? 3 : (job->format == JPEG_DECODE_YUY2 ? 2 : 1);
+    bool color = (job->format != JPEG_DECODE_GRAY && info->num_components == 3);
+
+    decode_scratch_t *s = heap_caps_malloc(sizeof(decode_scratch_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (s == NULL) {
+        s = malloc(sizeof(decode_scratch_t));
+        if (s == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    jpeg_scan_reader_t rd;
+    app_jpeg_scan_reader_init(&rd, info, job->in, job->in_len);
+    if (job->first_mcu > 0 && app_jpeg_scan_reader_seek(&rd, job->index, job->first_mcu) != job->first_mcu) {
+        free(s);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    esp_err_t err = ESP_OK;
+    for (uint32_t mcu = job->first_mcu; mcu < job->end_mcu; mcu++) {
+        err = app_jpeg_read_mcu(&rd, s->blocks);
+        if (err != ESP_OK) {
+            break;
+        }
+
+        // Blocks of every component land in its plane in raster order
+        uint8_t count[JPEG_MAX_COMPONENTS] = {0};
+        for (int b = 0; b < info->blocks_per_mcu; b++) {
+            int c = info->mcu_comp[b];
+            if (c != 0 && !color) {
+                continue;
+            }
+            int ch = single ? 1 : info->comp[c].h;
+            int k = count[c]++;
+            uint8_t *dst = s->plane[c] + (k / ch) * n * (ch * n) + (k % ch) * n;
+            app_jpeg_block_to_coefs(&s->blocks[b], s->coef);
+            idct_block(s->coef, info->quant[info->comp[c].tq], job->scale_shift, dst, ch * n);
+        }
+
+        // Clip to the output and convert; chroma is upsampled by replication
+        int ox = (mcu % info->mcus_x) * mcu_w;
+        int oy = (mcu / info->mcus_x) * mcu_h;
+        int w = (ox + mcu_w > job->out_w) ? job->out_w - ox : mcu_w;
+        int h = (oy + mcu_h > job->out_h) ? job->out_h - oy : mcu_h;
+        int yw = (single ? 1 : info->comp[0].h) * n;
+        for (int y = 0; y < h; y++) {
+            uint8_t *row = job->out + ((size_t)(oy + y) * job->out_w + ox) * bpp;
+            const uint8_t *luma = s->plane[0] + (y * (single ? 1 : info->comp[0].v) / v_max) * yw;
+            if (bpp == 1) {
+                if (yw == mcu_w) {
+                    memcpy(row, luma, w);
+                } else {
+                    for (int x = 0; x < w; x++) {
+                        row[x] = luma[x * yw / mcu_w];
+                    }
+                }
+                continue;
+            }
+            if (!color) {
+                for (int x = 0; x < w; x++) {
+                    uint8_t l = luma[x * yw / mcu_w];
+                    if (bpp == 2) {
+                        row[2 * x] = l;
+                        row[2 * x + 1] = 128;
+                    } else {
+                        row[3 * x] = row[3 * x + 1] = row[3 * x + 2] = l;
+                    }
+                }
+                continue;
+            }
+            int cbw = info->comp[1].h * n;
+            int crw = info->comp[2].h * n;
+            const uint8_t *cb = s->plane[1] + (y * info->comp[1].v / v_max) * cbw;
+            const uint8_t *cr = s->plane[2] + (y * info->comp[2].v / v_max) * crw;
+            if (bpp == 2) {
+                // Cb from even pixels, Cr from odd ones
+                for (int x = 0; x < w; x++) {
+                    row[2 * x] = luma[x * yw / mcu_w];
+                    row[2 * x + 1] = ((ox + x) & 1) ? cr[x * crw / mcu_w] : cb[x * cbw / mcu_w];
+                }
+                continue;
+            }
+            for (int x = 0; x < w; x++) {
+                int l = luma[x * yw / mcu_w];
+                int u = cb[x * cbw / mcu_w] - 128;
+                int v = cr[x * crw / mcu_w] - 128;
+                // JFIF YCbCr to RGB, 16 fraction bits
+                row[3 * x] = clamp_u8(l + ((91881 * v + 32768) >> 16));
+                row[3 * x + 1] = clamp_u8(l - ((22554 * u + 46802 * v - 32768) >> 16));
+                row[3 * x + 2] = clamp_u8(l + ((116130 * u + 32768) >> 16));
+            }
+        }
+    }
+
+    free(s);
+    return err;
+}
+
+#if CONFIG_IDF_TARGET_LINUX
+static void *decode_thread(void *arg)
+{
+    decode_worker_t *worker = (decode_worker_t *)arg;
+    while (1) {
+        sem_wait(&worker->start);
+        worker->job.result = decode_range(&worker->job);
+        sem_post(&g_done);
+    }
+    return NULL;
+}
+
+static void helper_start(decode_worker_t *worker)
+{
+    sem_post(&worker->start);
+}
+
+static void helpers_wait(uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++) {
+        sem_wait(&g_done);
+    }
+}
+
+esp_err_t app_jpeg_decode_init(void)
+{
+    idct_tables_init();
+
+    g_decode_mutex = xSemaphoreCreateMutex();
+    if (g_decode_mutex == NULL || sem_init(&g_done, 0, 0) != 0) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    g_default_workers = cpus < 1 ? 1 : (cpus > DECODE_MAX_WORKERS ? DECODE_MAX_WORKERS : (uint32_t)cpus);
+    // The whole pool is started so an explicit max_workers gets its workers even on a small host
+    for (int i = 0; i < DECODE_MAX_WORKERS - 1; i++) {
+        if (sem_init(&g_workers[i].start, 0, 0) != 0 ||
+            pthread_create(&g_workers[i].thread, NULL, decode_thread, &g_workers[i]) != 0) {
+            ESP_LOGE(TAG, "Failed to start decode thread %d", i);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    return ESP_OK;
+}
+#else
+static void decode_task(void *arg)
+{
+    decode_worker_t *worker = (decode_worker_t *)arg;
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        worker->job.result = decode_range(&worker->job);
+        xSemaphoreGive(g_done);
+    }
+}
+
+static void helper_start(decode_worker_t *worker)
+{
+    xTaskNotifyGive(worker->task);
+}
+
+static void helpers_wait(uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++) {
+        xSemaphoreTake(g_done, portMAX_DELAY);
+    }
+}
+
+esp_err_t app_jpeg_decode_init(void)
+{
+    idct_tables_init();
+
+    g_decode_mutex = xSemaphoreCreateMutex();
+    g_done = xSemaphoreCreateCounting(portNUM_PROCESSORS, 0);
+    if (g_decode_mutex == NULL || g_done == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    // One helper per core, so whichever core the caller runs on the others can join in
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        BaseType_t ret = xTaskCreatePinnedToCore(decode_task, "jpeg_dec", DECODE_TASK_STACK, &g_workers[core],
+                                                 DECODE_TASK_PRIORITY, &g_workers[core].task, core);
+        if (ret != pdPASS) {
+            ESP_LOGE(TAG, "Failed to create decode task on core %d", core);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    return ESP_OK;
+}
+#endif
+
+size_t app_jpeg_decode_out_size(uint16_t width, uint16_t height, const jpeg_decode_config_t *config)
+{
+    int div = 1 << config->scale_shift;
+    size_t w = (width + div - 1) / div;
+    size_t h = (height + div - 1) / div;
+    return w * h * (config->format == JPEG_DECODE_RGB888 ? 3 : (config->format == JPEG_DECODE_YUY2 ? 2 : 1));
+}
+
+esp_err_t app_jpeg_decode(const uint8_t *in, size_t in_len, const jpeg_index_t *index,
+                          const jpeg_decode_config_t *config, uint8_t *out, size_t out_cap,
+                          jpeg_decode_result_t *result)
+{
+    if (config->scale_shift > 3 || g_decode_mutex == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    int64_t t0 = esp_timer_get_time();
+    jpeg_info_t *info = heap_caps_malloc(sizeof(jpeg_info_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (info == NULL) {
+        info = malloc(sizeof(jpeg_info_t));
+        if (info == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    esp_err_t err = app_jpeg_parse_info(in, in_len, index, info);
+    if (err != ESP_OK) {
+        free(info);
+        return err;
+    }
+    for (int c = 0; c < info->num_components; c++) {
+        // Component planes hold at most four blocks
+        if (info->num_components > 1 && info->comp[c].h * info->comp[c].v > 4) {
+            free(info);
+            return ESP_ERR_NOT_SUPPORTED;
+        }
+    }
+    if (app_jpeg_decode_out_size(info->width, info->height, config) > out_cap) {
+        free(info);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    int div = 1 << config->scale_shift;
+    decode_job_t base = {
+        .info = info,
+        .in = in,
+        .in_len = in_len,
+        .index = index,
+        .format = config->format,
+        .scale_shift = config->scale_shift,
+        .out = out,
+        .out_w = (info->width + div - 1) / div,
+        .out_h = (info->height + div - 1) / div,
+    };
+    uint32_t total = (uint32_t)info->mcus_x * info->mcus_y;
+
+    // Pieces can only start at indexed restart markers
+    uint32_t entries = 1;
+    uint32_t entry_mcus = 0;
+    if (index != NULL && info->restart_interval && index->num_rst && index->rst_stride) {
+        entries = index->num_rst + 1;
+        entry_mcus = (uint32_t)index->rst_stride * info->restart_interval;
+    }
+    uint32_t workers = config->max_workers ? config->max_workers : g_default_workers;
+    if (workers > DECODE_MAX_WORKERS) {
+        workers = DECODE_MAX_WORKERS;
+    }
+    if (workers > entries) {
+        workers = entries;
+    }
+
+    xSemaphoreTake(g_decode_mutex, portMAX_DELAY);
+
+    // Piece 0 runs here, the others on helpers pinned to the remaining cores
+#if CONFIG_IDF_TARGET_LINUX
+    int my_core = -1;
+#else
+    int my_core = xPortGetCoreID();
+#endif
+    decode_job_t local = base;
+    decode_worker_t *helpers[DECODE_MAX_WORKERS];
+    uint32_t num_helpers = 0;
+    int core = 0;
+    for (uint32_t w = 0; w < workers; w++) {
+        decode_job_t *job = &local;
+        if (w > 0) {
+            if (core == my_core) {
+                core++;
+            }
+            helpers[num_helpers++] = &g_workers[core];
+            job = &g_workers[core++].job;
+            *job = base;
+        }
+        job->first_mcu = (entries * w / workers) * entry_mcus;
+        job->end_mcu = (w + 1 < workers) ? (entries * (w + 1) / workers) * entry_mcus : total;
+        if (job->end_mcu > total) {
+            job->end_mcu = total;
+        }
+    }
+    for (uint32_t i = 0; i < num_helpers; i++) {
+        helper_start(helpers[i]);
+    }
+    err = decode_range(&local);
+    helpers_wait(num_helpers);
+    for (uint32_t i = 0; i < num_helpers && err == ESP_OK; i++) {
+        err = helpers[i]->job.result;
+    }
+
+    xSemaphoreGive(g_decode_mutex);
+
+    if (result != NULL) {
+        result->width = base.out_w;
+        result->height = base.out_h;
+        result->workers = workers;
+        result->decode_us = (uint32_t)(esp_timer_get_time() - t0);
+    }
+    free(info);
+    return err;
+}
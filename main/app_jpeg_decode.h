@@ -0,0 +1,91 @@
+#pragma once
+
+#include "esp_err.h"
+#include "app_jpeg.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Pixel decoder for analytics and thumbnails. Output is reduced in the DCT domain
+ * (only the low-frequency corner of every block is transformed), so 1/8 scale costs
+ * little more than the Huffman decode. When the frame has restart markers the scan
+ * is split at indexed markers and the pieces are decoded on all cores at once (on the
+ * Linux target, on a pool of threads sized to the host's CPUs).
+ */
+
+/**
+ * @brief Output pixel format
+ */
+typedef enum {
+    JPEG_DECODE_GRAY,       // 1 byte per pixel, luma only
+    JPEG_DECODE_RGB888,     // 3 bytes per pixel, R G B
+    JPEG_DECODE_YUY2,       // 2 bytes per pixel, Y0 Cb Y1 Cr; an odd last column has Cb only
+} jpeg_decode_format_t;
+
+/**
+ * @brief What to decode to
+ */
+typedef struct {
+    jpeg_decode_format_t format;
+    uint8_t scale_shift;    // Output is 1 / (1 << scale_shift) of the frame size, 0-3
+    uint8_t max_workers;    // Cores to use, 0 for all of them; up to 8 threads on Linux
+} jpeg_decode_config_t;
+
+/**
+ * @brief Result of a decode
+ */
+typedef struct {
+    uint16_t width;         // Output size in pixels
+    uint16_t height;
+    uint8_t workers;        // Cores that took part
+    uint32_t decode_us;
+} jpeg_decode_result_t;
+
+/**
+ * @brief Start one helper task per core for parallel decoding
+ *
+ * On the Linux target a pool of helper threads is started instead.
+ *
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if the tasks cannot be created
+ */
+esp_err_t app_jpeg_decode_init(void);
+
+/**
+ * @brief Size of the output buffer for a frame
+ *
+ * @param width Frame width
+ * @param height Frame height
+ * @param config Output format and scale
+ * @return Bytes needed, rows are packed without padding
+ */
+size_t app_jpeg_decode_out_size(uint16_t width, uint16_t height, const jpeg_decode_config_t *config);
+
+/**
+ * @brief Decode a baseline JPEG frame to pixels
+ *
+ * The scan is split into as many pieces as there are workers, at restart markers
+ * recorded in the index; frames without markers (or without an index) are decoded
+ * on the calling core only. Decodes are serialized, concurrent callers wait.
+ *
+ * @param in JPEG frame
+ * @param in_len Frame length
+ * @param index Structure index of the frame, or NULL
+ * @param config Output format, scale and worker limit
+ * @param out Output buffer, app_jpeg_decode_out_size() bytes
+ * @param out_cap Capacity of out
+ * @param[out] result Output size and timing (may be NULL)
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG for a bad scale,
+ *         ESP_ERR_INVALID_SIZE if out is too small,
+ *         other errors as app_jpeg_parse_info() / app_jpeg_read_mcu()
+ */
+esp_err_t app_jpeg_decode(const uint8_t *in, size_t in_len, const jpeg_index_t *index,
+                          const jpeg_decode_config_t *config, uint8_t *out, size_t out_cap,
+                          jpeg_decode_result_t *result);
+
+#ifdef __cplusplus
+}
+#endif
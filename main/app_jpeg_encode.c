@@ -0,0 +1,479 @@
+#include "app_jpeg_encode.h"
+#include "app_jpeg.h"
+#include "app_jpeg_entropy.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+static const char *TAG = "app_jpeg_encode";
+
+// Helpers run below the USB tasks, which preempt them on core 0
+#define ENCODE_TASK_STACK       3072
+#define ENCODE_TASK_PRIORITY    (tskIDLE_PRIORITY + 3)
+
+// Fixed-point forward DCT (Loeffler-Ligtenberg-Moschytz, as in IJG jfdctint.c)
+#define FDCT_CONST_BITS 13
+#define FDCT_PASS1_BITS 2
+#define FIX_0_298631336 2446
+#define FIX_0_390180644 3196
+#define FIX_0_541196100 4433
+#define FIX_0_765366865 6270
+#define FIX_0_899976223 7373
+#define FIX_1_175875602 9633
+#define FIX_1_501321110 12299
+#define FIX_1_847759065 15137
+#define FIX_1_961570560 16069
+#define FIX_2_053119869 16819
+#define FIX_2_562915447 20995
+#define FIX_3_072711026 25172
+#define DESCALE(x, n)   (((x) + (1 << ((n) - 1))) >> (n))
+
+// Quantization reciprocals carry 16 fraction bits
+#define QUANT_BITS      16
+
+// SOI + APP0 + 2 DQT + SOF0 (3 components) + standard DHT + DRI + SOS (3 components)
+#define HEADER_LEN      (2 + 18 + 2 * 69 + 19 + JPEG_STD_DHT_LEN + 6 + 14)
+
+// ITU-T T.81 Annex K tables, natural order
+static const uint8_t k_std_luma_quant[64] = {
+    16, 11, 10, 16, 24, 40, 51, 61,
+    12, 12, 14, 19, 26, 58, 60, 55,
+    14, 13, 16, 24, 40, 57, 69, 56,
+    14, 17, 22, 29, 51, 87, 80, 62,
+    18, 22, 37, 56, 68, 109, 103, 77,
+    24, 35, 55, 64, 81, 104, 113, 92,
+    49, 64, 78, 87, 103, 121, 120, 101,
+    72, 92, 95, 98, 112, 100, 103, 99,
+};
+
+static const uint8_t k_std_chroma_quant[64] = {
+    17, 18, 24, 47, 99, 99, 99, 99,
+    18, 21, 26, 66, 99, 99, 99, 99,
+    24, 26, 56, 99, 99, 99, 99, 99,
+    47, 66, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+};
+
+/*
+ * Tables for one quality setting, zigzag order. Index 0 is luma, 1 chroma.
+ */
+typedef struct {
+    uint8_t quality;
+    uint8_t quant[2][64];       // As written to DQT
+    uint16_t recip[2][64];      // 2^16 / (8 * quant), the DCT output is scaled by 8
+} encode_tables_t;
+
+/*
+ * One band of MCU rows, first_row up to end_row, written to its own part of the
+ * output buffer. A band other than the first starts with the RST marker that ends
+ * the row before it, so bands can be concatenated as they are.
+ */
+typedef struct {
+    const uint8_t *in;
+    uint16_t width;
+    uint16_t height;
+    uint16_t first_row;
+    uint16_t end_row;
+    uint8_t *out;
+    size_t cap;
+    size_t len;
+    esp_err_t result;
+} encode_job_t;
+
+typedef struct {
+    TaskHandle_t task;
+    encode_job_t job;
+} encode_worker_t;
+
+static encode_worker_t g_workers[portNUM_PROCESSORS];
+static SemaphoreHandle_t g_encode_mutex = NULL;
+static SemaphoreHandle_t g_done = NULL;
+static encode_tables_t g_tables;
+static jpeg_huff_enc_t g_huff[4];   // DC luma, AC luma, DC chroma, AC chroma
+
+static void tables_set_quality(encode_tables_t *t, int quality)
+{
+    // IJG scaling: 50 gives the Annex K tables
+    int scale = quality < 50 ? 5000 / quality : 200 - 2 * quality;
+    for (int k = 0; k < 64; k++) {
+        int nat = app_jpeg_zigzag[k];
+        for (int i = 0; i < 2; i++) {
+            int base = i == 0 ? k_std_luma_quant[nat] : k_std_chroma_quant[nat];
+            int q = (base * scale + 50) / 100;
+            q = q < 1 ? 1 : (q > 255 ? 255 : q);
+            t->quant[i][k] = q;
+            t->recip[i][k] = ((1 << QUANT_BITS) + 4 * q) / (8 * q);
+        }
+    }
+    t->quality = quality;
+}
+
+/*
+ * In-place forward DCT of level-shifted samples. The result is 8 times the
+ * orthonormal DCT, the quantizer folds that factor in.
+ */
+static void fdct_block(int32_t *d)
+{
+    int32_t *p = d;
+    for (int i = 0; i < 8; i++, p += 8) {
+        int32_t tmp0 = p[0] + p[7];
+        int32_t tmp7 = p[0] - p[7];
+        int32_t tmp1 = p[1] + p[6];
+        int32_t tmp6 = p[1] - p[6];
+        int32_t tmp2 = p[2] + p[5];
+        int32_t tmp5 = p[2] - p[5];
+        int32_t tmp3 = p[3] + p[4];
+        int32_t tmp4 = p[3] - p[4];
+
+        int32_t tmp10 = tmp0 + tmp3;
+        int32_t tmp13 = tmp0 - tmp3;
+        int32_t tmp11 = tmp1 + tmp2;
+        int32_t tmp12 = tmp1 - tmp2;
+
+        p[0] = (tmp10 + tmp11) << FDCT_PASS1_BITS;
+        p[4] = (tmp10 - tmp11) << FDCT_PASS1_BITS;
+        int32_t z1 = (tmp12 + tmp13) * FIX_0_541196100;
+        p[2] = DESCALE(z1 + tmp13 * FIX_0_765366865, FDCT_CONST_BITS - FDCT_PASS1_BITS);
+        p[6] = DESCALE(z1 - tmp12 * FIX_1_847759065, FDCT_CONST_BITS - FDCT_PASS1_BITS);
+
+        z1 = tmp4 + tmp7;
+        int32_t z2 = tmp5 + tmp6;
+        int32_t z3 = tmp4 + tmp6;
+        int32_t z4 = tmp5 + tmp7;
+        int32_t z5 = (z3 + z4) * FIX_1_175875602;
+        tmp4 *= FIX_0_298631336;
+        tmp5 *= FIX_2_053119869;
+        tmp6 *= FIX_3_072711026;
+        tmp7 *= FIX_1_501321110;
+        z1 *= -FIX_0_899976223;
+        z2 *= -FIX_2_562915447;
+        z3 = z3 * -FIX_1_961570560 + z5;
+        z4 = z4 * -FIX_0_390180644 + z5;
+        p[7] = DESCALE(tmp4 + z1 + z3, FDCT_CONST_BITS - FDCT_PASS1_BITS);
+        p[5] = DESCALE(tmp5 + z2 + z4, FDCT_CONST_BITS - FDCT_PASS1_BITS);
+        p[3] = DESCALE(tmp6 + z2 + z3, FDCT_CONST_BITS - FDCT_PASS1_BITS);
+        p[1] = DESCALE(tmp7 + z1 + z4, FDCT_CONST_BITS - FDCT_PASS1_BITS);
+    }
+
+    p = d;
+    for (int i = 0; i < 8; i++, p++) {
+        int32_t tmp0 = p[0] + p[56];
+        int32_t tmp7 = p[0] - p[56];
+        int32_t tmp1 = p[8] + p[48];
+        int32_t tmp6 = p[8] - p[48];
+        int32_t tmp2 = p[16] + p[40];
+        int32_t tmp5 = p[16] - p[40];
+        int32_t tmp3 = p[24] + p[32];
+        int32_t tmp4 = p[24] - p[32];
+
+        int32_t tmp10 = tmp0 + tmp3;
+        int32_t tmp13 = tmp0 - tmp3;
+        int32_t tmp11 = tmp1 + tmp2;
+        int32_t tmp12 = tmp1 - tmp2;
+
+        p[0] = DESCALE(tmp10 + tmp11, FDCT_PASS1_BITS);
+        p[32] = DESCALE(tmp10 - tmp11, FDCT_PASS1_BITS);
+        int32_t z1 = (tmp12 + tmp13) * FIX_0_541196100;
+        p[16] = DESCALE(z1 + tmp13 * FIX_0_765366865, FDCT_CONST_BITS + FDCT_PASS1_BITS);
+        p[48] = DESCALE(z1 - tmp12 * FIX_1_847759065, FDCT_CONST_BITS + FDCT_PASS1_BITS);
+
+        z1 = tmp4 + tmp7;
+        int32_t z2 = tmp5 + tmp6;
+        int32_t z3 = tmp4 + tmp6;
+        int32_t z4 = tmp5 + tmp7;
+        int32_t z5 = (z3 + z4) * FIX_1_175875602;
+        tmp4 *= FIX_0_298631336;
+        tmp5 *= FIX_2_053119869;
+        tmp6 *= FIX_3_072711026;
+        tmp7 *= FIX_1_501321110;
+        z1 *= -FIX_0_899976223;
+        z2 *= -FIX_2_562915447;
+        z3 = z3 * -FIX_1_961570560 + z5;
+        z4 = z4 * -FIX_0_390180644 + z5;
+        p[56] = DESCALE(tmp4 + z1 + z3, FDCT_CONST_BITS + FDCT_PASS1_BITS);
+        p[40] = DESCALE(tmp5 + z2 + z4, FDCT_CONST_BITS + FDCT_PASS1_BITS);
+        p[24] = DESCALE(tmp6 + z2 + z3, FDCT_CONST_BITS + FDCT_PASS1_BITS);
+        p[8] = DESCALE(tmp7 + z1 + z4, FDCT_CONST_BITS + FDCT_PASS1_BITS);
+    }
+}
+
+// Quantize with rounding to nearest, output in zigzag order
+static void quantize_block(const int32_t *d, const uint16_t *recip, int16_t *coef)
+{
+    for (int k = 0; k < 64; k++) {
+        int32_t v = d[app_jpeg_zigzag[k]];
+        int32_t a = v < 0 ? -v : v;
+        int32_t q = (a * recip[k] + (1 << (QUANT_BITS - 1))) >> QUANT_BITS;
+        if (q > 1023) {
+            q = 1023;
+        }
+        coef[k] = v < 0 ? -q : q;
+    }
+}
+
+// fdct_block() and quantize_block() are the whole per-block arithmetic and stay scalar
+// C on every target, so the Linux build runs the same code as the device
+static void encode_block(jpeg_scan_writer_t *wr, int comp, int32_t *d, int16_t *coef)
+{
+    int t = comp ? 1 : 0;
+    fdct_block(d);
+    quantize_block(d, g_tables.recip[t], coef);
+    app_jpeg_write_coefs(wr, comp, &g_huff[2 * t], &g_huff[2 * t + 1], coef);
+}
+
+static esp_err_t encode_range(encode_job_t *job)
+{
+    int mcus_x = (job->width + 15) / 16;
+    size_t stride = (size_t)job->width * 2;
+    int32_t y[2][64];
+    int32_t cb[64];
+    int32_t cr[64];
+    int16_t coef[64];
+
+    jpeg_scan_writer_t wr;
+    app_jpeg_scan_writer_init(&wr, job->out, job->cap);
+    // The marker before row r is RST((r - 1) % 8)
+    wr.next_rst = job->first_row ? (job->first_row - 1) & 7 : 0;
+
+    for (int row = job->first_row; row < job->end_row; row++) {
+        if (row > 0) {
+            app_jpeg_write_restart(&wr);
+        }
+        for (int mx = 0; mx < mcus_x; mx++) {
+            int x0 = mx * 16;
+            bool inside = (x0 + 16 <= job->width);
+            for (int r = 0; r < 8; r++) {
+                // Edges are padded by repeating the last row / column
+                int sy = row * 8 + r;
+                if (sy >= job->height) {
+                    sy = job->height - 1;
+                }
+                const uint8_t *src = job->in + sy * stride;
+                int32_t *ly = &y[0][r * 8];
+                int32_t *ry = &y[1][r * 8];
+                if (inside) {
+                    const uint8_t *p = src + x0 * 2;
+                    for (int i = 0; i < 8; i++) {
+                        ly[i] = p[2 * i] - 128;
+                        ry[i] = p[16 + 2 * i] - 128;
+                        cb[r * 8 + i] = p[4 * i + 1] - 128;
+                        cr[r * 8 + i] = p[4 * i + 3] - 128;
+                    }
+                    continue;
+                }
+                for (int i = 0; i < 16; i++) {
+                    int sx = x0 + i < job->width ? x0 + i : job->width - 1;
+                    (i < 8 ? ly : ry)[i & 7] = src[sx * 2] - 128;
+                }
+                for (int i = 0; i < 8; i++) {
+                    int sx = x0 + 2 * i < job->width ? x0 + 2 * i : job->width - 2;
+                    cb[r * 8 + i] = src[sx * 2 + 1] - 128;
+                    cr[r * 8 + i] = src[sx * 2 + 3] - 128;
+                }
+            }
+            encode_block(&wr, 0, y[0], coef);
+            encode_block(&wr, 0, y[1], coef);
+            encode_block(&wr, 1, cb, coef);
+            encode_block(&wr, 2, cr, coef);
+        }
+        if (wr.bw.failed) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+    }
+    job->len = app_jpeg_scan_writer_finish(&wr);
+    return job->len > 0 || job->first_row == job->end_row ? ESP_OK : ESP_ERR_INVALID_SIZE;
+}
+
+static void encode_task(void *arg)
+{
+    encode_worker_t *worker = (encode_worker_t *)arg;
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        worker->job.result = encode_range(&worker->job);
+        xSemaphoreGive(g_done);
+    }
+}
+
+static size_t write_header(uint8_t *out, uint16_t width, uint16_t height, uint16_t restart_interval)
+{
+    static const uint8_t jfif[] = {
+        0xFF, JPEG_MARKER_APP0, 0x00, 0x10, 'J', 'F', 'I', 'F', 0x00, 0x01, 0x01, 0x00, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00,
+    };
+    size_t o = 0;
+
+    out[o++] = 0xFF;
+    out[o++] = JPEG_MARKER_SOI;
+    memcpy(&out[o], jfif, sizeof(jfif));
+    o += sizeof(jfif);
+
+    for (int t = 0; t < 2; t++) {
+        out[o++] = 0xFF;
+        out[o++] = JPEG_MARKER_DQT;
+        out[o++] = 0x00;
+        out[o++] = 67;
+        out[o++] = t;
+        memcpy(&out[o], g_tables.quant[t], 64);
+        o += 64;
+    }
+
+    // SOF0: 4:2:2, luma 2x1, chroma 1x1
+    const uint8_t sof[] = {
+        0xFF, JPEG_MARKER_SOF0, 0x00, 17, 8,
+        height >> 8, height & 0xFF, width >> 8, width & 0xFF,
+        3, 1, 0x21, 0, 2, 0x11, 1, 3, 0x11, 1,
+    };
+    memcpy(&out[o], sof, sizeof(sof));
+    o += sizeof(sof);
+
+    memcpy(&out[o], app_jpeg_std_dht, JPEG_STD_DHT_LEN);
+    o += JPEG_STD_DHT_LEN;
+
+    const uint8_t dri[] = { 0xFF, JPEG_MARKER_DRI, 0x00, 0x04, restart_interval >> 8, restart_interval & 0xFF };
+    memcpy(&out[o], dri, sizeof(dri));
+    o += sizeof(dri);
+
+    const uint8_t sos[] = { 0xFF, JPEG_MARKER_SOS, 0x00, 12, 3, 1, 0x00, 2, 0x11, 3, 0x11, 0, 63, 0 };
+    memcpy(&out[o], sos, sizeof(sos));
+    o += sizeof(sos);
+    return o;
+}
+
+esp_err_t app_jpeg_encode_init(void)
+{
+    // Encoding tables from the standard DHT segment (marker and length skipped)
+    jpeg_info_t *info = calloc(1, sizeof(jpeg_info_t));
+    if (info == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t err = app_jpeg_load_dht(info, app_jpeg_std_dht + 4, JPEG_STD_DHT_LEN - 4);
+    if (err == ESP_OK) {
+        for (int t = 0; t < 2; t++) {
+            app_jpeg_enc_from_dec(&info->dc[t], &g_huff[2 * t]);
+            app_jpeg_enc_from_dec(&info->ac[t], &g_huff[2 * t + 1]);
+        }
+    }
+    free(info);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    g_encode_mutex = xSemaphoreCreateMutex();
+    g_done = xSemaphoreCreateCounting(portNUM_PROCESSORS, 0);
+    if (g_encode_mutex == NULL || g_done == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        BaseType_t ret = xTaskCreatePinnedToCore(encode_task, "jpeg_enc", ENCODE_TASK_STACK, &g_workers[core],
+                                                 ENCODE_TASK_PRIORITY, &g_workers[core].task, core);
+        if (ret != pdPASS) {
+            ESP_LOGE(TAG, "Failed to create encode task on core %d", core);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t app_jpeg_encode_yuy2(const uint8_t *in, uint16_t width, uint16_t height,
+                               const jpeg_encode_config_t *config, uint8_t *out, size_t out_cap,
+                               jpeg_encode_result_t *result)
+{
+    if (width < 2 || (width & 1) || height == 0 || config->quality < 1 || config->quality > 100 ||
+        g_encode_mutex == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (out_cap < HEADER_LEN + 2) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    int64_t t0 = esp_timer_get_time();
+    uint16_t mcus_x = (width + 15) / 16;
+    uint16_t rows = (height + 7) / 8;
+    uint32_t workers = config->max_workers ? config->max_workers : portNUM_PROCESSORS;
+    if (workers > portNUM_PROCESSORS) {
+        workers = portNUM_PROCESSORS;
+    }
+    if (workers > rows) {
+        workers = rows;
+    }
+
+    xSemaphoreTake(g_encode_mutex, portMAX_DELAY);
+
+    if (g_tables.quality != config->quality) {
+        tables_set_quality(&g_tables, config->quality);
+    }
+    size_t hdr = write_header(out, width, height, mcus_x);
+
+    // Each band gets an equal share of the remaining buffer, EOI excluded
+    size_t slice = (out_cap - hdr - 2) / workers;
+    int my_core = xPortGetCoreID();
+    encode_job_t local;
+    encode_job_t *jobs[portNUM_PROCESSORS];
+    encode_worker_t *helpers[portNUM_PROCESSORS];
+    uint32_t num_helpers = 0;
+    int core = 0;
+    for (uint32_t w = 0; w < workers; w++) {
+        encode_job_t *job = &local;
+        if (w > 0) {
+            if (core == my_core) {
+                core++;
+            }
+            helpers[num_helpers++] = &g_workers[core];
+            job = &g_workers[core++].job;
+        }
+        *job = (encode_job_t) {
+            .in = in,
+            .width = width,
+            .height = height,
+            .first_row = rows * w / workers,
+            .end_row = rows * (w + 1) / workers,
+            .out = out + hdr + w * slice,
+            .cap = slice,
+        };
+        jobs[w] = job;
+    }
+    for (uint32_t i = 0; i < num_helpers; i++) {
+        xTaskNotifyGive(helpers[i]->task);
+    }
+    esp_err_t err = encode_range(&local);
+    for (uint32_t i = 0; i < num_helpers; i++) {
+        xSemaphoreTake(g_done, portMAX_DELAY);
+    }
+    for (uint32_t i = 0; i < num_helpers && err == ESP_OK; i++) {
+        err = helpers[i]->job.result;
+    }
+
+    // Close the gaps between bands
+    size_t o = hdr;
+    for (uint32_t w = 0; w < workers && err == ESP_OK; w++) {
+        if (jobs[w]->out != out + o) {
+            memmove(out + o, jobs[w]->out, jobs[w]->len);
+        }
+        o += jobs[w]->len;
+    }
+
+    xSemaphoreGive(g_encode_mutex);
+
+    if (err != ESP_OK) {
+        return err;
+    }
+    out[o++] = 0xFF;
+    out[o++] = JPEG_MARKER_EOI;
+
+    if (result != NULL) {
+        result->len = o;
+        result->workers = workers;
+        result->encode_us = (uint32_t)(esp_timer_get_time() - t0);
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "esp_err.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Baseline JPEG encoder for cameras that only deliver uncompressed YUY2. YUY2 is
+ * already 4:2:2, so samples go straight into 16x8 MCUs without color conversion.
+ * The forward DCT is integer-only and quantization multiplies by reciprocals; the
+ * standard Huffman tables are used so no statistics pass is needed. Every MCU row
+ * is its own restart interval, which lets the rows be encoded on all cores at once
+ * and gives the output the same restart structure the rest of the pipeline expects.
+ */
+
+/**
+ * @brief Encoder settings
+ */
+typedef struct {
+    uint8_t quality;        // 1-100, IJG scaling of the Annex K tables
+    uint8_t max_workers;    // Cores to use, 0 for all of them
+} jpeg_encode_config_t;
+
+/**
+ * @brief Result of an encode
+ */
+typedef struct {
+    size_t len;             // JPEG size in bytes
+    uint8_t workers;        // Cores that took part
+    uint32_t encode_us;
+} jpeg_encode_result_t;
+
+/**
+ * @brief Start one helper task per core for parallel encoding
+ *
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if the tasks cannot be created
+ */
+esp_err_t app_jpeg_encode_init(void);
+
+/**
+ * @brief Encode a YUY2 frame (Y0 U Y1 V, packed rows) to a baseline JPEG
+ *
+ * Bands of MCU rows are encoded in parallel and joined at their restart markers.
+ * Encodes are serialized, concurrent callers wait.
+ *
+ * @param in YUY2 frame, width * 2 bytes per row
+ * @param width Frame width, even
+ * @param height Frame height
+ * @param config Quality and worker limit
+ * @param out Output buffer
+ * @param out_cap Capacity of out
+ * @param[out] result Size and timing (may be NULL)
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG for a bad size or quality,
+ *         ESP_ERR_INVALID_SIZE if out is too small, ESP_ERR_NO_MEM
+ */
+esp_err_t app_jpeg_encode_yuy2(const uint8_t *in, uint16_t width, uint16_t height,
+                               const jpeg_encode_config_t *config, uint8_t *out, size_t out_cap,
+                               jpeg_encode_result_t *result);
+
+#ifdef __cplusplus
+}
+#endif
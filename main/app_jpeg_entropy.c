@@ -0,0 +1,1050 @@
+#include "app_jpeg_entropy.h"
+#include "app_jpeg.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include "esp_heap_caps.h"
+
+// ============================================================================
+// Header parsing
+// ============================================================================
+
+static esp_err_t build_dec(jpeg_huff_dec_t *dec, const uint8_t *bits, const uint8_t *huffval)
+{
+    uint32_t code = 0;
+    int k = 0;
+
+    memcpy(dec->bits, bits, 17);
+    dec->bits[0] = 0;
+    for (int l = 1; l <= 16; l++) {
+        dec->valoffset[l] = k - (int32_t)code;
+        code += bits[l];
+        k += bits[l];
+        dec->maxcode[l] = bits[l] ? (int32_t)code - 1 : -1;
+        if (code > (1u << l) || k > 256) {
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+        code <<= 1;
+    }
+    dec->maxcode[17] = INT32_MAX;
+    memcpy(dec->huffval, huffval, k);
+
+    memset(dec->lookup, 0, sizeof(dec->lookup));
+    code = 0;
+    int p = 0;
+    for (int l = 1; l <= JPEG_HUFF_LOOKAHEAD; l++) {
+        for (int i = 0; i < bits[l]; i++, p++, code++) {
+            uint32_t first = code << (JPEG_HUFF_LOOKAHEAD - l);
+            uint32_t count = 1u << (JPEG_HUFF_LOOKAHEAD - l);
+            for (uint32_t j = 0; j < count; j++) {
+                dec->lookup[first + j] = (uint16_t)((l << 8) | huffval[p]);
+            }
+        }
+        code <<= 1;
+    }
+    dec->present = true;
+    return ESP_OK;
+}
+
+esp_err_t app_jpeg_load_dht(jpeg_info_t *info, const uint8_t *seg, size_t seg_len)
+{
+    size_t p = 0;
+    while (p < seg_len) {
+        if (p + 17 > seg_len) {
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+        uint8_t tc = seg[p] >> 4;
+        uint8_t th = seg[p] & 0x0F;
+        if (tc > 1 || th > 3) {
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+        uint8_t bits[17] = {0};
+        size_t total = 0;
+        for (int l = 1; l <= 16; l++) {
+            bits[l] = seg[p + l];
+            total += bits[l];
+        }
+        p += 17;
+        if (total > 256 || p + total > seg_len) {
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+        esp_err_t err = build_dec(tc ? &info->ac[th] : &info->dc[th], bits, &seg[p]);
+        if (err != ESP_OK) {
+            return err;
+        }
+        p += total;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t parse_sof(jpeg_info_t *info, const uint8_t *seg, size_t n)
+{
+    if (n < 6 || seg[0] != 8) {
+        return seg[0] != 8 ? ESP_ERR_NOT_SUPPORTED : ESP_ERR_INVALID_RESPONSE;
+    }
+    info->height = (seg[1] << 8) | seg[2];
+    info->width = (seg[3] << 8) | seg[4];
+    info->num_components = seg[5];
+    if (info->width == 0 || info->height == 0) {
+        return ESP_ERR_NOT_SUPPORTED;   // DNL-defined height
+    }
+    if (info->num_components == 0 || info->num_components > JPEG_MAX_COMPONENTS ||
+        n < 6 + 3 * (size_t)info->num_components) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    for (int i = 0; i < info->num_components; i++) {
+        jpeg_component_t *c = &info->comp[i];
+        c->id = seg[6 + 3 * i];
+        c->h = seg[7 + 3 * i] >> 4;
+        c->v = seg[7 + 3 * i] & 0x0F;
+        c->tq = seg[8 + 3 * i] & 0x03;
+        if (c->h < 1 || c->h > 4 || c->v < 1 || c->v > 4) {
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+        if (c->h > info->h_max) {
+            info->h_max = c->h;
+        }
+        if (c->v > info->v_max) {
+            info->v_max = c->v;
+        }
+    }
+    return ESP_OK;
+}
+
+static esp_err_t parse_sos(jpeg_info_t *info, const uint8_t *seg, size_t n)
+{
+    if (info->num_components == 0 || n < 1) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    uint8_t ns = seg[0];
+    if (n < 1 + 2 * (size_t)ns + 3) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    // Only a single scan carrying every component is supported (baseline MJPEG)
+    if (ns != info->num_components) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    const uint8_t *p = &seg[1 + 2 * ns];
+    if (p[0] != 0 || p[1] != 63 || p[2] != 0) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    uint8_t scan_order[JPEG_MAX_COMPONENTS];
+    for (int i = 0; i < ns; i++) {
+        uint8_t cs = seg[1 + 2 * i];
+        int idx = -1;
+        for (int c = 0; c < info->num_components; c++) {
+            if (info->comp[c].id == cs) {
+                idx = c;
+                break;
+            }
+        }
+        if (idx < 0) {
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+        info->comp[idx].td = seg[2 + 2 * i] >> 4;
+        info->comp[idx].ta = seg[2 + 2 * i] & 0x0F;
+        if (info->comp[idx].td > 3 || info->comp[idx].ta > 3 ||
+            !info->dc[info->comp[idx].td].present || !info->ac[info->comp[idx].ta].present) {
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+        scan_order[i] = idx;
+    }
+
+    if (info->num_components == 1) {
+        // Non-interleaved scan: one block per MCU regardless of sampling factors
+        info->mcus_x = (info->width + 7) / 8;
+        info->mcus_y = (info->height + 7) / 8;
+        info->blocks_per_mcu = 1;
+        info->mcu_comp[0] = 0;
+        return ESP_OK;
+    }
+
+    info->mcus_x = (info->width + 8 * info->h_max - 1) / (8 * info->h_max);
+    info->mcus_y = (info->height + 8 * info->v_max - 1) / (8 * info->v_max);
+    info->blocks_per_mcu = 0;
+    for (int i = 0; i < ns; i++) {
+        const jpeg_component_t *c = &info->comp[scan_order[i]];
+        for (int b = 0; b < c->h * c->v; b++) {
+            if (info->blocks_per_mcu >= JPEG_MAX_BLOCKS_IN_MCU) {
+                return ESP_ERR_INVALID_RESPONSE;
+            }
+            info->mcu_comp[info->blocks_per_mcu++] = scan_order[i];
+        }
+    }
+    return ESP_OK;
+}
+
+static esp_err_t parse_dqt(jpeg_info_t *info, const uint8_t *seg, size_t n)
+{
+    size_t p = 0;
+    while (p < n) {
+        uint8_t pq = seg[p] >> 4;
+        uint8_t tq = seg[p] & 0x0F;
+        size_t size = pq ? 128 : 64;
+        if (tq > 3 || pq > 1 || p + 1 + size > n) {
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+        for (int i = 0; i < 64; i++) {
+            info->quant[tq][i] = pq ? (seg[p + 1 + 2 * i] << 8) | seg[p + 2 + 2 * i] : seg[p + 1 + i];
+        }
+        info->quant_present |= 1 << tq;
+        p += 1 + size;
+    }
+    return ESP_OK;
+}
+
+// Parse the marker segment at pos. SOS completes the header.
+static esp_err_t parse_segment_at(jpeg_info_t *info, const uint8_t *data, size_t len, size_t pos)
+{
+    if (pos + 4 > len || data[pos] != 0xFF) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    uint8_t marker = data[pos + 1];
+    size_t seg_len = ((size_t)data[pos + 2] << 8) | data[pos + 3];
+    if (seg_len < 2 || pos + 2 + seg_len > len) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    const uint8_t *seg = &data[pos + 4];
+    size_t n = seg_len - 2;
+
+    switch (marker) {
+    case JPEG_MARKER_SOF0:
+    case JPEG_MARKER_SOF1:
+        return parse_sof(info, seg, n);
+    case JPEG_MARKER_DHT:
+        return app_jpeg_load_dht(info, seg, n);
+    case JPEG_MARKER_DQT:
+        return parse_dqt(info, seg, n);
+    case JPEG_MARKER_DRI:
+        if (n < 2) {
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+        info->restart_interval = (seg[0] << 8) | seg[1];
+        return ESP_OK;
+    case JPEG_MARKER_SOS:
+        if (info->num_components == 0) {
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+        info->sos_pos = pos;
+        info->scan_pos = pos + 2 + seg_len;
+        return parse_sos(info, seg, n);
+    default:
+        // Progressive, lossless, hierarchical and arithmetic-coded frames
+        if (marker >= 0xC2 && marker <= 0xCF && marker != JPEG_MARKER_DHT && marker != 0xC8 && marker != 0xCC) {
+            return ESP_ERR_NOT_SUPPORTED;
+        }
+        return ESP_OK;
+    }
+}
+
+esp_err_t app_jpeg_parse_info(const uint8_t *data, size_t len, const jpeg_index_t *index, jpeg_info_t *info)
+{
+    memset(info, 0, sizeof(*info));
+
+    // UVC MJPEG usually relies on the standard tables, frame tables override them
+    esp_err_t err = app_jpeg_load_dht(info, app_jpeg_std_dht + 4, JPEG_STD_DHT_LEN - 4);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    if (len < 4 || data[0] != 0xFF || data[1] != JPEG_MARKER_SOI) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+
+    if (index != NULL) {
+        // Jump straight to the segments found at ingest
+        if (index->sof_pos == 0 || index->sos_pos == 0) {
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+        err = parse_segment_at(info, data, len, index->sof_pos);
+        for (int i = 0; i < index->num_dqt && err == ESP_OK; i++) {
+            err = parse_segment_at(info, data, len, index->dqt_pos[i]);
+        }
+        for (int i = 0; i < index->num_dht && err == ESP_OK; i++) {
+            err = parse_segment_at(info, data, len, index->dht_pos[i]);
+        }
+        if (index->dri_pos && err == ESP_OK) {
+            err = parse_segment_at(info, data, len, index->dri_pos);
+        }
+        if (err == ESP_OK) {
+            err = parse_segment_at(info, data, len, index->sos_pos);
+        }
+        return err;
+    }
+
+    size_t pos = 2;
+    while (pos + 4 <= len) {
+        if (data[pos] != 0xFF) {
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+        uint8_t marker = data[pos + 1];
+        if (marker == 0xFF) {
+            pos++;
+            continue;
+        }
+        if (marker == JPEG_MARKER_EOI) {
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+        err = parse_segment_at(info, data, len, pos);
+        if (err != ESP_OK || marker == JPEG_MARKER_SOS) {
+            return err;
+        }
+        pos += 2 + (((size_t)data[pos + 2] << 8) | data[pos + 3]);
+    }
+    return ESP_ERR_INVALID_RESPONSE;
+}
+
+// ============================================================================
+// Bit reader
+// ============================================================================
+
+static inline void br_fill(jpeg_bit_reader_t *br)
+{
+    while (br->bits <= 24) {
+        uint32_t byte = 0;
+        if (!br->marker_hit) {
+            if (br->pos >= br->len) {
+                br->marker_hit = true;
+            } else if (br->data[br->pos] != 0xFF) {
+                byte = br->data[br->pos++];
+            } else if (br->pos + 1 < br->len && br->data[br->pos + 1] == 0x00) {
+                byte = 0xFF;
+                br->pos += 2;
+            } else {
+                // Marker (RSTn, EOI or garbage): stop here, feed zeros
+                br->marker_hit = true;
+            }
+        }
+        br->acc |= byte << (24 - br->bits);
+        br->bits += 8;
+    }
+}
+
+static inline void br_skip(jpeg_bit_reader_t *br, int n)
+{
+    br->acc <<= n;
+    br->bits -= n;
+}
+
+static inline uint32_t br_get(jpeg_bit_reader_t *br, int n)
+{
+    if (n == 0) {
+        return 0;
+    }
+    br_fill(br);
+    uint32_t v = br->acc >> (32 - n);
+    br_skip(br, n);
+    return v;
+}
+
+static inline int huff_decode(jpeg_bit_reader_t *br, const jpeg_huff_dec_t *t)
+{
+    br_fill(br);
+    uint16_t e = t->lookup[br->acc >> (32 - JPEG_HUFF_LOOKAHEAD)];
+    if (e) {
+        br_skip(br, e >> 8);
+        return e & 0xFF;
+    }
+    for (int l = JPEG_HUFF_LOOKAHEAD + 1; l <= 16; l++) {
+        int32_t code = (int32_t)(br->acc >> (32 - l));
+        if (code <= t->maxcode[l]) {
+            br_skip(br, l);
+            return t->huffval[code + t->valoffset[l]];
+        }
+    }
+    return -1;
+}
+
+static inline int extend(uint32_t v, int s)
+{
+    return v < (1u << (s - 1)) ? (int)v - (1 << s) + 1 : (int)v;
+}
+
+// ============================================================================
+// Scan reader
+// ============================================================================
+
+void app_jpeg_scan_reader_init(jpeg_scan_reader_t *rd, const jpeg_info_t *info, const uint8_t *data, size_t len)
+{
+    memset(rd, 0, sizeof(*rd));
+    rd->info = info;
+    rd->br.data = data;
+    rd->br.pos = info->scan_pos;
+    rd->br.len = len;
+}
+
+static esp_err_t process_restart(jpeg_scan_reader_t *rd)
+{
+    jpeg_bit_reader_t *br = &rd->br;
+    br->acc = 0;
+    br->bits = 0;
+    br->marker_hit = false;
+    while (br->pos + 1 < br->len && br->data[br->pos] == 0xFF && br->data[br->pos + 1] == 0xFF) {
+        br->pos++;
+    }
+    if (br->pos + 1 >= br->len || br->data[br->pos] != 0xFF ||
+        br->data[br->pos + 1] != JPEG_MARKER_RST0 + rd->next_rst) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    br->pos += 2;
+    rd->next_rst = (rd->next_rst + 1) & 7;
+    memset(rd->pred, 0, sizeof(rd->pred));
+    return ESP_OK;
+}
+
+uint32_t app_jpeg_scan_reader_seek(jpeg_scan_reader_t *rd, const jpeg_index_t *index, uint32_t mcu)
+{
+    const jpeg_info_t *info = rd->info;
+    if (index == NULL || info->restart_interval == 0 || index->num_rst == 0 || index->rst_stride == 0) {
+        return rd->mcu_index;
+    }
+
+    // Restart marker number k (counting from 1) starts MCU k * restart_interval
+    uint32_t entry = mcu / info->restart_interval / index->rst_stride;
+    if (entry > index->num_rst) {
+        entry = index->num_rst;
+    }
+    uint32_t marker = entry * index->rst_stride;
+    uint32_t start = marker * info->restart_interval;
+    if (entry == 0 || start <= rd->mcu_index) {
+        return rd->mcu_index;
+    }
+
+    // Stop on the marker itself, app_jpeg_read_mcu() consumes it and resets the predictors
+    rd->br.pos = index->rst_pos[entry - 1];
+    rd->br.acc = 0;
+    rd->br.bits = 0;
+    rd->br.marker_hit = false;
+    rd->next_rst = (marker - 1) & 7;
+    rd->mcu_index = start;
+    return start;
+}
+
+static esp_err_t read_block(jpeg_bit_reader_t *br, const jpeg_huff_dec_t *dc, const jpeg_huff_dec_t *ac,
+                            int16_t *pred, jpeg_block_t *blk)
+{
+    int s = huff_decode(br, dc);
+    if (s < 0 || s > 11) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    int diff = s ? extend(br_get(br, s), s) : 0;
+    *pred += diff;
+    blk->dc = *pred;
+
+    int n = 0;
+    for (int k = 1; k < 64;) {
+        int rs = huff_decode(br, ac);
+        if (rs < 0) {
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+        int r = rs >> 4;
+        s = rs & 0x0F;
+        if (s) {
+            k += r;
+            if (k > 63) {
+                return ESP_ERR_INVALID_RESPONSE;
+            }
+            blk->ac_sym[n] = rs;
+            blk->ac_bits[n] = br_get(br, s);
+            n++;
+            k++;
+        } else if (r == 15) {
+            k += 16;
+            if (k > 64) {
+                return ESP_ERR_INVALID_RESPONSE;
+            }
+            blk->ac_sym[n] = rs;
+            blk->ac_bits[n] = 0;
+            n++;
+        } else if (r == 0) {
+            blk->ac_sym[n] = 0;
+            blk->ac_bits[n] = 0;
+            n++;
+            break;
+        } else {
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+    }
+    blk->num_ac = n;
+    return ESP_OK;
+}
+
+esp_err_t app_jpeg_read_mcu(jpeg_scan_reader_t *rd, jpeg_block_t *blocks)
+{
+    const jpeg_info_t *info = rd->info;
+
+    if (info->restart_interval && rd->mcu_index > 0 && rd->mcu_index % info->restart_interval == 0) {
+        esp_err_t err = process_restart(rd);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+
+    for (int b = 0; b < info->blocks_per_mcu; b++) {
+        const jpeg_component_t *c = &info->comp[info->mcu_comp[b]];
+        esp_err_t err = read_block(&rd->br, &info->dc[c->td], &info->ac[c->ta],
+                                   &rd->pred[info->mcu_comp[b]], &blocks[b]);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    rd->mcu_index++;
+    return ESP_OK;
+}
+
+// ============================================================================
+// Bit writer
+// ============================================================================
+
+static inline void bw_emit(jpeg_bit_writer_t *w, uint8_t byte)
+{
+    if (w->pos + 2 > w->cap) {
+        w->failed = true;
+        return;
+    }
+    w->out[w->pos++] = byte;
+    if (byte == 0xFF) {
+        w->out[w->pos++] = 0x00;
+    }
+}
+
+static inline void bw_put(jpeg_bit_writer_t *w, uint32_t code, int size)
+{
+    w->acc = (w->acc << size) | (code & ((1u << size) - 1));
+    w->bits += size;
+    while (w->bits >= 8) {
+        w->bits -= 8;
+        bw_emit(w, (uint8_t)(w->acc >> w->bits));
+    }
+    w->acc &= (1u << w->bits) - 1;
+}
+
+static void bw_pad(jpeg_bit_writer_t *w)
+{
+    if (w->bits > 0) {
+        bw_put(w, 0x7F, 8 - w->bits);
+    }
+}
+
+void app_jpeg_scan_writer_init(jpeg_scan_writer_t *wr, uint8_t *out, size_t cap)
+{
+    memset(wr, 0, sizeof(*wr));
+    wr->bw.out = out;
+    wr->bw.cap = cap;
+}
+
+void app_jpeg_write_block(jpeg_scan_writer_t *wr, int comp, const jpeg_huff_enc_t *dc,
+                          const jpeg_huff_enc_t *ac, const jpeg_block_t *blk)
+{
+    jpeg_bit_writer_t *w = &wr->bw;
+    int diff = blk->dc - wr->pred[comp];
+    wr->pred[comp] = blk->dc;
+
+    int a = diff < 0 ? -diff : diff;
+    int nbits = a ? 32 - __builtin_clz(a) : 0;
+    if (dc->size[nbits] == 0) {
+        w->failed = true;
+        w->no_code = true;
+        return;
+    }
+    bw_put(w, dc->code[nbits], dc->size[nbits]);
+    if (nbits) {
+        bw_put(w, (uint32_t)(diff < 0 ? diff - 1 : diff), nbits);
+    }
+
+    for (int i = 0; i < blk->num_ac; i++) {
+        uint8_t sym = blk->ac_sym[i];
+        if (ac->size[sym] == 0) {
+            w->failed = true;
+            w->no_code = true;
+            return;
+        }
+        bw_put(w, ac->code[sym], ac->size[sym]);
+        if (sym & 0x0F) {
+            bw_put(w, blk->ac_bits[i], sym & 0x0F);
+        }
+    }
+}
+
+void app_jpeg_write_coefs(jpeg_scan_writer_t *wr, int comp, const jpeg_huff_enc_t *dc,
+                          const jpeg_huff_enc_t *ac, const int16_t coef[64])
+{
+    jpeg_bit_writer_t *w = &wr->bw;
+    int diff = coef[0] - wr->pred[comp];
+    wr->pred[comp] = coef[0];
+
+    int a = diff < 0 ? -diff : diff;
+    int nbits = a ? 32 - __builtin_clz(a) : 0;
+    bw_put(w, dc->code[nbits], dc->size[nbits]);
+    if (nbits) {
+        bw_put(w, (uint32_t)(diff < 0 ? diff - 1 : diff), nbits);
+    }
+
+    int run = 0;
+    for (int k = 1; k < 64; k++) {
+        int v = coef[k];
+        if (v == 0) {
+            run++;
+            continue;
+        }
+        while (run > 15) {
+            bw_put(w, ac->code[0xF0], ac->size[0xF0]);
+            run -= 16;
+        }
+        a = v < 0 ? -v : v;
+        nbits = 32 - __builtin_clz(a);
+        int sym = (run << 4) | nbits;
+        bw_put(w, ac->code[sym], ac->size[sym]);
+        bw_put(w, (uint32_t)(v < 0 ? v - 1 : v), nbits);
+        run = 0;
+    }
+    if (run > 0) {
+        bw_put(w, ac->code[0x00], ac->size[0x00]);
+    }
+}
+
+void app_jpeg_write_restart(jpeg_scan_writer_t *wr)
+{
+    jpeg_bit_writer_t *w = &wr->bw;
+    bw_pad(w);
+    if (w->pos + 2 > w->cap) {
+        w->failed = true;
+        return;
+    }
+    w->out[w->pos++] = 0xFF;
+    w->out[w->pos++] = JPEG_MARKER_RST0 + wr->next_rst;
+    wr->next_rst = (wr->next_rst + 1) & 7;
+    memset(wr->pred, 0, sizeof(wr->pred));
+}
+
+void app_jpeg_write_raw(jpeg_scan_writer_t *wr, const uint8_t *data, size_t len)
+{
+    jpeg_bit_writer_t *w = &wr->bw;
+    if (w->bits != 0 || w->pos + len > w->cap) {
+        w->failed = true;
+        return;
+    }
+    memcpy(&w->out[w->pos], data, len);
+    w->pos += len;
+}
+
+esp_err_t app_jpeg_copy_scan_tail(jpeg_scan_reader_t *rd, jpeg_scan_writer_t *wr)
+{
+    jpeg_bit_reader_t *br = &rd->br;
+    jpeg_bit_writer_t *w = &wr->bw;
+    if (br->marker_hit) {
+        // Some buffered bits may be the zeros fed past the end
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // Bits the reader has buffered but not consumed
+    while (br->bits > 0) {
+        int n = br->bits > 16 ? 16 : br->bits;
+        bw_put(w, br->acc >> (32 - n), n);
+        br_skip(br, n);
+    }
+
+    size_t end = br->pos;
+    while (end < br->len) {
+        const uint8_t *ff = memchr(&br->data[end], 0xFF, br->len - end);
+        if (ff == NULL) {
+            end = br->len;
+            break;
+        }
+        end = ff - br->data;
+        if (end + 1 < br->len && br->data[end + 1] == 0x00) {
+            end += 2;
+        } else {
+            break;
+        }
+    }
+
+    if (w->bits == 0) {
+        // Same alignment: the stuffed bytes can be taken as they are
+        app_jpeg_write_raw(wr, &br->data[br->pos], end - br->pos);
+    } else {
+        for (size_t p = br->pos; p < end; p++) {
+            bw_put(w, br->data[p], 8);
+            if (br->data[p] == 0xFF) {
+                p++;    // Stuffed zero
+            }
+        }
+    }
+    br->pos = end;
+    br->marker_hit = true;
+    return w->failed ? ESP_ERR_INVALID_SIZE : ESP_OK;
+}
+
+size_t app_jpeg_scan_writer_finish(jpeg_scan_writer_t *wr)
+{
+    bw_pad(&wr->bw);
+    return wr->bw.failed ? 0 : wr->bw.pos;
+}
+
+// ============================================================================
+// Huffman tables
+// ============================================================================
+
+void app_jpeg_build_enc(const uint8_t bits[17], const uint8_t *huffval, jpeg_huff_enc_t *enc)
+{
+    memset(enc, 0, sizeof(*enc));
+    uint32_t code = 0;
+    int p = 0;
+    for (int l = 1; l <= 16; l++) {
+        for (int i = 0; i < bits[l]; i++, p++, code++) {
+            enc->code[huffval[p]] = code;
+            enc->size[huffval[p]] = l;
+        }
+        code <<= 1;
+    }
+}
+
+void app_jpeg_enc_from_dec(const jpeg_huff_dec_t *dec, jpeg_huff_enc_t *enc)
+{
+    app_jpeg_build_enc(dec->bits, dec->huffval, enc);
+}
+
+void app_jpeg_block_from_coefs(const int16_t coef[64], jpeg_block_t *blk)
+{
+    int n = 0;
+    int run = 0;
+    blk->dc = coef[0];
+    for (int k = 1; k < 64; k++) {
+        int v = coef[k];
+        if (v == 0) {
+            run++;
+            continue;
+        }
+        while (run > 15) {
+            blk->ac_sym[n] = 0xF0;
+            blk->ac_bits[n++] = 0;
+            run -= 16;
+        }
+        int a = v < 0 ? -v : v;
+        int size = 32 - __builtin_clz(a);
+        blk->ac_sym[n] = (run << 4) | size;
+        blk->ac_bits[n++] = (uint16_t)((v < 0 ? v - 1 : v) & ((1 << size) - 1));
+        run = 0;
+    }
+    if (run > 0) {
+        blk->ac_sym[n] = 0x00;
+        blk->ac_bits[n++] = 0;
+    }
+    blk->num_ac = n;
+}
+
+void app_jpeg_block_to_coefs(const jpeg_block_t *blk, int16_t coef[64])
+{
+    memset(coef, 0, 64 * sizeof(int16_t));
+    coef[0] = blk->dc;
+    int k = 1;
+    for (int i = 0; i < blk->num_ac && k < 64; i++) {
+        uint8_t sym = blk->ac_sym[i];
+        int size = sym & 15;
+        if (size == 0) {
+            if (sym != 0xF0) {
+                break;
+            }
+            k += 16;
+            continue;
+        }
+        k += sym >> 4;
+        if (k < 64) {
+            coef[k++] = extend(blk->ac_bits[i], size);
+        }
+    }
+}
+
+void app_jpeg_count_block(const jpeg_block_t *blk, int16_t *pred, uint32_t dc_freq[257], uint32_t ac_freq[257])
+{
+    int diff = blk->dc - *pred;
+    *pred = blk->dc;
+    int a = diff < 0 ? -diff : diff;
+    dc_freq[a ? 32 - __builtin_clz(a) : 0]++;
+    for (int i = 0; i < blk->num_ac; i++) {
+        ac_freq[blk->ac_sym[i]]++;
+    }
+}
+
+int app_jpeg_gen_optimal_table(const uint32_t freq_in[257], uint8_t bits[17], uint8_t huffval[256])
+{
+#define MAX_CLEN 32
+    int64_t freq[257];
+    int codesize[257];
+    int others[257];
+    int bits_tmp[MAX_CLEN + 1];
+
+    for (int i = 0; i < 256; i++) {
+        freq[i] = freq_in[i];
+    }
+    // Reserve one code point so no real symbol gets an all-ones code
+    freq[256] = 1;
+    memset(codesize, 0, sizeof(codesize));
+    memset(bits_tmp, 0, sizeof(bits_tmp));
+    for (int i = 0; i < 257; i++) {
+        others[i] = -1;
+    }
+
+    // Huffman's algorithm, merging the two least frequent trees (ties go to the larger symbol)
+    while (true) {
+        int c1 = -1;
+        int c2 = -1;
+        int64_t v = INT64_MAX;
+        for (int i = 0; i <= 256; i++) {
+            if (freq[i] && freq[i] <= v) {
+                v = freq[i];
+                c1 = i;
+            }
+        }
+        v = INT64_MAX;
+        for (int i = 0; i <= 256; i++) {
+            if (freq[i] && freq[i] <= v && i != c1) {
+                v = freq[i];
+                c2 = i;
+            }
+        }
+        if (c2 < 0) {
+            break;
+        }
+        freq[c1] += freq[c2];
+        freq[c2] = 0;
+        codesize[c1]++;
+        while (others[c1] >= 0) {
+            c1 = others[c1];
+            codesize[c1]++;
+        }
+        others[c1] = c2;
+        codesize[c2]++;
+        while (others[c2] >= 0) {
+            c2 = others[c2];
+            codesize[c2]++;
+        }
+    }
+
+    for (int i = 0; i <= 256; i++) {
+        if (codesize[i]) {
+            if (codesize[i] > MAX_CLEN) {
+                return -1;
+            }
+            bits_tmp[codesize[i]]++;
+        }
+    }
+
+    // Limit code lengths to 16 bits (K.3 Figure K.3)
+    int i;
+    for (i = MAX_CLEN; i > 16; i--) {
+        while (bits_tmp[i] > 0) {
+            int j = i - 2;
+            while (bits_tmp[j] == 0) {
+                j--;
+            }
+            bits_tmp[i] -= 2;
+            bits_tmp[i - 1]++;
+            bits_tmp[j + 1] += 2;
+            bits_tmp[j]--;
+        }
+    }
+    // Drop the reserved code point from the longest length
+    while (bits_tmp[i] == 0) {
+        i--;
+    }
+    bits_tmp[i]--;
+
+    bits[0] = 0;
+    for (i = 1; i <= 16; i++) {
+        bits[i] = bits_tmp[i];
+    }
+
+    int p = 0;
+    for (i = 1; i <= MAX_CLEN; i++) {
+        for (int j = 0; j <= 255; j++) {
+            if (codesize[j] == i) {
+                huffval[p++] = j;
+            }
+        }
+    }
+    return p;
+#undef MAX_CLEN
+}
+
+size_t app_jpeg_write_dht(uint8_t *out, size_t cap, int num_tables, const uint8_t *classes_ids,
+                          const uint8_t (*bits)[17], const uint8_t (*huffvals)[256])
+{
+    size_t len = 2;
+    for (int t = 0; t < num_tables; t++) {
+        len += 17;
+        for (int l = 1; l <= 16; l++) {
+            len += bits[t][l];
+        }
+    }
+    if (len + 2 > cap) {
+        return 0;
+    }
+
+    size_t p = 0;
+    out[p++] = 0xFF;
+    out[p++] = JPEG_MARKER_DHT;
+    out[p++] = len >> 8;
+    out[p++] = len & 0xFF;
+    for (int t = 0; t < num_tables; t++) {
+        int count = 0;
+        out[p++] = classes_ids[t];
+        for (int l = 1; l <= 16; l++) {
+            out[p++] = bits[t][l];
+            count += bits[t][l];
+        }
+        memcpy(&out[p], huffvals[t], count);
+        p += count;
+    }
+    return p;
+}
+
+// ============================================================================
+// Huffman optimization
+// ============================================================================
+
+typedef struct {
+    jpeg_info_t info;
+    jpeg_block_t blocks[JPEG_MAX_BLOCKS_IN_MCU];
+    uint32_t freq[8][257];          // DC tables 0-3, AC tables 4-7
+    uint8_t bits[8][17];
+    uint8_t huffval[8][256];
+    jpeg_huff_enc_t enc[8];
+} optimize_work_t;
+
+esp_err_t app_jpeg_optimize_huffman(const uint8_t *in, size_t in_len, const jpeg_index_t *index,
+                                    uint8_t *out, size_t out_cap, size_t *out_len)
+{
+    optimize_work_t *w = heap_caps_calloc(1, sizeof(optimize_work_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (w == NULL) {
+        w = calloc(1, sizeof(optimize_work_t));
+        if (w == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    jpeg_info_t *info = &w->info;
+    esp_err_t err = app_jpeg_parse_info(in, in_len, index, info);
+    if (err != ESP_OK) {
+        goto done;
+    }
+
+    // Pass 1: gather symbol statistics with the same predictor resets as the scan
+    uint32_t total_mcus = (uint32_t)info->mcus_x * info->mcus_y;
+    jpeg_scan_reader_t rd;
+    int16_t pred[JPEG_MAX_COMPONENTS] = {0};
+    app_jpeg_scan_reader_init(&rd, info, in, in_len);
+    for (uint32_t m = 0; m < total_mcus; m++) {
+        if (info->restart_interval && m > 0 && m % info->restart_interval == 0) {
+            memset(pred, 0, sizeof(pred));
+        }
+        err = app_jpeg_read_mcu(&rd, w->blocks);
+        if (err != ESP_OK) {
+            goto done;
+        }
+        for (int b = 0; b < info->blocks_per_mcu; b++) {
+            int ci = info->mcu_comp[b];
+            const jpeg_component_t *c = &info->comp[ci];
+            app_jpeg_count_block(&w->blocks[b], &pred[ci], w->freq[c->td], w->freq[4 + c->ta]);
+        }
+    }
+
+    // Build tables for the selectors the scan actually uses
+    uint8_t classes_ids[8];
+    uint8_t (*bits)[17] = w->bits;
+    uint8_t (*huffval)[256] = w->huffval;
+    int num_tables = 0;
+    uint8_t used = 0;
+    for (int c = 0; c < info->num_components; c++) {
+        used |= 1 << info->comp[c].td;
+        used |= 1 << (4 + info->comp[c].ta);
+    }
+    for (int t = 0; t < 8; t++) {
+        if (!(used & (1 << t))) {
+            continue;
+        }
+        if (app_jpeg_gen_optimal_table(w->freq[t], bits[num_tables], huffval[num_tables]) < 0) {
+            err = ESP_ERR_INVALID_RESPONSE;
+            goto done;
+        }
+        app_jpeg_build_enc(bits[num_tables], huffval[num_tables], &w->enc[t]);
+        classes_ids[num_tables] = t < 4 ? t : (0x10 | (t - 4));
+        // Keep bits/huffval of table t at index num_tables, enc stays indexed by t
+        num_tables++;
+    }
+
+    // Header: everything up to SOS except the old tables, then the new DHT and the SOS segment
+    size_t o = 0;
+    size_t pos = 0;
+    if (out_cap < 2) {
+        err = ESP_ERR_INVALID_SIZE;
+        goto done;
+    }
+    out[o++] = 0xFF;
+    out[o++] = JPEG_MARKER_SOI;
+    pos = 2;
+    while (pos < info->sos_pos) {
+        if (in[pos + 1] == 0xFF) {
+            pos++;
+            continue;
+        }
+        size_t seg_total = 2 + (((size_t)in[pos + 2] << 8) | in[pos + 3]);
+        if (in[pos + 1] != JPEG_MARKER_DHT) {
+            if (o + seg_total > out_cap) {
+                err = ESP_ERR_INVALID_SIZE;
+                goto done;
+            }
+            memcpy(&out[o], &in[pos], seg_total);
+            o += seg_total;
+        }
+        pos += seg_total;
+    }
+    size_t n = app_jpeg_write_dht(&out[o], out_cap - o, num_tables, classes_ids,
+                                  (const uint8_t (*)[17])bits, (const uint8_t (*)[256])huffval);
+    size_t sos_total = info->scan_pos - info->sos_pos;
+    if (n == 0 || o + n + sos_total > out_cap) {
+        err = ESP_ERR_INVALID_SIZE;
+        goto done;
+    }
+    o += n;
+    memcpy(&out[o], &in[info->sos_pos], sos_total);
+    o += sos_total;
+
+    // Pass 2: re-encode
+    jpeg_scan_writer_t wr;
+    app_jpeg_scan_reader_init(&rd, info, in, in_len);
+    app_jpeg_scan_writer_init(&wr, &out[o], out_cap - o - 2);
+    for (uint32_t m = 0; m < total_mcus; m++) {
+        if (info->restart_interval && m > 0 && m % info->restart_interval == 0) {
+            app_jpeg_write_restart(&wr);
+        }
+        err = app_jpeg_read_mcu(&rd, w->blocks);
+        if (err != ESP_OK) {
+            goto done;
+        }
+        for (int b = 0; b < info->blocks_per_mcu; b++) {
+            int ci = info->mcu_comp[b];
+            const jpeg_component_t *c = &info->comp[ci];
+            app_jpeg_write_block(&wr, ci, &w->enc[c->td], &w->enc[4 + c->ta], &w->blocks[b]);
+        }
+        if (wr.bw.failed) {
+            err = ESP_ERR_INVALID_SIZE;
+            goto done;
+        }
+    }
+    n = app_jpeg_scan_writer_finish(&wr);
+    if (n == 0) {
+        err = ESP_ERR_INVALID_SIZE;
+        goto done;
+    }
+    o += n;
+    out[o++] = 0xFF;
+    out[o++] = JPEG_MARKER_EOI;
+    *out_len = o;
+    err = ESP_OK;
+
+done:
+    free(w);
+    return err;
+}
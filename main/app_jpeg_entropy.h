@@ -0,0 +1,360 @@
+#pragma once
+
+#include "esp_err.h"
+#include "app_jpeg.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Compressed-domain access to baseline JPEG scans.
+ *
+ * Blocks are handled at the level of Huffman symbols: the DC value is kept
+ * absolute (so blocks can be moved or dropped and the DC predictors rebuilt),
+ * AC coefficients are kept as the run/size symbols and their raw amplitude bits.
+ * Nothing is dequantized or transformed, which keeps lossless operations
+ * (table optimization, MCU crop, component removal, block replacement) cheap.
+ */
+
+#define JPEG_MAX_COMPONENTS     3
+#define JPEG_MAX_BLOCKS_IN_MCU  10
+#define JPEG_HUFF_LOOKAHEAD     9
+
+/**
+ * @brief Huffman decoding table
+ */
+typedef struct {
+    uint16_t lookup[1 << JPEG_HUFF_LOOKAHEAD];  // (code length << 8) | symbol, 0 for longer codes
+    int32_t maxcode[18];
+    int32_t valoffset[17];
+    uint8_t bits[17];
+    uint8_t huffval[256];
+    bool present;
+} jpeg_huff_dec_t;
+
+/**
+ * @brief Huffman encoding table
+ */
+typedef struct {
+    uint16_t code[256];
+    uint8_t size[256];
+} jpeg_huff_enc_t;
+
+/**
+ * @brief One image component as declared by SOF and SOS
+ */
+typedef struct {
+    uint8_t id;
+    uint8_t h;
+    uint8_t v;
+    uint8_t tq;             // Quantization table selector
+    uint8_t td;             // DC Huffman table selector
+    uint8_t ta;             // AC Huffman table selector
+} jpeg_component_t;
+
+/**
+ * @brief Everything needed to walk the scan of a baseline JPEG
+ */
+typedef struct {
+    uint16_t width;
+    uint16_t height;
+    uint8_t num_components;
+    jpeg_component_t comp[JPEG_MAX_COMPONENTS];
+    uint8_t h_max;
+    uint8_t v_max;
+    uint16_t mcus_x;
+    uint16_t mcus_y;
+    uint8_t blocks_per_mcu;
+    uint8_t mcu_comp[JPEG_MAX_BLOCKS_IN_MCU];   // Component index of every block of an MCU
+    uint16_t restart_interval;                  // MCUs per restart interval, 0 if none
+    uint16_t quant[4][64];                      // Quantization tables, zigzag order
+    uint8_t quant_present;                      // Bit n set when table n was defined
+    jpeg_huff_dec_t dc[4];
+    jpeg_huff_dec_t ac[4];
+    size_t sos_pos;                             // Offset of the SOS marker
+    size_t scan_pos;                            // Offset of the first entropy-coded byte
+} jpeg_info_t;
+
+/**
+ * @brief One 8x8 block in symbol form
+ */
+typedef struct {
+    int16_t dc;             // Absolute quantized DC value
+    uint8_t num_ac;         // Number of AC symbols, including ZRL and EOB
+    uint8_t ac_sym[64];     // Run/size symbols
+    uint16_t ac_bits[64];   // Raw amplitude bits for each symbol (size = low nibble)
+} jpeg_block_t;
+
+/**
+ * @brief Bit-level reader over entropy-coded data, handles byte stuffing
+ */
+typedef struct {
+    const uint8_t *data;
+    size_t pos;
+    size_t len;
+    uint32_t acc;           // Left-aligned bit buffer
+    int bits;               // Valid bits in acc
+    bool marker_hit;        // A marker was reached, zeros are fed from here on
+} jpeg_bit_reader_t;
+
+/**
+ * @brief Bit-level writer producing byte-stuffed entropy-coded data
+ */
+typedef struct {
+    uint8_t *out;
+    size_t pos;
+    size_t cap;
+    uint32_t acc;
+    int bits;
+    bool failed;            // Output buffer too small or symbol missing from a table
+    bool no_code;           // A symbol had no code in its table (failed is set as well)
+} jpeg_bit_writer_t;
+
+/**
+ * @brief Sequential MCU reader for a scan, tracks DC predictors and restart markers
+ */
+typedef struct {
+    const jpeg_info_t *info;
+    jpeg_bit_reader_t br;
+    int16_t pred[JPEG_MAX_COMPONENTS];
+    uint32_t mcu_index;
+    uint8_t next_rst;
+} jpeg_scan_reader_t;
+
+/**
+ * @brief Scan writer, tracks DC predictors of the output
+ */
+typedef struct {
+    jpeg_bit_writer_t bw;
+    int16_t pred[JPEG_MAX_COMPONENTS];
+    uint8_t next_rst;
+} jpeg_scan_writer_t;
+
+/**
+ * @brief Parse the header of a baseline (SOF0/SOF1) JPEG
+ *
+ * Tables missing from the frame (typical for UVC MJPEG) are taken from the standard
+ * Annex K tables.
+ *
+ * @param data JPEG frame
+ * @param len Length of the frame
+ * @param index Structure index of the frame, or NULL to walk the header
+ * @param[out] info Parsed header
+ * @return ESP_OK on success, ESP_ERR_NOT_SUPPORTED for progressive/arithmetic/12-bit
+ *         or non-interleaved multi-scan frames, ESP_ERR_INVALID_RESPONSE if malformed
+ */
+esp_err_t app_jpeg_parse_info(const uint8_t *data, size_t len, const jpeg_index_t *index, jpeg_info_t *info);
+
+/**
+ * @brief Load Huffman tables from a DHT segment payload into info
+ *
+ * @param info Header to update
+ * @param seg DHT payload, after the length field
+ * @param seg_len Payload length
+ * @return ESP_OK on success, ESP_ERR_INVALID_RESPONSE if malformed
+ */
+esp_err_t app_jpeg_load_dht(jpeg_info_t *info, const uint8_t *seg, size_t seg_len);
+
+/**
+ * @brief Build an encoding table from a bits/huffval specification
+ *
+ * @param bits Code counts per length, bits[1..16]
+ * @param huffval Symbols in code order
+ * @param[out] enc Encoding table
+ */
+void app_jpeg_build_enc(const uint8_t bits[17], const uint8_t *huffval, jpeg_huff_enc_t *enc);
+
+/**
+ * @brief Build an encoding table equivalent to a decoding table
+ *
+ * @param dec Decoding table
+ * @param[out] enc Encoding table
+ */
+void app_jpeg_enc_from_dec(const jpeg_huff_dec_t *dec, jpeg_huff_enc_t *enc);
+
+/**
+ * @brief Compute an optimal length-limited Huffman code (T.81 K.2)
+ *
+ * @param freq Symbol frequencies, freq[256] is ignored
+ * @param[out] bits Code counts per length, bits[1..16]
+ * @param[out] huffval Symbols in code order
+ * @return Number of symbols, or -1 if no valid code could be built
+ */
+int app_jpeg_gen_optimal_table(const uint32_t freq[257], uint8_t bits[17], uint8_t huffval[256]);
+
+/**
+ * @brief Start reading the scan of a frame
+ *
+ * @param rd Reader to initialize
+ * @param info Parsed header of the frame
+ * @param data JPEG frame
+ * @param len Length of the frame
+ */
+void app_jpeg_scan_reader_init(jpeg_scan_reader_t *rd, const jpeg_info_t *info, const uint8_t *data, size_t len);
+
+/**
+ * @brief Skip ahead using the restart markers recorded in the frame index
+ *
+ * Positions the reader at the last indexed restart marker that precedes mcu, so only
+ * the MCUs between that marker and mcu still have to be decoded. The reader never
+ * moves backwards and is left untouched when the scan has no usable markers.
+ *
+ * @param rd Reader
+ * @param index Structure index of the frame the reader was initialized with
+ * @param mcu MCU the caller wants to read next
+ * @return Index of the MCU the reader is now positioned at (<= mcu)
+ */
+uint32_t app_jpeg_scan_reader_seek(jpeg_scan_reader_t *rd, const jpeg_index_t *index, uint32_t mcu);
+
+/**
+ * @brief Decode the next MCU, consuming a restart marker first if one is due
+ *
+ * @param rd Reader
+ * @param[out] blocks info->blocks_per_mcu blocks in scan order
+ * @return ESP_OK on success, ESP_ERR_INVALID_RESPONSE on corrupt data
+ */
+esp_err_t app_jpeg_read_mcu(jpeg_scan_reader_t *rd, jpeg_block_t *blocks);
+
+/**
+ * @brief Start writing entropy-coded data
+ *
+ * @param wr Writer to initialize
+ * @param out Output buffer
+ * @param cap Capacity of the output buffer
+ */
+void app_jpeg_scan_writer_init(jpeg_scan_writer_t *wr, uint8_t *out, size_t cap);
+
+/**
+ * @brief Encode one block, DC is coded against the writer's predictor for comp
+ *
+ * @param wr Writer
+ * @param comp Component index, selects the DC predictor
+ * @param dc DC encoding table
+ * @param ac AC encoding table
+ * @param blk Block to encode
+ */
+void app_jpeg_write_block(jpeg_scan_writer_t *wr, int comp, const jpeg_huff_enc_t *dc,
+                          const jpeg_huff_enc_t *ac, const jpeg_block_t *blk);
+
+/**
+ * @brief Encode one block straight from quantized coefficients
+ *
+ * Same output as app_jpeg_block_from_coefs() followed by app_jpeg_write_block(),
+ * without the intermediate symbol form. The tables must hold every symbol, as the
+ * standard tables do.
+ *
+ * @param wr Writer
+ * @param comp Component index, selects the DC predictor
+ * @param dc DC encoding table
+ * @param ac AC encoding table
+ * @param coef Quantized coefficients in zigzag order, AC within +-1023
+ */
+void app_jpeg_write_coefs(jpeg_scan_writer_t *wr, int comp, const jpeg_huff_enc_t *dc,
+                          const jpeg_huff_enc_t *ac, const int16_t coef[64]);
+
+/**
+ * @brief Pad to a byte boundary, emit the next RSTn marker and reset DC predictors
+ *
+ * @param wr Writer
+ */
+void app_jpeg_write_restart(jpeg_scan_writer_t *wr);
+
+/**
+ * @brief Append entropy-coded bytes verbatim
+ *
+ * The bytes must already be byte-stuffed and may contain RSTn markers; the caller
+ * keeps wr->next_rst in step with the markers it copies. The writer has to be on a
+ * byte boundary: at the start of the scan or right after app_jpeg_write_restart().
+ *
+ * @param wr Writer
+ * @param data Entropy-coded bytes
+ * @param len Number of bytes
+ */
+void app_jpeg_write_raw(jpeg_scan_writer_t *wr, const uint8_t *data, size_t len);
+
+/**
+ * @brief Copy the rest of the scan bit-exactly, from the reader's position to the end
+ *
+ * Only valid when the writer's DC predictors equal the reader's, i.e. the last
+ * block of every component was written unchanged, and when no restart marker follows.
+ *
+ * @param rd Reader, positioned on an MCU boundary
+ * @param wr Writer
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if the reader already ran into the
+ *         end of the scan (decode the remaining MCUs instead)
+ */
+esp_err_t app_jpeg_copy_scan_tail(jpeg_scan_reader_t *rd, jpeg_scan_writer_t *wr);
+
+/**
+ * @brief Pad the last byte with 1 bits
+ *
+ * @param wr Writer
+ * @return Number of bytes written, or 0 on overflow
+ */
+size_t app_jpeg_scan_writer_finish(jpeg_scan_writer_t *wr);
+
+/**
+ * @brief Build the symbol form of a block from quantized coefficients
+ *
+ * @param coef Quantized coefficients in zigzag order, AC within +-1023
+ * @param[out] blk Block
+ */
+void app_jpeg_block_from_coefs(const int16_t coef[64], jpeg_block_t *blk);
+
+/**
+ * @brief Expand the symbol form of a block into quantized coefficients
+ *
+ * @param blk Block
+ * @param[out] coef Quantized coefficients in zigzag order
+ */
+void app_jpeg_block_to_coefs(const jpeg_block_t *blk, int16_t coef[64]);
+
+/**
+ * @brief Accumulate the symbol statistics of one block
+ *
+ * @param blk Block
+ * @param pred DC predictor of the block's component, updated
+ * @param dc_freq DC symbol counts
+ * @param ac_freq AC symbol counts
+ */
+void app_jpeg_count_block(const jpeg_block_t *blk, int16_t *pred, uint32_t dc_freq[257], uint32_t ac_freq[257]);
+
+/**
+ * @brief Write a DHT marker segment
+ *
+ * @param out Output buffer
+ * @param cap Capacity of out
+ * @param num_tables Number of tables
+ * @param classes_ids Tc << 4 | Th for every table
+ * @param bits Code counts for every table
+ * @param huffvals Symbols for every table
+ * @return Bytes written, 0 if out is too small
+ */
+size_t app_jpeg_write_dht(uint8_t *out, size_t cap, int num_tables, const uint8_t *classes_ids,
+                          const uint8_t (*bits)[17], const uint8_t (*huffvals)[256]);
+
+/**
+ * @brief Losslessly re-encode a frame with Huffman tables optimized for it
+ *
+ * Same result as `jpegtran -optimize`: the image data is untouched, only the
+ * entropy coding changes. Restart intervals are preserved.
+ *
+ * @param in Input JPEG
+ * @param in_len Input length
+ * @param index Structure index of the input, or NULL
+ * @param out Output buffer
+ * @param out_cap Output capacity
+ * @param[out] out_len Length of the optimized JPEG
+ * @return ESP_OK on success, ESP_ERR_INVALID_SIZE if the result would not fit in out,
+ *         other errors as app_jpeg_parse_info() / app_jpeg_read_mcu()
+ */
+esp_err_t app_jpeg_optimize_huffman(const uint8_t *in, size_t in_len, const jpeg_index_t *index,
+                                    uint8_t *out, size_t out_cap, size_t *out_len);
+
+#ifdef __cplusplus
+}
+#endif
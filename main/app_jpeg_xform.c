@@ -0,0 +1,1500 @@
+#include "app_jpeg_xform.h"
+#include "app_jpeg_entropy.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_heap_caps.h"
+
+typedef struct {
+    jpeg_info_t info;
+    jpeg_block_t blocks[JPEG_MAX_BLOCKS_IN_MCU];
+    jpeg_huff_enc_t enc[8];         // DC tables 0-3, AC tables 4-7
+} xform_work_t;
+
+static xform_work_t *work_alloc(void)
+{
+    xform_work_t *w = heap_caps_calloc(1, sizeof(xform_work_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (w == NULL) {
+        w = calloc(1, sizeof(xform_work_t));
+    }
+    return w;
+}
+
+static void mcu_size(const jpeg_info_t *info, uint16_t *mcu_w, uint16_t *mcu_h)
+{
+    // A single-component scan is non-interleaved: one block per MCU
+    *mcu_w = info->num_components == 1 ? 8 : 8 * info->h_max;
+    *mcu_h = info->num_components == 1 ? 8 : 8 * info->v_max;
+}
+
+// Encoding tables equal to the decoding tables of the input, for every selector in use
+static void enc_from_input(xform_work_t *w)
+{
+    const jpeg_info_t *info = &w->info;
+    for (int c = 0; c < info->num_components; c++) {
+        app_jpeg_enc_from_dec(&info->dc[info->comp[c].td], &w->enc[info->comp[c].td]);
+        app_jpeg_enc_from_dec(&info->ac[info->comp[c].ta], &w->enc[4 + info->comp[c].ta]);
+    }
+}
+
+// Encoding tables from the standard Huffman tables, for a scan that has to be coded with them
+static esp_err_t enc_from_std(xform_work_t *w)
+{
+    const jpeg_info_t *info = &w->info;
+    for (int c = 0; c < info->num_components; c++) {
+        if (info->comp[c].td > 1 || info->comp[c].ta > 1) {
+            return ESP_ERR_NOT_SUPPORTED;
+        }
+    }
+    jpeg_info_t *std = malloc(sizeof(jpeg_info_t));
+    if (std == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t err = app_jpeg_load_dht(std, app_jpeg_std_dht + 4, JPEG_STD_DHT_LEN - 4);
+    if (err == ESP_OK) {
+        for (int t = 0; t < 2; t++) {
+            app_jpeg_enc_from_dec(&std->dc[t], &w->enc[t]);
+            app_jpeg_enc_from_dec(&std->ac[t], &w->enc[4 + t]);
+        }
+    }
+    free(std);
+    return err;
+}
+
+/*
+ * Copy the header in front of the scan with new frame dimensions. DRI is dropped
+ * unless HDR_KEEP_DRI is given, and the standard Huffman tables are written
+ * out when the input relies on them, since the output scan is coded with them.
+ * HDR_STD_DHT drops the input's own tables so the standard ones replace them.
+ * With HDR_LUMA_ONLY, SOF and SOS are rewritten to carry the first component only.
+ * Returns the header length including SOS, 0 if out is too small.
+ */
+#define HDR_LUMA_ONLY   (1 << 0)
+#define HDR_KEEP_DRI    (1 << 1)
+#define HDR_STD_DHT     (1 << 2)
+
+static size_t write_header(const uint8_t *in, const jpeg_info_t *info, uint16_t width, uint16_t height,
+                           uint32_t flags, uint8_t *out, size_t cap)
+{
+    const jpeg_component_t *y = &info->comp[0];
+    bool luma_only = (flags & HDR_LUMA_ONLY) != 0;
+    size_t o = 0;
+    size_t pos = 2;
+    bool has_dht = false;
+
+    if (cap < 2) {
+        return 0;
+    }
+    out[o++] = 0xFF;
+    out[o++] = JPEG_MARKER_SOI;
+
+    while (pos < info->sos_pos) {
+        uint8_t marker = in[pos + 1];
+        if (marker == 0xFF) {
+            pos++;
+            continue;
+        }
+        size_t seg_total = 2 + (((size_t)in[pos + 2] << 8) | in[pos + 3]);
+        bool is_sof = (marker == JPEG_MARKER_SOF0 || marker == JPEG_MARKER_SOF1);
+        bool drop = (marker == JPEG_MARKER_DRI && !(flags & HDR_KEEP_DRI)) ||
+                    (marker == JPEG_MARKER_DHT && (flags & HDR_STD_DHT));
+        if (is_sof && luma_only) {
+            if (o + 13 > cap) {
+                return 0;
+            }
+            const uint8_t sof[13] = {
+                0xFF, marker, 0x00, 11, 8, 0, 0, 0, 0, 1, y->id, 0x11, y->tq,
+            };
+            memcpy(&out[o], sof, sizeof(sof));
+            seg_total = sizeof(sof);
+        } else if (!drop) {
+            if (o + seg_total > cap) {
+                return 0;
+            }
+            memcpy(&out[o], &in[pos], seg_total);
+        }
+        if (!drop) {
+            if (is_sof) {
+                out[o + 5] = height >> 8;
+                out[o + 6] = height & 0xFF;
+                out[o + 7] = width >> 8;
+                out[o + 8] = width & 0xFF;
+            }
+            has_dht |= (marker == JPEG_MARKER_DHT);
+            o += seg_total;
+        }
+        pos += 2 + (((size_t)in[pos + 2] << 8) | in[pos + 3]);
+    }
+
+    size_t sos_total = luma_only ? 10 : info->scan_pos - info->sos_pos;
+    if (o + (has_dht ? 0 : JPEG_STD_DHT_LEN) + sos_total > cap) {
+        return 0;
+    }
+    if (!has_dht) {
+        memcpy(&out[o], app_jpeg_std_dht, JPEG_STD_DHT_LEN);
+        o += JPEG_STD_DHT_LEN;
+    }
+    if (luma_only) {
+        const uint8_t sos[10] = {
+            0xFF, JPEG_MARKER_SOS, 0x00, 8, 1, y->id, (y->td << 4) | y->ta, 0, 63, 0,
+        };
+        memcpy(&out[o], sos, sizeof(sos));
+    } else {
+        memcpy(&out[o], &in[info->sos_pos], sos_total);
+    }
+    return o + sos_total;
+}
+
+// ============================================================================
+// Crop
+// ============================================================================
+
+esp_err_t app_jpeg_crop(const uint8_t *in, size_t in_len, const jpeg_index_t *index, const jpeg_rect_t *rect,
+                        uint8_t *out, size_t out_cap, size_t *out_len, jpeg_rect_t *out_rect)
+{
+    xform_work_t *w = work_alloc();
+    if (w == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    jpeg_info_t *info = &w->info;
+    esp_err_t err = app_jpeg_parse_info(in, in_len, index, info);
+    if (err != ESP_OK) {
+        goto done;
+    }
+    if (rect->x >= info->width || rect->y >= info->height) {
+        err = ESP_ERR_INVALID_ARG;
+        goto done;
+    }
+
+    // Widen to whole MCUs, clip to the frame
+    uint16_t mcu_w, mcu_h;
+    mcu_size(info, &mcu_w, &mcu_h);
+    uint32_t x_end = (uint32_t)rect->x + (rect->w ? rect->w : 1);
+    uint32_t y_end = (uint32_t)rect->y + (rect->h ? rect->h : 1);
+    x_end = x_end < info->width ? x_end : info->width;
+    y_end = y_end < info->height ? y_end : info->height;
+    uint32_t mx0 = rect->x / mcu_w;
+    uint32_t my0 = rect->y / mcu_h;
+    uint32_t mx1 = (x_end + mcu_w - 1) / mcu_w;
+    uint32_t my1 = (y_end + mcu_h - 1) / mcu_h;
+    uint32_t px_end = mx1 * mcu_w < info->width ? mx1 * mcu_w : info->width;
+    uint32_t py_end = my1 * mcu_h < info->height ? my1 * mcu_h : info->height;
+    jpeg_rect_t kept = {
+        .x = mx0 * mcu_w,
+        .y = my0 * mcu_h,
+        .w = px_end - mx0 * mcu_w,
+        .h = py_end - my0 * mcu_h,
+    };
+
+    size_t o = write_header(in, info, kept.w, kept.h, 0, out, out_cap);
+    if (o == 0 || o + 2 > out_cap) {
+        err = ESP_ERR_INVALID_SIZE;
+        goto done;
+    }
+    enc_from_input(w);
+
+    jpeg_scan_reader_t rd;
+    jpeg_scan_writer_t wr;
+    app_jpeg_scan_reader_init(&rd, info, in, in_len);
+    app_jpeg_scan_writer_init(&wr, &out[o], out_cap - o - 2);
+    for (uint32_t my = my0; my < my1; my++) {
+        // Everything left of the region still has to be decoded, unless a restart marker is closer
+        uint32_t first = my * info->mcus_x + mx0;
+        app_jpeg_scan_reader_seek(&rd, index, first);
+        while (rd.mcu_index < first) {
+            err = app_jpeg_read_mcu(&rd, w->blocks);
+            if (err != ESP_OK) {
+                goto done;
+            }
+        }
+        for (uint32_t mx = mx0; mx < mx1; mx++) {
+            err = app_jpeg_read_mcu(&rd, w->blocks);
+            if (err != ESP_OK) {
+                goto done;
+            }
+            for (int b = 0; b < info->blocks_per_mcu; b++) {
+                int ci = info->mcu_comp[b];
+                const jpeg_component_t *c = &info->comp[ci];
+                app_jpeg_write_block(&wr, ci, &w->enc[c->td], &w->enc[4 + c->ta], &w->blocks[b]);
+            }
+        }
+        if (wr.bw.failed) {
+            err = ESP_ERR_INVALID_SIZE;
+            goto done;
+        }
+    }
+
+    size_t n = app_jpeg_scan_writer_finish(&wr);
+    if (n == 0) {
+        err = ESP_ERR_INVALID_SIZE;
+        goto done;
+    }
+    o += n;
+    out[o++] = 0xFF;
+    out[o++] = JPEG_MARKER_EOI;
+    *out_len = o;
+    if (out_rect != NULL) {
+        *out_rect = kept;
+    }
+    err = ESP_OK;
+
+done:
+    free(w);
+    return err;
+}
+
+// ============================================================================
+// Grayscale
+// ============================================================================
+
+esp_err_t app_jpeg_to_gray(const uint8_t *in, size_t in_len, const jpeg_index_t *index,
+                           uint8_t *out, size_t out_cap, size_t *out_len)
+{
+    xform_work_t *w = work_alloc();
+    if (w == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    jpeg_block_t *row = NULL;
+    jpeg_info_t *info = &w->info;
+    esp_err_t err = app_jpeg_parse_info(in, in_len, index, info);
+    if (err != ESP_OK) {
+        goto done;
+    }
+
+    // Luma blocks of one MCU row, laid out as yv block rows of mcus_x * yh blocks
+    const jpeg_component_t *y = &info->comp[0];
+    uint32_t yh = info->num_components == 1 ? 1 : y->h;
+    uint32_t yv = info->num_components == 1 ? 1 : y->v;
+    uint32_t row_blocks = info->mcus_x * yh;
+    row = heap_caps_malloc(row_blocks * yv * sizeof(jpeg_block_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (row == NULL) {
+        row = malloc(row_blocks * yv * sizeof(jpeg_block_t));
+        if (row == NULL) {
+            err = ESP_ERR_NO_MEM;
+            goto done;
+        }
+    }
+
+    size_t o = write_header(in, info, info->width, info->height, HDR_LUMA_ONLY, out, out_cap);
+    if (o == 0 || o + 2 > out_cap) {
+        err = ESP_ERR_INVALID_SIZE;
+        goto done;
+    }
+    app_jpeg_enc_from_dec(&info->dc[y->td], &w->enc[y->td]);
+    app_jpeg_enc_from_dec(&info->ac[y->ta], &w->enc[4 + y->ta]);
+
+    // A single-component scan covers exactly the image, not the padded MCU grid
+    uint32_t blocks_x = (info->width + 7) / 8;
+    uint32_t blocks_y = (info->height + 7) / 8;
+
+    jpeg_scan_reader_t rd;
+    jpeg_scan_writer_t wr;
+    app_jpeg_scan_reader_init(&rd, info, in, in_len);
+    app_jpeg_scan_writer_init(&wr, &out[o], out_cap - o - 2);
+    for (uint32_t my = 0; my < info->mcus_y; my++) {
+        for (uint32_t mx = 0; mx < info->mcus_x; mx++) {
+            err = app_jpeg_read_mcu(&rd, w->blocks);
+            if (err != ESP_OK) {
+                goto done;
+            }
+            // Luma blocks of an MCU are in raster order
+            uint32_t k = 0;
+            for (int b = 0; b < info->blocks_per_mcu; b++) {
+                if (info->mcu_comp[b] == 0) {
+                    row[(k / yh) * row_blocks + mx * yh + (k % yh)] = w->blocks[b];
+                    k++;
+                }
+            }
+        }
+        for (uint32_t r = 0; r < yv && my * yv + r < blocks_y; r++) {
+            for (uint32_t bx = 0; bx < blocks_x; bx++) {
+                app_jpeg_write_block(&wr, 0, &w->enc[y->td], &w->enc[4 + y->ta], &row[r * row_blocks + bx]);
+            }
+        }
+        if (wr.bw.failed) {
+            err = ESP_ERR_INVALID_SIZE;
+            goto done;
+        }
+    }
+
+    size_t n = app_jpeg_scan_writer_finish(&wr);
+    if (n == 0) {
+        err = ESP_ERR_INVALID_SIZE;
+        goto done;
+    }
+    o += n;
+    out[o++] = 0xFF;
+    out[o++] = JPEG_MARKER_EOI;
+    *out_len = o;
+    err = ESP_OK;
+
+done:
+    free(row);
+    free(w);
+    return err;
+}
+
+// ============================================================================
+// Overlay
+// ============================================================================
+
+// 8x8 glyphs for 0x20-0x5F, one byte per row, bit 0 is the leftmost pixel
+#define FONT_FIRST  0x20
+#define FONT_GLYPHS 64
+
+static const uint8_t font8x8[FONT_GLYPHS][8] = {
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},   // ' '
+    {0x18, 0x3C, 0x3C, 0x18, 0x18, 0x00, 0x18, 0x00},   // !
+    {0x36, 0x36, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},   // "
+    {0x36, 0x36, 0x7F, 0x36, 0x7F, 0x36, 0x36, 0x00},   // #
+    {0x0C, 0x3E, 0x03, 0x1E, 0x30, 0x1F, 0x0C, 0x00},   // $
+    {0x00, 0x63, 0x33, 0x18, 0x0C, 0x66, 0x63, 0x00},   // %
+    {0x1C, 0x36, 0x1C, 0x6E, 0x3B, 0x33, 0x6E, 0x00},   // &
+    {0x06, 0x06, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00},   // '
+    {0x18, 0x0C, 0x06, 0x06, 0x06, 0x0C, 0x18, 0x00},   // (
+    {0x06, 0x0C, 0x18, 0x18, 0x18, 0x0C, 0x06, 0x00},   // )
+    {0x00, 0x66, 0x3C, 0xFF, 0x3C, 0x66, 0x00, 0x00},   // *
+    {0x00, 0x0C, 0x0C, 0x3F, 0x0C, 0x0C, 0x00, 0x00},   // +
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C, 0x06},   // ,
+    {0x00, 0x00, 0x00, 0x3F, 0x00, 0x00, 0x00, 0x00},   // -
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C, 0x00},   // .
+    {0x60, 0x30, 0x18, 0x0C, 0x06, 0x03, 0x01, 0x00},   // /
+    {0x3E, 0x63, 0x73, 0x7B, 0x6F, 0x67, 0x3E, 0x00},   // 0
+    {0x0C, 0x0E, 0x0C, 0x0C, 0x0C, 0x0C, 0x3F, 0x00},   // 1
+    {0x1E, 0x33, 0x30, 0x1C, 0x06, 0x33, 0x3F, 0x00},   // 2
+    {0x1E, 0x33, 0x30, 0x1C, 0x30, 0x33, 0x1E, 0x00},   // 3
+    {0x38, 0x3C, 0x36, 0x33, 0x7F, 0x30, 0x78, 0x00},   // 4
+    {0x3F, 0x03, 0x1F, 0x30, 0x30, 0x33, 0x1E, 0x00},   // 5
+    {0x1C, 0x06, 0x03, 0x1F, 0x33, 0x33, 0x1E, 0x00},   // 6
+    {0x3F, 0x33, 0x30, 0x18, 0x0C, 0x0C, 0x0C, 0x00},   // 7
+    {0x1E, 0x33, 0x33, 0x1E, 0x33, 0x33, 0x1E, 0x00},   // 8
+    {0x1E, 0x33, 0x33, 0x3E, 0x30, 0x18, 0x0E, 0x00},   // 9
+    {0x00, 0x0C, 0x0C, 0x00, 0x00, 0x0C, 0x0C, 0x00},   // :
+    {0x00, 0x0C, 0x0C, 0x00, 0x00, 0x0C, 0x0C, 0x06},   // ;
+    {0x18, 0x0C, 0x06, 0x03, 0x06, 0x0C, 0x18, 0x00},   // <
+    {0x00, 0x00, 0x3F, 0x00, 0x00, 0x3F, 0x00, 0x00},   // =
+    {0x06, 0x0C, 0x18, 0x30, 0x18, 0x0C, 0x06, 0x00},   // >
+    {0x1E, 0x33, 0x30, 0x18, 0x0C, 0x00, 0x0C, 0x00},   // ?
+    {0x3E, 0x63, 0x7B, 0x7B, 0x7B, 0x03, 0x1E, 0x00},   // @
+    {0x0C, 0x1E, 0x33, 0x33, 0x3F, 0x33, 0x33, 0x00},   // A
+    {0x3F, 0x66, 0x66, 0x3E, 0x66, 0x66, 0x3F, 0x00},   // B
+    {0x3C, 0x66, 0x03, 0x03, 0x03, 0x66, 0x3C, 0x00},   // C
+    {0x1F, 0x36, 0x66, 0x66, 0x66, 0x36, 0x1F, 0x00},   // D
+    {0x7F, 0x46, 0x16, 0x1E, 0x16, 0x46, 0x7F, 0x00},   // E
+    {0x7F, 0x46, 0x16, 0x1E, 0x16, 0x06, 0x0F, 0x00},   // F
+    {0x3C, 0x66, 0x03, 0x03, 0x73, 0x66, 0x7C, 0x00},   // G
+    {0x33, 0x33, 0x33, 0x3F, 0x33, 0x33, 0x33, 0x00},   // H
+    {0x1E, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00},   // I
+    {0x78, 0x30, 0x30, 0x30, 0x33, 0x33, 0x1E, 0x00},   // J
+    {0x67, 0x66, 0x36, 0x1E, 0x36, 0x66, 0x67, 0x00},   // K
+    {0x0F, 0x06, 0x06, 0x06, 0x46, 0x66, 0x7F, 0x00},   // L
+    {0x63, 0x77, 0x7F, 0x7F, 0x6B, 0x63, 0x63, 0x00},   // M
+    {0x63, 0x67, 0x6F, 0x7B, 0x73, 0x63, 0x63, 0x00},   // N
+    {0x1C, 0x36, 0x63, 0x63, 0x63, 0x36, 0x1C, 0x00},   // O
+    {0x3F, 0x66, 0x66, 0x3E, 0x06, 0x06, 0x0F, 0x00},   // P
+    {0x1E, 0x33, 0x33, 0x33, 0x3B, 0x1E, 0x38, 0x00},   // Q
+    {0x3F, 0x66, 0x66, 0x3E, 0x36, 0x66, 0x67, 0x00},   // R
+    {0x1E, 0x33, 0x07, 0x0E, 0x38, 0x33, 0x1E, 0x00},   // S
+    {0x3F, 0x2D, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00},   // T
+    {0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x3F, 0x00},   // U
+    {0x33, 0x33, 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x00},   // V
+    {0x63, 0x63, 0x63, 0x6B, 0x7F, 0x77, 0x63, 0x00},   // W
+    {0x63, 0x63, 0x36, 0x1C, 0x1C, 0x36, 0x63, 0x00},   // X
+    {0x33, 0x33, 0x33, 0x1E, 0x0C, 0x0C, 0x1E, 0x00},   // Y
+    {0x7F, 0x63, 0x31, 0x18, 0x4C, 0x66, 0x7F, 0x00},   // Z
+    {0x1E, 0x06, 0x06, 0x06, 0x06, 0x06, 0x1E, 0x00},   // [
+    {0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x40, 0x00},   // backslash
+    {0x1E, 0x18, 0x18, 0x18, 0x18, 0x18, 0x1E, 0x00},   // ]
+    {0x08, 0x1C, 0x36, 0x63, 0x00, 0x00, 0x00, 0x00},   // ^
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF},   // _
+};
+
+#define OVERLAY_FG  235     // Luma of glyph pixels
+#define OVERLAY_BG  16      // Luma of the text background and of masks
+
+// Forward DCT and quantization of one 8x8 luma block (T.81 A.3.3), result in zigzag order.
+// Only run when the glyph cache is rebuilt, so plain floating point is fine.
+static void fdct_quantize(const uint8_t pixels[64], const uint16_t quant[64], int16_t coef[64])
+{
+    float tmp[64];
+    float out[64];
+    for (int y = 0; y < 8; y++) {
+        for (int u = 0; u < 8; u++) {
+            float sum = 0;
+            for (int x = 0; x < 8; x++) {
+                sum += ((float)pixels[y * 8 + x] - 128.0f) * cosf((2 * x + 1) * u * (float)M_PI / 16);
+            }
+            tmp[y * 8 + u] = sum * (u == 0 ? (float)M_SQRT1_2 : 1.0f) / 2;
+        }
+    }
+    for (int u = 0; u < 8; u++) {
+        for (int v = 0; v < 8; v++) {
+            float sum = 0;
+            for (int y = 0; y < 8; y++) {
+                sum += tmp[y * 8 + u] * cosf((2 * y + 1) * v * (float)M_PI / 16);
+            }
+            out[v * 8 + u] = sum * (v == 0 ? (float)M_SQRT1_2 : 1.0f) / 2;
+        }
+    }
+    for (int k = 0; k < 64; k++) {
+        int q = quant[k] ? quant[k] : 1;
+        int c = (int)lroundf(out[app_jpeg_zigzag[k]] / q);
+        int limit = k == 0 ? 2047 : 1023;
+        coef[k] = c > limit ? limit : (c < -limit ? -limit : c);
+    }
+}
+
+static esp_err_t overlay_cache_update(jpeg_overlay_cache_t *cache, const uint16_t quant[64], uint8_t scale)
+{
+    if (cache->valid && cache->scale == scale && memcmp(cache->quant, quant, sizeof(cache->quant)) == 0) {
+        return ESP_OK;
+    }
+
+    size_t count = (size_t)FONT_GLYPHS * scale * scale;
+    if (cache->glyphs == NULL || cache->scale != scale) {
+        free(cache->glyphs);
+        cache->valid = false;
+        cache->glyphs = heap_caps_malloc(count * sizeof(jpeg_block_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (cache->glyphs == NULL) {
+            cache->glyphs = malloc(count * sizeof(jpeg_block_t));
+            if (cache->glyphs == NULL) {
+                return ESP_ERR_NO_MEM;
+            }
+        }
+    }
+
+    uint8_t pixels[64];
+    int16_t coef[64];
+    memset(pixels, OVERLAY_BG, sizeof(pixels));
+    fdct_quantize(pixels, quant, coef);
+    app_jpeg_block_from_coefs(coef, &cache->background);
+
+    for (int g = 0; g < FONT_GLYPHS; g++) {
+        for (int sy = 0; sy < scale; sy++) {
+            for (int sx = 0; sx < scale; sx++) {
+                for (int y = 0; y < 8; y++) {
+                    uint8_t row = font8x8[g][(sy * 8 + y) / scale];
+                    for (int x = 0; x < 8; x++) {
+                        bool on = (row >> ((sx * 8 + x) / scale)) & 1;
+                        pixels[y * 8 + x] = on ? OVERLAY_FG : OVERLAY_BG;
+                    }
+                }
+                fdct_quantize(pixels, quant, coef);
+                app_jpeg_block_from_coefs(coef, &cache->glyphs[(g * scale + sy) * scale + sx]);
+            }
+        }
+    }
+
+    memcpy(cache->quant, quant, sizeof(cache->quant));
+    cache->scale = scale;
+    cache->valid = true;
+    return ESP_OK;
+}
+
+void app_jpeg_overlay_cache_free(jpeg_overlay_cache_t *cache)
+{
+    free(cache->glyphs);
+    memset(cache, 0, sizeof(*cache));
+}
+
+// Overlay geometry in MCUs, [x0, x1) x [y0, y1)
+typedef struct {
+    uint16_t x0, y0, x1, y1;
+} mcu_rect_t;
+
+typedef struct {
+    const jpeg_info_t *info;
+    const jpeg_overlay_t *overlay;
+    const jpeg_overlay_cache_t *cache;
+    uint16_t mcu_w;
+    uint16_t mcu_h;
+    uint16_t text_len;
+    uint16_t text_x;            // Text origin in pixels, on the MCU grid
+    uint16_t text_y;
+    uint8_t num_rects;          // Text first (if any), then masks
+    mcu_rect_t rects[1 + JPEG_OVERLAY_MAX_MASKS];
+    jpeg_block_t neutral;       // Chroma block of a gray pixel: DC 0, EOB
+    bool recode_all;            // Output tables differ from the input's: nothing is copied
+} overlay_plan_t;
+
+static mcu_rect_t to_mcu_rect(const overlay_plan_t *plan, uint32_t x, uint32_t y, uint32_t w, uint32_t h)
+{
+    const jpeg_info_t *info = plan->info;
+    uint32_t x1 = (x + w + plan->mcu_w - 1) / plan->mcu_w;
+    uint32_t y1 = (y + h + plan->mcu_h - 1) / plan->mcu_h;
+    mcu_rect_t r = {
+        .x0 = x / plan->mcu_w,
+        .y0 = y / plan->mcu_h,
+        .x1 = x1 < info->mcus_x ? x1 : info->mcus_x,
+        .y1 = y1 < info->mcus_y ? y1 : info->mcus_y,
+    };
+    return r;
+}
+
+static void overlay_plan(overlay_plan_t *plan, const jpeg_info_t *info, const jpeg_overlay_t *overlay,
+                         const jpeg_overlay_cache_t *cache)
+{
+    memset(plan, 0, sizeof(*plan));
+    plan->info = info;
+    plan->overlay = overlay;
+    plan->cache = cache;
+    mcu_size(info, &plan->mcu_w, &plan->mcu_h);
+    plan->neutral.num_ac = 1;
+
+    plan->text_len = strnlen(overlay->text, JPEG_OVERLAY_MAX_TEXT);
+    if (plan->text_len > 0 && overlay->text_x < info->width && overlay->text_y < info->height) {
+        uint32_t cell = 8 * cache->scale;
+        plan->text_x = overlay->text_x / plan->mcu_w * plan->mcu_w;
+        plan->text_y = overlay->text_y / plan->mcu_h * plan->mcu_h;
+        plan->rects[plan->num_rects++] = to_mcu_rect(plan, plan->text_x, plan->text_y,
+                                                     plan->text_len * cell, cell);
+    }
+    for (int i = 0; i < overlay->num_masks && i < JPEG_OVERLAY_MAX_MASKS; i++) {
+        const jpeg_rect_t *m = &overlay->masks[i];
+        if (m->x < info->width && m->y < info->height && m->w > 0 && m->h > 0) {
+            plan->rects[plan->num_rects++] = to_mcu_rect(plan, m->x, m->y, m->w, m->h);
+        }
+    }
+}
+
+// Which overlay rectangle covers the MCU: -1 for none, 0 for text (when present), masks win
+static int overlay_hit(const overlay_plan_t *plan, uint32_t mx, uint32_t my)
+{
+    int hit = -1;
+    for (int i = 0; i < plan->num_rects; i++) {
+        const mcu_rect_t *r = &plan->rects[i];
+        if (mx >= r->x0 && mx < r->x1 && my >= r->y0 && my < r->y1) {
+            hit = i;
+        }
+    }
+    return hit;
+}
+
+// Whether any MCU in [first_mcu, last_mcu] (scan order) lies under the overlay
+static bool overlay_range_touched(const overlay_plan_t *plan, uint32_t first_mcu, uint32_t last_mcu)
+{
+    uint32_t mcus_x = plan->info->mcus_x;
+    if (plan->recode_all) {
+        return true;
+    }
+    for (int i = 0; i < plan->num_rects; i++) {
+        const mcu_rect_t *r = &plan->rects[i];
+        if (r->x0 >= r->x1 || r->y0 >= r->y1) {
+            continue;
+        }
+        uint32_t a = (uint32_t)r->y0 * mcus_x + r->x0;
+        uint32_t b = (uint32_t)(r->y1 - 1) * mcus_x + r->x1 - 1;
+        if (b < first_mcu || a > last_mcu) {
+            continue;
+        }
+        // The MCU range may still fall between the rectangle's columns
+        for (uint32_t my = first_mcu / mcus_x; my <= last_mcu / mcus_x; my++) {
+            uint32_t row_a = my * mcus_x;
+            uint32_t lo = row_a + r->x0 > first_mcu ? row_a + r->x0 : first_mcu;
+            uint32_t hi = row_a + r->x1 - 1 < last_mcu ? row_a + r->x1 - 1 : last_mcu;
+            if (my >= r->y0 && my < r->y1 && lo <= hi) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static void overlay_replace(const overlay_plan_t *plan, int hit, uint32_t mx, uint32_t my, jpeg_block_t *blocks)
+{
+    const jpeg_info_t *info = plan->info;
+    const jpeg_overlay_cache_t *cache = plan->cache;
+    bool text = (hit == 0 && plan->text_len > 0);
+    uint32_t yh = info->num_components == 1 ? 1 : info->comp[0].h;
+    uint32_t cell = 8 * cache->scale;
+    uint32_t k = 0;
+
+    for (int b = 0; b < info->blocks_per_mcu; b++) {
+        if (info->mcu_comp[b] != 0) {
+            blocks[b] = plan->neutral;
+            continue;
+        }
+        const jpeg_block_t *src = &cache->background;
+        if (text) {
+            uint32_t px = mx * plan->mcu_w + (k % yh) * 8 - plan->text_x;
+            uint32_t py = my * plan->mcu_h + (k / yh) * 8 - plan->text_y;
+            uint32_t ch = px / cell;
+            if (py < cell && ch < plan->text_len) {
+                uint8_t c = (uint8_t)plan->overlay->text[ch];
+                if (c >= 'a' && c <= 'z') {
+                    c -= 'a' - 'A';
+                }
+                if (c < FONT_FIRST || c >= FONT_FIRST + FONT_GLYPHS) {
+                    c = '?';
+                }
+                uint32_t sx = (px % cell) / 8;
+                uint32_t sy = py / 8;
+                src = &cache->glyphs[((c - FONT_FIRST) * cache->scale + sy) * cache->scale + sx];
+            }
+        }
+        blocks[b] = *src;
+        k++;
+    }
+}
+
+// A symbol the output tables cannot code is told apart from running out of room
+static esp_err_t overlay_status(const jpeg_scan_writer_t *wr)
+{
+    if (wr->bw.no_code) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    return wr->bw.failed ? ESP_ERR_INVALID_SIZE : ESP_OK;
+}
+
+// Decode MCUs [first, end) and write them back, with overlay blocks where they apply
+static esp_err_t overlay_recode(const overlay_plan_t *plan, jpeg_scan_reader_t *rd, jpeg_scan_writer_t *wr,
+                                xform_work_t *w, uint32_t first, uint32_t end)
+{
+    const jpeg_info_t *info = plan->info;
+    for (uint32_t m = first; m < end; m++) {
+        esp_err_t err = app_jpeg_read_mcu(rd, w->blocks);
+        if (err != ESP_OK) {
+            return err;
+        }
+        int hit = overlay_hit(plan, m % info->mcus_x, m / info->mcus_x);
+        if (hit >= 0) {
+            overlay_replace(plan, hit, m % info->mcus_x, m / info->mcus_x, w->blocks);
+        }
+        for (int b = 0; b < info->blocks_per_mcu; b++) {
+            int ci = info->mcu_comp[b];
+            const jpeg_component_t *c = &info->comp[ci];
+            app_jpeg_write_block(wr, ci, &w->enc[c->td], &w->enc[4 + c->ta], &w->blocks[b]);
+        }
+    }
+    return overlay_status(wr);
+}
+
+// Walks the restart markers of a scan in increasing order, using the index where it can
+typedef struct {
+    const uint8_t *data;
+    size_t len;
+    const jpeg_index_t *index;
+    size_t pos;                 // Position of marker number `marker`, scan start for 0
+    uint32_t marker;
+} rst_cursor_t;
+
+// Next marker (not stuffing or fill) at or after p, len if none
+static size_t next_marker(const uint8_t *data, size_t len, size_t p)
+{
+    while (p + 1 < len) {
+        const uint8_t *ff = memchr(&data[p], 0xFF, len - p - 1);
+        if (ff == NULL) {
+            break;
+        }
+        p = ff - data;
+        if (data[p + 1] != 0x00 && data[p + 1] != 0xFF) {
+            return p;
+        }
+        p += (data[p + 1] == 0x00) ? 2 : 1;
+    }
+    return len;
+}
+
+// Position of restart marker number k (counting from 1), or of the scan end for k past the last one
+static esp_err_t rst_seek(rst_cursor_t *c, uint32_t k, size_t *pos)
+{
+    const jpeg_index_t *index = c->index;
+    if (index != NULL && index->rst_stride != 0) {
+        uint32_t e = k / index->rst_stride;
+        e = e < index->num_rst ? e : index->num_rst;
+        if (e > 0 && e * index->rst_stride > c->marker) {
+            c->marker = e * index->rst_stride;
+            c->pos = index->rst_pos[e - 1];
+        }
+    }
+    while (c->marker < k) {
+        size_t p = next_marker(c->data, c->len, c->marker ? c->pos + 2 : c->pos);
+        if (p >= c->len || c->data[p + 1] < JPEG_MARKER_RST0 || c->data[p + 1] > JPEG_MARKER_RST7) {
+            *pos = p;   // EOI or end of data
+            return ESP_ERR_NOT_FOUND;
+        }
+        c->pos = p;
+        c->marker++;
+    }
+    if (k > 0 && c->data[c->pos + 1] != JPEG_MARKER_RST0 + ((k - 1) & 7)) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    *pos = c->pos;
+    return ESP_OK;
+}
+
+static esp_err_t overlay_with_restarts(const overlay_plan_t *plan, const uint8_t *in, size_t in_len,
+                                       const jpeg_index_t *index, xform_work_t *w, jpeg_scan_writer_t *wr)
+{
+    const jpeg_info_t *info = plan->info;
+    uint32_t ri = info->restart_interval;
+    uint32_t total = (uint32_t)info->mcus_x * info->mcus_y;
+    uint32_t intervals = (total + ri - 1) / ri;
+    rst_cursor_t cur = { .data = in, .len = in_len, .index = index, .pos = info->scan_pos };
+    jpeg_scan_reader_t rd;
+    app_jpeg_scan_reader_init(&rd, info, in, in_len);
+
+    uint32_t k = 0;
+    while (k < intervals) {
+        if (k > 0) {
+            app_jpeg_write_restart(wr);
+        }
+        size_t start;
+        esp_err_t err = rst_seek(&cur, k, &start);
+        if (err != ESP_OK) {
+            return err == ESP_ERR_NOT_FOUND ? ESP_ERR_INVALID_RESPONSE : err;
+        }
+
+        if (overlay_range_touched(plan, k * ri, (k + 1) * ri - 1)) {
+            // Reader stops on marker k, app_jpeg_read_mcu() consumes it
+            rd.br.pos = start;
+            rd.br.acc = 0;
+            rd.br.bits = 0;
+            rd.br.marker_hit = false;
+            rd.next_rst = (k - 1) & 7;
+            rd.mcu_index = k * ri;
+            if (k == 0) {
+                app_jpeg_scan_reader_init(&rd, info, in, in_len);
+            }
+            uint32_t end = (k + 1) * ri < total ? (k + 1) * ri : total;
+            err = overlay_recode(plan, &rd, wr, w, k * ri, end);
+            if (err != ESP_OK) {
+                return err;
+            }
+            k++;
+            continue;
+        }
+
+        // Untouched intervals up to the next touched one go out verbatim, markers included
+        uint32_t j = k + 1;
+        while (j < intervals && !overlay_range_touched(plan, j * ri, (j + 1) * ri - 1)) {
+            j++;
+        }
+        size_t end;
+        err = rst_seek(&cur, j, &end);
+        if (err == ESP_ERR_INVALID_RESPONSE || (err == ESP_ERR_NOT_FOUND && j < intervals)) {
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+        size_t from = k > 0 ? start + 2 : start;
+        app_jpeg_write_raw(wr, &in[from], end - from);
+        wr->next_rst = (j - 1) & 7;
+        k = j;
+    }
+    return overlay_status(wr);
+}
+
+static esp_err_t overlay_without_restarts(const overlay_plan_t *plan, const uint8_t *in, size_t in_len,
+                                          xform_work_t *w, jpeg_scan_writer_t *wr)
+{
+    const jpeg_info_t *info = plan->info;
+    uint32_t total = (uint32_t)info->mcus_x * info->mcus_y;
+    uint32_t last = 0;
+    for (int i = 0; i < plan->num_rects; i++) {
+        const mcu_rect_t *r = &plan->rects[i];
+        if (r->x1 > r->x0 && r->y1 > r->y0) {
+            uint32_t m = (uint32_t)(r->y1 - 1) * info->mcus_x + r->x1 - 1;
+            last = m > last ? m : last;
+        }
+    }
+
+    // One MCU past the overlay brings every DC predictor back in line with the input
+    uint32_t end = last + 2 < total && !plan->recode_all ? last + 2 : total;
+    jpeg_scan_reader_t rd;
+    app_jpeg_scan_reader_init(&rd, info, in, in_len);
+    esp_err_t err = overlay_recode(plan, &rd, wr, w, 0, end);
+    if (err != ESP_OK || end == total) {
+        return err;
+    }
+    err = app_jpeg_copy_scan_tail(&rd, wr);
+    if (err == ESP_ERR_INVALID_STATE) {
+        err = overlay_recode(plan, &rd, wr, w, end, total);
+    }
+    return err;
+}
+
+// Header, scan and EOI, coded with the input's own tables or, with HDR_STD_DHT, the standard ones
+static esp_err_t overlay_write(const overlay_plan_t *plan, const uint8_t *in, size_t in_len,
+                               const jpeg_index_t *index, xform_work_t *w, uint32_t flags,
+                               uint8_t *out, size_t out_cap, size_t *out_len)
+{
+    const jpeg_info_t *info = plan->info;
+    size_t o = write_header(in, info, info->width, info->height, flags, out, out_cap);
+    if (o == 0 || o + 2 > out_cap) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (flags & HDR_STD_DHT) {
+        esp_err_t err = enc_from_std(w);
+        if (err != ESP_OK) {
+            return err;
+        }
+    } else {
+        enc_from_input(w);
+    }
+
+    jpeg_scan_writer_t wr;
+    app_jpeg_scan_writer_init(&wr, &out[o], out_cap - o - 2);
+    esp_err_t err;
+    if (info->restart_interval) {
+        err = overlay_with_restarts(plan, in, in_len, index, w, &wr);
+    } else {
+        err = overlay_without_restarts(plan, in, in_len, w, &wr);
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    size_t n = app_jpeg_scan_writer_finish(&wr);
+    if (n == 0) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    o += n;
+    out[o++] = 0xFF;
+    out[o++] = JPEG_MARKER_EOI;
+    *out_len = o;
+    return ESP_OK;
+}
+
+esp_err_t app_jpeg_overlay(const uint8_t *in, size_t in_len, const jpeg_index_t *index,
+                           const jpeg_overlay_t *overlay, jpeg_overlay_cache_t *cache,
+                           uint8_t *out, size_t out_cap, size_t *out_len)
+{
+    xform_work_t *w = work_alloc();
+    if (w == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    overlay_plan_t *plan = malloc(sizeof(overlay_plan_t));
+    if (plan == NULL) {
+        free(w);
+        return ESP_ERR_NO_MEM;
+    }
+
+    jpeg_info_t *info = &w->info;
+    esp_err_t err = app_jpeg_parse_info(in, in_len, index, info);
+    if (err != ESP_OK) {
+        goto done;
+    }
+    uint8_t scale = overlay->scale ? overlay->scale : (info->height >= 720 ? 2 : 1);
+    err = overlay_cache_update(cache, info->quant[info->comp[0].tq], scale > 2 ? 2 : scale);
+    if (err != ESP_OK) {
+        goto done;
+    }
+    overlay_plan(plan, info, overlay, cache);
+
+    err = overlay_write(plan, in, in_len, index, w, HDR_KEEP_DRI, out, out_cap, out_len);
+    if (err == ESP_ERR_NOT_SUPPORTED) {
+        // Tables optimized for the frame lack codes the overlay blocks need: recode it all
+        plan->recode_all = true;
+        err = overlay_write(plan, in, in_len, index, w, HDR_KEEP_DRI | HDR_STD_DHT, out, out_cap, out_len);
+    }
+
+done:
+    free(plan);
+    free(w);
+    return err;
+}
+
+// ============================================================================
+// Mosaic
+// ============================================================================
+
+/*
+ * A 2^s reduction turns each group of N x N source blocks (N = 1 << s) into one
+ * output block. With M = 8 / N, the low M x M coefficients of a source block are
+ * its M x M downscale in the DCT domain; placing those in the output block and
+ * transforming back is linear, so the output block is
+ *
+ *     sum over i, j of  P_i * L_ij * P_j^T
+ *
+ * with L_ij the low coefficients of the source block at row i, column j of the
+ * group and P_i = sqrt(1 / N) * C8[:, i*M .. i*M+M-1] * C_M^T (8 x M, orthonormal
+ * DCT matrices C). The P matrices only depend on s and are built once.
+ */
+
+#define MOSAIC_P_BITS   12      // Fraction bits of the P matrices
+#define MOSAIC_T_SHIFT  10      // Fraction bits dropped after the first product
+#define MOSAIC_ACC_BITS (2 * MOSAIC_P_BITS - MOSAIC_T_SHIFT)
+
+typedef struct {
+    bool drawn;
+    jpeg_info_t info;
+    jpeg_scan_reader_t rd;
+    uint32_t row;               // Next source MCU row
+} mosaic_tile_state_t;
+
+typedef struct {
+    mosaic_tile_state_t tiles[JPEG_MOSAIC_MAX_TILES];
+    jpeg_block_t blocks[JPEG_MAX_BLOCKS_IN_MCU];
+    jpeg_info_t std;            // Standard Huffman tables
+    jpeg_huff_enc_t enc[4];     // Standard tables: DC luma, AC luma, DC chroma, AC chroma
+    uint16_t quant[2][64];      // Output tables, zigzag order
+} mosaic_work_t;
+
+// P_i for each reduction, entry (i, x, u) at [(i * 8 + x) * M + u]
+static int16_t s_mosaic_p[4][64];
+static bool s_mosaic_p_ready = false;
+
+static void mosaic_build_p(void)
+{
+    for (int s = 1; s <= 3; s++) {
+        int n = 1 << s;
+        int m = 8 >> s;
+        for (int i = 0; i < n; i++) {
+            for (int x = 0; x < 8; x++) {
+                for (int u = 0; u < m; u++) {
+                    double sum = 0;
+                    for (int k = 0; k < m; k++) {
+                        double c8 = (x == 0 ? sqrt(1.0 / 8) : sqrt(2.0 / 8)) * cos((2 * (i * m + k) + 1) * x * M_PI / 16);
+                        double cm = (u == 0 ? sqrt(1.0 / m) : sqrt(2.0 / m)) * cos((2 * k + 1) * u * M_PI / (2 * m));
+                        sum += c8 * cm;
+                    }
+                    s_mosaic_p[s][(i * 8 + x) * m + u] = (int16_t)lround(sum * sqrt(1.0 / n) * (1 << MOSAIC_P_BITS));
+                }
+            }
+        }
+    }
+    s_mosaic_p_ready = true;
+}
+
+// Blocks of component c in an MCU, and where they start in it
+static void mosaic_comp_layout(const jpeg_info_t *info, int c, uint8_t *h, uint8_t *v, uint8_t *offset)
+{
+    *h = info->num_components == 1 ? 1 : info->comp[c].h;
+    *v = info->num_components == 1 ? 1 : info->comp[c].v;
+    *offset = 0;
+    for (int k = 0; k < c; k++) {
+        *offset += info->comp[k].h * info->comp[k].v;
+    }
+}
+
+// Same number of components with the same sampling, so blocks map one to one
+static bool mosaic_compatible(const jpeg_info_t *a, const jpeg_info_t *b)
+{
+    if (a->num_components != b->num_components) {
+        return false;
+    }
+    for (int c = 0; c < a->num_components && a->num_components > 1; c++) {
+        if (a->comp[c].h != b->comp[c].h || a->comp[c].v != b->comp[c].v) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Add the contribution of one source block to its output block
+static void mosaic_accumulate(const int16_t *coef, const uint16_t *quant, int shift, int i, int j, int32_t *acc)
+{
+    int m = 8 >> shift;
+    int32_t low[64];
+    bool row_used[8] = {0};
+
+    // Dequantized low m x m coefficients, natural order; baseline data stays within +-2047
+    for (int k = 0; k < 64; k++) {
+        int nat = app_jpeg_zigzag[k];
+        int v = nat >> 3;
+        int u = nat & 7;
+        if (v >= m || u >= m) {
+            continue;
+        }
+        int32_t d = (int32_t)coef[k] * quant[k];
+        low[v * 8 + u] = d > 2047 ? 2047 : (d < -2047 ? -2047 : d);
+        row_used[v] |= (d != 0);
+    }
+
+    if (shift == 0) {
+        for (int v = 0; v < 8; v++) {
+            for (int u = 0; u < 8 && row_used[v]; u++) {
+                acc[v * 8 + u] += low[v * 8 + u] << MOSAIC_ACC_BITS;
+            }
+        }
+        return;
+    }
+
+    // T = L * P_j^T (m x 8), then acc += P_i * T
+    const int16_t *pi = &s_mosaic_p[shift][i * 8 * m];
+    const int16_t *pj = &s_mosaic_p[shift][j * 8 * m];
+    int32_t t[8][8];
+    for (int v = 0; v < m; v++) {
+        if (!row_used[v]) {
+            continue;
+        }
+        for (int x = 0; x < 8; x++) {
+            int32_t sum = 0;
+            for (int u = 0; u < m; u++) {
+                sum += low[v * 8 + u] * pj[x * m + u];
+            }
+            t[v][x] = (sum + (1 << (MOSAIC_T_SHIFT - 1))) >> MOSAIC_T_SHIFT;
+        }
+    }
+    for (int y = 0; y < 8; y++) {
+        for (int v = 0; v < m; v++) {
+            if (!row_used[v]) {
+                continue;
+            }
+            int32_t p = pi[y * m + v];
+            for (int x = 0; x < 8; x++) {
+                acc[y * 8 + x] += p * t[v][x];
+            }
+        }
+    }
+}
+
+// Read the next 1 << shift MCU rows of a tile into its part of the output MCU row
+static esp_err_t mosaic_read_tile_row(mosaic_work_t *w, mosaic_tile_state_t *t, const jpeg_index_t *index,
+                                      int shift, uint32_t cell_mx, int32_t *acc, uint8_t out_bpm)
+{
+    const jpeg_info_t *info = &t->info;
+    int n = 1 << shift;
+    int16_t coef[64];
+
+    for (int r = 0; r < n; r++, t->row++) {
+        if (t->row >= info->mcus_y) {
+            return ESP_OK;
+        }
+        app_jpeg_scan_reader_seek(&t->rd, index, t->row * info->mcus_x);
+        while (t->rd.mcu_index < t->row * info->mcus_x) {
+            esp_err_t err = app_jpeg_read_mcu(&t->rd, w->blocks);
+            if (err != ESP_OK) {
+                return err;
+            }
+        }
+        // Columns past the cell are only decoded if no restart marker lets the next row skip them
+        uint32_t cols = info->mcus_x < cell_mx * n ? info->mcus_x : cell_mx * n;
+        for (uint32_t mx = 0; mx < cols; mx++) {
+            esp_err_t err = app_jpeg_read_mcu(&t->rd, w->blocks);
+            if (err != ESP_OK) {
+                return err;
+            }
+            for (int b = 0; b < info->blocks_per_mcu; b++) {
+                int c = info->mcu_comp[b];
+                uint8_t h, v, offset;
+                mosaic_comp_layout(info, c, &h, &v, &offset);
+                // Block position in the component's block grid, then in the output
+                uint32_t sx = mx * h + (b - offset) % h;
+                uint32_t sy = r * v + (b - offset) / h;
+                uint32_t ox = sx >> shift;
+                uint32_t oy = sy >> shift;
+                uint32_t out_mcu = ox / h;
+                int out_block = offset + (oy % v) * h + ox % h;
+                app_jpeg_block_to_coefs(&w->blocks[b], coef);
+                mosaic_accumulate(coef, info->quant[info->comp[c].tq], shift, sy & (n - 1), sx & (n - 1),
+                                  &acc[((size_t)out_mcu * out_bpm + out_block) * 64]);
+            }
+        }
+    }
+    return ESP_OK;
+}
+
+// Round acc / (q << MOSAIC_ACC_BITS) to the nearest integer, within +-1023
+static int16_t mosaic_quantize(int32_t acc, uint16_t q)
+{
+    int32_t d = (int32_t)q << MOSAIC_ACC_BITS;
+    int32_t v = acc >= 0 ? (acc + d / 2) / d : -((d / 2 - acc) / d);
+    return v > 1023 ? 1023 : (v < -1023 ? -1023 : v);
+}
+
+static size_t mosaic_write_header(const jpeg_info_t *ref, const uint16_t quant[2][64], uint16_t width,
+                                  uint16_t height, uint16_t restart_interval, uint8_t *out, size_t cap)
+{
+    int tables = ref->num_components > 1 ? 2 : 1;
+    if (cap < 2 + tables * (5 + 128) + 10 + 3 * JPEG_MAX_COMPONENTS + JPEG_STD_DHT_LEN + 6 + 8 + 2 * JPEG_MAX_COMPONENTS) {
+        return 0;
+    }
+    size_t o = 0;
+    out[o++] = 0xFF;
+    out[o++] = JPEG_MARKER_SOI;
+
+    for (int t = 0; t < tables; t++) {
+        bool wide = false;
+        for (int k = 0; k < 64; k++) {
+            wide |= quant[t][k] > 255;
+        }
+        size_t len = 3 + (wide ? 128 : 64);
+        out[o++] = 0xFF;
+        out[o++] = JPEG_MARKER_DQT;
+        out[o++] = len >> 8;
+        out[o++] = len & 0xFF;
+        out[o++] = (wide ? 0x10 : 0x00) | t;
+        for (int k = 0; k < 64; k++) {
+            if (wide) {
+                out[o++] = quant[t][k] >> 8;
+            }
+            out[o++] = quant[t][k] & 0xFF;
+        }
+    }
+
+    size_t sof_len = 8 + 3 * ref->num_components;
+    out[o++] = 0xFF;
+    out[o++] = JPEG_MARKER_SOF0;
+    out[o++] = 0x00;
+    out[o++] = sof_len;
+    out[o++] = 8;
+    out[o++] = height >> 8;
+    out[o++] = height & 0xFF;
+    out[o++] = width >> 8;
+    out[o++] = width & 0xFF;
+    out[o++] = ref->num_components;
+    for (int c = 0; c < ref->num_components; c++) {
+        out[o++] = ref->comp[c].id;
+        out[o++] = ref->num_components == 1 ? 0x11 : (ref->comp[c].h << 4) | ref->comp[c].v;
+        out[o++] = c ? 1 : 0;
+    }
+
+    memcpy(&out[o], app_jpeg_std_dht, JPEG_STD_DHT_LEN);
+    o += JPEG_STD_DHT_LEN;
+
+    const uint8_t dri[] = { 0xFF, JPEG_MARKER_DRI, 0x00, 0x04, restart_interval >> 8, restart_interval & 0xFF };
+    memcpy(&out[o], dri, sizeof(dri));
+    o += sizeof(dri);
+
+    out[o++] = 0xFF;
+    out[o++] = JPEG_MARKER_SOS;
+    out[o++] = 0x00;
+    out[o++] = 6 + 2 * ref->num_components;
+    out[o++] = ref->num_components;
+    for (int c = 0; c < ref->num_components; c++) {
+        out[o++] = ref->comp[c].id;
+        out[o++] = c ? 0x11 : 0x00;
+    }
+    out[o++] = 0;
+    out[o++] = 63;
+    out[o++] = 0;
+    return o;
+}
+
+esp_err_t app_jpeg_mosaic(const jpeg_mosaic_tile_t *tiles, uint8_t cols, uint8_t rows, uint8_t scale_shift,
+                          uint8_t *out, size_t out_cap, jpeg_mosaic_result_t *result)
+{
+    uint32_t num_tiles = (uint32_t)cols * rows;
+    if (num_tiles == 0 || num_tiles > JPEG_MOSAIC_MAX_TILES || scale_shift > 3) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!s_mosaic_p_ready) {
+        mosaic_build_p();
+    }
+    mosaic_work_t *w = heap_caps_calloc(1, sizeof(mosaic_work_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (w == NULL) {
+        w = calloc(1, sizeof(mosaic_work_t));
+        if (w == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    // The first tile that parses sets the cell size, sampling and quantization
+    const jpeg_info_t *ref = NULL;
+    for (uint32_t t = 0; t < num_tiles; t++) {
+        mosaic_tile_state_t *st = &w->tiles[t];
+        if (tiles[t].data == NULL ||
+            app_jpeg_parse_info(tiles[t].data, tiles[t].len, tiles[t].index, &st->info) != ESP_OK) {
+            continue;
+        }
+        if (ref == NULL) {
+            ref = &st->info;
+        }
+        st->drawn = mosaic_compatible(ref, &st->info);
+        if (st->drawn) {
+            app_jpeg_scan_reader_init(&st->rd, &st->info, tiles[t].data, tiles[t].len);
+        }
+    }
+    int32_t *acc = NULL;
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    if (ref == NULL) {
+        goto done;
+    }
+
+    uint16_t mcu_w, mcu_h;
+    mcu_size(ref, &mcu_w, &mcu_h);
+    uint32_t cell_mx = ref->mcus_x >> scale_shift ? ref->mcus_x >> scale_shift : 1;
+    uint32_t cell_my = ref->mcus_y >> scale_shift ? ref->mcus_y >> scale_shift : 1;
+    uint32_t mcus_x = cell_mx * cols;
+    uint32_t width = mcus_x * mcu_w;
+    uint32_t height = cell_my * rows * mcu_h;
+    if (width > UINT16_MAX || height > UINT16_MAX) {
+        err = ESP_ERR_INVALID_ARG;
+        goto done;
+    }
+    uint8_t bpm = ref->num_components == 1 ? 1 : ref->blocks_per_mcu;
+    size_t acc_size = (size_t)mcus_x * bpm * 64 * sizeof(int32_t);
+    acc = heap_caps_malloc(acc_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (acc == NULL) {
+        acc = malloc(acc_size);
+        if (acc == NULL) {
+            err = ESP_ERR_NO_MEM;
+            goto done;
+        }
+    }
+
+    // Output tables: luma from the first component, chroma from the second (shared by the third)
+    memcpy(w->quant[0], ref->quant[ref->comp[0].tq], sizeof(w->quant[0]));
+    if (ref->num_components > 1) {
+        memcpy(w->quant[1], ref->quant[ref->comp[1].tq], sizeof(w->quant[1]));
+    }
+    err = app_jpeg_load_dht(&w->std, app_jpeg_std_dht + 4, JPEG_STD_DHT_LEN - 4);
+    if (err != ESP_OK) {
+        goto done;
+    }
+    for (int t = 0; t < 2; t++) {
+        app_jpeg_enc_from_dec(&w->std.dc[t], &w->enc[2 * t]);
+        app_jpeg_enc_from_dec(&w->std.ac[t], &w->enc[2 * t + 1]);
+    }
+
+    size_t o = mosaic_write_header(ref, w->quant, width, height, mcus_x, out, out_cap);
+    if (o == 0) {
+        err = ESP_ERR_INVALID_SIZE;
+        goto done;
+    }
+    jpeg_scan_writer_t wr;
+    app_jpeg_scan_writer_init(&wr, out + o, out_cap - o - 2);
+
+    int16_t coef[64];
+    for (uint32_t oy = 0; oy < cell_my * rows; oy++) {
+        uint32_t tile_row = oy / cell_my;
+        memset(acc, 0, acc_size);
+        for (uint32_t tc = 0; tc < cols; tc++) {
+            uint32_t t = tile_row * cols + tc;
+            mosaic_tile_state_t *st = &w->tiles[t];
+            if (!st->drawn) {
+                continue;
+            }
+            // A corrupt tile stays grey from here on
+            if (mosaic_read_tile_row(w, st, tiles[t].index, scale_shift, cell_mx,
+                                     &acc[(size_t)tc * cell_mx * bpm * 64], bpm) != ESP_OK) {
+                st->drawn = false;
+            }
+        }
+
+        if (oy > 0) {
+            app_jpeg_write_restart(&wr);
+        }
+        for (uint32_t mx = 0; mx < mcus_x; mx++) {
+            for (int b = 0; b < bpm; b++) {
+                int c = ref->num_components == 1 ? 0 : ref->mcu_comp[b];
+                const uint16_t *q = w->quant[c ? 1 : 0];
+                const int32_t *blk = &acc[((size_t)mx * bpm + b) * 64];
+                for (int k = 0; k < 64; k++) {
+                    coef[k] = mosaic_quantize(blk[app_jpeg_zigzag[k]], q[k]);
+                }
+                app_jpeg_write_coefs(&wr, c, &w->enc[c ? 2 : 0], &w->enc[c ? 3 : 1], coef);
+            }
+        }
+        if (wr.bw.failed) {
+            err = ESP_ERR_INVALID_SIZE;
+            goto done;
+        }
+    }
+
+    size_t n = app_jpeg_scan_writer_finish(&wr);
+    if (n == 0) {
+        err = ESP_ERR_INVALID_SIZE;
+        goto done;
+    }
+    o += n;
+    out[o++] = 0xFF;
+    out[o++] = JPEG_MARKER_EOI;
+
+    result->len = o;
+    result->width = width;
+    result->height = height;
+    result->drawn = 0;
+    for (uint32_t t = 0; t < num_tiles; t++) {
+        result->drawn |= w->tiles[t].drawn << t;
+    }
+    err = ESP_OK;
+
+done:
+    free(acc);
+    free(w);
+    return err;
+}
+
+// ============================================================================
+// Delta
+// ============================================================================
+
+// FNV-1a
+static uint32_t delta_hash(const uint8_t *data, size_t len)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ data[i]) * 16777619u;
+    }
+    return h;
+}
+
+static uint32_t delta_gcd(uint32_t a, uint32_t b)
+{
+    while (b != 0) {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// Copy entropy-coded bytes, numbering the restart markers in them from RST0
+static void delta_copy_scan(const uint8_t *src, size_t len, uint8_t *dst)
+{
+    memcpy(dst, src, len);
+    uint8_t next = 0;
+    const uint8_t *end = dst + len;
+    uint8_t *p = dst;
+    while ((p = memchr(p, 0xFF, end - p)) != NULL && p + 1 < end) {
+        if (p[1] >= JPEG_MARKER_RST0 && p[1] <= JPEG_MARKER_RST7) {
+            p[1] = JPEG_MARKER_RST0 + (next++ & 7);
+        }
+        p += 2;
+    }
+}
+
+esp_err_t app_jpeg_delta(const uint8_t *in, size_t in_len, const jpeg_index_t *index, jpeg_delta_ref_t *ref,
+                         bool key, uint8_t *out, size_t out_cap, jpeg_delta_result_t *result)
+{
+    if (index == NULL || index->scan_pos == 0 || index->eoi_pos <= index->scan_pos) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    xform_work_t *w = work_alloc();
+    if (w == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    jpeg_info_t *info = &w->info;
+    esp_err_t err = app_jpeg_parse_info(in, in_len, index, info);
+    if (err != ESP_OK) {
+        goto done;
+    }
+
+    // Segments run from one recorded restart marker to the next
+    uint32_t total_mcus = (uint32_t)info->mcus_x * info->mcus_y;
+    bool markers = info->restart_interval != 0 && index->num_rst != 0 && index->rst_stride != 0;
+    uint32_t seg_mcus = markers ? (uint32_t)info->restart_interval * index->rst_stride : total_mcus;
+    uint32_t num_segs = markers ? index->num_rst + 1u : 1;
+    if (num_segs > JPEG_DELTA_MAX_SEGS || (uint64_t)(num_segs - 1) * seg_mcus >= total_mcus) {
+        err = ESP_ERR_INVALID_ARG;
+        goto done;
+    }
+
+    // Bands must be whole MCU rows made of whole segments
+    uint64_t unit_mcus = (uint64_t)seg_mcus / delta_gcd(seg_mcus, info->mcus_x) * info->mcus_x;
+    uint32_t segs_per_unit = unit_mcus < total_mcus ? unit_mcus / seg_mcus : num_segs;
+    uint32_t rows_per_unit = unit_mcus < total_mcus ? unit_mcus / info->mcus_x : info->mcus_y;
+    uint32_t num_units = (num_segs + segs_per_unit - 1) / segs_per_unit;
+
+    uint32_t header_hash = delta_hash(in, index->scan_pos);
+    key = key || !ref->valid || ref->header_hash != header_hash || ref->seg_mcus != seg_mcus ||
+          ref->num_segs != num_segs;
+
+    // New hashes, they replace the ones in ref once the message is complete
+    uint32_t *hashes = malloc(num_segs * sizeof(uint32_t));
+    if (hashes == NULL) {
+        err = ESP_ERR_NO_MEM;
+        goto done;
+    }
+    for (uint32_t s = 0; s < num_segs; s++) {
+        size_t start = s == 0 ? index->scan_pos : index->rst_pos[s - 1] + 2;
+        size_t end = s < index->num_rst ? index->rst_pos[s] : index->eoi_pos;
+        hashes[s] = delta_hash(&in[start], end - start);
+    }
+
+    uint16_t mcu_w, mcu_h;
+    mcu_size(info, &mcu_w, &mcu_h);
+    size_t o = 8;
+    uint16_t bands = 0;
+    uint32_t rows_sent = 0;
+    err = ESP_ERR_INVALID_SIZE;
+    if (out_cap < o) {
+        goto free_hashes;
+    }
+    for (uint32_t u = 0; u < num_units; ) {
+        // Find the next run of changed units
+        uint32_t u0 = u;
+        for (; u0 < num_units && !key; u0++) {
+            uint32_t s_end = (u0 + 1) * segs_per_unit < num_segs ? (u0 + 1) * segs_per_unit : num_segs;
+            uint32_t s = u0 * segs_per_unit;
+            while (s < s_end && hashes[s] == ref->seg_hash[s]) {
+                s++;
+            }
+            if (s < s_end) {
+                break;
+            }
+        }
+        if (u0 >= num_units) {
+            break;
+        }
+        uint32_t u1 = u0 + 1;
+        for (; u1 < num_units && !key; u1++) {
+            uint32_t s_end = (u1 + 1) * segs_per_unit < num_segs ? (u1 + 1) * segs_per_unit : num_segs;
+            uint32_t s = u1 * segs_per_unit;
+            while (s < s_end && hashes[s] == ref->seg_hash[s]) {
+                s++;
+            }
+            if (s == s_end) {
+                break;
+            }
+        }
+        if (key) {
+            u1 = num_units;
+        }
+        u = u1;
+
+        uint32_t s0 = u0 * segs_per_unit;
+        uint32_t s1 = (u1 * segs_per_unit < num_segs ? u1 * segs_per_unit : num_segs) - 1;
+        size_t start = s0 == 0 ? index->scan_pos : index->rst_pos[s0 - 1] + 2;
+        size_t end = s1 < index->num_rst ? index->rst_pos[s1] : index->eoi_pos;
+        uint32_t y = u0 * rows_per_unit * mcu_h;
+        uint32_t y_end = u1 * rows_per_unit * mcu_h < info->height ? u1 * rows_per_unit * mcu_h : info->height;
+
+        size_t band_pos = o;
+        o += 8;
+        if (o >= out_cap) {
+            goto free_hashes;
+        }
+        size_t n = write_header(in, info, info->width, y_end - y, HDR_KEEP_DRI, &out[o], out_cap - o);
+        if (n == 0 || o + n + (end - start) + 2 > out_cap) {
+            goto free_hashes;
+        }
+        o += n;
+        delta_copy_scan(&in[start], end - start, &out[o]);
+        o += end - start;
+        out[o++] = 0xFF;
+        out[o++] = JPEG_MARKER_EOI;
+
+        size_t band_len = o - band_pos - 8;
+        uint8_t *b = &out[band_pos];
+        b[0] = y >> 8;
+        b[1] = y & 0xFF;
+        b[2] = (y_end - y) >> 8;
+        b[3] = (y_end - y) & 0xFF;
+        b[4] = band_len >> 24;
+        b[5] = (band_len >> 16) & 0xFF;
+        b[6] = (band_len >> 8) & 0xFF;
+        b[7] = band_len & 0xFF;
+        bands++;
+        rows_sent += (y_end - y + mcu_h - 1) / mcu_h;
+    }
+
+    const uint8_t head[8] = {
+        key ? JPEG_DELTA_KEY : 0, 0, info->width >> 8, info->width & 0xFF,
+        info->height >> 8, info->height & 0xFF, bands >> 8, bands & 0xFF,
+    };
+    memcpy(out, head, sizeof(head));
+    result->len = bands ? o : 0;
+    result->key = key;
+    result->bands = bands;
+    result->rows_sent = rows_sent;
+    result->rows_total = info->mcus_y;
+
+    ref->valid = true;
+    ref->header_hash = header_hash;
+    ref->seg_mcus = seg_mcus;
+    ref->num_segs = num_segs;
+    memcpy(ref->seg_hash, hashes, num_segs * sizeof(uint32_t));
+    err = ESP_OK;
+
+free_hashes:
+    free(hashes);
+done:
+    free(w);
+    return err;
+}
@@ -0,0 +1,250 @@
+#pragma once
+
+#include "esp_err.h"
+#include "app_jpeg.h"
+#include "app_jpeg_entropy.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Structural transforms of baseline JPEG frames, done in the compressed domain
+ * on top of app_jpeg_entropy: blocks are moved, dropped or replaced as Huffman
+ * symbols, so the image data that is kept is bit-exact and no pixel is decoded.
+ */
+
+/**
+ * @brief Rectangle in pixels
+ */
+typedef struct {
+    uint16_t x;
+    uint16_t y;
+    uint16_t w;
+    uint16_t h;
+} jpeg_rect_t;
+
+/**
+ * @brief Cut a region out of a frame without re-compressing it
+ *
+ * The rectangle is widened to MCU boundaries (16x16 for 4:2:0, 16x8 for 4:2:2) and
+ * clipped to the frame. The output keeps the tables of the input (the standard Huffman
+ * tables are written out if the input relies on them) and has no restart interval.
+ *
+ * @param in Input JPEG
+ * @param in_len Input length
+ * @param index Structure index of the input, or NULL; its restart markers let the
+ *              decoder skip the MCUs left of and above the region
+ * @param rect Region to keep
+ * @param out Output buffer
+ * @param out_cap Output capacity
+ * @param[out] out_len Length of the cropped JPEG
+ * @param[out] out_rect Region actually kept, after snapping to MCUs (may be NULL)
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if the region lies outside the frame,
+ *         ESP_ERR_INVALID_SIZE if the result would not fit in out,
+ *         other errors as app_jpeg_parse_info() / app_jpeg_read_mcu()
+ */
+esp_err_t app_jpeg_crop(const uint8_t *in, size_t in_len, const jpeg_index_t *index, const jpeg_rect_t *rect,
+                        uint8_t *out, size_t out_cap, size_t *out_len, jpeg_rect_t *out_rect);
+
+/**
+ * @brief Drop the chroma components of a frame without re-compressing it
+ *
+ * The luma blocks are re-emitted as a single-component (non-interleaved) scan in
+ * block raster order and SOF/SOS are rewritten to one component. Luma is bit-exact.
+ *
+ * @param in Input JPEG
+ * @param in_len Input length
+ * @param index Structure index of the input, or NULL
+ * @param out Output buffer
+ * @param out_cap Output capacity
+ * @param[out] out_len Length of the grayscale JPEG
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if the block row buffer cannot be allocated,
+ *         ESP_ERR_INVALID_SIZE if the result would not fit in out,
+ *         other errors as app_jpeg_parse_info() / app_jpeg_read_mcu()
+ */
+esp_err_t app_jpeg_to_gray(const uint8_t *in, size_t in_len, const jpeg_index_t *index,
+                           uint8_t *out, size_t out_cap, size_t *out_len);
+
+#define JPEG_OVERLAY_MAX_TEXT   40
+#define JPEG_OVERLAY_MAX_MASKS  4
+
+/**
+ * @brief What to burn into a frame
+ */
+typedef struct {
+    char text[JPEG_OVERLAY_MAX_TEXT];           // ASCII, lower case is drawn as upper case; empty for none
+    uint16_t text_x;                            // Top-left corner of the text, snapped down to MCUs
+    uint16_t text_y;
+    uint8_t scale;                              // Glyph size in 8x8 blocks per side (1 or 2), 0 picks by frame height
+    uint8_t num_masks;
+    jpeg_rect_t masks[JPEG_OVERLAY_MAX_MASKS];  // Solid black, widened to MCUs
+} jpeg_overlay_t;
+
+/**
+ * @brief Glyphs pre-encoded for one luma quantization table
+ *
+ * Kept by the caller across frames; rebuilt only when the camera's table or the
+ * glyph scale changes.
+ */
+typedef struct {
+    bool valid;
+    uint8_t scale;
+    uint16_t quant[64];
+    jpeg_block_t background;    // Solid black luma block
+    jpeg_block_t *glyphs;       // scale * scale blocks per glyph, raster order
+} jpeg_overlay_cache_t;
+
+/**
+ * @brief Burn text and privacy masks into a frame in the compressed domain
+ *
+ * Every MCU under the text or a mask is replaced by pre-encoded blocks (glyphs on
+ * black, neutral chroma); DC predictors are recoded around them. With restart
+ * markers only the intervals that contain replaced MCUs are decoded, the others are
+ * copied byte for byte. Without them the scan is decoded up to the last replaced MCU
+ * and the rest is copied bit-exactly, so overlays near the top of the frame are cheapest.
+ * When the frame's Huffman tables lack a code the overlay blocks need (tables
+ * optimized for the frame's content), the whole scan is recoded with the standard
+ * tables instead, and their DHT replaces the frame's.
+ *
+ * @param in Input JPEG
+ * @param in_len Input length
+ * @param index Structure index of the input, or NULL
+ * @param overlay What to draw
+ * @param cache Glyph cache, zero-initialized before first use
+ * @param out Output buffer
+ * @param out_cap Output capacity
+ * @param[out] out_len Length of the output JPEG
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if the glyph cache cannot be allocated,
+ *         ESP_ERR_INVALID_SIZE if the result would not fit in out,
+ *         ESP_ERR_NOT_SUPPORTED if the frame's tables lack a needed code and its
+ *         components use tables other than 0 and 1, so the standard ones cannot stand in,
+ *         other errors as app_jpeg_parse_info() / app_jpeg_read_mcu()
+ */
+esp_err_t app_jpeg_overlay(const uint8_t *in, size_t in_len, const jpeg_index_t *index,
+                           const jpeg_overlay_t *overlay, jpeg_overlay_cache_t *cache,
+                           uint8_t *out, size_t out_cap, size_t *out_len);
+
+/**
+ * @brief Release the glyphs held by an overlay cache
+ *
+ * @param cache Cache, left zeroed
+ */
+void app_jpeg_overlay_cache_free(jpeg_overlay_cache_t *cache);
+
+#define JPEG_MOSAIC_MAX_TILES   4
+
+/**
+ * @brief One cell of a mosaic
+ */
+typedef struct {
+    const uint8_t *data;        // JPEG frame, NULL for a grey cell
+    size_t len;
+    const jpeg_index_t *index;  // Structure index of the frame, or NULL
+} jpeg_mosaic_tile_t;
+
+/**
+ * @brief Result of a mosaic
+ */
+typedef struct {
+    size_t len;                 // JPEG size in bytes
+    uint16_t width;
+    uint16_t height;
+    uint8_t drawn;              // Bit n set when tile n was drawn in full
+} jpeg_mosaic_result_t;
+
+/**
+ * @brief Stitch frames into a grid, each reduced by 1 << scale_shift, without decoding pixels
+ *
+ * Every output block is computed from the DCT coefficients of the source blocks it
+ * covers, so tiles are downscaled and placed in the compressed domain. The first
+ * tile that parses sets the cell size (its size in MCUs, reduced), the sampling and
+ * the quantization tables; other tiles are cut or padded to the cell. Tiles that are
+ * missing, use a different sampling or turn out to be corrupt are drawn grey. Each
+ * MCU row is a restart interval and the standard Huffman tables are used.
+ *
+ * @param tiles cols * rows tiles in raster order
+ * @param cols Grid columns
+ * @param rows Grid rows
+ * @param scale_shift Reduction, 0-3
+ * @param out Output buffer
+ * @param out_cap Output capacity
+ * @param[out] result Size and tiles drawn
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG for a bad grid or reduction,
+ *         ESP_ERR_NOT_FOUND if no tile parses, ESP_ERR_NO_MEM,
+ *         ESP_ERR_INVALID_SIZE if the result would not fit in out
+ */
+esp_err_t app_jpeg_mosaic(const jpeg_mosaic_tile_t *tiles, uint8_t cols, uint8_t rows, uint8_t scale_shift,
+                          uint8_t *out, size_t out_cap, jpeg_mosaic_result_t *result);
+
+/*
+ * Delta updates: a frame is cut at its restart markers into segments that decode
+ * on their own, and only the bands of MCU rows whose segments changed since the
+ * previous update are sent, each as a small JPEG of its own. An update message is
+ * (big-endian)
+ *
+ *     u8 flags (JPEG_DELTA_KEY), u8 0, u16 width, u16 height, u16 bands,
+ *     per band: u16 y, u16 h, u32 len, len bytes of JPEG
+ *
+ * and is drawn by placing every band at (0, y) over the previous picture. With
+ * vertically subsampled chroma (4:2:0) the pixel rows at band edges can differ
+ * slightly from a whole-frame decode, which upsamples chroma across the edge;
+ * keyframes clear that.
+ */
+
+#define JPEG_DELTA_KEY          (1 << 0)    // Bands cover the whole frame
+#define JPEG_DELTA_MAX_SEGS     (JPEG_INDEX_MAX_RST + 1)
+
+/**
+ * @brief What the receiver of delta updates currently shows, zero-initialized at the start
+ */
+typedef struct {
+    bool valid;
+    uint32_t header_hash;       // Tables, size and restart interval
+    uint32_t seg_mcus;          // MCUs per segment
+    uint16_t num_segs;
+    uint32_t seg_hash[JPEG_DELTA_MAX_SEGS];
+} jpeg_delta_ref_t;
+
+/**
+ * @brief Result of a delta update
+ */
+typedef struct {
+    size_t len;                 // Message size, 0 if nothing changed
+    bool key;
+    uint16_t bands;
+    uint16_t rows_sent;         // MCU rows in the message
+    uint16_t rows_total;        // MCU rows of the frame
+} jpeg_delta_result_t;
+
+/**
+ * @brief Build the update that turns the picture in ref into this frame
+ *
+ * Segments are compared by hashes of their entropy-coded bytes, so nothing is
+ * decoded; changed bands are copied byte for byte with their restart markers
+ * renumbered. A band is the smallest run of whole MCU rows that starts and ends on
+ * recorded restart markers; frames without restart markers are sent whole. A
+ * keyframe is sent when asked for, on the first call and whenever the tables or
+ * the frame geometry change. ref is updated to the new frame.
+ *
+ * @param in Input JPEG
+ * @param in_len Input length
+ * @param index Structure index of the input
+ * @param ref Receiver state
+ * @param key Send the whole frame
+ * @param out Message buffer
+ * @param out_cap Capacity of out
+ * @param[out] result Message size and what it carries
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG without an index,
+ *         ESP_ERR_INVALID_SIZE if the message would not fit in out (ref is left as it was),
+ *         other errors as app_jpeg_parse_info()
+ */
+esp_err_t app_jpeg_delta(const uint8_t *in, size_t in_len, const jpeg_index_t *index, jpeg_delta_ref_t *ref,
+                         bool key, uint8_t *out, size_t out_cap, jpeg_delta_result_t *result);
+
+#ifdef __cplusplus
+}
+#endif
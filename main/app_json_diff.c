@@ -0,0 +1,76 @@
+#include "app_json_diff.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+static uint32_t fnv1a(const char *s, size_t len)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (uint8_t)s[i]) * 16777619u;
+    }
+    return h;
+}
+
+int app_json_diff(json_diff_t *diff, const char *json, size_t len, char *out, size_t size)
+{
+    size_t pos = 0;
+    size_t start = 1;
+    int depth = 0;
+    bool in_string = false;
+    bool escaped = false;
+
+    for (size_t i = 1; i < len; i++) {
+        char c = json[i];
+        if (in_string) {
+            if (escaped) {
+                escaped = false;
+            } else if (c == '\\') {
+                escaped = true;
+            } else if (c == '"') {
+                in_string = false;
+            }
+            continue;
+        }
+        if (c == '"') {
+            in_string = true;
+        } else if (c == '{' || c == '[') {
+            depth++;
+        } else if (depth > 0 && (c == '}' || c == ']')) {
+            depth--;
+        } else if (depth == 0 && (c == ',' || c == '}')) {
+            const char *member = json + start;
+            size_t member_len = i - start;
+            const char *colon = memchr(member, ':', member_len);
+            start = i + 1;
+            if (colon == NULL) {
+                continue;
+            }
+            uint32_t key = fnv1a(member, colon - member);
+            uint32_t value = fnv1a(member, member_len);
+            int k = 0;
+            while (k < diff->num_keys && diff->key_hash[k] != key) {
+                k++;
+            }
+            if (k < diff->num_keys && diff->value_hash[k] == value) {
+                continue;
+            }
+            if (k == diff->num_keys && k < JSON_DIFF_MAX_KEYS) {
+                diff->key_hash[k] = key;
+                diff->num_keys++;
+            }
+            if (k < JSON_DIFF_MAX_KEYS) {
+                diff->value_hash[k] = value;
+            }
+            if (pos + member_len + 1 >= size) {
+                return -1;
+            }
+            if (pos > 0) {
+                out[pos++] = ',';
+            }
+            memcpy(out + pos, member, member_len);
+            pos += member_len;
+        }
+    }
+    return pos;
+}
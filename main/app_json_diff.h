@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Top-level members tracked per receiver; members past this are sent every time
+#define JSON_DIFF_MAX_KEYS  64
+
+/**
+ * @brief What one receiver was last sent of a JSON object, zero-initialized at the start
+ *
+ * Members are remembered by hashes of their key and of the whole member, so the
+ * state is small and independent of the object's size.
+ */
+typedef struct {
+    uint8_t num_keys;
+    uint32_t key_hash[JSON_DIFF_MAX_KEYS];
+    uint32_t value_hash[JSON_DIFF_MAX_KEYS];   // Of the member as last sent
+} json_diff_t;
+
+/**
+ * @brief Top-level members of an object that changed since the receiver's last call
+ *
+ * The members are appended as they appear in json ("key":value, comma separated,
+ * without the braces) and recorded as sent. The first call gives all of them.
+ * Nested objects and arrays count as one member; strings may contain any of {}[],:.
+ *
+ * @param diff Receiver state
+ * @param json JSON object
+ * @param len Length of json
+ * @param out Output buffer
+ * @param size Output capacity
+ * @return Length written, 0 if nothing changed, -1 if out is too small (some members
+ *         may then be recorded as sent)
+ */
+int app_json_diff(json_diff_t *diff, const char *json, size_t len, char *out, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
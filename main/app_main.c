@@ -2,10 +2,18 @@
 #include "app_wifi.h"
 #include "app_uvc.h"
 #include "app_http.h"
+#include "app_history.h"
+#include "app_storage.h"
+#include "app_timelapse.h"
+#include "app_jpeg_codec.h"
 
 void app_main(void)
 {
     app_wifi_init();
+    app_jpeg_codec_init();
     app_uvc_init();
+    app_storage_init();
     app_http_init();
+    app_history_init();
+    app_timelapse_init();
 }
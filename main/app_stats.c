@@ -0,0 +1,304 @@
+#include "app_stats.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#define WINDOW_US ((int64_t)STREAM_STATS_WINDOW_SLOTS * STREAM_STATS_SLOT_US)
+
+static uint32_t g_drops[DROP_REASON_COUNT] = {0};
+
+static const char *const drop_reason_names[DROP_REASON_COUNT] = {
+    [DROP_QUEUE_FULL] = "queue_full",
+    [DROP_BUFFER_OVERFLOW] = "buffer_overflow",
+    [DROP_OVERSIZE] = "oversize",
+    [DROP_STORE_BUSY] = "store_busy",
+    [DROP_TRANSFER_ERROR] = "transfer_error",
+    [DROP_TRUNCATED] = "truncated",
+    [DROP_CORRUPT] = "corrupt",
+    [DROP_GOP_FULL] = "gop_full",
+};
+
+static inline uint32_t log2_bucket(uint32_t value, uint32_t base_shift, uint32_t n_buckets)
+{
+    uint32_t v = value >> base_shift;
+    if (v == 0) {
+        return 0;
+    }
+    uint32_t bucket = 32 - __builtin_clz(v);
+    return bucket < n_buckets ? bucket : n_buckets - 1;
+}
+
+// Move the rolling window forward to now_us, clearing slots that fell out of it.
+// At most STREAM_STATS_WINDOW_SLOTS iterations, so still O(1).
+static void advance_window(stream_stats_t *stats, int64_t now_us)
+{
+    int64_t elapsed = now_us - stats->slot_start_us;
+    if (elapsed < STREAM_STATS_SLOT_US) {
+        return;
+    }
+    int64_t steps = elapsed / STREAM_STATS_SLOT_US;
+    if (steps >= STREAM_STATS_WINDOW_SLOTS) {
+        memset(stats->slot_bytes, 0, sizeof(stats->slot_bytes));
+        memset(stats->slot_frames, 0, sizeof(stats->slot_frames));
+        stats->slot_idx = 0;
+    } else {
+        for (int64_t i = 0; i < steps; i++) {
+            stats->slot_idx = (stats->slot_idx + 1) % STREAM_STATS_WINDOW_SLOTS;
+            stats->slot_bytes[stats->slot_idx] = 0;
+            stats->slot_frames[stats->slot_idx] = 0;
+        }
+    }
+    stats->slot_start_us += steps * STREAM_STATS_SLOT_US;
+}
+
+void app_stats_init(stream_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    portMUX_TYPE unlocked = portMUX_INITIALIZER_UNLOCKED;
+    stats->lock = unlocked;
+    stats->size_min = UINT32_MAX;
+}
+
+void app_stats_reset(stream_stats_t *stats)
+{
+    taskENTER_CRITICAL(&stats->lock);
+    stats->last_frame_us = 0;
+    stats->slot_start_us = 0;
+    stats->start_us = 0;
+    stats->slot_idx = 0;
+    memset(stats->slot_bytes, 0, sizeof(stats->slot_bytes));
+    memset(stats->slot_frames, 0, sizeof(stats->slot_frames));
+    stats->frames_total = 0;
+    stats->bytes_total = 0;
+    stats->size_min = UINT32_MAX;
+    stats->size_max = 0;
+    stats->interval_avg_us = 0;
+    stats->jitter_us = 0;
+    stats->interval_max_us = 0;
+    memset(stats->size_hist, 0, sizeof(stats->size_hist));
+    memset(stats->interval_hist, 0, sizeof(stats->interval_hist));
+    taskEXIT_CRITICAL(&stats->lock);
+}
+
+void app_stats_record(stream_stats_t *stats, size_t len, int64_t now_us)
+{
+    uint32_t size = len > UINT32_MAX ? UINT32_MAX : (uint32_t)len;
+
+    taskENTER_CRITICAL(&stats->lock);
+
+    if (stats->frames_total == 0) {
+        stats->slot_start_us = now_us;
+        stats->start_us = now_us;
+    } else {
+        advance_window(stats, now_us);
+
+        int64_t delta = now_us - stats->last_frame_us;
+        uint32_t interval = delta < 0 ? 0 : (delta > UINT32_MAX ? UINT32_MAX : (uint32_t)delta);
+        if (stats->frames_total == 1) {
+            stats->interval_avg_us = interval;
+        } else {
+            int32_t diff = (int32_t)(interval - stats->interval_avg_us);
+            stats->interval_avg_us += diff / 16;
+            uint32_t abs_diff = diff < 0 ? (uint32_t)-diff : (uint32_t)diff;
+            stats->jitter_us += ((int32_t)(abs_diff - stats->jitter_us)) / 16;
+        }
+        if (interval > stats->interval_max_us) {
+            stats->interval_max_us = interval;
+        }
+        stats->interval_hist[log2_bucket(interval / 1000, STREAM_STATS_INTERVAL_BASE_SHIFT,
+                                         STREAM_STATS_INTERVAL_BUCKETS)]++;
+    }
+
+    stats->slot_bytes[stats->slot_idx] += size;
+    stats->slot_frames[stats->slot_idx]++;
+    stats->last_frame_us = now_us;
+    stats->frames_total++;
+    stats->bytes_total += size;
+    if (size < stats->size_min) {
+        stats->size_min = size;
+    }
+    if (size > stats->size_max) {
+        stats->size_max = size;
+    }
+    stats->size_hist[log2_bucket(size, STREAM_STATS_SIZE_BASE_SHIFT, STREAM_STATS_SIZE_BUCKETS)]++;
+
+    taskEXIT_CRITICAL(&stats->lock);
+}
+
+void app_stats_snapshot(stream_stats_t *stats, int64_t now_us, stream_stats_snapshot_t *out)
+{
+    uint64_t window_bytes = 0;
+    uint32_t window_frames = 0;
+    int64_t window_us = 0;
+
+    taskENTER_CRITICAL(&stats->lock);
+
+    if (stats->frames_total > 0) {
+        advance_window(stats, now_us);
+        for (int i = 0; i < STREAM_STATS_WINDOW_SLOTS; i++) {
+            window_bytes += stats->slot_bytes[i];
+            window_frames += stats->slot_frames[i];
+        }
+        // Full slots behind the current one plus the elapsed part of the current slot,
+        // but never more history than we actually have: right after the first frame
+        // the window is what has elapsed since, and at least one slot so a single
+        // frame does not read as a burst
+        window_us = (STREAM_STATS_WINDOW_SLOTS - 1) * (int64_t)STREAM_STATS_SLOT_US
+                    + (now_us - stats->slot_start_us);
+        if (window_us > WINDOW_US) {
+            window_us = WINDOW_US;
+        }
+        if (window_us > now_us - stats->start_us) {
+            window_us = now_us - stats->start_us;
+        }
+        if (window_us < STREAM_STATS_SLOT_US) {
+            window_us = STREAM_STATS_SLOT_US;
+        }
+    }
+
+    out->frames_total = stats->frames_total;
+    out->bytes_total = stats->bytes_total;
+    out->size_min = stats->frames_total ? stats->size_min : 0;
+    out->size_max = stats->size_max;
+    out->interval_avg_us = stats->interval_avg_us;
+    out->jitter_us = stats->jitter_us;
+    out->interval_max_us = stats->interval_max_us;
+    memcpy(out->size_hist, stats->size_hist, sizeof(out->size_hist));
+    memcpy(out->interval_hist, stats->interval_hist, sizeof(out->interval_hist));
+
+    taskEXIT_CRITICAL(&stats->lock);
+
+    if (window_us > 0) {
+        out->fps_x100 = (uint32_t)((uint64_t)window_frames * 100 * 1000000 / window_us);
+        out->bitrate_bps = (uint32_t)(window_bytes * 8 * 1000000 / window_us);
+    } else {
+        out->fps_x100 = 0;
+        out->bitrate_bps = 0;
+    }
+    out->avg_frame_size = window_frames ? (uint32_t)(window_bytes / window_frames) : 0;
+}
+
+static int append_hist(char *buf, size_t buf_len, const uint32_t *hist, int n)
+{
+    int pos = 0;
+    for (int i = 0; i < n && pos >= 0 && (size_t)pos < buf_len; i++) {
+        pos += snprintf(buf + pos, buf_len - pos, "%s%" PRIu32, i ? "," : "", hist[i]);
+    }
+    return pos;
+}
+
+int app_stats_to_json(const stream_stats_snapshot_t *snap, char *buf, size_t buf_len)
+{
+    int pos = snprintf(buf, buf_len,
+        "{\"fps\":%" PRIu32 ".%02" PRIu32 ",\"bitrate_bps\":%" PRIu32 ",\"avg_frame_size\":%" PRIu32
+        ",\"frames\":%" PRIu32 ",\"bytes\":%" PRIu64 ",\"size_min\":%" PRIu32 ",\"size_max\":%" PRIu32
+        ",\"interval_avg_us\":%" PRIu32 ",\"jitter_us\":%" PRIu32 ",\"interval_max_us\":%" PRIu32
+        ",\"size_hist\":[",
+        snap->fps_x100 / 100, snap->fps_x100 % 100, snap->bitrate_bps, snap->avg_frame_size,
+        snap->frames_total, snap->bytes_total, snap->size_min, snap->size_max,
+        snap->interval_avg_us, snap->jitter_us, snap->interval_max_us);
+    if (pos < 0 || (size_t)pos >= buf_len) {
+        return -1;
+    }
+    pos += append_hist(buf + pos, buf_len - pos, snap->size_hist, STREAM_STATS_SIZE_BUCKETS);
+    if ((size_t)pos >= buf_len) {
+        return -1;
+    }
+    pos += snprintf(buf + pos, buf_len - pos, "],\"interval_hist\":[");
+    if ((size_t)pos >= buf_len) {
+        return -1;
+    }
+    pos += append_hist(buf + pos, buf_len - pos, snap->interval_hist, STREAM_STATS_INTERVAL_BUCKETS);
+    if ((size_t)pos >= buf_len) {
+        return -1;
+    }
+    pos += snprintf(buf + pos, buf_len - pos, "]}");
+    return (size_t)pos < buf_len ? pos : -1;
+}
+
+void app_stats_xform_init(xform_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    portMUX_TYPE unlocked = portMUX_INITIALIZER_UNLOCKED;
+    stats->lock = unlocked;
+}
+
+void app_stats_xform_record(xform_stats_t *stats, uint16_t width, uint16_t height,
+                            size_t bytes_in, size_t bytes_out, uint32_t time_us)
+{
+    taskENTER_CRITICAL(&stats->lock);
+    int i;
+    for (i = 0; i < XFORM_STATS_MAX_RES - 1; i++) {
+        if (stats->res[i].frames == 0 || (stats->res[i].width == width && stats->res[i].height == height)) {
+            break;
+        }
+    }
+    xform_res_stats_t *r = &stats->res[i];
+    if (r->width != width || r->height != height) {
+        memset(r, 0, sizeof(*r));
+        r->width = width;
+        r->height = height;
+    }
+    r->frames++;
+    r->bytes_in += bytes_in;
+    r->bytes_out += bytes_out;
+    r->time_us += time_us;
+    taskEXIT_CRITICAL(&stats->lock);
+}
+
+void app_stats_xform_fail(xform_stats_t *stats)
+{
+    taskENTER_CRITICAL(&stats->lock);
+    stats->failures++;
+    taskEXIT_CRITICAL(&stats->lock);
+}
+
+int app_stats_xform_to_json(xform_stats_t *stats, char *buf, size_t buf_len)
+{
+    xform_stats_t copy;
+    taskENTER_CRITICAL(&stats->lock);
+    memcpy(copy.res, stats->res, sizeof(copy.res));
+    copy.failures = stats->failures;
+    taskEXIT_CRITICAL(&stats->lock);
+
+    int pos = snprintf(buf, buf_len, "{\"failures\":%" PRIu32 ",\"by_resolution\":[", copy.failures);
+    for (int i = 0; i < XFORM_STATS_MAX_RES && pos >= 0 && (size_t)pos < buf_len; i++) {
+        const xform_res_stats_t *r = &copy.res[i];
+        if (r->frames == 0) {
+            break;
+        }
+        // Saved bytes in 0.1% units, negative if the transform grows frames
+        int32_t saved_pm = r->bytes_in ? (int32_t)(((int64_t)r->bytes_in - (int64_t)r->bytes_out) * 1000 / (int64_t)r->bytes_in) : 0;
+        pos += snprintf(buf + pos, buf_len - pos,
+            "%s{\"res\":\"%ux%u\",\"frames\":%" PRIu32 ",\"avg_in\":%" PRIu32 ",\"avg_out\":%" PRIu32
+            ",\"saved_pct\":%s%" PRId32 ".%" PRId32 ",\"avg_us\":%" PRIu32 "}",
+            i ? "," : "", r->width, r->height, r->frames,
+            (uint32_t)(r->bytes_in / r->frames), (uint32_t)(r->bytes_out / r->frames),
+            saved_pm < 0 ? "-" : "", (saved_pm < 0 ? -saved_pm : saved_pm) / 10, (saved_pm < 0 ? -saved_pm : saved_pm) % 10,
+            (uint32_t)(r->time_us / r->frames));
+    }
+    if (pos < 0 || (size_t)pos >= buf_len) {
+        return -1;
+    }
+    pos += snprintf(buf + pos, buf_len - pos, "]}");
+    return (size_t)pos < buf_len ? pos : -1;
+}
+
+void app_stats_count_drop(drop_reason_t reason)
+{
+    if (reason < DROP_REASON_COUNT) {
+        // Counted from the USB driver, frame handling and stream tasks at once
+        __atomic_fetch_add(&g_drops[reason], 1, __ATOMIC_RELAXED);
+    }
+}
+
+uint32_t app_stats_get_drops(drop_reason_t reason)
+{
+    return reason < DROP_REASON_COUNT ? __atomic_load_n(&g_drops[reason], __ATOMIC_RELAXED) : 0;
+}
+
+const char *app_stats_drop_reason_name(drop_reason_t reason)
+{
+    return reason < DROP_REASON_COUNT ? drop_reason_names[reason] : "unknown";
+}
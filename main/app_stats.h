@@ -0,0 +1,217 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Rolling window: 8 slots of 250 ms = 2 s of history for bitrate/fps
+#define STREAM_STATS_WINDOW_SLOTS      8
+#define STREAM_STATS_SLOT_US           (250 * 1000)
+
+// Frame sizes: log2 buckets, <8KB, <16KB, ... , >=8MB
+#define STREAM_STATS_SIZE_BUCKETS      12
+#define STREAM_STATS_SIZE_BASE_SHIFT   13
+
+// Inter-frame intervals: log2 buckets, <8ms, <16ms, ... , >=2048ms
+#define STREAM_STATS_INTERVAL_BUCKETS  10
+#define STREAM_STATS_INTERVAL_BASE_SHIFT 3
+
+/**
+ * @brief Per-stream quality estimator
+ *
+ * Fixed-size state updated in O(1) per frame. One instance is kept at the
+ * capture boundary and one per viewer. Do not touch fields directly, use the
+ * app_stats_* functions which take care of locking.
+ */
+typedef struct {
+    portMUX_TYPE lock;
+    int64_t last_frame_us;
+    int64_t slot_start_us;
+    int64_t start_us;           // First frame since the last reset
+    uint8_t slot_idx;
+    uint32_t slot_bytes[STREAM_STATS_WINDOW_SLOTS];
+    uint16_t slot_frames[STREAM_STATS_WINDOW_SLOTS];
+    uint32_t frames_total;
+    uint64_t bytes_total;
+    uint32_t size_min;
+    uint32_t size_max;
+    uint32_t interval_avg_us;   // EWMA, alpha = 1/16
+    uint32_t jitter_us;         // EWMA of |interval - interval_avg|
+    uint32_t interval_max_us;
+    uint32_t size_hist[STREAM_STATS_SIZE_BUCKETS];
+    uint32_t interval_hist[STREAM_STATS_INTERVAL_BUCKETS];
+} stream_stats_t;
+
+/**
+ * @brief Consistent copy of a stream_stats_t, safe to read without locking
+ */
+typedef struct {
+    uint32_t fps_x100;          // Frames per second over the rolling window, x100
+    uint32_t bitrate_bps;       // Bits per second over the rolling window
+    uint32_t avg_frame_size;    // Mean frame size over the rolling window
+    uint32_t frames_total;
+    uint64_t bytes_total;
+    uint32_t size_min;
+    uint32_t size_max;
+    uint32_t interval_avg_us;
+    uint32_t jitter_us;
+    uint32_t interval_max_us;
+    uint32_t size_hist[STREAM_STATS_SIZE_BUCKETS];
+    uint32_t interval_hist[STREAM_STATS_INTERVAL_BUCKETS];
+} stream_stats_snapshot_t;
+
+// Distinct resolutions tracked per frame transform
+#define XFORM_STATS_MAX_RES 4
+
+/**
+ * @brief Cost and effect of a frame transform at one resolution
+ */
+typedef struct {
+    uint16_t width;
+    uint16_t height;
+    uint32_t frames;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t time_us;
+} xform_res_stats_t;
+
+/**
+ * @brief Cost and effect of a frame transform, broken down by input resolution
+ */
+typedef struct {
+    portMUX_TYPE lock;
+    uint32_t failures;
+    xform_res_stats_t res[XFORM_STATS_MAX_RES];
+} xform_stats_t;
+
+/**
+ * @brief Reasons a frame can be dropped before reaching a viewer
+ */
+typedef enum {
+    DROP_QUEUE_FULL = 0,        // Capture queue full, buffer handed back to the UVC driver
+    DROP_BUFFER_OVERFLOW,       // UVC driver frame buffer overflow
+    DROP_OVERSIZE,              // Empty frame or larger than a frame store slot
+    DROP_STORE_BUSY,            // Frame store lock not available in time
+    DROP_TRANSFER_ERROR,        // USB transfer error while the frame was being assembled
+    DROP_TRUNCATED,             // Scan ends without EOI or restart markers are missing
+    DROP_CORRUPT,               // Malformed header or implausible dimensions
+    DROP_GOP_FULL,              // H.264 access unit did not fit in the GOP cache
+    DROP_REASON_COUNT,
+} drop_reason_t;
+
+/**
+ * @brief Set up an estimator, including its lock
+ *
+ * Only for an estimator nobody else can see yet; use app_stats_reset() on one that
+ * may be read concurrently.
+ *
+ * @param stats Estimator to set up
+ */
+void app_stats_init(stream_stats_t *stats);
+
+/**
+ * @brief Clear the counters of an estimator, under its lock
+ *
+ * @param stats Estimator to reset
+ */
+void app_stats_reset(stream_stats_t *stats);
+
+/**
+ * @brief Account one frame
+ *
+ * @param stats Estimator
+ * @param len Frame size in bytes
+ * @param now_us Timestamp of the frame (esp_timer_get_time())
+ */
+void app_stats_record(stream_stats_t *stats, size_t len, int64_t now_us);
+
+/**
+ * @brief Take a snapshot of the estimator
+ *
+ * Rolling values decay to zero when no frames arrive.
+ *
+ * @param stats Estimator
+ * @param now_us Current time (esp_timer_get_time())
+ * @param out Snapshot to fill
+ */
+void app_stats_snapshot(stream_stats_t *stats, int64_t now_us, stream_stats_snapshot_t *out);
+
+/**
+ * @brief Format a snapshot as a JSON object
+ *
+ * @param snap Snapshot to format
+ * @param buf Output buffer
+ * @param buf_len Size of output buffer
+ * @return Number of characters written (excluding terminator), or -1 if truncated
+ */
+int app_stats_to_json(const stream_stats_snapshot_t *snap, char *buf, size_t buf_len);
+
+/**
+ * @brief Reset transform statistics
+ *
+ * @param stats Statistics to reset
+ */
+void app_stats_xform_init(xform_stats_t *stats);
+
+/**
+ * @brief Account one transformed frame
+ *
+ * When more than XFORM_STATS_MAX_RES resolutions are seen, the last entry is reused.
+ *
+ * @param stats Statistics
+ * @param width Input frame width
+ * @param height Input frame height
+ * @param bytes_in Input frame size
+ * @param bytes_out Output frame size
+ * @param time_us CPU time spent on the frame
+ */
+void app_stats_xform_record(xform_stats_t *stats, uint16_t width, uint16_t height,
+                            size_t bytes_in, size_t bytes_out, uint32_t time_us);
+
+/**
+ * @brief Account a frame the transform could not handle
+ *
+ * @param stats Statistics
+ */
+void app_stats_xform_fail(xform_stats_t *stats);
+
+/**
+ * @brief Format transform statistics as a JSON object
+ *
+ * @param stats Statistics
+ * @param buf Output buffer
+ * @param buf_len Size of output buffer
+ * @return Number of characters written (excluding terminator), or -1 if truncated
+ */
+int app_stats_xform_to_json(xform_stats_t *stats, char *buf, size_t buf_len);
+
+/**
+ * @brief Count a dropped frame
+ *
+ * @param reason Why the frame was dropped
+ */
+void app_stats_count_drop(drop_reason_t reason);
+
+/**
+ * @brief Get the lifetime number of drops for a reason
+ *
+ * @param reason Drop reason
+ * @return Number of frames dropped for that reason
+ */
+uint32_t app_stats_get_drops(drop_reason_t reason);
+
+/**
+ * @brief Get the short name of a drop reason, as used in JSON/CSV output
+ *
+ * @param reason Drop reason
+ * @return Static string
+ */
+const char *app_stats_drop_reason_name(drop_reason_t reason);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,118 @@
+#include "app_storage.h"
+
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "esp_vfs_fat.h"
+#include "sdmmc_cmd.h"
+#include "soc/soc_caps.h"
+#if SOC_SDMMC_HOST_SUPPORTED
+#include "driver/sdmmc_host.h"
+#else
+#include "driver/sdspi_host.h"
+#include "driver/spi_common.h"
+#endif
+#if CONFIG_IDF_TARGET_ESP32P4
+#include "sd_pwr_ctrl_by_on_chip_ldo.h"
+#endif
+
+static const char *TAG = "app_storage";
+
+// Card pins. The P4 uses slot 0 on its IOMUX pins, powered from on-chip LDO 4 as on
+// the Function EV board; the S3 routes slot 1 through the GPIO matrix; the S2 has no
+// SDMMC host and talks SPI.
+#if CONFIG_IDF_TARGET_ESP32P4
+#define SD_LDO_CHANNEL  4
+#elif SOC_SDMMC_HOST_SUPPORTED
+#define SD_PIN_CLK      14
+#define SD_PIN_CMD      15
+#define SD_PIN_D0       2
+#define SD_PIN_D1       4
+#define SD_PIN_D2       12
+#define SD_PIN_D3       13
+#else
+#define SD_PIN_MOSI     35
+#define SD_PIN_MISO     37
+#define SD_PIN_CLK      36
+#define SD_PIN_CS       34
+#endif
+
+static sdmmc_card_t *s_card = NULL;
+
+esp_err_t app_storage_init(void)
+{
+    // Large allocation units keep the FAT small and long appends contiguous
+    const esp_vfs_fat_mount_config_t mount_config = {
+        .format_if_mount_failed = false,
+        .max_files = 6,
+        .allocation_unit_size = 32 * 1024,
+    };
+    esp_err_t err;
+
+#if SOC_SDMMC_HOST_SUPPORTED
+    sdmmc_host_t host = SDMMC_HOST_DEFAULT();
+    host.max_freq_khz = SDMMC_FREQ_HIGHSPEED;
+    sdmmc_slot_config_t slot_config = SDMMC_SLOT_CONFIG_DEFAULT();
+    slot_config.width = 4;
+    slot_config.flags |= SDMMC_SLOT_FLAG_INTERNAL_PULLUP;
+#if CONFIG_IDF_TARGET_ESP32P4
+    host.slot = SDMMC_HOST_SLOT_0;
+    sd_pwr_ctrl_ldo_config_t ldo_config = { .ldo_chan_id = SD_LDO_CHANNEL };
+    sd_pwr_ctrl_handle_t pwr_ctrl = NULL;
+    err = sd_pwr_ctrl_new_on_chip_ldo(&ldo_config, &pwr_ctrl);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Cannot power the card slot: %s", esp_err_to_name(err));
+        return err;
+    }
+    host.pwr_ctrl_handle = pwr_ctrl;
+#else
+    slot_config.clk = SD_PIN_CLK;
+    slot_config.cmd = SD_PIN_CMD;
+    slot_config.d0 = SD_PIN_D0;
+    slot_config.d1 = SD_PIN_D1;
+    slot_config.d2 = SD_PIN_D2;
+    slot_config.d3 = SD_PIN_D3;
+#endif
+    err = esp_vfs_fat_sdmmc_mount(APP_STORAGE_ROOT, &host, &slot_config, &mount_config, &s_card);
+#else
+    sdmmc_host_t host = SDSPI_HOST_DEFAULT();
+    const spi_bus_config_t bus_config = {
+        .mosi_io_num = SD_PIN_MOSI,
+        .miso_io_num = SD_PIN_MISO,
+        .sclk_io_num = SD_PIN_CLK,
+        .quadwp_io_num = -1,
+        .quadhd_io_num = -1,
+        .max_transfer_sz = 32 * 1024,
+    };
+    err = spi_bus_initialize(host.slot, &bus_config, SDSPI_DEFAULT_DMA);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Cannot set up the SPI bus: %s", esp_err_to_name(err));
+        return err;
+    }
+    sdspi_device_config_t slot_config = SDSPI_DEVICE_CONFIG_DEFAULT();
+    slot_config.gpio_cs = SD_PIN_CS;
+    slot_config.host_id = host.slot;
+    err = esp_vfs_fat_sdspi_mount(APP_STORAGE_ROOT, &host, &slot_config, &mount_config, &s_card);
+#endif
+
+    if (err != ESP_OK) {
+        s_card = NULL;
+        ESP_LOGW(TAG, "No SD card mounted: %s", esp_err_to_name(err));
+        return err;
+    }
+    ESP_LOGI(TAG, "SD card mounted at %s: %s, %llu MB", APP_STORAGE_ROOT, s_card->cid.name,
+             (uint64_t)s_card->csd.capacity * s_card->csd.sector_size / (1024 * 1024));
+    return ESP_OK;
+}
+
+bool app_storage_is_mounted(void)
+{
+    return s_card != NULL;
+}
+
+esp_err_t app_storage_get_space(uint64_t *total_bytes, uint64_t *free_bytes)
+{
+    if (s_card == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    return esp_vfs_fat_info(APP_STORAGE_ROOT, total_bytes, free_bytes);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Mount point of the SD card
+#define APP_STORAGE_ROOT "/sdcard"
+
+/**
+ * @brief Mount the SD card (FAT) at APP_STORAGE_ROOT
+ *
+ * SDMMC with a 4-bit bus where the chip has the host, SPI otherwise. A missing
+ * card is not fatal, recorders that need one just refuse to start.
+ *
+ * @return ESP_OK on success, otherwise the mount error
+ */
+esp_err_t app_storage_init(void);
+
+/**
+ * @brief Whether a card is mounted
+ */
+bool app_storage_is_mounted(void);
+
+/**
+ * @brief Size and free space of the card
+ *
+ * @param[out] total_bytes Card size
+ * @param[out] free_bytes Free space
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if no card is mounted
+ */
+esp_err_t app_storage_get_space(uint64_t *total_bytes, uint64_t *free_bytes);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,733 @@
+#include "app_timelapse.h"
+#include "app_storage.h"
+#include "app_http.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "sdkconfig.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+static const char *TAG = "app_timelapse";
+
+// Bytes per write: whole sectors from a DMA-capable buffer, so FATFS hands them to
+// the card without going through its sector buffer
+#define TL_BATCH_SIZE       (32 * 1024)
+#define TL_SECTOR           512
+#define TL_FRAME_MAX        (512 * 1024)
+// Frames per file, bounds the AVI index kept in memory
+#define TL_SEGMENT_FRAMES   10000
+// AVI 1.0 players stop at 1 GB
+#define TL_SEGMENT_BYTES    (1000u * 1024 * 1024)
+// A partial batch is padded to a sector, written and synced at least this often
+#define TL_SYNC_MS          30000
+#define TL_IDLE_SAMPLE_MS   5000
+#define TL_NVS_NAMESPACE    "timelapse"
+#define TL_NVS_KEY          "config"
+
+// The AVI header is padded to one sector so frames start aligned and it can be
+// rewritten in place. 'movi' sits at TL_AVI_MOVI, index offsets count from there.
+#define TL_AVI_HEADER       TL_SECTOR
+#define TL_AVI_MOVI         (TL_AVI_HEADER - 4)
+#define TL_AVIF_HASINDEX    0x10
+#define TL_AVIIF_KEYFRAME   0x10
+
+typedef struct {
+    uint32_t offset;
+    uint32_t size;
+} tl_index_t;
+
+typedef struct {
+    SemaphoreHandle_t lock;             // Guards start, stop and the status
+    SemaphoreHandle_t frame_ready;
+    SemaphoreHandle_t stopped;
+    volatile bool running;
+    volatile bool stop_requested;
+    timelapse_config_t config;
+    bool low_applied;
+
+    // Capture side, only touched by the capture path
+    uint32_t frame_count;
+    int64_t next_due_us;
+    bool have_best;
+    int64_t best_score;
+    uint8_t *pick_buf;
+    size_t pick_len;
+    size_t pick_dht;
+    uint16_t pick_width;
+    uint16_t pick_height;
+    uint16_t prev_num_segs;
+    uint32_t prev_segs[JPEG_INDEX_MAX_RST + 1];
+
+    // Hand-off, owned by the writer while write_busy is set
+    volatile bool write_busy;
+    uint8_t *write_buf;
+    size_t write_len;
+    size_t write_dht;
+    uint16_t write_width;
+    uint16_t write_height;
+
+    // Writer side
+    int fd;
+    uint32_t file_no;
+    uint8_t *batch;
+    size_t batch_len;
+    uint64_t file_pos;                  // Bytes in the file, batch included
+    uint64_t synced_pos;                // Bytes on the card
+    tl_index_t *index;
+    uint16_t width;
+    uint16_t height;
+    int64_t start_us;
+    int64_t last_sync_us;
+    uint64_t write_us;
+    int64_t idle_prev_us;
+    uint32_t idle_prev[2];
+    timelapse_status_t status;
+} timelapse_t;
+
+static timelapse_t s_tl = { .fd = -1 };
+
+static inline uint8_t *put_le32(uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+    return p + 4;
+}
+
+static inline uint8_t *put_le16(uint8_t *p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    return p + 2;
+}
+
+static inline uint8_t *put_fourcc(uint8_t *p, const char *fourcc)
+{
+    memcpy(p, fourcc, 4);
+    return p + 4;
+}
+
+// ============================================================================
+// Writer
+// ============================================================================
+
+// Write whole buffer, accounting the time. Returns false on error.
+static bool write_all(timelapse_t *tl, const uint8_t *buf, size_t len)
+{
+    int64_t t0 = esp_timer_get_time();
+    while (len > 0) {
+        ssize_t n = write(tl->fd, buf, len);
+        if (n <= 0) {
+            tl->status.errors++;
+            tl->write_us += esp_timer_get_time() - t0;
+            return false;
+        }
+        buf += n;
+        len -= n;
+        tl->status.bytes += n;
+    }
+    tl->write_us += esp_timer_get_time() - t0;
+    return true;
+}
+
+static bool batch_flush(timelapse_t *tl)
+{
+    bool ok = (tl->batch_len == 0 || write_all(tl, tl->batch, tl->batch_len));
+    tl->batch_len = 0;
+    return ok;
+}
+
+// Append to the batch, writing it out whenever it is full
+static bool batch_put(timelapse_t *tl, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    while (len > 0) {
+        size_t n = TL_BATCH_SIZE - tl->batch_len;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(tl->batch + tl->batch_len, p, n);
+        tl->batch_len += n;
+        tl->file_pos += n;
+        p += n;
+        len -= n;
+        if (tl->batch_len == TL_BATCH_SIZE && !batch_flush(tl)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// RIFF header with the sizes of what is in the file so far
+static void avi_header(timelapse_t *tl, uint8_t *h, uint64_t movi_end, uint64_t file_len, bool has_index)
+{
+    uint32_t frames = tl->status.segment_frames;
+    uint32_t fps = tl->config.play_fps;
+    uint32_t max_frame = TL_FRAME_MAX;
+    uint8_t *p = h;
+
+    memset(h, 0, TL_AVI_HEADER);
+    p = put_fourcc(p, "RIFF");
+    p = put_le32(p, (uint32_t)(file_len - 8));
+    p = put_fourcc(p, "AVI ");
+    p = put_fourcc(p, "LIST");
+    p = put_le32(p, 4 + 8 + 56 + 12 + 8 + 56 + 8 + 40);
+    p = put_fourcc(p, "hdrl");
+
+    p = put_fourcc(p, "avih");
+    p = put_le32(p, 56);
+    p = put_le32(p, 1000000 / fps);
+    p = put_le32(p, max_frame * fps);
+    p = put_le32(p, 0);
+    p = put_le32(p, has_index ? TL_AVIF_HASINDEX : 0);
+    p = put_le32(p, frames);
+    p = put_le32(p, 0);
+    p = put_le32(p, 1);
+    p = put_le32(p, max_frame);
+    p = put_le32(p, tl->width);
+    p = put_le32(p, tl->height);
+    p += 16;
+
+    p = put_fourcc(p, "LIST");
+    p = put_le32(p, 4 + 8 + 56 + 8 + 40);
+    p = put_fourcc(p, "strl");
+    p = put_fourcc(p, "strh");
+    p = put_le32(p, 56);
+    p = put_fourcc(p, "vids");
+    p = put_fourcc(p, "MJPG");
+    p += 4 + 2 + 2 + 4;             // Flags, priority, language, initial frames
+    p = put_le32(p, 1);             // Scale
+    p = put_le32(p, fps);           // Rate
+    p = put_le32(p, 0);             // Start
+    p = put_le32(p, frames);
+    p = put_le32(p, max_frame);
+    p = put_le32(p, 0xFFFFFFFF);    // Quality
+    p = put_le32(p, 0);             // Sample size
+    p += 4;
+    p = put_le16(p, tl->width);
+    p = put_le16(p, tl->height);
+    p = put_fourcc(p, "strf");
+    p = put_le32(p, 40);
+    p = put_le32(p, 40);
+    p = put_le32(p, tl->width);
+    p = put_le32(p, tl->height);
+    p = put_le16(p, 1);
+    p = put_le16(p, 24);
+    p = put_fourcc(p, "MJPG");
+    p = put_le32(p, (uint32_t)tl->width * tl->height * 3);
+    p += 16;
+
+    // Pad to the sector, then open 'movi' in its last bytes
+    size_t junk = TL_AVI_MOVI - 8 - (p - h) - 8;
+    p = put_fourcc(p, "JUNK");
+    p = put_le32(p, junk);
+    p += junk;
+    p = put_fourcc(p, "LIST");
+    p = put_le32(p, (uint32_t)(movi_end - TL_AVI_MOVI));
+    put_fourcc(p, "movi");
+}
+
+// Rewrite the AVI header in place and return to the end of the file
+static bool avi_patch_header(timelapse_t *tl, bool has_index)
+{
+    uint8_t *h = tl->batch + TL_BATCH_SIZE;     // Spare sector after the batch
+    uint64_t movi_end = has_index ? tl->file_pos - 8 - (uint64_t)tl->status.segment_frames * 16 : tl->file_pos;
+    avi_header(tl, h, movi_end, tl->file_pos, has_index);
+    return lseek(tl->fd, 0, SEEK_SET) == 0 && write_all(tl, h, TL_AVI_HEADER) &&
+           lseek(tl->fd, (off_t)tl->synced_pos, SEEK_SET) == (off_t)tl->synced_pos;
+}
+
+// Pad the batch to a sector (a JUNK chunk, or 0xFF fill bytes which JPEG allows
+// before a marker), write it out and sync, so a power cut loses at most TL_SYNC_MS
+static void segment_sync(timelapse_t *tl)
+{
+    size_t gap = (TL_SECTOR - tl->batch_len % TL_SECTOR) % TL_SECTOR;
+    if (tl->config.format == TIMELAPSE_AVI) {
+        if (gap > 0 && gap < 8) {
+            gap += TL_SECTOR;
+        }
+        if (gap > 0) {
+            uint8_t junk[8];
+            put_le32(put_fourcc(junk, "JUNK"), gap - 8);
+            memcpy(tl->batch + tl->batch_len, junk, 8);
+            memset(tl->batch + tl->batch_len + 8, 0, gap - 8);
+        }
+    } else {
+        memset(tl->batch + tl->batch_len, 0xFF, gap);
+    }
+    tl->batch_len += gap;
+    tl->file_pos += gap;
+
+    int64_t t0 = esp_timer_get_time();
+    bool ok = batch_flush(tl);
+    tl->synced_pos = tl->file_pos;
+    if (ok && tl->config.format == TIMELAPSE_AVI) {
+        ok = avi_patch_header(tl, false);
+    }
+    if (!ok || fsync(tl->fd) != 0) {
+        tl->status.errors++;
+    }
+    tl->write_us += esp_timer_get_time() - t0;
+    tl->last_sync_us = esp_timer_get_time();
+    tl->status.syncs++;
+}
+
+static void segment_close(timelapse_t *tl)
+{
+    if (tl->fd < 0) {
+        return;
+    }
+    bool ok = true;
+    if (tl->config.format == TIMELAPSE_AVI) {
+        uint8_t chunk[16];
+        put_le32(put_fourcc(chunk, "idx1"), tl->status.segment_frames * 16);
+        ok = batch_put(tl, chunk, 8);
+        for (uint32_t i = 0; i < tl->status.segment_frames && ok; i++) {
+            uint8_t *p = put_fourcc(chunk, "00dc");
+            p = put_le32(p, TL_AVIIF_KEYFRAME);
+            p = put_le32(p, tl->index[i].offset);
+            put_le32(p, tl->index[i].size);
+            ok = batch_put(tl, chunk, 16);
+        }
+        ok = ok && batch_flush(tl);
+        tl->synced_pos = tl->file_pos;
+        ok = ok && avi_patch_header(tl, true);
+    } else {
+        ok = batch_flush(tl);
+    }
+    if (!ok || close(tl->fd) != 0) {
+        tl->status.errors++;
+        ESP_LOGE(TAG, "Could not finish %s", tl->status.path);
+    } else {
+        ESP_LOGI(TAG, "Closed %s: %lu frames, %llu bytes", tl->status.path, tl->status.segment_frames, tl->file_pos);
+    }
+    tl->fd = -1;
+}
+
+// Number the next file after the ones already on the card
+static void find_file_no(timelapse_t *tl)
+{
+    DIR *dir = opendir(APP_STORAGE_ROOT "/" TIMELAPSE_DIR_NAME);
+    if (dir == NULL) {
+        return;
+    }
+    struct dirent *e;
+    while ((e = readdir(dir)) != NULL) {
+        unsigned long no;
+        if ((sscanf(e->d_name, "TL%5lu.", &no) == 1 || sscanf(e->d_name, "tl%5lu.", &no) == 1) && no >= tl->file_no) {
+            tl->file_no = no + 1;
+        }
+    }
+    closedir(dir);
+}
+
+static bool segment_open(timelapse_t *tl, uint16_t width, uint16_t height)
+{
+    mkdir(APP_STORAGE_ROOT "/" TIMELAPSE_DIR_NAME, 0775);
+    if (tl->file_no == 0) {
+        tl->file_no = 1;
+        find_file_no(tl);
+    }
+    snprintf(tl->status.path, sizeof(tl->status.path), APP_STORAGE_ROOT "/" TIMELAPSE_DIR_NAME "/TL%05lu.%s",
+             tl->file_no++, tl->config.format == TIMELAPSE_AVI ? "AVI" : "MJP");
+    tl->fd = open(tl->status.path, O_WRONLY | O_CREAT | O_TRUNC, 0664);
+    if (tl->fd < 0) {
+        tl->status.errors++;
+        ESP_LOGE(TAG, "Cannot create %s", tl->status.path);
+        return false;
+    }
+    tl->width = width;
+    tl->height = height;
+    tl->batch_len = 0;
+    tl->file_pos = 0;
+    tl->synced_pos = 0;
+    tl->status.segment_frames = 0;
+    tl->status.files++;
+    tl->last_sync_us = esp_timer_get_time();
+    if (tl->config.format == TIMELAPSE_AVI) {
+        avi_header(tl, tl->batch, TL_AVI_HEADER, TL_AVI_HEADER, false);
+        tl->batch_len = TL_AVI_HEADER;
+        tl->file_pos = TL_AVI_HEADER;
+    }
+    ESP_LOGI(TAG, "Recording to %s, %ux%u", tl->status.path, width, height);
+    return true;
+}
+
+static void append_frame(timelapse_t *tl)
+{
+    size_t dht_len = (tl->write_dht != 0 && tl->write_dht < tl->write_len) ? JPEG_STD_DHT_LEN : 0;
+    size_t len = tl->write_len + dht_len;
+
+    // A new file at the size limits and whenever the picture size changes
+    if (tl->fd >= 0 && (tl->status.segment_frames >= TL_SEGMENT_FRAMES || tl->file_pos + len + 8 > TL_SEGMENT_BYTES ||
+                        tl->write_width != tl->width || tl->write_height != tl->height)) {
+        segment_close(tl);
+    }
+    if (tl->fd < 0 && !segment_open(tl, tl->write_width, tl->write_height)) {
+        return;
+    }
+
+    bool ok = true;
+    if (tl->config.format == TIMELAPSE_AVI) {
+        uint8_t chunk[8];
+        tl->index[tl->status.segment_frames] = (tl_index_t){
+            .offset = (uint32_t)(tl->file_pos - TL_AVI_MOVI),
+            .size = len,
+        };
+        put_le32(put_fourcc(chunk, "00dc"), len);
+        ok = batch_put(tl, chunk, 8);
+    }
+    if (dht_len != 0) {
+        ok = ok && batch_put(tl, tl->write_buf, tl->write_dht) && batch_put(tl, app_jpeg_std_dht, dht_len) &&
+             batch_put(tl, tl->write_buf + tl->write_dht, tl->write_len - tl->write_dht);
+    } else {
+        ok = ok && batch_put(tl, tl->write_buf, tl->write_len);
+    }
+    if (ok && tl->config.format == TIMELAPSE_AVI && (len & 1)) {
+        ok = batch_put(tl, "", 1);
+    }
+    if (ok) {
+        tl->status.segment_frames++;
+        tl->status.frames++;
+    }
+}
+
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+// Share of time the idle task of each core ran since the last sample. The run time
+// counter ticks in microseconds (esp_timer).
+static void sample_idle(timelapse_t *tl, int64_t now)
+{
+    if (now - tl->idle_prev_us < TL_IDLE_SAMPLE_MS * 1000LL) {
+        return;
+    }
+    for (int core = 0; core < portNUM_PROCESSORS && core < 2; core++) {
+        uint32_t idle = (uint32_t)ulTaskGetRunTimeCounter(xTaskGetIdleTaskHandleForCore(core));
+        if (tl->idle_prev_us != 0) {
+            uint64_t pct = (uint64_t)(idle - tl->idle_prev[core]) * 100 / (uint64_t)(now - tl->idle_prev_us);
+            tl->status.idle_pct[core] = pct > 100 ? 100 : (uint8_t)pct;
+        }
+        tl->idle_prev[core] = idle;
+    }
+    tl->idle_prev_us = now;
+}
+#else
+static void sample_idle(timelapse_t *tl, int64_t now)
+{
+}
+#endif
+
+// Lowest camera rate while an interval recording runs and nobody watches
+static void update_low_rate(timelapse_t *tl)
+{
+    http_counters_t counters;
+    app_http_get_counters(&counters);
+    bool low = tl->running && tl->config.every_frames == 0 && tl->config.low_rate && counters.viewers == 0;
+    if (low != tl->low_applied) {
+        app_uvc_set_low_rate(tl->config.camera, low);
+        tl->low_applied = low;
+    }
+}
+
+static void timelapse_task(void *arg)
+{
+    timelapse_t *tl = (timelapse_t *)arg;
+
+    while (true) {
+        xSemaphoreTake(tl->frame_ready, pdMS_TO_TICKS(1000));
+        if (tl->write_busy) {
+            append_frame(tl);
+            tl->write_busy = false;
+        }
+        int64_t now = esp_timer_get_time();
+        if (tl->fd >= 0 && !tl->stop_requested && now - tl->last_sync_us >= TL_SYNC_MS * 1000LL) {
+            segment_sync(tl);
+        }
+        update_low_rate(tl);
+        if (tl->stop_requested) {
+            segment_close(tl);
+            tl->stop_requested = false;
+            xSemaphoreGive(tl->stopped);
+        }
+        sample_idle(tl, now);
+    }
+}
+
+// ============================================================================
+// Capture side
+// ============================================================================
+
+// Lower is better. STILL: change of the restart segment sizes against the previous
+// frame, in thousandths of the scan. SHARP: entropy-coded bytes, negated.
+static int64_t frame_score(timelapse_t *tl, const app_frame_t *frame)
+{
+    const jpeg_index_t *index = &frame->index;
+    uint32_t scan = index->eoi_pos - index->scan_pos;
+
+    if (tl->config.pick == TIMELAPSE_PICK_SHARP) {
+        return -(int64_t)scan;
+    }
+
+    uint32_t segs[JPEG_INDEX_MAX_RST + 1];
+    uint16_t num_segs = 0;
+    uint32_t pos = index->scan_pos;
+    for (uint16_t i = 0; i < index->num_rst; i++) {
+        segs[num_segs++] = index->rst_pos[i] - pos;
+        pos = index->rst_pos[i];
+    }
+    segs[num_segs++] = index->eoi_pos - pos;
+
+    int64_t score = INT64_MAX;
+    if (num_segs == tl->prev_num_segs && scan > 0) {
+        uint64_t diff = 0;
+        for (uint16_t i = 0; i < num_segs; i++) {
+            diff += (segs[i] > tl->prev_segs[i]) ? segs[i] - tl->prev_segs[i] : tl->prev_segs[i] - segs[i];
+        }
+        score = (int64_t)(diff * 1000 / scan);
+    }
+    memcpy(tl->prev_segs, segs, num_segs * sizeof(uint32_t));
+    tl->prev_num_segs = num_segs;
+    return score;
+}
+
+// Give the writer a frame, copied once into its buffer
+static void hand_off_copy(timelapse_t *tl, const app_frame_t *frame, size_t dht_insert_pos)
+{
+    if (tl->write_busy) {
+        tl->status.skipped++;
+        return;
+    }
+    memcpy(tl->write_buf, frame->data, frame->len);
+    tl->write_len = frame->len;
+    tl->write_dht = dht_insert_pos;
+    tl->write_width = frame->index.width;
+    tl->write_height = frame->index.height;
+    tl->write_busy = true;
+    xSemaphoreGive(tl->frame_ready);
+}
+
+// Give the writer the best frame of the interval by swapping buffers
+static void hand_off_best(timelapse_t *tl)
+{
+    tl->have_best = false;
+    if (tl->write_busy) {
+        tl->status.skipped++;
+        return;
+    }
+    uint8_t *buf = tl->write_buf;
+    tl->write_buf = tl->pick_buf;
+    tl->pick_buf = buf;
+    tl->write_len = tl->pick_len;
+    tl->write_dht = tl->pick_dht;
+    tl->write_width = tl->pick_width;
+    tl->write_height = tl->pick_height;
+    tl->write_busy = true;
+    xSemaphoreGive(tl->frame_ready);
+}
+
+void app_timelapse_offer(const app_frame_t *frame, size_t dht_insert_pos)
+{
+    timelapse_t *tl = &s_tl;
+    const timelapse_config_t *config = &tl->config;
+
+    // Unlocked peek: the capture path pays nothing while no recording runs
+    if (!tl->running || frame->camera != config->camera || frame->index_status != ESP_OK || frame->len > TL_FRAME_MAX) {
+        return;
+    }
+
+    if (config->every_frames != 0) {
+        if (tl->frame_count++ % config->every_frames == 0) {
+            hand_off_copy(tl, frame, dht_insert_pos);
+        }
+        return;
+    }
+
+    int64_t now = frame->timestamp_us;
+    int64_t interval_us = (int64_t)config->interval_s * 1000000;
+    if (config->pick == TIMELAPSE_PICK_FIRST) {
+        if (now >= tl->next_due_us) {
+            hand_off_copy(tl, frame, dht_insert_pos);
+            tl->next_due_us = (tl->next_due_us + interval_us > now) ? tl->next_due_us + interval_us : now + interval_us;
+        }
+        return;
+    }
+
+    int64_t score = frame_score(tl, frame);
+    if (now >= tl->next_due_us) {
+        if (tl->have_best) {
+            hand_off_best(tl);
+        }
+        tl->next_due_us = (tl->next_due_us + interval_us > now) ? tl->next_due_us + interval_us : now + interval_us;
+    }
+    if (!tl->have_best || score < tl->best_score) {
+        memcpy(tl->pick_buf, frame->data, frame->len);
+        tl->pick_len = frame->len;
+        tl->pick_dht = dht_insert_pos;
+        tl->pick_width = frame->index.width;
+        tl->pick_height = frame->index.height;
+        tl->best_score = score;
+        tl->have_best = true;
+    }
+}
+
+// ============================================================================
+// Control
+// ============================================================================
+
+static void release_buffers(timelapse_t *tl)
+{
+    free(tl->pick_buf);
+    free(tl->write_buf);
+    free(tl->batch);
+    free(tl->index);
+    tl->pick_buf = NULL;
+    tl->write_buf = NULL;
+    tl->batch = NULL;
+    tl->index = NULL;
+}
+
+esp_err_t app_timelapse_start(const timelapse_config_t *config)
+{
+    timelapse_t *tl = &s_tl;
+    esp_err_t err = ESP_OK;
+
+    if (config->camera >= APP_UVC_MAX_CAMERAS || (config->every_frames == 0 && config->interval_s == 0) ||
+        config->play_fps == 0 || config->pick > TIMELAPSE_PICK_SHARP || config->format > TIMELAPSE_MJPEG) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!app_storage_is_mounted()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(tl->lock, portMAX_DELAY);
+    if (tl->running || tl->stop_requested) {
+        err = ESP_ERR_INVALID_STATE;
+        goto done;
+    }
+
+    // The batch has a spare sector for padding and header rewrites
+    tl->batch = heap_caps_aligned_alloc(64, TL_BATCH_SIZE + 2 * TL_SECTOR, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+    if (tl->batch == NULL) {
+        tl->batch = heap_caps_aligned_alloc(64, TL_BATCH_SIZE + 2 * TL_SECTOR, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    }
+    tl->pick_buf = heap_caps_malloc(TL_FRAME_MAX, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    tl->write_buf = heap_caps_malloc(TL_FRAME_MAX, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    tl->index = heap_caps_malloc(TL_SEGMENT_FRAMES * sizeof(tl_index_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (tl->batch == NULL || tl->pick_buf == NULL || tl->write_buf == NULL || tl->index == NULL) {
+        release_buffers(tl);
+        err = ESP_ERR_NO_MEM;
+        goto done;
+    }
+
+    tl->config = *config;
+    tl->frame_count = 0;
+    tl->have_best = false;
+    tl->prev_num_segs = 0;
+    tl->write_busy = false;
+    tl->start_us = esp_timer_get_time();
+    tl->next_due_us = (config->pick == TIMELAPSE_PICK_FIRST) ? tl->start_us :
+                      tl->start_us + (int64_t)config->interval_s * 1000000;
+    tl->write_us = 0;
+    memset(&tl->status, 0, sizeof(tl->status));
+    tl->running = true;
+
+    nvs_handle_t nvs;
+    if (nvs_open(TL_NVS_NAMESPACE, NVS_READWRITE, &nvs) == ESP_OK) {
+        nvs_set_blob(nvs, TL_NVS_KEY, config, sizeof(*config));
+        nvs_commit(nvs);
+        nvs_close(nvs);
+    }
+    ESP_LOGI(TAG, "Started on camera %u: %s %lu", config->camera,
+             config->every_frames ? "every frames" : "interval s",
+             config->every_frames ? config->every_frames : config->interval_s);
+
+done:
+    xSemaphoreGive(tl->lock);
+    return err;
+}
+
+esp_err_t app_timelapse_stop(void)
+{
+    timelapse_t *tl = &s_tl;
+    esp_err_t err = ESP_OK;
+
+    xSemaphoreTake(tl->lock, portMAX_DELAY);
+    if (!tl->running) {
+        xSemaphoreGive(tl->lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    tl->running = false;
+    nvs_handle_t nvs;
+    if (nvs_open(TL_NVS_NAMESPACE, NVS_READWRITE, &nvs) == ESP_OK) {
+        nvs_erase_key(nvs, TL_NVS_KEY);
+        nvs_commit(nvs);
+        nvs_close(nvs);
+    }
+
+    // The writer finishes the frame it holds, then the file
+    xSemaphoreTake(tl->stopped, 0);
+    tl->stop_requested = true;
+    xSemaphoreGive(tl->frame_ready);
+    if (xSemaphoreTake(tl->stopped, pdMS_TO_TICKS(10000)) == pdTRUE) {
+        release_buffers(tl);
+    } else {
+        err = ESP_ERR_TIMEOUT;
+    }
+    xSemaphoreGive(tl->lock);
+    return err;
+}
+
+void app_timelapse_get_status(timelapse_status_t *out)
+{
+    timelapse_t *tl = &s_tl;
+
+    xSemaphoreTake(tl->lock, portMAX_DELAY);
+    *out = tl->status;
+    out->running = tl->running;
+    out->config = tl->config;
+    out->write_ms = (uint32_t)(tl->write_us / 1000);
+    out->write_bytes_per_s = tl->write_us ? (uint32_t)(tl->status.bytes * 1000000 / tl->write_us) : 0;
+    int64_t elapsed_us = esp_timer_get_time() - tl->start_us;
+    out->avg_bytes_per_s = (tl->start_us && elapsed_us > 0) ? (uint32_t)(tl->status.bytes * 1000000 / elapsed_us) : 0;
+    out->num_cores = portNUM_PROCESSORS < 2 ? portNUM_PROCESSORS : 2;
+    xSemaphoreGive(tl->lock);
+}
+
+esp_err_t app_timelapse_init(void)
+{
+    timelapse_t *tl = &s_tl;
+
+    tl->lock = xSemaphoreCreateMutex();
+    tl->frame_ready = xSemaphoreCreateBinary();
+    tl->stopped = xSemaphoreCreateBinary();
+    if (tl->lock == NULL || tl->frame_ready == NULL || tl->stopped == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    BaseType_t task_created = xTaskCreate(timelapse_task, "timelapse", 4096, tl, tskIDLE_PRIORITY + 2, NULL);
+    if (task_created != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    // A recording that was running before a reboot continues in a new file
+    nvs_handle_t nvs;
+    timelapse_config_t config;
+    size_t size = sizeof(config);
+    if (nvs_open(TL_NVS_NAMESPACE, NVS_READONLY, &nvs) == ESP_OK) {
+        if (nvs_get_blob(nvs, TL_NVS_KEY, &config, &size) == ESP_OK && size == sizeof(config)) {
+            esp_err_t err = app_timelapse_start(&config);
+            ESP_LOGI(TAG, "Resuming recording: %s", esp_err_to_name(err));
+        }
+        nvs_close(nvs);
+    }
+    return ESP_OK;
+}
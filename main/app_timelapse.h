@@ -0,0 +1,110 @@
+#pragma once
+
+#include "esp_err.h"
+#include "app_uvc.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Recordings go to APP_STORAGE_ROOT "/tl/TLnnnnn.AVI" (or .MJP), FAT 8.3 names
+#define TIMELAPSE_DIR_NAME  "tl"
+
+/**
+ * @brief Which frame of an interval is kept
+ *
+ * Both scores come from the compressed frame: entropy-coded bytes grow with
+ * detail, and the restart segments of a still scene keep their sizes.
+ */
+typedef enum {
+    TIMELAPSE_PICK_FIRST = 0,   // First frame of the interval, nothing is scored
+    TIMELAPSE_PICK_STILL,       // Least change against the frame before it
+    TIMELAPSE_PICK_SHARP,       // Most entropy-coded bytes
+} timelapse_pick_t;
+
+typedef enum {
+    TIMELAPSE_AVI = 0,          // MJPEG AVI, playable as is
+    TIMELAPSE_MJPEG,            // JPEG frames back to back
+} timelapse_format_t;
+
+/**
+ * @brief What to record
+ */
+typedef struct {
+    uint8_t camera;
+    uint32_t every_frames;      // Keep every Nth frame; 0 to keep one frame per interval_s
+    uint32_t interval_s;
+    timelapse_pick_t pick;      // interval_s only
+    timelapse_format_t format;
+    uint8_t play_fps;           // Playback rate written to the AVI header
+    bool low_rate;              // interval_s only: run the camera at its lowest rate while nobody watches
+} timelapse_config_t;
+
+/**
+ * @brief Recorder state and cost
+ */
+typedef struct {
+    bool running;
+    timelapse_config_t config;
+    char path[32];              // File being written
+    uint32_t frames;            // Frames written since start
+    uint32_t segment_frames;    // Frames in the current file
+    uint32_t files;
+    uint32_t skipped;           // Picked frames dropped while the writer was busy
+    uint32_t errors;            // Failed writes
+    uint64_t bytes;             // Written since start, headers and padding included
+    uint32_t write_ms;          // Spent in write and sync calls
+    uint32_t write_bytes_per_s; // Throughput of those calls
+    uint32_t avg_bytes_per_s;   // Bytes over time since start
+    uint32_t syncs;
+    uint8_t num_cores;
+    uint8_t idle_pct[2];        // Idle CPU per core over the last few seconds
+} timelapse_status_t;
+
+/**
+ * @brief Start the writer task and resume a recording that was running before a reboot
+ *
+ * @return ESP_OK on success, ESP_ERR_NO_MEM
+ */
+esp_err_t app_timelapse_init(void);
+
+/**
+ * @brief Start recording into a new file; the configuration is kept across reboots
+ *
+ * @param config What to record
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG for a bad configuration,
+ *         ESP_ERR_INVALID_STATE if a recording runs or no card is mounted, ESP_ERR_NO_MEM
+ */
+esp_err_t app_timelapse_start(const timelapse_config_t *config);
+
+/**
+ * @brief Stop recording and close the file
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if no recording runs,
+ *         ESP_ERR_TIMEOUT if the writer did not finish the file in time
+ */
+esp_err_t app_timelapse_stop(void);
+
+/**
+ * @brief Offer a frame, called from the capture path for every MJPEG frame
+ *
+ * Returns at once when the frame is not wanted; a kept frame is copied once.
+ *
+ * @param frame Frame
+ * @param dht_insert_pos Where the standard Huffman tables go, 0 if the frame has its own
+ */
+void app_timelapse_offer(const app_frame_t *frame, size_t dht_insert_pos);
+
+/**
+ * @brief Get the recorder state
+ *
+ * @param[out] out State
+ */
+void app_timelapse_get_status(timelapse_status_t *out);
+
+#ifdef __cplusplus
+}
+#endif
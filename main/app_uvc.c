@@ -1,44 +1,157 @@
 #include "app_uvc.h"
+#include "app_jpeg_codec.h"
 
 #include <inttypes.h>
+#include <string.h>
 
 #include "sdkconfig.h"
 #include "esp_system.h"
 #include "esp_log.h"
 #include "esp_err.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
+#include "freertos/semphr.h"
 
 #include "usb/usb_host.h"
 #include "usb/uvc_host.h"
 
 #define USB_HOST_PRIORITY   (15)
 
+// Per-format open timeout once a device is known to be attached; the open only
+// waits this long for a device, the descriptors and probe/commit are not bounded by it
+#define USB_OPEN_TIMEOUT_MS 500
+
+// YUY2 frames are encoded to JPEG at this quality before they reach consumers
+#define YUY2_JPEG_QUALITY   80
+#define YUY2_JPEG_BUF_SIZE  (512 * 1024)
+
+// Periodic (isochronous) bandwidth the cameras share. The P4 root port runs at
+// high speed with 125 us microframes, the S2/S3 at full speed with 1 ms frames;
+// USB 2.0 leaves 80% and 90% of them to periodic transfers.
+#if CONFIG_IDF_TARGET_ESP32P4
+#define USB_INTERVALS_PER_S     8000
+#define USB_PERIODIC_BYTES      6000
+#define USB_MAX_PACKET          3072    // 3 x 1024 bytes per microframe
+#else
+#define USB_INTERVALS_PER_S     1000
+#define USB_PERIODIC_BYTES      1350
+#define USB_MAX_PACKET          1023
+#endif
+
 // Private function prototypes
 static bool frame_callback(const uvc_host_frame_t *frame, void *user_ctx);
 static void stream_callback(const uvc_host_stream_event_data_t *event, void *user_ctx);
 
+// Everything one camera's pipeline owns, handed to the driver as user_ctx
+typedef struct {
+    uint8_t index;
+    QueueHandle_t rx_frames_queue;
+    volatile bool dev_connected;
+    volatile bool transfer_error;
+    stream_stats_t ingest_stats;
+    app_frame_t frame_desc;
+    uint64_t index_time_us;
+    uint64_t index_bytes;
+    volatile app_frame_format_t format;
+    volatile bool encoding;
+    uint8_t *jpeg_buf;
+    xform_stats_t encode_stats;
+    uvc_host_stream_format_t vs_format;     // Open stream
+    uint32_t usb_bytes;                     // Reserved bandwidth, 0 while closed
+    float full_fps;                         // Rate the stream was opened at
+    volatile bool want_low_rate;            // Set by app_uvc_set_low_rate()
+    bool low_rate;
+    // Still requests from app_uvc_capture_still(), served by the frame handling task
+    SemaphoreHandle_t still_lock;           // Held by the requester until the still is released
+    SemaphoreHandle_t still_done;
+    volatile uint32_t still_req;            // Bumped by every request
+    volatile uint32_t still_ack;            // Request last completed
+    uint32_t still_serving;
+    bool still_resuming;                    // Waiting for the first live frame after a still
+    int64_t still_stop_us;                  // Live stream stopped
+    esp_err_t still_err;
+    uint8_t *still_buf;
+    app_still_t still;
+    app_still_stats_t still_stats;
+} uvc_camera_t;
+
 // Private variables
-static QueueHandle_t rx_frames_queue;
-static bool dev_connected = false;
 static const char *TAG = "app_uvc";
 static uvc_frame_ready_cb_t g_user_frame_callback = NULL;
 static void *g_user_callback_ctx = NULL;
+static uvc_camera_t g_cameras[APP_UVC_MAX_CAMERAS];
+static SemaphoreHandle_t g_usb_lock = NULL;     // Held while a camera picks a format and reserves bandwidth
+static SemaphoreHandle_t g_usb_attached = NULL; // One count per attached camera no pipeline has claimed yet
+static uint32_t g_usb_reserved = 0;
+
+// USB IDs per camera. With UVC_HOST_ANY_* a camera takes whichever device the
+// driver finds first that is not open yet; set them to keep the numbering stable
+// across reboots when several cameras hang off a hub.
+static const struct {
+    uint16_t vid;
+    uint16_t pid;
+} g_camera_ids[APP_UVC_MAX_CAMERAS] = {
+    { UVC_HOST_ANY_VID, UVC_HOST_ANY_PID },
+    { UVC_HOST_ANY_VID, UVC_HOST_ANY_PID },
+};
+
+// Formats tried in order when a camera is found, skipping those that do not fit
+// the bandwidth other cameras left. MJPEG comes first, /stream and everything
+// built on it needs it; H.264 needs about a tenth of the bitrate but only feeds
+// /stream.h264 and /stream.mp4, so it is opt-in (CONFIG_APP_UVC_H264). Cameras
+// without MJPEG send YUY2, which is encoded here: 720p at USB 2.0 full-speed
+// rates is limited to a few fps by the link itself, so smaller sizes are tried as
+// well. Those are also what a second or third camera ends up with on a full-speed bus.
+// OPTIMIZATION: Lowered to 720p for stable Wi-Fi streaming.
+// Change back to 1920x1080 if your network can handle the bandwidth.
+static const uvc_host_stream_format_t g_formats[] = {
+#if CONFIG_APP_UVC_H264
+    { .h_res = 1280, .v_res = 720, .fps = 20, .format = UVC_VS_FORMAT_H264 },
+#endif
+    { .h_res = 1280, .v_res = 720, .fps = 20, .format = UVC_VS_FORMAT_MJPEG },
+    { .h_res = 1280, .v_res = 720, .fps = 10, .format = UVC_VS_FORMAT_YUY2 },
+    { .h_res = 640, .v_res = 480, .fps = 15, .format = UVC_VS_FORMAT_MJPEG },
+    { .h_res = 640, .v_res = 480, .fps = 15, .format = UVC_VS_FORMAT_YUY2 },
+    { .h_res = 320, .v_res = 240, .fps = 15, .format = UVC_VS_FORMAT_MJPEG },
+    { .h_res = 320, .v_res = 240, .fps = 15, .format = UVC_VS_FORMAT_YUY2 },
+};
+
+// Formats tried in order for a still (/still). usb_host_uvc has no still image
+// probe/commit or trigger request (UVC still methods 2 and 3), so the stream is
+// switched to one of these for a frame and back. Only MJPEG, so the still needs no encode.
+static const uvc_host_stream_format_t g_still_formats[] = {
+    { .h_res = 2592, .v_res = 1944, .fps = 15, .format = UVC_VS_FORMAT_MJPEG },
+    { .h_res = 1920, .v_res = 1080, .fps = 15, .format = UVC_VS_FORMAT_MJPEG },
+    { .h_res = 1920, .v_res = 1080, .fps = 30, .format = UVC_VS_FORMAT_MJPEG },
+};
+
+// Rates tried, lowest first, while a camera idles (app_uvc_set_low_rate()). Cameras
+// only accept the frame intervals they list, so several are tried.
+static const float g_low_rates[] = { 1, 2, 5, 10 };
+
+// Stills are received into frame buffers of this size, the driver would otherwise
+// size them for an uncompressed frame
+#define STILL_BUF_SIZE      (2 * 1024 * 1024)
+// Good frames dropped after the switch while the sensor settles exposure
+#define STILL_SKIP_FRAMES   2
+// Give up on the still format after this long
+#define STILL_WAIT_MS       3000
 
 static const uvc_host_stream_config_t stream_config = {
     .event_cb = stream_callback,
     .frame_cb = frame_callback,
-    .user_ctx = &rx_frames_queue,
+    .user_ctx = NULL,   // Set to the camera
     .usb = {
         .vid = UVC_HOST_ANY_VID,
         .pid = UVC_HOST_ANY_PID,
         .uvc_stream_index = 0,
     },
     .vs_format = {
-        // OPTIMIZATION: Lowered to 720p 15fps for stable Wi-Fi streaming. 
-        // Change back to 1920x1080 if your network can handle the bandwidth.
+        // Replaced by each entry of g_formats in turn
         .h_res = 1280,
         .v_res = 720,
         .fps = 20,
@@ -57,12 +170,21 @@ static bool frame_callback(const uvc_host_frame_t *frame, void *user_ctx)
 {
     assert(frame);
     assert(user_ctx);
-    QueueHandle_t frame_q = *((QueueHandle_t *)user_ctx);
+    uvc_camera_t *cam = (uvc_camera_t *)user_ctx;
+
+    // Events and frames come from the same driver task, so a transfer error seen
+    // since the last frame hit the one that is being completed now
+    if (cam->transfer_error) {
+        cam->transfer_error = false;
+        app_stats_count_drop(DROP_TRANSFER_ERROR);
+        return true;
+    }
 
     // Send the received frame to queue for further processing
-    BaseType_t result = xQueueSendToBack(frame_q, &frame, 0);
+    BaseType_t result = xQueueSendToBack(cam->rx_frames_queue, &frame, 0);
     if (pdPASS != result) {
-        ESP_LOGW(TAG, "Queue full, losing frame"); 
+        app_stats_count_drop(DROP_QUEUE_FULL);
+        ESP_LOGW(TAG, "Camera %u: queue full, losing frame", cam->index); 
         return true; // Return true so the UVC driver immediately reuses this buffer
     }
     return false; 
@@ -70,26 +192,358 @@ static bool frame_callback(const uvc_host_frame_t *frame, void *user_ctx)
 
 static void stream_callback(const uvc_host_stream_event_data_t *event, void *user_ctx)
 {
+    uvc_camera_t *cam = (uvc_camera_t *)user_ctx;
     switch (event->type) {
     case UVC_HOST_TRANSFER_ERROR:
-        ESP_LOGE(TAG, "USB error has occurred, err_no = %i", event->transfer_error.error);
+        ESP_LOGE(TAG, "Camera %u: USB error has occurred, err_no = %i", cam->index, event->transfer_error.error);
+        cam->transfer_error = true;
         break;
     case UVC_HOST_DEVICE_DISCONNECTED:
-        ESP_LOGI(TAG, "Device suddenly disconnected");
-        dev_connected = false;
+        ESP_LOGI(TAG, "Camera %u: device suddenly disconnected", cam->index);
+        cam->dev_connected = false;
         ESP_ERROR_CHECK(uvc_host_stream_close(event->device_disconnected.stream_hdl));
         break;
     case UVC_HOST_FRAME_BUFFER_OVERFLOW:
-        ESP_LOGW(TAG, "Frame buffer overflow");
+        app_stats_count_drop(DROP_BUFFER_OVERFLOW);
+        ESP_LOGW(TAG, "Camera %u: frame buffer overflow", cam->index);
         break;
     case UVC_HOST_FRAME_BUFFER_UNDERFLOW:
-        ESP_LOGW(TAG, "Frame buffer underflow");
+        ESP_LOGW(TAG, "Camera %u: frame buffer underflow", cam->index);
         break;
     default:
         break;
     }
 }
 
+/**
+ * @brief Bus bandwidth a format needs
+ * 
+ * The data rate is estimated from typical compressed sizes and capped at the
+ * largest isochronous packet, which is all a camera can ask for. A camera that
+ * asks for a larger alternate setting than estimated fails to open and the next
+ * format is tried.
+ * 
+ * @return Bytes per (micro)frame
+ */
+static uint32_t format_usb_bytes(const uvc_host_stream_format_t *format)
+{
+    // Bytes per pixel, in thousandths
+    uint32_t per_mille = (format->format == UVC_VS_FORMAT_H264) ? 14 :
+                         (format->format == UVC_VS_FORMAT_MJPEG) ? 150 : 2000;
+    double bytes_per_s = (double)format->h_res * format->v_res * format->fps * per_mille / 1000.0;
+    uint32_t bytes = (uint32_t)(bytes_per_s / USB_INTERVALS_PER_S) + 1;
+    return bytes > USB_MAX_PACKET ? USB_MAX_PACKET : bytes;
+}
+
+/**
+ * @brief Open one format if it fits the remaining bandwidth, called with g_usb_lock held
+ * 
+ * @return ESP_OK with the bandwidth reserved in cam->usb_bytes, ESP_ERR_NOT_FOUND if
+ *         the format does not fit, otherwise the open error
+ */
+static esp_err_t open_format(uvc_camera_t *cam, uvc_host_stream_config_t *config,
+                             const uvc_host_stream_format_t *format, uvc_host_stream_hdl_t *stream)
+{
+    uint32_t bytes = format_usb_bytes(format);
+    if (g_usb_reserved + bytes > USB_PERIODIC_BYTES) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    config->vs_format = *format;
+    // Raw frames and stills are large, two buffers are enough as they are consumed at once
+    config->advanced.number_of_frame_buffers = (format->format == UVC_VS_FORMAT_YUY2 || config->advanced.frame_size != 0) ?
+            2 : stream_config.advanced.number_of_frame_buffers;
+    esp_err_t err = uvc_host_stream_open(config, pdMS_TO_TICKS(USB_OPEN_TIMEOUT_MS), stream);
+    if (err == ESP_OK) {
+        cam->usb_bytes = bytes;
+        g_usb_reserved += bytes;
+    }
+    return err;
+}
+
+/**
+ * @brief Open the first format the camera offers that fits the remaining bandwidth
+ * 
+ * Cameras open one at a time so each sees what the others hold. Only called with a
+ * device attached, so a format the camera lacks fails fast and the lock is never
+ * held while waiting for a device.
+ * 
+ * @return ESP_OK with the bandwidth reserved in cam->usb_bytes, otherwise the last error
+ */
+static esp_err_t open_stream(uvc_camera_t *cam, uvc_host_stream_config_t *config, uvc_host_stream_hdl_t *stream)
+{
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    xSemaphoreTake(g_usb_lock, portMAX_DELAY);
+    for (size_t i = 0; i < sizeof(g_formats) / sizeof(g_formats[0]) && err != ESP_OK; i++) {
+        err = open_format(cam, config, &g_formats[i], stream);
+    }
+    xSemaphoreGive(g_usb_lock);
+    return err;
+}
+
+static void release_stream(uvc_camera_t *cam)
+{
+    xSemaphoreTake(g_usb_lock, portMAX_DELAY);
+    g_usb_reserved -= cam->usb_bytes;
+    cam->usb_bytes = 0;
+    xSemaphoreGive(g_usb_lock);
+}
+
+// Stop and close a stream, handing back the frames still queued from it
+static void close_stream(uvc_camera_t *cam, uvc_host_stream_hdl_t stream)
+{
+    uvc_host_frame_t *frame;
+    if (cam->dev_connected) {
+        uvc_host_stream_stop(stream);
+        while (xQueueReceive(cam->rx_frames_queue, &frame, 0) == pdPASS) {
+            uvc_host_frame_return(stream, frame);
+        }
+        uvc_host_stream_close(stream);
+    }
+    release_stream(cam);
+}
+
+/**
+ * @brief Cheap sanity checks on an indexed frame
+ * 
+ * @return DROP_REASON_COUNT if the frame may be forwarded, otherwise the reason to drop it
+ */
+static drop_reason_t validate_frame(const app_frame_t *desc, const uvc_host_stream_format_t *format)
+{
+    const jpeg_index_t *index = &desc->index;
+    
+    if (desc->format == APP_FRAME_H264) {
+        // Access units with parameter sets only are fine, they update the cached SPS/PPS
+        return (desc->index_status == ESP_OK || desc->index_status == ESP_ERR_NOT_FOUND) ?
+               DROP_REASON_COUNT : DROP_CORRUPT;
+    }
+    if (desc->index_status == ESP_ERR_INVALID_SIZE) {
+        return DROP_TRUNCATED;
+    }
+    if (desc->index_status != ESP_OK) {
+        return DROP_CORRUPT;
+    }
+    if (index->width == 0 || index->height == 0 ||
+        index->width > format->h_res || index->height > format->v_res) {
+        return DROP_CORRUPT;
+    }
+    
+    // Lost USB packets usually take restart markers with them
+    if (index->restart_interval != 0) {
+        uint32_t mcu_w = 8 * ((index->sampling >> 4) ? (index->sampling >> 4) : 1);
+        uint32_t mcu_h = 8 * ((index->sampling & 0x0F) ? (index->sampling & 0x0F) : 1);
+        uint32_t mcus = ((index->width + mcu_w - 1) / mcu_w) * ((index->height + mcu_h - 1) / mcu_h);
+        if (index->rst_total < (mcus - 1) / index->restart_interval) {
+            return DROP_TRUNCATED;
+        }
+    }
+    return DROP_REASON_COUNT;
+}
+
+/**
+ * @brief Replace a YUY2 frame in the descriptor by its JPEG encoding
+ *
+ * @return DROP_REASON_COUNT on success, otherwise the reason to drop the frame
+ */
+static drop_reason_t encode_frame(uvc_camera_t *cam, app_frame_t *desc, const uvc_host_stream_format_t *format)
+{
+    if (desc->len < (size_t)format->h_res * format->v_res * 2) {
+        return DROP_TRUNCATED;
+    }
+    const jpeg_codec_image_t image = {
+        .data = (uint8_t *)desc->data,
+        .width = format->h_res,
+        .height = format->v_res,
+        .format = JPEG_CODEC_YUY2,
+    };
+    size_t len = 0;
+    int64_t t0 = esp_timer_get_time();
+    esp_err_t err = app_jpeg_codec_encode(app_jpeg_codec_get(NULL), &image, YUY2_JPEG_QUALITY,
+                                          cam->jpeg_buf, YUY2_JPEG_BUF_SIZE, &len);
+    if (err != ESP_OK) {
+        app_stats_xform_fail(&cam->encode_stats);
+        ESP_LOGW(TAG, "YUY2 encode failed: %s", esp_err_to_name(err));
+        return err == ESP_ERR_INVALID_SIZE ? DROP_OVERSIZE : DROP_CORRUPT;
+    }
+    app_stats_xform_record(&cam->encode_stats, format->h_res, format->v_res, desc->len, len,
+                           (uint32_t)(esp_timer_get_time() - t0));
+    desc->data = cam->jpeg_buf;
+    desc->len = len;
+    return DROP_REASON_COUNT;
+}
+
+/**
+ * @brief Keep the first good frame of a still stream, after the sensor has settled
+ * 
+ * @return ESP_OK with the still in cam->still, ESP_ERR_TIMEOUT if none came in time
+ */
+static esp_err_t still_capture(uvc_camera_t *cam, uvc_host_stream_hdl_t stream, const uvc_host_stream_format_t *format)
+{
+    app_frame_t *desc = &cam->frame_desc;
+    int64_t deadline = esp_timer_get_time() + STILL_WAIT_MS * 1000LL;
+    int skip = STILL_SKIP_FRAMES;
+    esp_err_t err = uvc_host_stream_start(stream);
+    if (err != ESP_OK) {
+        return err;
+    }
+    
+    err = ESP_ERR_TIMEOUT;
+    while (err == ESP_ERR_TIMEOUT && cam->dev_connected && esp_timer_get_time() < deadline) {
+        uvc_host_frame_t *frame;
+        if (xQueueReceive(cam->rx_frames_queue, &frame, pdMS_TO_TICKS(100)) != pdPASS) {
+            continue;
+        }
+        // The descriptor is borrowed, the next live frame fills it again; seq stays
+        desc->data = frame->data;
+        desc->len = frame->data_len;
+        desc->format = APP_FRAME_MJPEG;
+        desc->index_status = app_jpeg_build_index(desc->data, desc->len, &desc->index);
+        if (validate_frame(desc, format) == DROP_REASON_COUNT && skip-- <= 0) {
+            int64_t now = esp_timer_get_time();
+            memcpy(cam->still_buf, desc->data, desc->len);
+            cam->still = (app_still_t){
+                .data = cam->still_buf,
+                .len = desc->len,
+                .dht_insert_pos = (desc->index.sos_pos != 0 && desc->index.num_dht == 0) ? desc->index.sos_pos : 0,
+                .width = desc->index.width,
+                .height = desc->index.height,
+                .timestamp_us = now,
+                .switch_us = (uint32_t)(now - cam->still_stop_us),
+            };
+            err = ESP_OK;
+        }
+        uvc_host_frame_return(stream, frame);
+    }
+    return err;
+}
+
+// Complete the request being served, once live frames flow again (or cannot)
+static void still_finish(uvc_camera_t *cam)
+{
+    uint32_t outage_us = (uint32_t)(esp_timer_get_time() - cam->still_stop_us);
+    cam->still.outage_us = outage_us;
+    cam->still_stats.last_outage_us = outage_us;
+    if (outage_us > cam->still_stats.max_outage_us) {
+        cam->still_stats.max_outage_us = outage_us;
+    }
+    if (cam->still_err == ESP_OK) {
+        cam->still_stats.taken++;
+    } else {
+        cam->still_stats.failed++;
+    }
+    ESP_LOGI(TAG, "Camera %u: still %s, %ux%u, live stream out for %lu ms", cam->index,
+             cam->still_err == ESP_OK ? "taken" : esp_err_to_name(cam->still_err),
+             cam->still.width, cam->still.height, outage_us / 1000);
+    cam->still_resuming = false;
+    cam->still_ack = cam->still_serving;
+    xSemaphoreGive(cam->still_done);
+}
+
+/**
+ * @brief Serve a still request: switch the stream to a still format and back
+ * 
+ * The live stream is closed, the first still format the camera accepts within the
+ * bandwidth it held is opened for one frame, then the live format is reopened.
+ * 
+ * @return ESP_OK with the live stream running again in *stream; the request is
+ *         completed at the first live frame. Otherwise *stream is NULL and the
+ *         request is completed at once.
+ */
+static esp_err_t still_bounce(uvc_camera_t *cam, uvc_host_stream_config_t *config, uvc_host_stream_hdl_t *stream)
+{
+    const uvc_host_stream_format_t live = cam->vs_format;
+    uvc_host_stream_hdl_t still_stream = NULL;
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    
+    cam->still_serving = cam->still_req;
+    cam->still_stop_us = esp_timer_get_time();
+    memset(&cam->still, 0, sizeof(cam->still));
+    close_stream(cam, *stream);
+    *stream = NULL;
+    
+    config->advanced.frame_size = STILL_BUF_SIZE;
+    xSemaphoreTake(g_usb_lock, portMAX_DELAY);
+    for (size_t i = 0; i < sizeof(g_still_formats) / sizeof(g_still_formats[0]) && err != ESP_OK; i++) {
+        err = open_format(cam, config, &g_still_formats[i], &still_stream);
+    }
+    xSemaphoreGive(g_usb_lock);
+    config->advanced.frame_size = stream_config.advanced.frame_size;
+    if (err == ESP_OK) {
+        err = still_capture(cam, still_stream, &config->vs_format);
+        close_stream(cam, still_stream);
+    } else {
+        err = ESP_ERR_NOT_SUPPORTED;
+    }
+    cam->still_err = err;
+    
+    xSemaphoreTake(g_usb_lock, portMAX_DELAY);
+    err = cam->dev_connected ? open_format(cam, config, &live, stream) : ESP_ERR_INVALID_STATE;
+    xSemaphoreGive(g_usb_lock);
+    if (err == ESP_OK) {
+        err = uvc_host_stream_start(*stream);
+        if (err != ESP_OK) {
+            close_stream(cam, *stream);
+            *stream = NULL;
+        }
+    }
+    if (err != ESP_OK) {
+        still_finish(cam);
+        return err;
+    }
+    cam->still_resuming = true;
+    return ESP_OK;
+}
+
+/**
+ * @brief Reopen the stream at the lowest rate the camera accepts for its size and
+ *        format, or back at the rate it was opened at
+ * 
+ * @return ESP_OK with the stream running again in *stream, otherwise *stream is NULL
+ */
+static esp_err_t rate_switch(uvc_camera_t *cam, uvc_host_stream_config_t *config, uvc_host_stream_hdl_t *stream)
+{
+    bool low = cam->want_low_rate;
+    uvc_host_stream_format_t format = cam->vs_format;
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    
+    close_stream(cam, *stream);
+    *stream = NULL;
+    xSemaphoreTake(g_usb_lock, portMAX_DELAY);
+    for (size_t i = 0; low && i < sizeof(g_low_rates) / sizeof(g_low_rates[0]) && g_low_rates[i] < cam->full_fps &&
+         err != ESP_OK && cam->dev_connected; i++) {
+        format.fps = g_low_rates[i];
+        err = open_format(cam, config, &format, stream);
+    }
+    if (err != ESP_OK && cam->dev_connected) {
+        format.fps = cam->full_fps;
+        err = open_format(cam, config, &format, stream);
+    }
+    xSemaphoreGive(g_usb_lock);
+    if (err == ESP_OK) {
+        err = uvc_host_stream_start(*stream);
+        if (err != ESP_OK) {
+            close_stream(cam, *stream);
+            *stream = NULL;
+        }
+    }
+    // A camera without a lower rate keeps its own, it is not asked again
+    cam->low_rate = low;
+    if (err == ESP_OK) {
+        cam->vs_format = config->vs_format;
+        ESP_LOGI(TAG, "Camera %u: %s rate, %ux%u@%u", cam->index, low ? "low" : "full",
+                 config->vs_format.h_res, config->vs_format.v_res, (unsigned)config->vs_format.fps);
+    }
+    return err;
+}
+
+// Called from the UVC driver task for every new streaming interface
+static void driver_event_callback(const uvc_host_driver_event_data_t *event, void *user_ctx)
+{
+    if (event->type == UVC_HOST_DRIVER_EVENT_DEVICE_CONNECTED && event->device_connected.uvc_stream_index == 0) {
+        ESP_LOGI(TAG, "UVC device attached at address %u", event->device_connected.dev_addr);
+        xSemaphoreGive(g_usb_attached);
+    }
+}
+
 static void usb_lib_task(void *arg)
 {
     while (1) {
@@ -106,49 +560,146 @@ static void usb_lib_task(void *arg)
 
 static void frame_handling_task(void *arg)
 {
-    const uvc_host_stream_config_t *stream_config = (const uvc_host_stream_config_t *)arg;
-    QueueHandle_t frame_q = *((QueueHandle_t *)(stream_config->user_ctx));  
+    uvc_camera_t *cam = (uvc_camera_t *)arg;
+    uvc_host_stream_config_t config = stream_config;
+    config.user_ctx = cam;
+    config.usb.vid = g_camera_ids[cam->index].vid;
+    config.usb.pid = g_camera_ids[cam->index].pid;
+    bool attached = false;      // Our device is still on the bus after the last stream
     
     while (true) {
         uvc_host_stream_hdl_t uvc_stream = NULL;
-        ESP_LOGI(TAG, "Looking for UVC camera...");
-        esp_err_t err = uvc_host_stream_open(stream_config, pdMS_TO_TICKS(5000), &uvc_stream);
-        if (ESP_OK != err) {
+        if (!attached) {
+            ESP_LOGI(TAG, "Camera %u: looking for UVC camera...", cam->index);
+            xSemaphoreTake(g_usb_attached, portMAX_DELAY);
+        }
+        if (open_stream(cam, &config, &uvc_stream) != ESP_OK) {
+            // Not ours (other IDs), nothing fits, or already gone: leave it to the
+            // other pipelines and look again later
+            ESP_LOGW(TAG, "Camera %u: could not open the attached camera", cam->index);
+            attached = false;
+            xSemaphoreGive(g_usb_attached);
             vTaskDelay(pdMS_TO_TICKS(2000));
             continue;
         }
         
-        dev_connected = true;
-        ESP_LOGI(TAG, "Camera connected! Starting stream...");
+        cam->encoding = (config.vs_format.format == UVC_VS_FORMAT_YUY2);
+        if (cam->encoding && cam->jpeg_buf == NULL) {
+            cam->jpeg_buf = heap_caps_malloc(YUY2_JPEG_BUF_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+            if (cam->jpeg_buf == NULL) {
+                ESP_LOGE(TAG, "Camera %u: no memory for the YUY2 encode buffer", cam->index);
+                uvc_host_stream_close(uvc_stream);
+                release_stream(cam);
+                attached = true;
+                vTaskDelay(pdMS_TO_TICKS(2000));
+                continue;
+            }
+        }
+        cam->vs_format = config.vs_format;
+        cam->full_fps = config.vs_format.fps;
+        cam->low_rate = false;
+        cam->dev_connected = true;
+        cam->format = (config.vs_format.format == UVC_VS_FORMAT_H264) ? APP_FRAME_H264 : APP_FRAME_MJPEG;
+        ESP_LOGI(TAG, "Camera %u connected! Starting %s stream %ux%u@%u, %lu of %u bytes per USB interval...",
+                 cam->index, cam->format == APP_FRAME_H264 ? "H.264" : (cam->encoding ? "YUY2" : "MJPEG"),
+                 config.vs_format.h_res, config.vs_format.v_res, (unsigned)config.vs_format.fps,
+                 cam->usb_bytes, USB_PERIODIC_BYTES);
         vTaskDelay(pdMS_TO_TICKS(100));
         
         uvc_host_stream_start(uvc_stream);
         
-        while (dev_connected) {
+        while (cam->dev_connected) {
+            if (cam->still_req != cam->still_ack && !cam->still_resuming) {
+                if (still_bounce(cam, &config, &uvc_stream) != ESP_OK) {
+                    break;
+                }
+                continue;
+            }
+            if (cam->want_low_rate != cam->low_rate && !cam->still_resuming) {
+                if (rate_switch(cam, &config, &uvc_stream) != ESP_OK) {
+                    break;
+                }
+                continue;
+            }
             uvc_host_frame_t *frame;
-            if (xQueueReceive(frame_q, &frame, pdMS_TO_TICKS(1000)) == pdPASS) {
-                if (g_user_frame_callback != NULL) {
-                    g_user_frame_callback(frame->data, frame->data_len, g_user_callback_ctx);
+            if (xQueueReceive(cam->rx_frames_queue, &frame, pdMS_TO_TICKS(1000)) == pdPASS) {
+                int64_t now = esp_timer_get_time();
+                app_stats_record(&cam->ingest_stats, frame->data_len, now);
+                
+                app_frame_t *desc = &cam->frame_desc;
+                desc->data = frame->data;
+                desc->len = frame->data_len;
+                desc->seq++;
+                desc->timestamp_us = now;
+                desc->format = cam->format;
+                desc->camera = cam->index;
+                drop_reason_t reason = DROP_REASON_COUNT;
+                if (cam->encoding) {
+                    reason = encode_frame(cam, desc, &frame->vs_format);
+                }
+                if (reason == DROP_REASON_COUNT) {
+                    int64_t t0 = esp_timer_get_time();
+                    if (desc->format == APP_FRAME_H264) {
+                        desc->index_status = app_h264_build_index(desc->data, desc->len, &desc->h264);
+                    } else {
+                        desc->index_status = app_jpeg_build_index(desc->data, desc->len, &desc->index);
+                    }
+                    cam->index_time_us += esp_timer_get_time() - t0;
+                    cam->index_bytes += desc->len;
+                    reason = validate_frame(desc, &frame->vs_format);
+                }
+                if (reason != DROP_REASON_COUNT) {
+                    app_stats_count_drop(reason);
+                    ESP_LOGW(TAG, "Camera %u: dropping frame %" PRIu32 " (%zu bytes): %s",
+                             cam->index, desc->seq, desc->len, app_stats_drop_reason_name(reason));
+                } else {
+                    if (g_user_frame_callback != NULL) {
+                        g_user_frame_callback(desc, g_user_callback_ctx);
+                    }
+                    if (cam->still_resuming) {
+                        still_finish(cam);
+                    }
                 }
                 uvc_host_frame_return(uvc_stream, frame);
             }
         }
         
-        if (dev_connected) {
-            ESP_LOGI(TAG, "Stream stop");
+        if (cam->still_resuming) {
+            still_finish(cam);
+        }
+        if (uvc_stream == NULL) {
+            ESP_LOGW(TAG, "Camera %u: live stream did not come back after a format switch", cam->index);
+            vTaskDelay(pdMS_TO_TICKS(2000));
+        } else if (cam->dev_connected) {
+            ESP_LOGI(TAG, "Camera %u: stream stop", cam->index);
             uvc_host_stream_stop(uvc_stream);
             vTaskDelay(pdMS_TO_TICKS(2000));
         } else {
-            ESP_LOGI(TAG, "Device disconnected");
+            ESP_LOGI(TAG, "Camera %u: device disconnected", cam->index);
         }
+        attached = cam->dev_connected;
+        release_stream(cam);
     }
 }
 
 esp_err_t app_uvc_init(void)
 {
-    // OPTIMIZATION: Increased queue size from 3 to 10 to absorb Wi-Fi latency spikes
-    rx_frames_queue = xQueueCreate(10, sizeof(uvc_host_frame_t *));  
-    assert(rx_frames_queue);
+    g_usb_lock = xSemaphoreCreateMutex();
+    g_usb_attached = xSemaphoreCreateCounting(APP_UVC_MAX_CAMERAS * 4, 0);
+    assert(g_usb_lock && g_usb_attached);
+    for (uint8_t i = 0; i < APP_UVC_MAX_CAMERAS; i++) {
+        uvc_camera_t *cam = &g_cameras[i];
+        cam->index = i;
+        // OPTIMIZATION: Increased queue size from 3 to 10 to absorb Wi-Fi latency spikes
+        cam->rx_frames_queue = xQueueCreate(10, sizeof(uvc_host_frame_t *));  
+        assert(cam->rx_frames_queue);
+        cam->format = APP_FRAME_MJPEG;
+        cam->still_lock = xSemaphoreCreateMutex();
+        cam->still_done = xSemaphoreCreateBinary();
+        assert(cam->still_lock && cam->still_done);
+        app_stats_init(&cam->ingest_stats);
+        app_stats_xform_init(&cam->encode_stats);
+    }
     
     ESP_LOGI(TAG, "Installing USB Host");
     const usb_host_config_t host_config = {
@@ -166,12 +717,18 @@ esp_err_t app_uvc_init(void)
         .driver_task_priority = USB_HOST_PRIORITY + 1,
         .xCoreID = 0, // Pin to core 0
         .create_background_task = true,
+        .event_cb = driver_event_callback,
+        .user_ctx = NULL,
     };
     ESP_ERROR_CHECK(uvc_host_install(&uvc_driver_config));
     
     // OPTIMIZATION: Increased priority to ensure frames are handled quickly
-    task_created = xTaskCreatePinnedToCore(frame_handling_task, "frame_hdl", 4096, (void *)&stream_config, USB_HOST_PRIORITY, NULL, 0);
-    assert(task_created == pdTRUE);
+    // Stack also covers the share of a YUY2 encode that runs in this task
+    // One pipeline per camera, each with its own queue and frame descriptor
+    for (uint8_t i = 0; i < APP_UVC_MAX_CAMERAS; i++) {
+        task_created = xTaskCreatePinnedToCore(frame_handling_task, "frame_hdl", 6144, &g_cameras[i], USB_HOST_PRIORITY, NULL, 0);
+        assert(task_created == pdTRUE);
+    }
 
     return ESP_OK;
 }
@@ -184,4 +741,116 @@ esp_err_t app_uvc_register_frame_callback(uvc_frame_ready_cb_t frame_cb, void *u
     g_user_frame_callback = frame_cb;
     g_user_callback_ctx = user_ctx;
     return ESP_OK;
-}
\ No newline at end of file
+}
+
+void app_uvc_get_stats(uint8_t camera, stream_stats_snapshot_t *out)
+{
+    assert(camera < APP_UVC_MAX_CAMERAS);
+    app_stats_snapshot(&g_cameras[camera].ingest_stats, esp_timer_get_time(), out);
+}
+
+uint32_t app_uvc_get_queue_depth(uint8_t camera)
+{
+    assert(camera < APP_UVC_MAX_CAMERAS);
+    QueueHandle_t q = g_cameras[camera].rx_frames_queue;
+    return q ? uxQueueMessagesWaiting(q) : 0;
+}
+
+app_frame_format_t app_uvc_get_format(uint8_t camera)
+{
+    assert(camera < APP_UVC_MAX_CAMERAS);
+    return g_cameras[camera].format;
+}
+
+bool app_uvc_is_encoding(uint8_t camera)
+{
+    assert(camera < APP_UVC_MAX_CAMERAS);
+    return g_cameras[camera].encoding;
+}
+
+xform_stats_t *app_uvc_get_encode_stats(uint8_t camera)
+{
+    assert(camera < APP_UVC_MAX_CAMERAS);
+    return &g_cameras[camera].encode_stats;
+}
+
+uint32_t app_uvc_get_index_us_per_mb(uint8_t camera)
+{
+    assert(camera < APP_UVC_MAX_CAMERAS);
+    const uvc_camera_t *cam = &g_cameras[camera];
+    return cam->index_bytes ? (uint32_t)(cam->index_time_us * 1024 * 1024 / cam->index_bytes) : 0;
+}
+
+void app_uvc_get_camera_info(uint8_t camera, uvc_camera_info_t *out)
+{
+    assert(camera < APP_UVC_MAX_CAMERAS);
+    const uvc_camera_t *cam = &g_cameras[camera];
+    memset(out, 0, sizeof(*out));
+    if (!cam->dev_connected) {
+        return;
+    }
+    out->connected = true;
+    out->width = cam->vs_format.h_res;
+    out->height = cam->vs_format.v_res;
+    out->fps = (uint8_t)cam->vs_format.fps;
+    out->usb_bytes = cam->usb_bytes;
+}
+
+uint32_t app_uvc_get_usb_budget(void)
+{
+    return USB_PERIODIC_BYTES;
+}
+esp_err_t app_uvc_capture_still(uint8_t camera, TickType_t timeout, app_still_t *out)
+{
+    assert(camera < APP_UVC_MAX_CAMERAS);
+    uvc_camera_t *cam = &g_cameras[camera];
+    
+    if (!cam->dev_connected || xSemaphoreTake(cam->still_lock, 0) != pdTRUE) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (cam->still_buf == NULL) {
+        cam->still_buf = heap_caps_malloc(STILL_BUF_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (cam->still_buf == NULL) {
+            xSemaphoreGive(cam->still_lock);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    
+    // A request that timed out earlier may still be served first; its completion
+    // does not match this one and is waited past
+    xSemaphoreTake(cam->still_done, 0);
+    uint32_t req = cam->still_req + 1;
+    cam->still_req = req;
+    TickType_t start = xTaskGetTickCount();
+    while (cam->still_ack != req) {
+        TickType_t waited = xTaskGetTickCount() - start;
+        if (waited >= timeout || xSemaphoreTake(cam->still_done, timeout - waited) != pdTRUE) {
+            xSemaphoreGive(cam->still_lock);
+            return ESP_ERR_TIMEOUT;
+        }
+    }
+    if (cam->still_err != ESP_OK) {
+        xSemaphoreGive(cam->still_lock);
+        return cam->still_err;
+    }
+    *out = cam->still;
+    return ESP_OK;
+}
+
+void app_uvc_release_still(uint8_t camera)
+{
+    assert(camera < APP_UVC_MAX_CAMERAS);
+    xSemaphoreGive(g_cameras[camera].still_lock);
+}
+
+void app_uvc_get_still_stats(uint8_t camera, app_still_stats_t *out)
+{
+    assert(camera < APP_UVC_MAX_CAMERAS);
+    *out = g_cameras[camera].still_stats;
+}
+
+void app_uvc_set_low_rate(uint8_t camera, bool low)
+{
+    assert(camera < APP_UVC_MAX_CAMERAS);
+    g_cameras[camera].want_low_rate = low;
+}
@@ -3,6 +3,10 @@
 #include "esp_err.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
+#include "app_stats.h"
+#include "app_jpeg.h"
+#include "app_h264.h"
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -10,14 +14,43 @@
 extern "C" {
 #endif
 
+// Cameras that can stream at once, e.g. through a USB hub
+#define APP_UVC_MAX_CAMERAS 2
+
+/**
+ * @brief Encoding of the frames coming out of the camera
+ */
+typedef enum {
+    APP_FRAME_MJPEG = 0,
+    APP_FRAME_H264,             // One Annex B access unit per frame
+} app_frame_format_t;
+
+/**
+ * @brief Frame descriptor handed to consumers
+ * 
+ * The JPEG structure (or the NAL units of an H.264 access unit) is parsed once
+ * at ingest so consumers can jump to segments and restart markers without
+ * scanning the frame again.
+ */
+typedef struct {
+    const uint8_t *data;        // Frame data (MJPEG or H.264)
+    size_t len;                 // Length of frame data in bytes
+    uint32_t seq;               // Capture sequence number
+    int64_t timestamp_us;       // Time the frame left the capture queue
+    app_frame_format_t format;
+    uint8_t camera;             // Camera the frame came from, below APP_UVC_MAX_CAMERAS
+    esp_err_t index_status;     // Result of app_jpeg_build_index() or app_h264_build_index()
+    jpeg_index_t index;         // MJPEG frames only
+    h264_index_t h264;          // H.264 frames only
+} app_frame_t;
+
 /**
  * @brief Frame ready callback function type
  * 
- * @param data Pointer to frame data (MJPEG)
- * @param len Length of frame data in bytes
+ * @param frame Frame descriptor, only valid during the call
  * @param user_ctx User context passed during registration
  */
-typedef void (*uvc_frame_ready_cb_t)(const uint8_t *data, size_t len, void *user_ctx);
+typedef void (*uvc_frame_ready_cb_t)(const app_frame_t *frame, void *user_ctx);
 
 /**
  * @brief Initialize UVC module
@@ -35,6 +68,152 @@ esp_err_t app_uvc_init(void);
  */
 esp_err_t app_uvc_register_frame_callback(uvc_frame_ready_cb_t frame_cb, void *user_ctx);
 
+/**
+ * @brief Stream a camera has negotiated
+ */
+typedef struct {
+    bool connected;
+    uint16_t width;
+    uint16_t height;
+    uint8_t fps;
+    uint32_t usb_bytes;         // Bus bandwidth reserved for the stream, bytes per (micro)frame
+} uvc_camera_info_t;
+
+/**
+ * @brief Get rolling statistics of frames coming out of a camera
+ * 
+ * Frames are accounted at the frame handling task boundary, before any consumer runs.
+ * 
+ * @param camera Camera, below APP_UVC_MAX_CAMERAS
+ * @param out Snapshot to fill
+ */
+void app_uvc_get_stats(uint8_t camera, stream_stats_snapshot_t *out);
+
+/**
+ * @brief Get the number of frames waiting in a camera's capture queue
+ * 
+ * @param camera Camera, below APP_UVC_MAX_CAMERAS
+ * @return Queue depth
+ */
+uint32_t app_uvc_get_queue_depth(uint8_t camera);
+
+/**
+ * @brief Get the format of a camera's open stream
+ * 
+ * @param camera Camera, below APP_UVC_MAX_CAMERAS
+ * @return Frame format, APP_FRAME_MJPEG while no camera is connected
+ */
+app_frame_format_t app_uvc_get_format(uint8_t camera);
+
+/**
+ * @brief Whether a camera sends YUY2 that is encoded to JPEG on the device
+ * 
+ * @param camera Camera, below APP_UVC_MAX_CAMERAS
+ * @return true for a YUY2 camera; its frames are handed out as APP_FRAME_MJPEG
+ */
+bool app_uvc_is_encoding(uint8_t camera);
+
+/**
+ * @brief Get the cost and compression of a camera's YUY2 to JPEG encoder
+ * 
+ * @param camera Camera, below APP_UVC_MAX_CAMERAS
+ * @return Statistics, updated for every encoded frame
+ */
+xform_stats_t *app_uvc_get_encode_stats(uint8_t camera);
+
+/**
+ * @brief Get the average cost of building the JPEG structure index at ingest
+ * 
+ * @param camera Camera, below APP_UVC_MAX_CAMERAS
+ * @return Microseconds per MB of frame data
+ */
+uint32_t app_uvc_get_index_us_per_mb(uint8_t camera);
+
+/**
+ * @brief Get the stream a camera has negotiated and the bandwidth it holds
+ * 
+ * @param camera Camera, below APP_UVC_MAX_CAMERAS
+ * @param out Info to fill, zeroed while the camera is not connected
+ */
+void app_uvc_get_camera_info(uint8_t camera, uvc_camera_info_t *out);
+
+/**
+ * @brief Get the periodic bandwidth of the bus shared by all cameras
+ * 
+ * @return Bytes per (micro)frame
+ */
+uint32_t app_uvc_get_usb_budget(void);
+
+/**
+ * @brief Run a camera at the lowest frame rate it offers for its size and format,
+ *        or back at the rate it was opened at
+ * 
+ * The camera's frame handling task reopens the stream, consumers see a short gap
+ * in the frames. Reconnecting a camera starts it at the full rate and the request
+ * is applied again.
+ * 
+ * @param camera Camera, below APP_UVC_MAX_CAMERAS
+ * @param low true for the lowest rate
+ */
+void app_uvc_set_low_rate(uint8_t camera, bool low);
+
+/**
+ * @brief A full-resolution still taken during a live stream
+ */
+typedef struct {
+    const uint8_t *data;        // JPEG, valid until app_uvc_release_still()
+    size_t len;
+    size_t dht_insert_pos;      // Non-zero if the still lacks Huffman tables: where they go
+    uint16_t width;
+    uint16_t height;
+    int64_t timestamp_us;
+    uint32_t switch_us;         // Live stream stopped to still received
+    uint32_t outage_us;         // Live stream stopped to the next live frame
+} app_still_t;
+
+/**
+ * @brief Counters of the stills a camera has taken
+ */
+typedef struct {
+    uint32_t taken;
+    uint32_t failed;
+    uint32_t last_outage_us;
+    uint32_t max_outage_us;
+} app_still_stats_t;
+
+/**
+ * @brief Take a full-resolution still
+ *
+ * The camera's frame handling task stops the live stream, reopens it at the
+ * largest still format the camera accepts, keeps the first good frame after the
+ * sensor has settled and reopens the live format. Consumers see a gap in the
+ * frames but no disconnect. Returns once live frames flow again, so the outage
+ * is known. One still at a time per camera.
+ *
+ * @param camera Camera, below APP_UVC_MAX_CAMERAS
+ * @param timeout Ticks to wait for the still and the live stream to come back
+ * @param[out] out Still, to be released with app_uvc_release_still() on success
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if the camera is not connected or
+ *         busy with another still, ESP_ERR_NO_MEM, ESP_ERR_NOT_SUPPORTED if the camera
+ *         accepts no still format, ESP_ERR_TIMEOUT
+ */
+esp_err_t app_uvc_capture_still(uint8_t camera, TickType_t timeout, app_still_t *out);
+
+/**
+ * @brief Hand back the buffer of a still
+ *
+ * @param camera Camera the still was taken with
+ */
+void app_uvc_release_still(uint8_t camera);
+
+/**
+ * @brief Get the still counters of a camera
+ *
+ * @param camera Camera, below APP_UVC_MAX_CAMERAS
+ * @param out Counters to fill
+ */
+void app_uvc_get_still_stats(uint8_t camera, app_still_stats_t *out);
+
 #ifdef __cplusplus
 }
 #endif
@@ -5,6 +5,7 @@
 #include "esp_wifi.h"
 #include "esp_event.h"
 #include "esp_log.h"
+#include "esp_netif_sntp.h"
 #include "nvs_flash.h"
 
 static const char *TAG = "app_wifi";
@@ -20,6 +21,9 @@ static bool ap_connected = false;
 #define EXAMPLE_ESP_WIFI_PASS      "XXX"
 #define EXAMPLE_ESP_MAXIMUM_RETRY  5
 
+// Wall clock for burned-in timestamps, synced in the background once the link is up
+#define APP_SNTP_SERVER            "pool.ntp.org"
+
 static void event_handler(void *arg, esp_event_base_t event_base,
                           int32_t event_id, void *event_data)
 {
@@ -79,6 +83,11 @@ static void wifi_init()
     ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
     ESP_ERROR_CHECK(esp_wifi_start());
 
+    esp_sntp_config_t sntp_config = ESP_NETIF_SNTP_DEFAULT_CONFIG(APP_SNTP_SERVER);
+    if (esp_netif_sntp_init(&sntp_config) != ESP_OK) {
+        ESP_LOGW(TAG, "SNTP init failed, timestamps will show uptime");
+    }
+
     ESP_LOGI(TAG, "STA initialization complete");
 
     EventBits_t bits = xEventGroupWaitBits(wifi_event_group, WIFI_CONNECTED_BIT | WIFI_FAIL_BIT, pdFALSE, pdFALSE, portMAX_DELAY);
@@ -109,4 +118,13 @@ esp_err_t app_wifi_init(void)
 bool app_wifi_is_connected(void)
 {
     return ap_connected;
+}
+
+int app_wifi_get_rssi(void)
+{
+    wifi_ap_record_t ap_info;
+    if (!ap_connected || esp_wifi_sta_get_ap_info(&ap_info) != ESP_OK) {
+        return 0;
+    }
+    return ap_info.rssi;
 }
\ No newline at end of file
@@ -19,6 +19,12 @@ esp_err_t app_wifi_init(void);
  */
 bool app_wifi_is_connected(void);
 
+/**
+ * Get the signal strength of the current AP
+ * @return RSSI in dBm, 0 if not connected
+ */
+int app_wifi_get_rssi(void);
+
 #ifdef __cplusplus
 }
 #endif
\ No newline at end of file
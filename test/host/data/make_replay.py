@@ -0,0 +1,35 @@
+#!/usr/bin/env python3
+"""Regenerate replay_320x240.h264, the H.264 capture the host tests replay.
+
+Needs PyAV (pip install av). The stream is shaped like the UVC H.264 cameras:
+baseline profile, an access unit delimiter before every frame, SPS and PPS
+repeated before every IDR, an IDR every 10 frames.
+"""
+import os
+
+import av
+import numpy as np
+
+WIDTH, HEIGHT, FRAMES = 320, 240, 30
+
+out_path = os.path.join(os.path.dirname(os.path.abspath(__file__)), "replay_320x240.h264")
+with av.open(out_path, "w", format="h264") as container:
+    stream = container.add_stream("libx264", rate=30)
+    stream.width, stream.height = WIDTH, HEIGHT
+    stream.pix_fmt = "yuv420p"
+    stream.options = {"profile": "baseline", "g": "10", "bf": "0", "threads": "1",
+                      "x264-params": "aud=1:repeat-headers=1:scenecut=0:keyint=10:min-keyint=10"}
+    y, x = np.mgrid[0:HEIGHT, 0:WIDTH]
+    for i in range(FRAMES):
+        # Gradient background with a square moving across it
+        img = np.zeros((HEIGHT, WIDTH, 3), np.uint8)
+        img[..., 0] = x * 255 // WIDTH
+        img[..., 1] = y * 255 // HEIGHT
+        img[..., 2] = 128
+        left = 8 * i
+        img[100:140, left:left + 40] = (240, 240, 40)
+        frame = av.VideoFrame.from_ndarray(img, format="rgb24")
+        for packet in stream.encode(frame):
+            container.mux(packet)
+    for packet in stream.encode():
+        container.mux(packet)
@@ -0,0 +1,301 @@
+#include "fake_uvc.h"
+#include "test_util.h"
+#include "usb/usb_host.h"
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_FRAME_BUFFERS   8
+// Distinct MJPEG frames a stream cycles through, encoded when it starts
+#define MJPEG_VARIANTS      4
+
+struct uvc_host_stream_s {
+    int port;
+    uvc_host_stream_config_t config;
+    pthread_t thread;
+    volatile bool started;
+    volatile bool closed;
+    unsigned num_buffers;
+    uvc_host_frame_t frames[MAX_FRAME_BUFFERS];
+    bool busy[MAX_FRAME_BUFFERS];
+};
+
+typedef struct {
+    const fake_uvc_device_t *device;
+    bool plugged;
+    struct uvc_host_stream_s *stream;   // Open stream, NULL if none
+    uint32_t frames_sent;
+} port_t;
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static port_t g_ports[FAKE_UVC_MAX_DEVICES];
+static int g_num_ports;
+static uvc_host_driver_config_t g_driver;
+static bool g_installed;
+
+static void announce(int port)
+{
+    uvc_host_driver_event_data_t event = {
+        .type = UVC_HOST_DRIVER_EVENT_DEVICE_CONNECTED,
+        .device_connected = { .dev_addr = port + 1, .uvc_stream_index = 0, .frame_info_num = 1 },
+    };
+    g_driver.event_cb(&event, g_driver.user_ctx);
+}
+
+static bool mode_offered(const fake_uvc_device_t *device, const uvc_host_stream_format_t *format)
+{
+    if (device->format != format->format) {
+        return false;
+    }
+    for (int m = 0; m < FAKE_UVC_MAX_MODES && device->modes[m].width != 0; m++) {
+        const fake_uvc_mode_t *mode = &device->modes[m];
+        if (mode->width != format->h_res || mode->height != format->v_res) {
+            continue;
+        }
+        for (int r = 0; r < FAKE_UVC_MAX_RATES && mode->fps[r] > 0; r++) {
+            if (fabsf(mode->fps[r] - format->fps) < 0.01f) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static uvc_host_frame_t *take_buffer(struct uvc_host_stream_s *s)
+{
+    uvc_host_frame_t *frame = NULL;
+    pthread_mutex_lock(&g_lock);
+    for (unsigned i = 0; i < s->num_buffers && frame == NULL; i++) {
+        if (!s->busy[i]) {
+            s->busy[i] = true;
+            frame = &s->frames[i];
+        }
+    }
+    pthread_mutex_unlock(&g_lock);
+    return frame;
+}
+
+static void give_buffer(struct uvc_host_stream_s *s, uvc_host_frame_t *frame)
+{
+    pthread_mutex_lock(&g_lock);
+    s->busy[frame - s->frames] = false;
+    pthread_mutex_unlock(&g_lock);
+}
+
+// One camera's sensor: a frame every 1 / fps while the stream is started
+static void *stream_thread(void *arg)
+{
+    struct uvc_host_stream_s *s = arg;
+    const uvc_host_stream_format_t *format = &s->config.vs_format;
+    uint8_t *mjpeg[MJPEG_VARIANTS] = {0};
+    size_t mjpeg_len[MJPEG_VARIANTS] = {0};
+    if (format->format == UVC_VS_FORMAT_MJPEG) {
+        for (int i = 0; i < MJPEG_VARIANTS; i++) {
+            mjpeg[i] = test_scene_jpeg(format->h_res, format->v_res, 4 * i, 80, &mjpeg_len[i]);
+        }
+    }
+
+    long period_ns = (long)(1e9 / format->fps);
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    for (uint32_t n = 0; !s->closed;) {
+        next.tv_nsec += period_ns;
+        while (next.tv_nsec >= 1000000000) {
+            next.tv_sec++;
+            next.tv_nsec -= 1000000000;
+        }
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR) {
+        }
+        uvc_host_frame_t *frame = s->started ? take_buffer(s) : NULL;
+        if (frame == NULL) {
+            continue;
+        }
+
+        frame->vs_format = *format;
+        if (format->format == UVC_VS_FORMAT_MJPEG) {
+            int v = n % MJPEG_VARIANTS;
+            frame->data_len = mjpeg_len[v] <= frame->data_buflen ? mjpeg_len[v] : 0;
+            memcpy(frame->data, mjpeg[v], frame->data_len);
+        } else {
+            test_scene_yuy2(format->h_res, format->v_res, n, frame->data);
+            frame->data_len = (size_t)format->h_res * format->v_res * 2;
+        }
+        n++;
+        pthread_mutex_lock(&g_lock);
+        g_ports[s->port].frames_sent++;
+        pthread_mutex_unlock(&g_lock);
+        if (s->config.frame_cb(frame, s->config.user_ctx)) {
+            give_buffer(s, frame);
+        }
+    }
+
+    for (int i = 0; i < MJPEG_VARIANTS; i++) {
+        free(mjpeg[i]);
+    }
+    return NULL;
+}
+
+int fake_uvc_plug(const fake_uvc_device_t *device)
+{
+    pthread_mutex_lock(&g_lock);
+    CHECK(g_num_ports < FAKE_UVC_MAX_DEVICES);
+    int port = g_num_ports++;
+    g_ports[port] = (port_t){ .device = device, .plugged = true };
+    bool installed = g_installed;
+    pthread_mutex_unlock(&g_lock);
+    if (installed) {
+        announce(port);
+    }
+    return port;
+}
+
+void fake_uvc_unplug(int port)
+{
+    pthread_mutex_lock(&g_lock);
+    g_ports[port].plugged = false;
+    struct uvc_host_stream_s *s = g_ports[port].stream;
+    pthread_mutex_unlock(&g_lock);
+    if (s == NULL) {
+        return;
+    }
+    s->started = false;
+    uvc_host_stream_event_data_t event = {
+        .type = UVC_HOST_DEVICE_DISCONNECTED,
+        .device_disconnected = { .stream_hdl = s },
+    };
+    s->config.event_cb(&event, s->config.user_ctx);
+    CHECK(g_ports[port].stream == NULL);
+}
+
+bool fake_uvc_streaming(int port, uvc_host_stream_format_t *format)
+{
+    pthread_mutex_lock(&g_lock);
+    struct uvc_host_stream_s *s = g_ports[port].stream;
+    bool streaming = (s != NULL && s->started);
+    if (streaming && format != NULL) {
+        *format = s->config.vs_format;
+    }
+    pthread_mutex_unlock(&g_lock);
+    return streaming;
+}
+
+uint32_t fake_uvc_frames_sent(int port)
+{
+    pthread_mutex_lock(&g_lock);
+    uint32_t frames = g_ports[port].frames_sent;
+    pthread_mutex_unlock(&g_lock);
+    return frames;
+}
+
+// ---- usb_host
+
+esp_err_t usb_host_install(const usb_host_config_t *config)
+{
+    (void)config;
+    return ESP_OK;
+}
+
+esp_err_t usb_host_lib_handle_events(uint32_t timeout_ticks, uint32_t *event_flags_ret)
+{
+    (void)timeout_ticks;
+    usleep(100 * 1000);
+    *event_flags_ret = 0;
+    return ESP_OK;
+}
+
+esp_err_t usb_host_device_free_all(void)
+{
+    return ESP_OK;
+}
+
+// ---- uvc_host
+
+esp_err_t uvc_host_install(const uvc_host_driver_config_t *driver_config)
+{
+    pthread_mutex_lock(&g_lock);
+    g_driver = *driver_config;
+    g_installed = true;
+    int num_ports = g_num_ports;
+    pthread_mutex_unlock(&g_lock);
+    // Cameras already on the bus are enumerated now
+    for (int port = 0; port < num_ports; port++) {
+        if (g_ports[port].plugged) {
+            announce(port);
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t uvc_host_stream_open(const uvc_host_stream_config_t *stream_config, int timeout,
+                               uvc_host_stream_hdl_t *stream_hdl_ret)
+{
+    (void)timeout;
+    pthread_mutex_lock(&g_lock);
+    int port = -1;
+    for (int i = 0; i < g_num_ports && port < 0; i++) {
+        if (g_ports[i].plugged && g_ports[i].stream == NULL &&
+            mode_offered(g_ports[i].device, &stream_config->vs_format)) {
+            port = i;
+        }
+    }
+    if (port < 0) {
+        pthread_mutex_unlock(&g_lock);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    // Closed streams are never freed: the pipeline may still hand back a frame after a disconnect
+    struct uvc_host_stream_s *s = calloc(1, sizeof(*s));
+    CHECK(s != NULL);
+    s->port = port;
+    s->config = *stream_config;
+    s->num_buffers = stream_config->advanced.number_of_frame_buffers;
+    CHECK(s->num_buffers > 0 && s->num_buffers <= MAX_FRAME_BUFFERS);
+    size_t buflen = stream_config->advanced.frame_size ? stream_config->advanced.frame_size :
+                    (size_t)stream_config->vs_format.h_res * stream_config->vs_format.v_res * 2;
+    for (unsigned i = 0; i < s->num_buffers; i++) {
+        s->frames[i].data = malloc(buflen);
+        s->frames[i].data_buflen = buflen;
+        CHECK(s->frames[i].data != NULL);
+    }
+    g_ports[port].stream = s;
+    pthread_mutex_unlock(&g_lock);
+
+    CHECK(pthread_create(&s->thread, NULL, stream_thread, s) == 0);
+    *stream_hdl_ret = s;
+    return ESP_OK;
+}
+
+esp_err_t uvc_host_stream_close(uvc_host_stream_hdl_t stream_hdl)
+{
+    pthread_mutex_lock(&g_lock);
+    if (g_ports[stream_hdl->port].stream == stream_hdl) {
+        g_ports[stream_hdl->port].stream = NULL;
+    }
+    pthread_mutex_unlock(&g_lock);
+    stream_hdl->started = false;
+    stream_hdl->closed = true;
+    pthread_join(stream_hdl->thread, NULL);
+    return ESP_OK;
+}
+
+esp_err_t uvc_host_stream_start(uvc_host_stream_hdl_t stream_hdl)
+{
+    stream_hdl->started = true;
+    return ESP_OK;
+}
+
+esp_err_t uvc_host_stream_stop(uvc_host_stream_hdl_t stream_hdl)
+{
+    stream_hdl->started = false;
+    return ESP_OK;
+}
+
+esp_err_t uvc_host_frame_return(uvc_host_stream_hdl_t stream_hdl, uvc_host_frame_t *frame)
+{
+    give_buffer(stream_hdl, frame);
+    return ESP_OK;
+}
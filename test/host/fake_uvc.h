@@ -0,0 +1,65 @@
+#pragma once
+
+#include "usb/uvc_host.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * A USB bus with synthetic UVC cameras behind the usb_host and uvc_host calls
+ * app_uvc makes. A camera streams the test scene (test_util.h) at the size and
+ * rate it was opened with, as MJPEG or raw YUY2, from a thread of its own, and
+ * can be plugged and unplugged while the pipeline runs.
+ */
+
+#define FAKE_UVC_MAX_DEVICES    4
+#define FAKE_UVC_MAX_MODES      4
+#define FAKE_UVC_MAX_RATES      4
+
+/**
+ * @brief A frame size a camera offers, with the rates it accepts at that size
+ */
+typedef struct {
+    uint16_t width;
+    uint16_t height;
+    float fps[FAKE_UVC_MAX_RATES];      // 0-terminated
+} fake_uvc_mode_t;
+
+/**
+ * @brief A synthetic camera
+ */
+typedef struct {
+    const char *name;
+    enum uvc_host_stream_format format;     // MJPEG or YUY2
+    fake_uvc_mode_t modes[FAKE_UVC_MAX_MODES];  // Terminated by a width of 0
+} fake_uvc_device_t;
+
+/**
+ * @brief Attach a camera; the driver announces it once uvc_host_install() has run
+ *
+ * @param device Camera, must outlive the test
+ * @return Port of the camera, for fake_uvc_unplug()
+ */
+int fake_uvc_plug(const fake_uvc_device_t *device);
+
+/**
+ * @brief Detach a camera; its open stream stops and the driver reports the disconnect
+ *
+ * @param port Port from fake_uvc_plug()
+ */
+void fake_uvc_unplug(int port);
+
+/**
+ * @brief The stream a camera is sending
+ *
+ * @param port Port from fake_uvc_plug()
+ * @param[out] format Open format (may be NULL)
+ * @return true if a stream is open and started
+ */
+bool fake_uvc_streaming(int port, uvc_host_stream_format_t *format);
+
+/**
+ * @brief Frames a camera has handed to the driver since it was plugged
+ *
+ * @param port Port from fake_uvc_plug()
+ */
+uint32_t fake_uvc_frames_sent(int port);
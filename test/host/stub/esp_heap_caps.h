@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdlib.h>
+
+// Every capability maps to the host heap
+#define MALLOC_CAP_EXEC     (1 << 0)
+#define MALLOC_CAP_32BIT    (1 << 1)
+#define MALLOC_CAP_8BIT     (1 << 2)
+#define MALLOC_CAP_DMA      (1 << 3)
+#define MALLOC_CAP_SPIRAM   (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+#define MALLOC_CAP_DEFAULT  (1 << 12)
+
+static inline void *heap_caps_malloc(size_t size, int caps)
+{
+    (void)caps;
+    return malloc(size);
+}
+
+static inline void *heap_caps_calloc(size_t n, size_t size, int caps)
+{
+    (void)caps;
+    return calloc(n, size);
+}
+
+static inline void *heap_caps_aligned_alloc(size_t alignment, size_t size, int caps)
+{
+    (void)caps;
+    void *p = NULL;
+    return posix_memalign(&p, alignment, size) == 0 ? p : NULL;
+}
+
+static inline void heap_caps_free(void *p)
+{
+    free(p);
+}
+
+static inline size_t heap_caps_get_free_size(int caps)
+{
+    (void)caps;
+    return 8 * 1024 * 1024;
+}
+
+static inline size_t heap_caps_get_largest_free_block(int caps)
+{
+    (void)caps;
+    return 4 * 1024 * 1024;
+}
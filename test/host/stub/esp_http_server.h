@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stddef.h>
+#include <sys/socket.h>
+
+// Only what app_clip needs: the server's socket send is a plain send()
+typedef void *httpd_handle_t;
+
+static inline int httpd_socket_send(httpd_handle_t hd, int sockfd, const char *buf, size_t len, int flags)
+{
+    (void)hd;
+    // A peer that went away is an error, not a SIGPIPE, as on lwIP
+    return (int)send(sockfd, buf, len, flags | MSG_NOSIGNAL);
+}
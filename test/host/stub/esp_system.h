@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "esp_err.h"
+
+static inline void esp_restart(void)
+{
+    abort();
+}
+
+static inline uint32_t esp_get_free_heap_size(void)
+{
+    return 8 * 1024 * 1024;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+/*
+ * FreeRTOS on the host: tasks are pthreads, blocking calls wait on condition
+ * variables, one tick is one millisecond. Two cores are reported, as on the S3
+ * and P4, so code that splits work per core runs its parallel path.
+ */
+
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdTRUE                  1
+#define pdFALSE                 0
+#define pdPASS                  pdTRUE
+#define pdFAIL                  pdFALSE
+#define portMAX_DELAY           ((TickType_t)0xffffffffu)
+#define configTICK_RATE_HZ      1000
+#define portTICK_PERIOD_MS      1
+#define pdMS_TO_TICKS(ms)       ((TickType_t)(ms))
+#define configMAX_PRIORITIES    25
+#define tskIDLE_PRIORITY        0
+#define tskNO_AFFINITY          0x7FFFFFFF
+
+#ifndef portNUM_PROCESSORS
+#define portNUM_PROCESSORS      2
+#endif
+
+// Critical sections are a spinlock, not recursive
+typedef struct {
+    volatile int locked;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED { 0 }
+
+static inline void host_critical_enter(portMUX_TYPE *mux)
+{
+    while (__atomic_exchange_n(&mux->locked, 1, __ATOMIC_ACQUIRE)) {
+        sched_yield();
+    }
+}
+
+static inline void host_critical_exit(portMUX_TYPE *mux)
+{
+    __atomic_store_n(&mux->locked, 0, __ATOMIC_RELEASE);
+}
+
+#define taskENTER_CRITICAL(mux)         host_critical_enter(mux)
+#define taskEXIT_CRITICAL(mux)          host_critical_exit(mux)
+#define taskENTER_CRITICAL_ISR(mux)     host_critical_enter(mux)
+#define taskEXIT_CRITICAL_ISR(mux)      host_critical_exit(mux)
+#define portENTER_CRITICAL(mux)         host_critical_enter(mux)
+#define portEXIT_CRITICAL(mux)          host_critical_exit(mux)
@@ -0,0 +1,4 @@
+#pragma once
+
+// Host build: there is no Kconfig. Options a test needs are set as compile
+// definitions of its target in CMakeLists.txt.
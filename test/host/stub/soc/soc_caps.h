@@ -0,0 +1,3 @@
+#pragma once
+
+// Host build: no SoC peripherals, so hardware codec backends are left out
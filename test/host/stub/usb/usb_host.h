@@ -0,0 +1,24 @@
+#pragma once
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * USB Host Library, the calls app_uvc makes. Implemented by the fake bus in
+ * fake_uvc.c.
+ */
+
+#define USB_HOST_LIB_EVENT_FLAGS_NO_CLIENTS     0x01
+#define USB_HOST_LIB_EVENT_FLAGS_ALL_FREE       0x02
+
+#define ESP_INTR_FLAG_LOWMED    0
+
+typedef struct {
+    bool skip_phy_setup;
+    int intr_flags;
+} usb_host_config_t;
+
+esp_err_t usb_host_install(const usb_host_config_t *config);
+esp_err_t usb_host_lib_handle_events(uint32_t timeout_ticks, uint32_t *event_flags_ret);
+esp_err_t usb_host_device_free_all(void);
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "esp_err.h"
+#include "esp_heap_caps.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * usb_host_uvc driver, the subset app_uvc uses, with the same names and
+ * semantics. Implemented by the fake bus in fake_uvc.c.
+ */
+
+#define UVC_HOST_ANY_VID    0
+#define UVC_HOST_ANY_PID    0
+
+enum uvc_host_stream_format {
+    UVC_VS_FORMAT_UNDEFINED = 0,
+    UVC_VS_FORMAT_MJPEG,
+    UVC_VS_FORMAT_YUY2,
+    UVC_VS_FORMAT_H264,
+    UVC_VS_FORMAT_H265,
+};
+
+typedef struct {
+    unsigned h_res;
+    unsigned v_res;
+    float fps;
+    enum uvc_host_stream_format format;
+} uvc_host_stream_format_t;
+
+typedef struct {
+    uint8_t *data;
+    size_t data_len;
+    size_t data_buflen;
+    uvc_host_stream_format_t vs_format;
+} uvc_host_frame_t;
+
+typedef struct uvc_host_stream_s *uvc_host_stream_hdl_t;
+
+enum uvc_host_dev_event {
+    UVC_HOST_TRANSFER_ERROR,
+    UVC_HOST_DEVICE_DISCONNECTED,
+    UVC_HOST_FRAME_BUFFER_OVERFLOW,
+    UVC_HOST_FRAME_BUFFER_UNDERFLOW,
+};
+
+typedef struct {
+    enum uvc_host_dev_event type;
+    union {
+        struct {
+            esp_err_t error;
+        } transfer_error;
+        struct {
+            uvc_host_stream_hdl_t stream_hdl;
+        } device_disconnected;
+    };
+} uvc_host_stream_event_data_t;
+
+// Return true to hand the frame buffer back at once, false to keep it until uvc_host_frame_return()
+typedef bool (*uvc_host_frame_callback_t)(const uvc_host_frame_t *frame, void *user_ctx);
+typedef void (*uvc_host_stream_callback_t)(const uvc_host_stream_event_data_t *event, void *user_ctx);
+
+typedef struct {
+    uvc_host_stream_callback_t event_cb;
+    uvc_host_frame_callback_t frame_cb;
+    void *user_ctx;
+    struct {
+        uint16_t vid;
+        uint16_t pid;
+        uint8_t uvc_stream_index;
+    } usb;
+    uvc_host_stream_format_t vs_format;
+    struct {
+        size_t frame_size;                  // 0 for the size of an uncompressed frame
+        unsigned number_of_frame_buffers;
+        unsigned number_of_urbs;
+        unsigned urb_size;
+        uint32_t frame_heap_caps;
+    } advanced;
+} uvc_host_stream_config_t;
+
+enum uvc_host_driver_event {
+    UVC_HOST_DRIVER_EVENT_DEVICE_CONNECTED = 0,
+};
+
+typedef struct {
+    enum uvc_host_driver_event type;
+    union {
+        struct {
+            uint8_t dev_addr;
+            uint8_t uvc_stream_index;
+            size_t frame_info_num;
+        } device_connected;
+    };
+} uvc_host_driver_event_data_t;
+
+typedef void (*uvc_host_driver_event_callback_t)(const uvc_host_driver_event_data_t *event, void *user_ctx);
+
+typedef struct {
+    size_t driver_task_stack_size;
+    unsigned driver_task_priority;
+    int xCoreID;
+    bool create_background_task;
+    uvc_host_driver_event_callback_t event_cb;
+    void *user_ctx;
+} uvc_host_driver_config_t;
+
+esp_err_t uvc_host_install(const uvc_host_driver_config_t *driver_config);
+esp_err_t uvc_host_stream_open(const uvc_host_stream_config_t *stream_config, int timeout,
+                               uvc_host_stream_hdl_t *stream_hdl_ret);
+esp_err_t uvc_host_stream_close(uvc_host_stream_hdl_t stream_hdl);
+esp_err_t uvc_host_stream_start(uvc_host_stream_hdl_t stream_hdl);
+esp_err_t uvc_host_stream_stop(uvc_host_stream_hdl_t stream_hdl);
+esp_err_t uvc_host_frame_return(uvc_host_stream_hdl_t stream_hdl, uvc_host_frame_t *frame);
@@ -0,0 +1,191 @@
+/*
+ * Lossless bursts (/burst?frames=N): nothing is copied until a burst is armed, it
+ * takes the next N frames of its camera and no other, the reader gets them in
+ * order while the capture goes on, a pool that fills up ends the burst early and
+ * says so, and the pool settles for less rather than eat into the PSRAM kept for
+ * viewers.
+ */
+#include "test_util.h"
+#include "app_burst.h"
+#include "esp_heap_caps.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#define POOL_SIZE       (512 * 1024)
+#define FRAME_LEN       (10 * 1024)
+#define FRAME_US        33333
+
+typedef struct {
+    burst_pool_t *pool;
+    uint32_t frames;
+} producer_t;
+
+static uint8_t g_frame[FRAME_LEN];
+
+// Frame n: its bytes follow from n, so a frame stored in the wrong place shows
+static const uint8_t *frame_data(uint32_t n)
+{
+    for (size_t i = 0; i < FRAME_LEN; i++) {
+        g_frame[i] = (uint8_t)(n * 31 + i * 7 + (i >> 8));
+    }
+    return g_frame;
+}
+
+static void offer(burst_pool_t *pool, uint8_t camera, uint32_t n)
+{
+    app_burst_offer(pool, camera, frame_data(n), FRAME_LEN, n % 2 ? 0 : 300, n, (int64_t)n * FRAME_US);
+}
+
+static void check_frame(burst_pool_t *pool, const burst_frame_t *frame, uint32_t n)
+{
+    CHECK(frame->seq == n && frame->time_us == (int64_t)n * FRAME_US && frame->len == FRAME_LEN);
+    CHECK(frame->dht_insert_pos == (n % 2 ? 0 : 300));
+    CHECK(frame->pos + frame->len <= pool->used);
+    CHECK(memcmp(pool->buf + frame->pos, frame_data(n), FRAME_LEN) == 0);
+}
+
+static void check_capture(burst_pool_t *pool)
+{
+    // Nothing armed: frames pass by untouched
+    for (uint32_t n = 0; n < 10; n++) {
+        offer(pool, 0, n);
+    }
+    CHECK(pool->used == 0 && pool->frames_total == 0);
+
+    CHECK_ERR(ESP_ERR_INVALID_ARG, app_burst_start(pool, 0, 0));
+    CHECK_ERR(ESP_ERR_INVALID_ARG, app_burst_start(pool, 0, BURST_MAX_FRAMES + 1));
+    CHECK_OK(app_burst_start(pool, 1, 8));
+    CHECK_ERR(ESP_ERR_INVALID_STATE, app_burst_start(pool, 0, 8));
+
+    // Frames of the other camera are not taken; the next 8 of camera 1 are, and no more
+    burst_frame_t frame;
+    CHECK_ERR(ESP_ERR_TIMEOUT, app_burst_wait(pool, 0, pdMS_TO_TICKS(20), &frame));
+    for (uint32_t n = 100; n < 120; n++) {
+        offer(pool, 0, n + 1000);
+        offer(pool, 1, n);
+    }
+    CHECK(pool->captured == 8 && !pool->armed && pool->busy && !pool->truncated);
+    CHECK(pool->used == 8 * FRAME_LEN && pool->frames_total == 8);
+    for (uint16_t i = 0; i < 8; i++) {
+        CHECK_OK(app_burst_wait(pool, i, 0, &frame));
+        check_frame(pool, &frame, 100 + i);
+    }
+    CHECK_ERR(ESP_ERR_NOT_FOUND, app_burst_wait(pool, 8, pdMS_TO_TICKS(1000), &frame));
+
+    // Still held until stopped, then free for the next burst
+    CHECK_ERR(ESP_ERR_INVALID_STATE, app_burst_start(pool, 1, 8));
+    app_burst_stop(pool);
+    CHECK_OK(app_burst_start(pool, 1, 1));
+    offer(pool, 1, 200);
+    CHECK_OK(app_burst_wait(pool, 0, 0, &frame));
+    check_frame(pool, &frame, 200);
+    app_burst_stop(pool);
+    CHECK(pool->bursts == 2 && pool->frames_total == 9 && pool->truncations == 0);
+
+    // Stopped while running: later frames are not taken
+    CHECK_OK(app_burst_start(pool, 1, 8));
+    offer(pool, 1, 300);
+    app_burst_stop(pool);
+    offer(pool, 1, 301);
+    CHECK(pool->captured == 1 && pool->used == FRAME_LEN);
+}
+
+// More frames asked for than the pool holds: the burst ends when it is full
+static void check_overflow(burst_pool_t *pool)
+{
+    uint32_t fit = pool->cap / FRAME_LEN;
+    CHECK(fit < BURST_MAX_FRAMES);
+    CHECK_OK(app_burst_start(pool, 0, BURST_MAX_FRAMES));
+    for (uint32_t n = 0; n < BURST_MAX_FRAMES; n++) {
+        offer(pool, 0, n);
+    }
+    CHECK(pool->captured == fit && pool->used == fit * FRAME_LEN);
+    CHECK(pool->truncated && pool->truncations == 1 && !pool->armed);
+    burst_frame_t frame;
+    for (uint16_t i = 0; i < fit; i++) {
+        CHECK_OK(app_burst_wait(pool, i, 0, &frame));
+        check_frame(pool, &frame, i);
+    }
+    CHECK_ERR(ESP_ERR_NOT_FOUND, app_burst_wait(pool, fit, pdMS_TO_TICKS(1000), &frame));
+    app_burst_stop(pool);
+
+    // The next burst starts from an empty pool
+    CHECK_OK(app_burst_start(pool, 0, 2));
+    CHECK(!pool->truncated && pool->used == 0);
+    offer(pool, 0, 7);
+    offer(pool, 0, 8);
+    CHECK_OK(app_burst_wait(pool, 1, 0, &frame));
+    check_frame(pool, &frame, 8);
+    app_burst_stop(pool);
+}
+
+static void *producer_thread(void *arg)
+{
+    producer_t *p = arg;
+    // Not g_frame: the reader checks the frames against it meanwhile
+    static uint8_t data[FRAME_LEN];
+    for (uint32_t n = 0; n < p->frames; n++) {
+        usleep(2000);
+        for (size_t i = 0; i < FRAME_LEN; i++) {
+            data[i] = (uint8_t)(n * 31 + i * 7 + (i >> 8));
+        }
+        app_burst_offer(p->pool, 2, data, FRAME_LEN, n % 2 ? 0 : 300, n, (int64_t)n * FRAME_US);
+    }
+    return NULL;
+}
+
+// The reader waits on frames as the capture path adds them, as the HTTP handler does
+static void check_concurrent(burst_pool_t *pool)
+{
+    uint16_t frames = pool->cap / FRAME_LEN;
+    CHECK_OK(app_burst_start(pool, 2, frames));
+    producer_t p = { .pool = pool, .frames = frames + 10 };
+    pthread_t thread;
+    CHECK(pthread_create(&thread, NULL, producer_thread, &p) == 0);
+    burst_frame_t frame;
+    for (uint16_t i = 0; i < frames; i++) {
+        CHECK_OK(app_burst_wait(pool, i, pdMS_TO_TICKS(2000), &frame));
+        check_frame(pool, &frame, i);
+    }
+    CHECK_ERR(ESP_ERR_NOT_FOUND, app_burst_wait(pool, frames, pdMS_TO_TICKS(2000), &frame));
+    pthread_join(thread, NULL);
+    CHECK(pool->captured == frames && !pool->truncated);
+    app_burst_stop(pool);
+}
+
+// Sizes that would leave less than the reserve free are passed over, down to an eighth
+static void check_reserve(void)
+{
+    size_t free_size = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+    burst_pool_t pool;
+    CHECK_OK(app_burst_init(&pool, POOL_SIZE, free_size - POOL_SIZE / 2));
+    CHECK(pool.cap == POOL_SIZE / 2);
+    free(pool.buf);
+    CHECK_ERR(ESP_ERR_NO_MEM, app_burst_init(&pool, POOL_SIZE, free_size - POOL_SIZE / 16));
+    CHECK(pool.buf == NULL && pool.cap == 0);
+    CHECK_ERR(ESP_ERR_NO_MEM, app_burst_init(&pool, 0, 0));
+    CHECK(pool.buf == NULL);
+    // No pool, so a burst that starts anyway ends at its first frame
+    CHECK_OK(app_burst_start(&pool, 0, 4));
+    offer(&pool, 0, 0);
+    burst_frame_t frame;
+    CHECK(pool.truncated && pool.captured == 0);
+    CHECK_ERR(ESP_ERR_NOT_FOUND, app_burst_wait(&pool, 0, 0, &frame));
+    app_burst_stop(&pool);
+}
+
+int main(void)
+{
+    static burst_pool_t pool;
+    CHECK_OK(app_burst_init(&pool, POOL_SIZE, 0));
+    CHECK(pool.cap == POOL_SIZE);
+    check_capture(&pool);
+    check_overflow(&pool);
+    check_concurrent(&pool);
+    check_reserve();
+    free(pool.buf);
+    printf("burst: OK\n");
+    return 0;
+}
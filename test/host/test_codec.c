@@ -0,0 +1,253 @@
+/*
+ * Codec backends: the registry, the software backend against the decoder and
+ * encoder it wraps, the fallbacks for backends that cannot reduce, scale or
+ * encode (as the ESP32-P4 engine cannot reduce), and the shared benchmark run on
+ * one corpus for every backend.
+ */
+#include "test_util.h"
+#include "app_jpeg.h"
+#include "app_jpeg_codec.h"
+#include "app_jpeg_decode.h"
+#include "app_jpeg_encode.h"
+
+#include <string.h>
+
+#define QUALITY         80
+#define CORPUS_FRAMES   8
+
+// A backend shaped like the hardware one: full-size decode only, no scaler, no encoder
+static esp_err_t full_only_decode(const uint8_t *in, size_t len, const jpeg_index_t *index, uint8_t scale_shift,
+                                  jpeg_codec_image_t *out, size_t out_cap)
+{
+    if (scale_shift != 0) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    return app_jpeg_codec_at(0)->decode(in, len, index, 0, out, out_cap);
+}
+
+static const jpeg_codec_t g_full_only = {
+    .name = "full_only",
+    .decode = full_only_decode,
+};
+
+static void check_registry(void)
+{
+    CHECK(app_jpeg_codec_count() >= 1);
+    const jpeg_codec_t *sw = app_jpeg_codec_at(0);
+    CHECK(sw != NULL && strcmp(sw->name, "sw") == 0);
+    CHECK(app_jpeg_codec_at(app_jpeg_codec_count()) == NULL);
+    CHECK(app_jpeg_codec_get("sw") == sw);
+    CHECK(app_jpeg_codec_get(NULL) == sw);
+    // No JPEG engine on the host
+    CHECK(app_jpeg_codec_get("hw") == NULL);
+    CHECK(app_jpeg_codec_get("nope") == NULL);
+    CHECK_ERR(ESP_ERR_NOT_FOUND, app_jpeg_codec_select("hw"));
+    CHECK_ERR(ESP_ERR_NOT_FOUND, app_jpeg_codec_select(NULL));
+    CHECK(app_jpeg_codec_get(NULL) == sw);
+    CHECK_OK(app_jpeg_codec_select("sw"));
+
+    CHECK(app_jpeg_codec_image_size(640, 480, JPEG_CODEC_GRAY) == 640 * 480);
+    CHECK(app_jpeg_codec_image_size(640, 480, JPEG_CODEC_YUY2) == 640 * 480 * 2);
+    CHECK(app_jpeg_codec_image_size(640, 480, JPEG_CODEC_RGB888) == 640 * 480 * 3);
+}
+
+// The software backend gives exactly what the decoder gives
+static void check_sw_decode(const uint8_t *jpeg, size_t len, const jpeg_index_t *index)
+{
+    static const jpeg_codec_pixel_t formats[] = { JPEG_CODEC_GRAY, JPEG_CODEC_YUY2, JPEG_CODEC_RGB888 };
+    static const jpeg_decode_format_t decode_formats[] = { JPEG_DECODE_GRAY, JPEG_DECODE_YUY2, JPEG_DECODE_RGB888 };
+    const jpeg_codec_t *sw = app_jpeg_codec_get("sw");
+    size_t cap = app_jpeg_codec_image_size(index->width, index->height, JPEG_CODEC_RGB888);
+    uint8_t *a = malloc(cap);
+    uint8_t *b = malloc(cap);
+
+    for (int f = 0; f < 3; f++) {
+        for (uint8_t scale = 0; scale <= 3; scale++) {
+            jpeg_codec_image_t img = { .data = a, .format = formats[f] };
+            CHECK_OK(app_jpeg_codec_decode(sw, jpeg, len, index, scale, &img, cap));
+            CHECK(img.width == (index->width + (1 << scale) - 1) >> scale);
+            CHECK(img.height == (index->height + (1 << scale) - 1) >> scale);
+
+            jpeg_decode_config_t config = { .format = decode_formats[f], .scale_shift = scale };
+            CHECK_OK(app_jpeg_decode(jpeg, len, index, &config, b, cap, NULL));
+            CHECK(memcmp(a, b, app_jpeg_codec_image_size(img.width, img.height, img.format)) == 0);
+        }
+    }
+
+    jpeg_codec_image_t img = { .data = a, .format = JPEG_CODEC_GRAY };
+    CHECK_ERR(ESP_ERR_INVALID_ARG, app_jpeg_codec_decode(sw, jpeg, len, index, 4, &img, cap));
+    CHECK_ERR(ESP_ERR_INVALID_SIZE, app_jpeg_codec_decode(sw, jpeg, len, index, 0, &img, 1000));
+    free(b);
+    free(a);
+}
+
+// A backend that cannot reduce decodes at full size and is scaled in software
+static void check_fallbacks(const uint8_t *jpeg, size_t len, const jpeg_index_t *index)
+{
+    const jpeg_codec_t *sw = app_jpeg_codec_get("sw");
+    size_t full_cap = app_jpeg_codec_image_size(index->width, index->height, JPEG_CODEC_YUY2);
+    uint8_t *full = malloc(full_cap);
+    uint8_t *reduced = malloc(full_cap);
+    uint8_t *scaled = malloc(full_cap);
+
+    for (int f = 0; f < 2; f++) {
+        jpeg_codec_pixel_t format = f ? JPEG_CODEC_YUY2 : JPEG_CODEC_GRAY;
+        jpeg_codec_image_t img = { .data = reduced, .format = format };
+        CHECK_OK(app_jpeg_codec_decode(&g_full_only, jpeg, len, index, 2, &img, full_cap));
+        CHECK(img.width == index->width / 4 && img.height == index->height / 4);
+
+        // The same pixels as decoding at full size and scaling by hand
+        jpeg_codec_image_t src = { .data = full, .format = format };
+        CHECK_OK(app_jpeg_codec_decode(sw, jpeg, len, index, 0, &src, full_cap));
+        jpeg_codec_image_t dst = { .data = scaled, .width = img.width, .height = img.height, .format = format };
+        CHECK_OK(app_jpeg_codec_scale(sw, &src, &dst));
+        size_t size = app_jpeg_codec_image_size(img.width, img.height, format);
+        CHECK(memcmp(reduced, scaled, size) == 0);
+
+        // And close to the DCT-domain reduction: both are 4x4 area averages of the luma
+        jpeg_codec_image_t dct = { .data = scaled, .format = format };
+        CHECK_OK(app_jpeg_codec_decode(sw, jpeg, len, index, 2, &dct, full_cap));
+        int step = f ? 2 : 1;
+        long diff = 0;
+        for (size_t i = 0; i < size; i += step) {
+            diff += abs(reduced[i] - scaled[i]);
+        }
+        CHECK(diff * step < (long)size * 3);
+    }
+
+    // Without an index the full size is unknown
+    jpeg_codec_image_t img = { .data = reduced, .format = JPEG_CODEC_GRAY };
+    CHECK_ERR(ESP_ERR_NOT_SUPPORTED, app_jpeg_codec_decode(&g_full_only, jpeg, len, NULL, 2, &img, full_cap));
+
+    // Encoding falls back to software, with the same result
+    jpeg_codec_image_t src = { .data = full, .format = JPEG_CODEC_YUY2 };
+    CHECK_OK(app_jpeg_codec_decode(sw, jpeg, len, index, 0, &src, full_cap));
+    size_t sw_len, fallback_len;
+    CHECK_OK(app_jpeg_codec_encode(sw, &src, QUALITY, scaled, full_cap, &sw_len));
+    CHECK_OK(app_jpeg_codec_encode(&g_full_only, &src, QUALITY, reduced, full_cap, &fallback_len));
+    CHECK(sw_len == fallback_len && memcmp(scaled, reduced, sw_len) == 0);
+    jpeg_index_t encoded;
+    CHECK_OK(app_jpeg_build_index(scaled, sw_len, &encoded));
+    CHECK(encoded.width == index->width && encoded.height == index->height);
+
+    CHECK_ERR(ESP_ERR_INVALID_ARG, app_jpeg_codec_encode(sw, &src, 0, scaled, full_cap, &sw_len));
+    CHECK_ERR(ESP_ERR_INVALID_SIZE, app_jpeg_codec_encode(sw, &src, QUALITY, scaled, 1000, &sw_len));
+    jpeg_codec_image_t gray = { .data = full, .width = index->width, .height = index->height,
+                                .format = JPEG_CODEC_GRAY };
+    CHECK_ERR(ESP_ERR_NOT_SUPPORTED, app_jpeg_codec_encode(sw, &gray, QUALITY, scaled, full_cap, &sw_len));
+
+    free(scaled);
+    free(reduced);
+    free(full);
+}
+
+static void check_scale(void)
+{
+    const jpeg_codec_t *sw = app_jpeg_codec_get("sw");
+    uint8_t src_data[16 * 8];
+    for (int y = 0; y < 8; y++) {
+        for (int x = 0; x < 16; x++) {
+            src_data[y * 16 + x] = (x & 1) ? 200 : 100;
+        }
+    }
+    jpeg_codec_image_t src = { .data = src_data, .width = 16, .height = 8, .format = JPEG_CODEC_GRAY };
+
+    // Shrinking averages the area
+    uint8_t small_data[4 * 2];
+    jpeg_codec_image_t small = { .data = small_data, .width = 4, .height = 2, .format = JPEG_CODEC_GRAY };
+    CHECK_OK(app_jpeg_codec_scale(sw, &src, &small));
+    for (int i = 0; i < 8; i++) {
+        CHECK(small_data[i] == 150);
+    }
+
+    // Growing repeats samples
+    uint8_t big_data[32 * 16];
+    jpeg_codec_image_t big = { .data = big_data, .width = 32, .height = 16, .format = JPEG_CODEC_GRAY };
+    CHECK_OK(app_jpeg_codec_scale(sw, &src, &big));
+    CHECK(big_data[0] == 100 && big_data[1] == 100 && big_data[2] == 200 && big_data[32 * 15 + 31] == 200);
+
+    jpeg_codec_image_t yuy2 = { .data = big_data, .width = 8, .height = 8, .format = JPEG_CODEC_YUY2 };
+    CHECK_ERR(ESP_ERR_NOT_SUPPORTED, app_jpeg_codec_scale(sw, &src, &yuy2));
+}
+
+static void print_bench(const jpeg_codec_bench_t *b)
+{
+    printf("%-10s %6lu %10lu %12lu %10lu %10lu  %s\n", b->name, (unsigned long)b->frames,
+           (unsigned long)b->decode_us, (unsigned long)b->decode_small_us, (unsigned long)b->encode_us,
+           (unsigned long)b->encode_bytes, esp_err_to_name(b->result));
+}
+
+static void bench(void)
+{
+    // A mixed corpus: the synthetic camera at two sizes, the figure moving between frames
+    jpeg_codec_frame_t frames[CORPUS_FRAMES];
+    jpeg_index_t index[CORPUS_FRAMES];
+    uint8_t *data[CORPUS_FRAMES];
+    size_t corpus_bytes = 0;
+    for (int i = 0; i < CORPUS_FRAMES; i++) {
+        size_t len;
+        data[i] = (i & 1) ? test_scene_jpeg(1280, 720, i, 85, &len) : test_scene_jpeg(640, 480, i, 85, &len);
+        CHECK_OK(app_jpeg_build_index(data[i], len, &index[i]));
+        frames[i] = (jpeg_codec_frame_t){ .data = data[i], .len = len, .index = &index[i] };
+        corpus_bytes += len;
+    }
+
+    printf("%d frames, %zu bytes; per frame:\n", CORPUS_FRAMES, corpus_bytes);
+    printf("backend    frames  decode us  1/4 size us  encode us  enc bytes  result\n");
+    jpeg_codec_bench_t sw_result = {0};
+    for (size_t i = 0; i < app_jpeg_codec_count(); i++) {
+        jpeg_codec_bench_t result;
+        CHECK_OK(app_jpeg_codec_bench(app_jpeg_codec_at(i), frames, CORPUS_FRAMES, QUALITY, &result));
+        print_bench(&result);
+        CHECK_OK(result.result);
+        CHECK(result.frames == CORPUS_FRAMES && result.decode_us > 0 && result.encode_bytes > 0);
+        if (i == 0) {
+            sw_result = result;
+        }
+    }
+
+    // A backend without reduction pays a full decode plus the scaler for small output,
+    // and one without an encoder reports it rather than timing nothing
+    jpeg_codec_bench_t full_only;
+    CHECK_OK(app_jpeg_codec_bench(&g_full_only, frames, CORPUS_FRAMES, QUALITY, &full_only));
+    print_bench(&full_only);
+    CHECK(full_only.result == ESP_ERR_NOT_SUPPORTED && full_only.frames == 0);
+    jpeg_codec_t full_with_encode = g_full_only;
+    full_with_encode.name = "full+enc";
+    full_with_encode.encode = app_jpeg_codec_get("sw")->encode;
+    CHECK_OK(app_jpeg_codec_bench(&full_with_encode, frames, CORPUS_FRAMES, QUALITY, &full_only));
+    print_bench(&full_only);
+    CHECK_OK(full_only.result);
+    CHECK(sw_result.decode_small_us < full_only.decode_small_us);
+    CHECK(sw_result.decode_small_us < sw_result.decode_us);
+
+    // Frames must come with their index
+    frames[0].index = NULL;
+    jpeg_codec_bench_t result;
+    CHECK_ERR(ESP_ERR_INVALID_ARG, app_jpeg_codec_bench(app_jpeg_codec_at(0), frames, CORPUS_FRAMES, QUALITY,
+                                                        &result));
+
+    for (int i = 0; i < CORPUS_FRAMES; i++) {
+        free(data[i]);
+    }
+}
+
+int main(void)
+{
+    CHECK_OK(app_jpeg_codec_init());
+    check_registry();
+
+    size_t len;
+    uint8_t *jpeg = test_scene_jpeg(640, 480, 2, QUALITY, &len);
+    jpeg_index_t index;
+    CHECK_OK(app_jpeg_build_index(jpeg, len, &index));
+    check_sw_decode(jpeg, len, &index);
+    check_fallbacks(jpeg, len, &index);
+    check_scale();
+    free(jpeg);
+
+    bench();
+
+    printf("codec: OK\n");
+    return 0;
+}
@@ -0,0 +1,175 @@
+/*
+ * Lossless crop (/stream?crop=x,y,w,h): the region snaps to whole MCUs, the kept
+ * blocks decode to exactly the pixels they had in the full frame, and the cut costs
+ * a fraction of the bytes and of the CPU of decoding and re-encoding the region.
+ * The index benchmark gives the cost per MB of parsing a frame's markers at ingest.
+ */
+#include "test_util.h"
+#include "app_jpeg.h"
+#include "app_jpeg_decode.h"
+#include "app_jpeg_encode.h"
+#include "app_jpeg_xform.h"
+#include "esp_timer.h"
+
+#include <string.h>
+
+#define WIDTH       1280
+#define HEIGHT      720
+#define QUALITY     80
+#define BENCH_RUNS  50
+
+static uint8_t *decode_gray(const uint8_t *jpeg, size_t len, uint16_t *width, uint16_t *height)
+{
+    jpeg_index_t index;
+    CHECK_OK(app_jpeg_build_index(jpeg, len, &index));
+    jpeg_decode_config_t config = { .format = JPEG_DECODE_GRAY };
+    size_t cap = app_jpeg_decode_out_size(index.width, index.height, &config);
+    uint8_t *gray = malloc(cap);
+    jpeg_decode_result_t result;
+    CHECK_OK(app_jpeg_decode(jpeg, len, &index, &config, gray, cap, &result));
+    *width = result.width;
+    *height = result.height;
+    return gray;
+}
+
+static void check_crop(const uint8_t *frame, size_t len, const jpeg_index_t *index, const uint8_t *full_gray,
+                       jpeg_rect_t rect, jpeg_rect_t expected)
+{
+    size_t cap = len;
+    uint8_t *out = malloc(cap);
+    size_t out_len;
+    jpeg_rect_t kept;
+    CHECK_OK(app_jpeg_crop(frame, len, index, &rect, out, cap, &out_len, &kept));
+    CHECK(kept.x == expected.x && kept.y == expected.y && kept.w == expected.w && kept.h == expected.h);
+
+    // A valid JPEG of the kept size whose luma is bit-exact
+    jpeg_index_t crop_index;
+    CHECK_OK(app_jpeg_build_index(out, out_len, &crop_index));
+    CHECK(crop_index.width == kept.w && crop_index.height == kept.h);
+    uint16_t w, h;
+    uint8_t *gray = decode_gray(out, out_len, &w, &h);
+    CHECK(w == kept.w && h == kept.h);
+    for (int y = 0; y < h; y++) {
+        CHECK(memcmp(gray + (size_t)y * w, full_gray + (size_t)(kept.y + y) * WIDTH + kept.x, w) == 0);
+    }
+    free(gray);
+    free(out);
+}
+
+static void bench(const uint8_t *frame, size_t len, const jpeg_index_t *index, jpeg_rect_t rect)
+{
+    uint8_t *out = malloc(len);
+    size_t out_len = 0;
+    jpeg_rect_t kept;
+
+    int64_t t0 = esp_timer_get_time();
+    for (int i = 0; i < BENCH_RUNS; i++) {
+        CHECK_OK(app_jpeg_crop(frame, len, index, &rect, out, len, &out_len, &kept));
+    }
+    int64_t crop_us = (esp_timer_get_time() - t0) / BENCH_RUNS;
+
+    // The pixel path: decode the frame, re-encode the region at the same quality
+    jpeg_decode_config_t dec = { .format = JPEG_DECODE_YUY2, .max_workers = 1 };
+    size_t yuy2_cap = app_jpeg_decode_out_size(WIDTH, HEIGHT, &dec);
+    uint8_t *yuy2 = malloc(yuy2_cap);
+    uint8_t *region = malloc((size_t)kept.w * kept.h * 2);
+    uint8_t *reencoded = malloc(len);
+    jpeg_encode_config_t enc = { .quality = QUALITY, .max_workers = 1 };
+    jpeg_encode_result_t enc_result = {0};
+    t0 = esp_timer_get_time();
+    for (int i = 0; i < BENCH_RUNS; i++) {
+        CHECK_OK(app_jpeg_decode(frame, len, index, &dec, yuy2, yuy2_cap, NULL));
+        for (int y = 0; y < kept.h; y++) {
+            memcpy(region + (size_t)y * kept.w * 2, yuy2 + ((size_t)(kept.y + y) * WIDTH + kept.x) * 2, kept.w * 2);
+        }
+        CHECK_OK(app_jpeg_encode_yuy2(region, kept.w, kept.h, &enc, reencoded, len, &enc_result));
+    }
+    int64_t pixel_us = (esp_timer_get_time() - t0) / BENCH_RUNS;
+
+    printf("crop %ux%u of %ux%u: %zu of %zu bytes (%.1f%%), %lld us/frame; decode + encode %lld us/frame (%.1fx)\n",
+           kept.w, kept.h, WIDTH, HEIGHT, out_len, len, 100.0 * out_len / len, (long long)crop_us,
+           (long long)pixel_us, (double)pixel_us / (crop_us ? crop_us : 1));
+
+    // A quarter of the picture costs about a quarter of the bytes and much less than the pixel path
+    CHECK(out_len * 100 < len * 40);
+    CHECK(crop_us < pixel_us);
+
+    free(reencoded);
+    free(region);
+    free(yuy2);
+    free(out);
+}
+
+// Parsing the markers once at ingest, against the crop that uses the index and the one that scans for itself
+static void bench_index(const uint8_t *frame, size_t len, const jpeg_index_t *index, jpeg_rect_t rect)
+{
+    uint8_t *out = malloc(len);
+    size_t out_len = 0;
+    jpeg_index_t parsed;
+
+    int64_t t0 = esp_timer_get_time();
+    for (int i = 0; i < BENCH_RUNS; i++) {
+        CHECK_OK(app_jpeg_build_index(frame, len, &parsed));
+    }
+    int64_t index_ns = (esp_timer_get_time() - t0) * 1000 / BENCH_RUNS;
+    CHECK(parsed.rst_total == index->rst_total && parsed.eoi_pos == index->eoi_pos);
+
+    t0 = esp_timer_get_time();
+    for (int i = 0; i < BENCH_RUNS; i++) {
+        CHECK_OK(app_jpeg_crop(frame, len, index, &rect, out, len, &out_len, NULL));
+    }
+    int64_t indexed_ns = (esp_timer_get_time() - t0) * 1000 / BENCH_RUNS;
+    t0 = esp_timer_get_time();
+    for (int i = 0; i < BENCH_RUNS; i++) {
+        CHECK_OK(app_jpeg_crop(frame, len, NULL, &rect, out, len, &out_len, NULL));
+    }
+    int64_t scan_ns = (esp_timer_get_time() - t0) * 1000 / BENCH_RUNS;
+
+    printf("index %zu bytes, %lu restart markers: %.1f us/frame, %.0f us/MB; crop with it %lld us, without %lld us\n",
+           len, (unsigned long)index->rst_total, index_ns / 1000.0, index_ns / 1000.0 * 1048576 / len,
+           (long long)indexed_ns / 1000, (long long)scan_ns / 1000);
+    // Once per frame at ingest costs less than one viewer's crop of the same frame
+    CHECK(index_ns < scan_ns);
+
+    free(out);
+}
+
+int main(void)
+{
+    CHECK_OK(app_jpeg_encode_init());
+    CHECK_OK(app_jpeg_decode_init());
+
+    size_t len;
+    uint8_t *frame = test_scene_jpeg(WIDTH, HEIGHT, 10, QUALITY, &len);
+    jpeg_index_t index;
+    CHECK_OK(app_jpeg_build_index(frame, len, &index));
+    CHECK(index.num_rst > 0);
+    uint16_t w, h;
+    uint8_t *full_gray = decode_gray(frame, len, &w, &h);
+    CHECK(w == WIDTH && h == HEIGHT);
+
+    // 4:2:2 MCUs are 16x8: the region widens outwards to them
+    check_crop(frame, len, &index, full_gray, (jpeg_rect_t){ 100, 50, 300, 200 }, (jpeg_rect_t){ 96, 48, 304, 208 });
+    check_crop(frame, len, &index, full_gray, (jpeg_rect_t){ 0, 0, 16, 8 }, (jpeg_rect_t){ 0, 0, 16, 8 });
+    // Clipped at the right and bottom edges
+    check_crop(frame, len, &index, full_gray, (jpeg_rect_t){ 1200, 700, 500, 500 }, (jpeg_rect_t){ 1200, 696, 80, 24 });
+    // The whole frame
+    check_crop(frame, len, &index, full_gray, (jpeg_rect_t){ 0, 0, WIDTH, HEIGHT }, (jpeg_rect_t){ 0, 0, WIDTH, HEIGHT });
+    // Without an index the crop decodes from the start of the scan and gives the same result
+    check_crop(frame, len, NULL, full_gray, (jpeg_rect_t){ 640, 360, 64, 64 }, (jpeg_rect_t){ 640, 360, 64, 64 });
+
+    uint8_t small[256];
+    size_t out_len;
+    CHECK_ERR(ESP_ERR_INVALID_ARG, app_jpeg_crop(frame, len, &index, &(jpeg_rect_t){ WIDTH, 0, 16, 16 },
+                                                 small, sizeof(small), &out_len, NULL));
+    CHECK_ERR(ESP_ERR_INVALID_SIZE, app_jpeg_crop(frame, len, &index, &(jpeg_rect_t){ 0, 0, WIDTH, HEIGHT },
+                                                  small, sizeof(small), &out_len, NULL));
+
+    bench(frame, len, &index, (jpeg_rect_t){ 320, 180, 640, 360 });
+    bench_index(frame, len, &index, (jpeg_rect_t){ 320, 180, 640, 360 });
+
+    free(full_gray);
+    free(frame);
+    printf("crop: OK\n");
+    return 0;
+}
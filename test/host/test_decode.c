@@ -0,0 +1,164 @@
+/*
+ * Parallel pixel decode: every split of the scan gives exactly the pixels of the
+ * serial decode, in every format and scale, and the split pays off in wall time
+ * when the host has the cores for it.
+ */
+#include "test_util.h"
+#include "app_jpeg.h"
+#include "app_jpeg_decode.h"
+#include "app_jpeg_encode.h"
+#include "esp_timer.h"
+
+#include <math.h>
+#include <string.h>
+#include <unistd.h>
+
+#define QUALITY     90
+#define BENCH_RUNS  30
+
+static const char *format_name(jpeg_decode_format_t format)
+{
+    switch (format) {
+    case JPEG_DECODE_GRAY:   return "gray";
+    case JPEG_DECODE_RGB888: return "rgb";
+    default:                 return "yuy2";
+    }
+}
+
+static uint8_t *decode(const uint8_t *jpeg, size_t len, const jpeg_index_t *index, jpeg_decode_format_t format,
+                       uint8_t scale_shift, uint8_t max_workers, size_t *out_len, jpeg_decode_result_t *result)
+{
+    jpeg_decode_config_t config = { .format = format, .scale_shift = scale_shift, .max_workers = max_workers };
+    *out_len = app_jpeg_decode_out_size(index->width, index->height, &config);
+    uint8_t *out = malloc(*out_len);
+    CHECK(out != NULL);
+    CHECK_OK(app_jpeg_decode(jpeg, len, max_workers == 1 ? NULL : index, &config, out, *out_len, result));
+    return out;
+}
+
+// Serial decode without the index against splits into 2, 3 and 8 pieces
+static void check_splits(uint16_t width, uint16_t height)
+{
+    size_t len;
+    uint8_t *jpeg = test_scene_jpeg(width, height, 7, QUALITY, &len);
+    jpeg_index_t index;
+    CHECK_OK(app_jpeg_build_index(jpeg, len, &index));
+    CHECK(index.num_rst > 0);
+
+    static const jpeg_decode_format_t formats[] = { JPEG_DECODE_GRAY, JPEG_DECODE_RGB888, JPEG_DECODE_YUY2 };
+    static const int bpp[] = { 1, 3, 2 };
+    static const uint8_t splits[] = { 2, 3, 8 };
+    for (int f = 0; f < 3; f++) {
+        for (uint8_t scale = 0; scale <= 3; scale++) {
+            size_t serial_len;
+            jpeg_decode_result_t serial_result;
+            uint8_t *serial = decode(jpeg, len, &index, formats[f], scale, 1, &serial_len, &serial_result);
+            CHECK(serial_result.workers == 1);
+            CHECK(serial_result.width == (width + (1 << scale) - 1) >> scale);
+            CHECK(serial_result.height == (height + (1 << scale) - 1) >> scale);
+            CHECK(serial_len == (size_t)serial_result.width * serial_result.height * bpp[f]);
+
+            for (int s = 0; s < 3; s++) {
+                size_t par_len;
+                jpeg_decode_result_t par_result;
+                uint8_t *par = decode(jpeg, len, &index, formats[f], scale, splits[s], &par_len, &par_result);
+                CHECK(par_result.workers > 1 && par_result.workers <= splits[s]);
+                CHECK(par_result.width == serial_result.width && par_result.height == serial_result.height);
+                if (memcmp(par, serial, serial_len) != 0) {
+                    fprintf(stderr, "%ux%u %s 1/%d: %u workers differ from serial\n", width, height,
+                            format_name(formats[f]), 1 << scale, par_result.workers);
+                    exit(1);
+                }
+                free(par);
+            }
+            free(serial);
+        }
+    }
+    free(jpeg);
+}
+
+// The decoded luma is the source's, up to the quantization
+static void check_fidelity(uint16_t width, uint16_t height)
+{
+    uint8_t *yuy2 = malloc((size_t)width * height * 2);
+    test_scene_yuy2(width, height, 3, yuy2);
+    size_t len;
+    uint8_t *jpeg = test_scene_jpeg(width, height, 3, QUALITY, &len);
+    jpeg_index_t index;
+    CHECK_OK(app_jpeg_build_index(jpeg, len, &index));
+
+    size_t gray_len;
+    uint8_t *gray = decode(jpeg, len, &index, JPEG_DECODE_GRAY, 0, 0, &gray_len, NULL);
+    double sse = 0;
+    for (size_t i = 0; i < (size_t)width * height; i++) {
+        int d = gray[i] - yuy2[2 * i];
+        sse += d * d;
+    }
+    double psnr = 10 * log10(255.0 * 255.0 * width * height / (sse > 0 ? sse : 1));
+    printf("%ux%u q%d: luma PSNR %.1f dB\n", width, height, QUALITY, psnr);
+    CHECK(psnr > 35);
+
+    free(gray);
+    free(jpeg);
+    free(yuy2);
+}
+
+static int64_t time_decode(const uint8_t *jpeg, size_t len, const jpeg_index_t *index,
+                           const jpeg_decode_config_t *config, uint8_t *out, size_t cap, uint8_t *workers)
+{
+    jpeg_decode_result_t result;
+    CHECK_OK(app_jpeg_decode(jpeg, len, index, config, out, cap, &result));
+    int64_t t0 = esp_timer_get_time();
+    for (int i = 0; i < BENCH_RUNS; i++) {
+        CHECK_OK(app_jpeg_decode(jpeg, len, index, config, out, cap, &result));
+    }
+    *workers = result.workers;
+    return (esp_timer_get_time() - t0) / BENCH_RUNS;
+}
+
+static void bench(uint16_t width, uint16_t height, jpeg_decode_format_t format, uint8_t scale_shift)
+{
+    size_t len;
+    uint8_t *jpeg = test_scene_jpeg(width, height, 0, QUALITY, &len);
+    jpeg_index_t index;
+    CHECK_OK(app_jpeg_build_index(jpeg, len, &index));
+    jpeg_decode_config_t config = { .format = format, .scale_shift = scale_shift, .max_workers = 1 };
+    size_t cap = app_jpeg_decode_out_size(width, height, &config);
+    uint8_t *out = malloc(cap);
+
+    uint8_t serial_workers, par_workers;
+    int64_t serial_us = time_decode(jpeg, len, &index, &config, out, cap, &serial_workers);
+    config.max_workers = 0;
+    int64_t par_us = time_decode(jpeg, len, &index, &config, out, cap, &par_workers);
+    double speedup = (double)serial_us / (par_us ? par_us : 1);
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    printf("%ux%u %s 1/%d: 1 worker %lld us, %u workers %lld us (%.2fx on %ld CPUs)\n", width, height,
+           format_name(format), 1 << scale_shift, (long long)serial_us, par_workers, (long long)par_us, speedup, cpus);
+
+    // Only a host with a core per worker can show the gain; on one CPU the split must not cost much
+    if (cpus >= par_workers && par_workers > 1) {
+        CHECK(speedup > 1.3);
+    } else {
+        CHECK(speedup > 0.7);
+    }
+
+    free(out);
+    free(jpeg);
+}
+
+int main(void)
+{
+    CHECK_OK(app_jpeg_encode_init());
+    CHECK_OK(app_jpeg_decode_init());
+
+    check_splits(1280, 720);
+    // Partial MCUs at the right and bottom edges
+    check_splits(330, 250);
+    check_fidelity(640, 480);
+
+    bench(1280, 720, JPEG_DECODE_YUY2, 0);
+    bench(1280, 720, JPEG_DECODE_GRAY, 3);
+
+    printf("decode: OK\n");
+    return 0;
+}
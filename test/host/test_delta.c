@@ -0,0 +1,204 @@
+/*
+ * Delta updates on a replayed camera: every message parses as app_jpeg_xform.h
+ * lays it out, drawing the bands over the previous picture gives exactly the
+ * decode of the whole frame (4:2:2, so no chroma is shared across band edges),
+ * an unchanged frame costs nothing and a change of tables forces a keyframe. The
+ * benchmark gives the bytes saved against sending every frame whole.
+ */
+#include "test_util.h"
+#include "app_jpeg.h"
+#include "app_jpeg_decode.h"
+#include "app_jpeg_encode.h"
+#include "app_jpeg_xform.h"
+#include "esp_timer.h"
+
+#include <string.h>
+
+#define WIDTH           640
+#define HEIGHT          480
+#define QUALITY         80
+#define REPLAY_FRAMES   60
+#define KEY_INTERVAL    15      // Frames between keyframes, as a viewer asking for one every second or so
+#define MSG_CAP         (WIDTH * HEIGHT * 2)
+
+static uint16_t be16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static uint32_t be32(const uint8_t *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static uint8_t *decode_yuy2(const uint8_t *jpeg, size_t len, uint16_t width, uint16_t height)
+{
+    jpeg_index_t index;
+    CHECK_OK(app_jpeg_build_index(jpeg, len, &index));
+    CHECK(index.width == width && index.height == height);
+    jpeg_decode_config_t config = { .format = JPEG_DECODE_YUY2 };
+    size_t out_len = app_jpeg_decode_out_size(width, height, &config);
+    uint8_t *out = malloc(out_len);
+    CHECK_OK(app_jpeg_decode(jpeg, len, &index, &config, out, out_len, NULL));
+    return out;
+}
+
+// Check the layout of a message and draw its bands over the picture, as the viewer does
+static void apply(const uint8_t *msg, const jpeg_delta_result_t *result, uint8_t *picture)
+{
+    CHECK(result->len >= 8);
+    CHECK(msg[0] == (result->key ? JPEG_DELTA_KEY : 0) && msg[1] == 0);
+    CHECK(be16(&msg[2]) == WIDTH && be16(&msg[4]) == HEIGHT);
+    uint16_t bands = be16(&msg[6]);
+    CHECK(bands == result->bands && bands > 0);
+
+    size_t o = 8;
+    uint32_t next_y = 0;
+    uint32_t rows = 0;
+    for (uint16_t b = 0; b < bands; b++) {
+        CHECK(o + 8 <= result->len);
+        uint16_t y = be16(&msg[o]);
+        uint16_t h = be16(&msg[o + 2]);
+        uint32_t len = be32(&msg[o + 4]);
+        o += 8;
+        CHECK(o + len <= result->len);
+        // Bands are whole MCU rows, top to bottom, not overlapping
+        CHECK(y % 8 == 0 && y >= next_y && h > 0 && y + h <= HEIGHT);
+        CHECK(h % 8 == 0 || y + h == HEIGHT);
+        next_y = y + h;
+        rows += (h + 7) / 8;
+
+        uint8_t *band = decode_yuy2(&msg[o], len, WIDTH, h);
+        memcpy(&picture[(size_t)y * WIDTH * 2], band, (size_t)h * WIDTH * 2);
+        free(band);
+        o += len;
+    }
+    CHECK(o == result->len);
+    CHECK(rows == result->rows_sent && result->rows_total == HEIGHT / 8);
+    if (result->key) {
+        CHECK(bands == 1 && rows == result->rows_total);
+    }
+}
+
+// Replay the camera, drawing every update, and compare the bytes with sending frames whole
+static void replay(void)
+{
+    uint8_t *jpeg[REPLAY_FRAMES];
+    size_t len[REPLAY_FRAMES];
+    for (int f = 0; f < REPLAY_FRAMES; f++) {
+        jpeg[f] = test_scene_jpeg(WIDTH, HEIGHT, f, QUALITY, &len[f]);
+    }
+
+    static jpeg_delta_ref_t ref;
+    uint8_t *msg = malloc(MSG_CAP);
+    uint8_t *picture = calloc(1, (size_t)WIDTH * HEIGHT * 2);
+    uint64_t full_bytes = 0, sent_bytes = 0, key_bytes = 0, delta_full_bytes = 0, delta_bytes = 0;
+    uint32_t keys = 0, deltas = 0, rows_sent = 0;
+    int64_t delta_us = 0;
+    for (int f = 0; f < REPLAY_FRAMES; f++) {
+        jpeg_index_t index;
+        CHECK_OK(app_jpeg_build_index(jpeg[f], len[f], &index));
+        bool key = f % KEY_INTERVAL == 0;
+        jpeg_delta_result_t result;
+        int64_t t0 = esp_timer_get_time();
+        CHECK_OK(app_jpeg_delta(jpeg[f], len[f], &index, &ref, key, msg, MSG_CAP, &result));
+        delta_us += esp_timer_get_time() - t0;
+        CHECK(result.key == key && result.len > 0);
+        apply(msg, &result, picture);
+
+        // The viewer now shows exactly this frame
+        uint8_t *whole = decode_yuy2(jpeg[f], len[f], WIDTH, HEIGHT);
+        CHECK(memcmp(picture, whole, (size_t)WIDTH * HEIGHT * 2) == 0);
+        free(whole);
+
+        full_bytes += len[f];
+        sent_bytes += result.len;
+        if (result.key) {
+            keys++;
+            key_bytes += result.len;
+        } else {
+            deltas++;
+            delta_bytes += result.len;
+            delta_full_bytes += len[f];
+            rows_sent += result.rows_sent;
+        }
+
+        // The same frame again: nothing to send, and ref is left as it was
+        jpeg_delta_result_t again;
+        CHECK_OK(app_jpeg_delta(jpeg[f], len[f], &index, &ref, false, msg, MSG_CAP, &again));
+        CHECK(again.len == 0 && again.bands == 0 && !again.key);
+    }
+
+    printf("%d frames %ux%u q%u, keyframe every %d\n", REPLAY_FRAMES, WIDTH, HEIGHT, QUALITY, KEY_INTERVAL);
+    printf("  whole frames   %8llu bytes\n", (unsigned long long)full_bytes);
+    printf("  delta stream   %8llu bytes (%.1f%%): %lu keyframes %llu bytes, %lu deltas %llu bytes\n",
+           (unsigned long long)sent_bytes, 100.0 * sent_bytes / full_bytes, (unsigned long)keys,
+           (unsigned long long)key_bytes, (unsigned long)deltas, (unsigned long long)delta_bytes);
+    printf("  deltas alone   %.1f%% of their frames, %.1f of %u MCU rows each, %.0f us per update\n",
+           100.0 * delta_bytes / delta_full_bytes, (double)rows_sent / deltas, HEIGHT / 8,
+           (double)delta_us / REPLAY_FRAMES);
+    // The figure covers a quarter of the rows: deltas carry about that share of the bytes
+    CHECK(keys == REPLAY_FRAMES / KEY_INTERVAL);
+    CHECK(delta_bytes * 100 < delta_full_bytes * 40);
+    CHECK(sent_bytes * 100 < full_bytes * 50);
+
+    free(picture);
+    free(msg);
+    for (int f = 0; f < REPLAY_FRAMES; f++) {
+        free(jpeg[f]);
+    }
+}
+
+// New tables or a new size restart the viewer with a keyframe; a message that does not fit leaves ref alone
+static void check_keys_and_errors(void)
+{
+    size_t len_a, len_b, len_q, len_small;
+    uint8_t *a = test_scene_jpeg(WIDTH, HEIGHT, 0, QUALITY, &len_a);
+    uint8_t *b = test_scene_jpeg(WIDTH, HEIGHT, 1, QUALITY, &len_b);
+    uint8_t *q = test_scene_jpeg(WIDTH, HEIGHT, 1, QUALITY - 20, &len_q);
+    uint8_t *small = test_scene_jpeg(WIDTH / 2, HEIGHT / 2, 1, QUALITY, &len_small);
+    jpeg_index_t index_a, index_b, index_q, index_small;
+    CHECK_OK(app_jpeg_build_index(a, len_a, &index_a));
+    CHECK_OK(app_jpeg_build_index(b, len_b, &index_b));
+    CHECK_OK(app_jpeg_build_index(q, len_q, &index_q));
+    CHECK_OK(app_jpeg_build_index(small, len_small, &index_small));
+    uint8_t *msg = malloc(MSG_CAP);
+    jpeg_delta_ref_t ref = {0};
+    jpeg_delta_result_t result;
+
+    // The first update is a keyframe even when not asked for
+    CHECK_OK(app_jpeg_delta(a, len_a, &index_a, &ref, false, msg, MSG_CAP, &result));
+    CHECK(result.key && ref.valid);
+
+    // Too small for the delta: an error, and the next update is still made against a
+    jpeg_delta_ref_t before = ref;
+    CHECK_ERR(ESP_ERR_INVALID_SIZE, app_jpeg_delta(b, len_b, &index_b, &ref, false, msg, 64, &result));
+    CHECK(memcmp(&ref, &before, sizeof(ref)) == 0);
+    CHECK_ERR(ESP_ERR_INVALID_SIZE, app_jpeg_delta(b, len_b, &index_b, &ref, false, msg, 4, &result));
+    CHECK_OK(app_jpeg_delta(b, len_b, &index_b, &ref, false, msg, MSG_CAP, &result));
+    CHECK(!result.key && result.len > 0 && result.rows_sent < result.rows_total);
+
+    // Other quantization tables, then another size
+    CHECK_OK(app_jpeg_delta(q, len_q, &index_q, &ref, false, msg, MSG_CAP, &result));
+    CHECK(result.key);
+    CHECK_OK(app_jpeg_delta(small, len_small, &index_small, &ref, false, msg, MSG_CAP, &result));
+    CHECK(result.key && be16(&msg[2]) == WIDTH / 2 && be16(&msg[4]) == HEIGHT / 2);
+
+    CHECK_ERR(ESP_ERR_INVALID_ARG, app_jpeg_delta(a, len_a, NULL, &ref, false, msg, MSG_CAP, &result));
+
+    free(msg);
+    free(small);
+    free(q);
+    free(b);
+    free(a);
+}
+
+int main(void)
+{
+    CHECK_OK(app_jpeg_encode_init());
+    CHECK_OK(app_jpeg_decode_init());
+    check_keys_and_errors();
+    replay();
+    printf("delta: OK\n");
+    return 0;
+}
@@ -0,0 +1,171 @@
+/*
+ * YUY2 to JPEG encoder, scalar path: the output is a 4:2:2 baseline JPEG with a
+ * restart marker after every MCU row, it decodes back to the source within the
+ * quantization error, and splitting the rows over workers changes nothing in it.
+ * The benchmark gives frames per second against quality at 640x480 and 1280x720.
+ */
+#include "test_util.h"
+#include "app_jpeg.h"
+#include "app_jpeg_decode.h"
+#include "app_jpeg_encode.h"
+#include "esp_timer.h"
+
+#include <math.h>
+#include <string.h>
+
+#define BENCH_RUNS  20
+
+typedef struct {
+    size_t len;
+    double psnr_y;
+    double psnr_c;
+} encode_stats_t;
+
+static double psnr(double sse, size_t samples)
+{
+    return 10 * log10(255.0 * 255.0 * samples / (sse > 0 ? sse : 1));
+}
+
+// Encode, check the structure and compare the decoded YUY2 with the source
+static encode_stats_t check_encode(const uint8_t *yuy2, uint16_t width, uint16_t height, uint8_t quality)
+{
+    size_t cap = (size_t)width * height * 2 + 1024;
+    uint8_t *jpeg = malloc(cap);
+    jpeg_encode_config_t config = { .quality = quality };
+    jpeg_encode_result_t result;
+    CHECK_OK(app_jpeg_encode_yuy2(yuy2, width, height, &config, jpeg, cap, &result));
+    CHECK(result.len > 0 && result.len <= cap);
+
+    jpeg_index_t index;
+    CHECK_OK(app_jpeg_build_index(jpeg, result.len, &index));
+    CHECK(index.width == width && index.height == height);
+    CHECK(index.sof_marker == 0xc0 && index.num_components == 3 && index.sampling == 0x21);
+    int mcus_x = (width + 15) / 16;
+    int rows = (height + 7) / 8;
+    CHECK(index.restart_interval == mcus_x);
+    CHECK(index.rst_total == (uint32_t)rows - 1);
+
+    jpeg_decode_config_t dec = { .format = JPEG_DECODE_YUY2 };
+    size_t out_len = app_jpeg_decode_out_size(width, height, &dec);
+    uint8_t *out = malloc(out_len);
+    CHECK_OK(app_jpeg_decode(jpeg, result.len, &index, &dec, out, out_len, NULL));
+    double sse_y = 0, sse_c = 0;
+    for (size_t i = 0; i < (size_t)width * height; i++) {
+        int d = out[2 * i] - yuy2[2 * i];
+        int c = out[2 * i + 1] - yuy2[2 * i + 1];
+        sse_y += d * d;
+        sse_c += c * c;
+    }
+
+    encode_stats_t stats = {
+        .len = result.len,
+        .psnr_y = psnr(sse_y, (size_t)width * height),
+        .psnr_c = psnr(sse_c, (size_t)width * height),
+    };
+    free(out);
+    free(jpeg);
+    return stats;
+}
+
+// Row bands are independent restart intervals: any split gives the same bytes
+static void check_workers(const uint8_t *yuy2, uint16_t width, uint16_t height)
+{
+    size_t cap = (size_t)width * height * 2 + 1024;
+    uint8_t *serial = malloc(cap);
+    uint8_t *par = malloc(cap);
+    jpeg_encode_config_t config = { .quality = 75, .max_workers = 1 };
+    jpeg_encode_result_t serial_result, par_result;
+    CHECK_OK(app_jpeg_encode_yuy2(yuy2, width, height, &config, serial, cap, &serial_result));
+    CHECK(serial_result.workers == 1);
+    config.max_workers = 2;
+    CHECK_OK(app_jpeg_encode_yuy2(yuy2, width, height, &config, par, cap, &par_result));
+    CHECK(par_result.workers == 2);
+    CHECK(par_result.len == serial_result.len && memcmp(par, serial, serial_result.len) == 0);
+    free(par);
+    free(serial);
+}
+
+static void check_errors(const uint8_t *yuy2)
+{
+    uint8_t out[4096];
+    jpeg_encode_config_t config = { .quality = 75 };
+    CHECK_ERR(ESP_ERR_INVALID_ARG, app_jpeg_encode_yuy2(yuy2, 63, 48, &config, out, sizeof(out), NULL));
+    CHECK_ERR(ESP_ERR_INVALID_ARG, app_jpeg_encode_yuy2(yuy2, 0, 48, &config, out, sizeof(out), NULL));
+    CHECK_ERR(ESP_ERR_INVALID_ARG, app_jpeg_encode_yuy2(yuy2, 64, 0, &config, out, sizeof(out), NULL));
+    config.quality = 0;
+    CHECK_ERR(ESP_ERR_INVALID_ARG, app_jpeg_encode_yuy2(yuy2, 64, 48, &config, out, sizeof(out), NULL));
+    config.quality = 101;
+    CHECK_ERR(ESP_ERR_INVALID_ARG, app_jpeg_encode_yuy2(yuy2, 64, 48, &config, out, sizeof(out), NULL));
+    config.quality = 75;
+    CHECK_ERR(ESP_ERR_INVALID_SIZE, app_jpeg_encode_yuy2(yuy2, 640, 480, &config, out, sizeof(out), NULL));
+}
+
+static double encode_fps(const uint8_t *yuy2, uint16_t width, uint16_t height, uint8_t quality, uint8_t workers)
+{
+    size_t cap = (size_t)width * height * 2 + 1024;
+    uint8_t *jpeg = malloc(cap);
+    jpeg_encode_config_t config = { .quality = quality, .max_workers = workers };
+    CHECK_OK(app_jpeg_encode_yuy2(yuy2, width, height, &config, jpeg, cap, NULL));
+    int64_t t0 = esp_timer_get_time();
+    for (int i = 0; i < BENCH_RUNS; i++) {
+        CHECK_OK(app_jpeg_encode_yuy2(yuy2, width, height, &config, jpeg, cap, NULL));
+    }
+    int64_t us = esp_timer_get_time() - t0;
+    free(jpeg);
+    return 1e6 * BENCH_RUNS / (us ? us : 1);
+}
+
+static void bench(uint16_t width, uint16_t height)
+{
+    static const uint8_t qualities[] = { 30, 50, 75, 90, 95 };
+    uint8_t *yuy2 = malloc((size_t)width * height * 2);
+    test_scene_yuy2(width, height, 5, yuy2);
+
+    printf("     size  quality   bytes   bpp  PSNR Y/C (dB)  fps 1 worker  fps 2 workers\n");
+    encode_stats_t prev = {0};
+    for (size_t q = 0; q < sizeof(qualities); q++) {
+        encode_stats_t stats = check_encode(yuy2, width, height, qualities[q]);
+        double fps1 = encode_fps(yuy2, width, height, qualities[q], 1);
+        double fps2 = encode_fps(yuy2, width, height, qualities[q], 2);
+        printf("%4ux%-4u  %7u %7zu %5.2f  %5.1f / %4.1f  %12.1f  %13.1f\n", width, height, qualities[q], stats.len,
+               8.0 * stats.len / ((double)width * height), stats.psnr_y, stats.psnr_c, fps1, fps2);
+
+        // Quality buys fidelity with bytes
+        if (q > 0) {
+            CHECK(stats.len > prev.len && stats.psnr_y > prev.psnr_y);
+        }
+        CHECK(stats.psnr_y > 30 && stats.psnr_c > 30);
+        prev = stats;
+    }
+    free(yuy2);
+}
+
+int main(void)
+{
+    CHECK_OK(app_jpeg_encode_init());
+    CHECK_OK(app_jpeg_decode_init());
+
+    // Whole MCUs, and partial MCUs at the right and bottom edges
+    static const uint16_t sizes[][2] = { { 640, 480 }, { 1280, 720 }, { 330, 250 }, { 16, 8 }, { 2, 1 } };
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        uint16_t width = sizes[s][0];
+        uint16_t height = sizes[s][1];
+        uint8_t *yuy2 = malloc((size_t)width * height * 2);
+        test_scene_yuy2(width, height, 1, yuy2);
+        encode_stats_t stats = check_encode(yuy2, width, height, 90);
+        CHECK(stats.psnr_y > 35);
+        if (height >= 16) {
+            check_workers(yuy2, width, height);
+        }
+        if (s == 0) {
+            check_errors(yuy2);
+        }
+        free(yuy2);
+    }
+
+    bench(640, 480);
+    bench(1280, 720);
+
+    printf("encode: OK\n");
+    return 0;
+}
@@ -0,0 +1,115 @@
+/*
+ * Live metrics over SSE (/events): each listener gets the whole object first,
+ * then only the top-level members that changed since what it was sent, with
+ * nested objects and arrays compared as one member and strings free to hold
+ * braces, brackets, commas, colons and escaped quotes.
+ */
+#include "test_util.h"
+#include "app_json_diff.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define OUT_SIZE    4096
+
+static char g_out[OUT_SIZE];
+
+// The members sent for json, as the text between the braces of the event
+static const char *diff(json_diff_t *d, const char *json)
+{
+    int n = app_json_diff(d, json, strlen(json), g_out, sizeof(g_out));
+    CHECK(n >= 0 && n < OUT_SIZE);
+    g_out[n] = '\0';
+    return g_out;
+}
+
+static void check_members(void)
+{
+    json_diff_t a = {0}, b = {0};
+    const char *s1 = "{\"fps\":30,\"cams\":[{\"id\":0,\"fps\":30},{\"id\":1,\"fps\":15}],\"wifi\":{\"rssi\":-60},\"up\":5}";
+    CHECK(strcmp(diff(&a, s1), "\"fps\":30,\"cams\":[{\"id\":0,\"fps\":30},{\"id\":1,\"fps\":15}],"
+                               "\"wifi\":{\"rssi\":-60},\"up\":5") == 0);
+    CHECK(a.num_keys == 4);
+    CHECK(strcmp(diff(&a, s1), "") == 0);
+
+    // A change inside an array or object sends the member whole
+    CHECK(strcmp(diff(&a, "{\"fps\":30,\"cams\":[{\"id\":0,\"fps\":30},{\"id\":1,\"fps\":14}],"
+                          "\"wifi\":{\"rssi\":-60},\"up\":6}"),
+                 "\"cams\":[{\"id\":0,\"fps\":30},{\"id\":1,\"fps\":14}],\"up\":6") == 0);
+    CHECK(strcmp(diff(&a, "{\"fps\":30,\"cams\":[{\"id\":0,\"fps\":30},{\"id\":1,\"fps\":14}],"
+                          "\"wifi\":{\"rssi\":-61},\"up\":6}"),
+                 "\"wifi\":{\"rssi\":-61}") == 0);
+
+    // Each listener has its own state: a new one gets everything
+    CHECK(strcmp(diff(&b, "{\"fps\":30,\"up\":6}"), "\"fps\":30,\"up\":6") == 0);
+    CHECK(strcmp(diff(&b, "{\"fps\":29,\"up\":6}"), "\"fps\":29") == 0);
+    CHECK(strcmp(diff(&a, "{\"fps\":29,\"up\":6}"), "\"fps\":29") == 0);
+
+    // A member that comes and goes is sent when it comes back changed, not when it is gone
+    CHECK(strcmp(diff(&b, "{\"fps\":29,\"up\":6,\"sd\":{\"free\":100}}"), "\"sd\":{\"free\":100}") == 0);
+    CHECK(strcmp(diff(&b, "{\"fps\":29,\"up\":6}"), "") == 0);
+    CHECK(strcmp(diff(&b, "{\"sd\":{\"free\":100},\"fps\":29,\"up\":6}"), "") == 0);
+    CHECK(strcmp(diff(&b, "{\"fps\":29,\"up\":6,\"sd\":{\"free\":90}}"), "\"sd\":{\"free\":90}") == 0);
+
+    CHECK(strcmp(diff(&b, "{}"), "") == 0);
+}
+
+// Separators inside strings do not end a member
+static void check_strings(void)
+{
+    json_diff_t d = {0};
+    const char *s1 = "{\"name\":\"cam {0}, [front]: \\\"door\\\" \\\\\",\"ssid\":\"a,b}\",\"n\":1}";
+    CHECK(strcmp(diff(&d, s1), "\"name\":\"cam {0}, [front]: \\\"door\\\" \\\\\",\"ssid\":\"a,b}\",\"n\":1") == 0);
+    CHECK(d.num_keys == 3);
+    CHECK(strcmp(diff(&d, s1), "") == 0);
+    CHECK(strcmp(diff(&d, "{\"name\":\"cam {0}, [front]: \\\"door\\\" \\\\\",\"ssid\":\"a,b]\",\"n\":1}"),
+                 "\"ssid\":\"a,b]\"") == 0);
+    CHECK(strcmp(diff(&d, "{\"name\":\"x\",\"ssid\":\"a,b]\",\"n\":[1,\"]\",{\"k\":\"}\"}]}"),
+                 "\"name\":\"x\",\"n\":[1,\"]\",{\"k\":\"}\"}]") == 0);
+    // A key that looks like a path
+    CHECK(strcmp(diff(&d, "{\"name\":\"x\",\"ssid\":\"a,b]\",\"n\":[1,\"]\",{\"k\":\"}\"}],\"a:b\":2}"),
+                 "\"a:b\":2") == 0);
+}
+
+static void check_limits(void)
+{
+    json_diff_t d = {0};
+    const char *s1 = "{\"fps\":30,\"up\":5,\"name\":\"front door\"}";
+    // Too small: an error rather than a member cut short
+    CHECK(app_json_diff(&d, s1, strlen(s1), g_out, 20) == -1);
+    // Room for the members and a terminator is enough
+    json_diff_t fresh = {0};
+    int n = app_json_diff(&fresh, s1, strlen(s1), g_out, strlen(s1) - 1);
+    CHECK(n == (int)strlen(s1) - 2);
+
+    // Members past JSON_DIFF_MAX_KEYS are not tracked, so they go out every time
+    char json[OUT_SIZE / 2];
+    size_t len = 0;
+    json[len++] = '{';
+    for (int k = 0; k < JSON_DIFF_MAX_KEYS + 4; k++) {
+        len += snprintf(json + len, sizeof(json) - len, "%s\"k%d\":%d", k ? "," : "", k, k);
+    }
+    json[len++] = '}';
+    json[len] = '\0';
+    json_diff_t many = {0};
+    const char *first = diff(&many, json);
+    CHECK(strlen(first) == len - 2 && strncmp(first, json + 1, len - 2) == 0);
+    CHECK(many.num_keys == JSON_DIFF_MAX_KEYS);
+    char expect[64];
+    const char *again = diff(&many, json);
+    for (int k = JSON_DIFF_MAX_KEYS; k < JSON_DIFF_MAX_KEYS + 4; k++) {
+        snprintf(expect, sizeof(expect), "\"k%d\":%d", k, k);
+        CHECK(strstr(again, expect) != NULL);
+    }
+    snprintf(expect, sizeof(expect), "\"k%d\":", JSON_DIFF_MAX_KEYS - 1);
+    CHECK(strstr(again, expect) == NULL);
+}
+
+int main(void)
+{
+    check_members();
+    check_strings();
+    check_limits();
+    printf("events: OK\n");
+    return 0;
+}
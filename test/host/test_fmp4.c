@@ -0,0 +1,227 @@
+/*
+ * fMP4 muxer on the recorded H.264 stream: the init segment describes the stream,
+ * every fragment is a well-formed moof + mdat whose sample is the access unit's
+ * slices in length-prefixed form, and muxing costs next to nothing per frame
+ * because the NAL units are never copied.
+ */
+#include "test_util.h"
+#include "app_fmp4.h"
+#include "app_h264.h"
+#include "esp_timer.h"
+
+#include <string.h>
+
+#define MAX_AUS     64
+#define FRAME_US    33333
+#define BENCH_RUNS  2000
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+// Box of the given type among the boxes in [buf, buf + len), NULL if absent; checks the sizes on the way
+static const uint8_t *find_box(const uint8_t *buf, size_t len, const char *type, size_t *box_len)
+{
+    size_t pos = 0;
+    while (pos < len) {
+        CHECK(pos + 8 <= len);
+        uint32_t size = get_u32(buf + pos);
+        CHECK(size >= 8 && pos + size <= len);
+        if (memcmp(buf + pos + 4, type, 4) == 0) {
+            *box_len = size;
+            return buf + pos;
+        }
+        pos += size;
+    }
+    return NULL;
+}
+
+// Children of a box; full boxes skip their version and flags too
+static const uint8_t *find_child(const uint8_t *box, size_t box_len, size_t header, const char *type, size_t *len)
+{
+    const uint8_t *child = find_box(box + header, box_len - header, type, len);
+    CHECK(child != NULL);
+    return child;
+}
+
+static void check_init(const uint8_t *sps, size_t sps_len, const uint8_t *pps, size_t pps_len)
+{
+    uint8_t init[1024];
+    size_t init_len;
+    CHECK_OK(app_fmp4_write_init(sps, sps_len, pps, pps_len, init, sizeof(init), &init_len));
+
+    // ftyp then moov, nothing else
+    size_t ftyp_len, moov_len;
+    CHECK(find_box(init, init_len, "ftyp", &ftyp_len) == init);
+    const uint8_t *moov = find_box(init, init_len, "moov", &moov_len);
+    CHECK(moov == init + ftyp_len && ftyp_len + moov_len == init_len);
+
+    size_t len, trak_len, mdia_len, minf_len, stbl_len, stsd_len, avc1_len, avcc_len;
+    const uint8_t *trak = find_child(moov, moov_len, 8, "trak", &trak_len);
+    find_child(moov, moov_len, 8, "mvex", &len);
+    const uint8_t *mdia = find_child(trak, trak_len, 8, "mdia", &mdia_len);
+    const uint8_t *mdhd = find_child(mdia, mdia_len, 8, "mdhd", &len);
+    CHECK(get_u32(mdhd + (mdhd[8] == 1 ? 28 : 20)) == FMP4_TIMESCALE);
+    const uint8_t *minf = find_child(mdia, mdia_len, 8, "minf", &minf_len);
+    const uint8_t *stbl = find_child(minf, minf_len, 8, "stbl", &stbl_len);
+    const uint8_t *stsd = find_child(stbl, stbl_len, 8, "stsd", &stsd_len);
+    CHECK(get_u32(stsd + 12) == 1);
+    const uint8_t *avc1 = find_child(stsd, stsd_len, 16, "avc1", &avc1_len);
+    CHECK((avc1[32] << 8 | avc1[33]) == 320 && (avc1[34] << 8 | avc1[35]) == 240);
+
+    // avcC: profile, compatibility and level from the SPS, then the parameter sets verbatim
+    const uint8_t *avcc = find_child(avc1, avc1_len, 86, "avcC", &avcc_len);
+    CHECK(avcc[8] == 1 && memcmp(avcc + 9, sps + 1, 3) == 0);
+    CHECK((avcc[12] & 3) == 3 && (avcc[13] & 0x1f) == 1);
+    CHECK((size_t)(avcc[14] << 8 | avcc[15]) == sps_len && memcmp(avcc + 16, sps, sps_len) == 0);
+    const uint8_t *p = avcc + 16 + sps_len;
+    CHECK(p[0] == 1 && (size_t)(p[1] << 8 | p[2]) == pps_len && memcmp(p + 3, pps, pps_len) == 0);
+
+    char codec[16], expected[16];
+    app_fmp4_codec_string(sps, sps_len, codec, sizeof(codec));
+    snprintf(expected, sizeof(expected), "avc1.%02X%02X%02X", sps[1], sps[2], sps[3]);
+    CHECK(strcmp(codec, expected) == 0);
+    printf("init segment %zu bytes, %s\n", init_len, codec);
+
+    CHECK_ERR(ESP_ERR_INVALID_SIZE, app_fmp4_write_init(sps, sps_len, pps, pps_len, init, init_len - 1, &len));
+    CHECK_ERR(ESP_ERR_INVALID_RESPONSE, app_fmp4_write_init(sps, 3, pps, pps_len, init, sizeof(init), &len));
+}
+
+static size_t gather(const struct iovec *iov, int iovcnt, uint8_t *out)
+{
+    size_t n = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        memcpy(out + n, iov[i].iov_base, iov[i].iov_len);
+        n += iov[i].iov_len;
+    }
+    return n;
+}
+
+static void check_fragment(const uint8_t *au, const h264_index_t *index, const uint8_t *frag, size_t frag_len,
+                           uint32_t sequence, int64_t timestamp_us)
+{
+    size_t moof_len, mdat_len, len, traf_len;
+    const uint8_t *moof = find_box(frag, frag_len, "moof", &moof_len);
+    const uint8_t *mdat = find_box(frag, frag_len, "mdat", &mdat_len);
+    CHECK(moof == frag && mdat == frag + moof_len && moof_len + mdat_len == frag_len);
+
+    CHECK(get_u32(find_child(moof, moof_len, 8, "mfhd", &len) + 12) == sequence);
+    const uint8_t *traf = find_child(moof, moof_len, 8, "traf", &traf_len);
+    const uint8_t *tfdt = find_child(traf, traf_len, 8, "tfdt", &len);
+    uint64_t decode_time = (uint64_t)get_u32(tfdt + 12) << 32 | get_u32(tfdt + 16);
+    CHECK(decode_time == (uint64_t)timestamp_us * FMP4_TIMESCALE / 1000000);
+
+    // One sample: the data offset points at the mdat payload and the size covers it
+    const uint8_t *trun = find_child(traf, traf_len, 8, "trun", &len);
+    CHECK(get_u32(trun + 12) == 1);
+    CHECK(get_u32(trun + 16) == moof_len + 8);
+    CHECK(get_u32(trun + 24) == mdat_len - 8);
+    // sample_is_non_sync_sample
+    bool sync = !(trun[29] & 0x01);
+    CHECK(sync == index->keyframe);
+
+    // The payload is every NAL unit except AUD / SPS / PPS, length-prefixed, in order
+    const uint8_t *p = mdat + 8;
+    for (int i = 0; i < index->num_nals; i++) {
+        const h264_nal_t *nal = &index->nals[i];
+        if (nal->type == H264_NAL_AUD || nal->type == H264_NAL_SPS || nal->type == H264_NAL_PPS) {
+            continue;
+        }
+        CHECK(get_u32(p) == nal->len && memcmp(p + 4, au + nal->pos, nal->len) == 0);
+        p += 4 + nal->len;
+    }
+    CHECK(p == mdat + mdat_len);
+}
+
+// The muxer against assembling each fragment into one buffer, as a copying muxer would
+static void bench(const uint8_t *data, const size_t *pos, const h264_index_t *index, size_t num_aus, uint8_t *frag)
+{
+    uint8_t hdr[FMP4_FRAGMENT_HDR_MAX];
+    struct iovec iov[FMP4_FRAGMENT_MAX_IOV];
+    int iovcnt;
+    size_t frag_len, bytes = 0;
+
+    int64_t t0 = esp_timer_get_time();
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        fmp4_muxer_t mux = {0};
+        for (size_t i = 0; i < num_aus; i++) {
+            CHECK_OK(app_fmp4_write_fragment(&mux, data + pos[i], &index[i], (int64_t)i * FRAME_US, hdr, iov,
+                                             &iovcnt, &frag_len));
+            bytes += frag_len;
+        }
+    }
+    int64_t mux_us = esp_timer_get_time() - t0;
+
+    t0 = esp_timer_get_time();
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        fmp4_muxer_t mux = {0};
+        for (size_t i = 0; i < num_aus; i++) {
+            CHECK_OK(app_fmp4_write_fragment(&mux, data + pos[i], &index[i], (int64_t)i * FRAME_US, hdr, iov,
+                                             &iovcnt, &frag_len));
+            gather(iov, iovcnt, frag);
+        }
+    }
+    int64_t copy_us = esp_timer_get_time() - t0;
+
+    size_t frags = (size_t)BENCH_RUNS * num_aus;
+    double mux_ns = 1000.0 * mux_us / frags;
+    printf("fmp4: %zu fragments, %.0f ns/fragment in place (%.0f MB/s of output), %.0f ns/fragment assembled\n",
+           frags, mux_ns, (double)bytes / (mux_us ? mux_us : 1), 1000.0 * copy_us / frags);
+
+    // Far below a frame interval: muxing never limits the stream
+    CHECK(mux_ns < 20000);
+}
+
+int main(void)
+{
+    size_t len;
+    uint8_t *data = test_read_file(TEST_DATA_DIR "/replay_320x240.h264", &len);
+    static size_t pos[MAX_AUS], lens[MAX_AUS];
+    static h264_index_t index[MAX_AUS];
+    size_t num_aus = test_split_aus(data, len, pos, lens, MAX_AUS);
+    CHECK(num_aus > 0);
+    for (size_t i = 0; i < num_aus; i++) {
+        CHECK_OK(app_h264_build_index(data + pos[i], lens[i], &index[i]));
+    }
+
+    const h264_nal_t *sps = &index[0].nals[index[0].sps];
+    const h264_nal_t *pps = &index[0].nals[index[0].pps];
+    check_init(data + sps->pos, sps->len, data + pps->pos, pps->len);
+
+    uint8_t hdr[FMP4_FRAGMENT_HDR_MAX];
+    struct iovec iov[FMP4_FRAGMENT_MAX_IOV];
+    uint8_t *frag = malloc(len + FMP4_FRAGMENT_HDR_MAX);
+    fmp4_muxer_t mux = {0};
+    for (size_t i = 0; i < num_aus; i++) {
+        int iovcnt;
+        size_t frag_len;
+        int64_t ts = (int64_t)i * FRAME_US;
+        CHECK_OK(app_fmp4_write_fragment(&mux, data + pos[i], &index[i], ts, hdr, iov, &iovcnt, &frag_len));
+        CHECK(iovcnt > 0 && iovcnt <= FMP4_FRAGMENT_MAX_IOV);
+        // Slice data is referenced, not copied
+        for (int k = 1; k < iovcnt; k += 2) {
+            CHECK((uint8_t *)iov[k].iov_base >= data + pos[i] && (uint8_t *)iov[k].iov_base < data + pos[i] + lens[i]);
+        }
+        CHECK(gather(iov, iovcnt, frag) == frag_len);
+        check_fragment(data + pos[i], &index[i], frag, frag_len, i + 1, ts);
+    }
+
+    // Parameter sets alone are not a sample
+    h264_index_t params = index[0];
+    params.num_nals = params.total_nals = params.pps + 1;
+    int iovcnt;
+    size_t frag_len;
+    CHECK_ERR(ESP_ERR_NOT_FOUND, app_fmp4_write_fragment(&mux, data + pos[0], &params, 0, hdr, iov, &iovcnt,
+                                                         &frag_len));
+    params.total_nals = H264_INDEX_MAX_NALS + 1;
+    CHECK_ERR(ESP_ERR_NOT_SUPPORTED, app_fmp4_write_fragment(&mux, data + pos[0], &params, 0, hdr, iov, &iovcnt,
+                                                             &frag_len));
+
+    bench(data, pos, index, num_aus, frag);
+
+    free(frag);
+    free(data);
+    printf("fmp4: OK\n");
+    return 0;
+}
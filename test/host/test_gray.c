@@ -0,0 +1,86 @@
+/*
+ * Grayscale in the compressed domain (/stream?gray=1): the output is a
+ * single-component JPEG whose luma is bit-exact with the input's, at any size,
+ * for frames with or without their own Huffman tables.
+ */
+#include "test_util.h"
+#include "app_jpeg.h"
+#include "app_jpeg_decode.h"
+#include "app_jpeg_encode.h"
+#include "app_jpeg_xform.h"
+
+#include <string.h>
+
+#define QUALITY     80
+
+static uint8_t *decode_gray(const uint8_t *jpeg, size_t len, uint16_t width, uint16_t height)
+{
+    jpeg_index_t index;
+    CHECK_OK(app_jpeg_build_index(jpeg, len, &index));
+    CHECK(index.width == width && index.height == height);
+    jpeg_decode_config_t config = { .format = JPEG_DECODE_GRAY };
+    uint8_t *gray = malloc((size_t)width * height);
+    CHECK_OK(app_jpeg_decode(jpeg, len, &index, &config, gray, (size_t)width * height, NULL));
+    return gray;
+}
+
+// Convert the frame and compare its luma; returns the output length
+static size_t check_gray(const uint8_t *frame, size_t len, const jpeg_index_t *index, const uint8_t *luma,
+                         uint16_t width, uint16_t height)
+{
+    uint8_t *out = malloc(len + 1024);
+    size_t out_len;
+    CHECK_OK(app_jpeg_to_gray(frame, len, index, out, len + 1024, &out_len));
+
+    jpeg_index_t out_index;
+    CHECK_OK(app_jpeg_build_index(out, out_len, &out_index));
+    CHECK(out_index.num_components == 1 && out_index.num_dht > 0);
+    uint8_t *gray = decode_gray(out, out_len, width, height);
+    CHECK(memcmp(gray, luma, (size_t)width * height) == 0);
+
+    free(gray);
+    free(out);
+    return out_len;
+}
+
+static void check_frame(uint16_t width, uint16_t height)
+{
+    size_t len;
+    uint8_t *frame = test_scene_jpeg(width, height, 7, QUALITY, &len);
+    jpeg_index_t index;
+    CHECK_OK(app_jpeg_build_index(frame, len, &index));
+    uint8_t *luma = decode_gray(frame, len, width, height);
+
+    size_t out_len = check_gray(frame, len, &index, luma, width, height);
+    CHECK(check_gray(frame, len, NULL, luma, width, height) == out_len);
+    size_t bare_len;
+    uint8_t *bare = test_strip_dht(frame, len, &bare_len);
+    CHECK(check_gray(bare, bare_len, NULL, luma, width, height) == out_len);
+
+    // Chroma is a third of a 4:2:2 frame's blocks, though fewer of its bits on this scene
+    printf("%ux%u: %zu -> %zu bytes (%.1f%%)\n", width, height, len, out_len, 100.0 * out_len / len);
+    CHECK(out_len < len);
+
+    uint8_t *small = malloc(out_len - 1);
+    size_t small_len;
+    CHECK_ERR(ESP_ERR_INVALID_SIZE, app_jpeg_to_gray(frame, len, &index, small, out_len - 1, &small_len));
+    free(small);
+
+    free(bare);
+    free(luma);
+    free(frame);
+}
+
+int main(void)
+{
+    CHECK_OK(app_jpeg_encode_init());
+    CHECK_OK(app_jpeg_decode_init());
+    check_frame(640, 480);
+    check_frame(1280, 720);
+    // Odd MCU counts: the padding block at the right of each row is dropped
+    check_frame(1010, 566);
+    check_frame(24, 64);
+    check_frame(8, 256);
+    printf("gray: OK\n");
+    return 0;
+}
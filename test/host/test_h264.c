@@ -0,0 +1,167 @@
+/*
+ * H.264 ingest on a recorded stream (data/replay_320x240.h264, see make_replay.py):
+ * every access unit indexes, the SPS gives the stream size, and the GOP cache hands
+ * a live viewer and a late one exactly the bytes the camera sent, parameter sets
+ * first.
+ */
+#include "test_util.h"
+#include "app_h264.h"
+
+#include <string.h>
+
+#define MAX_AUS     64
+#define NUM_AUS     30
+#define GOP_LEN     10
+#define FRAME_US    33333
+
+static const uint8_t *g_data;
+static size_t g_pos[MAX_AUS];
+static size_t g_len[MAX_AUS];
+static h264_index_t g_index[MAX_AUS];
+
+// A GOP entry: SPS and PPS with 4 byte start codes, then the access unit
+static void check_gop_start(const uint8_t *out, size_t out_len, const h264_gop_t *gop, int au)
+{
+    static const uint8_t start_code[4] = { 0, 0, 0, 1 };
+    size_t n = 0;
+    CHECK(memcmp(out + n, start_code, 4) == 0 && (out[n + 4] & 0x1f) == H264_NAL_SPS);
+    CHECK(memcmp(out + n + 4, gop->sps, gop->sps_len) == 0);
+    n += 4 + gop->sps_len;
+    CHECK(memcmp(out + n, start_code, 4) == 0 && (out[n + 4] & 0x1f) == H264_NAL_PPS);
+    CHECK(memcmp(out + n + 4, gop->pps, gop->pps_len) == 0);
+    n += 4 + gop->pps_len;
+    CHECK(out_len == n + g_len[au] && memcmp(out + n, g_data + g_pos[au], g_len[au]) == 0);
+}
+
+static void check_index(size_t num_aus)
+{
+    int keyframes = 0;
+    for (size_t i = 0; i < num_aus; i++) {
+        const uint8_t *au = g_data + g_pos[i];
+        h264_index_t *index = &g_index[i];
+        CHECK_OK(app_h264_build_index(au, g_len[i], index));
+        CHECK(index->num_nals == index->total_nals && index->num_nals >= 2);
+        CHECK(index->nals[0].type == H264_NAL_AUD);
+
+        // The NAL units tile the access unit, start codes aside
+        uint32_t end = 0;
+        for (int n = 0; n < index->num_nals; n++) {
+            const h264_nal_t *nal = &index->nals[n];
+            CHECK(nal->pos >= end + 3 && nal->pos + nal->len <= g_len[i]);
+            CHECK((au[nal->pos] & 0x1f) == nal->type);
+            end = nal->pos + nal->len;
+        }
+        CHECK(end == g_len[i]);
+
+        bool idr = (i % GOP_LEN == 0);
+        CHECK(index->keyframe == idr);
+        CHECK((index->sps >= 0) == idr && (index->pps >= 0) == idr);
+        keyframes += index->keyframe;
+        if (idr) {
+            const h264_nal_t *sps = &index->nals[index->sps];
+            h264_sps_info_t info;
+            CHECK_OK(app_h264_parse_sps(au + sps->pos, sps->len, &info));
+            CHECK(info.width == 320 && info.height == 240);
+            CHECK(info.profile_idc == 66);
+            // A truncated SPS is refused rather than read past its end
+            CHECK_ERR(ESP_ERR_INVALID_RESPONSE, app_h264_parse_sps(au + sps->pos, 3, &info));
+        }
+    }
+    CHECK(keyframes == NUM_AUS / GOP_LEN);
+}
+
+static void check_gop(size_t num_aus)
+{
+    static h264_gop_t gop;
+    CHECK_OK(app_h264_gop_init(&gop, 64 * 1024));
+    size_t cap = 16 * 1024;
+    uint8_t *out = malloc(cap);
+    size_t out_len;
+    int64_t ts;
+
+    // Nothing can be cached or read before the first IDR
+    CHECK_ERR(ESP_ERR_INVALID_STATE, app_h264_gop_push(&gop, g_data + g_pos[1], g_len[1], &g_index[1], 0));
+    h264_cursor_t live = {0};
+    CHECK_ERR(ESP_ERR_NOT_FOUND, app_h264_gop_read(&gop, &live, out, cap, &out_len, NULL));
+
+    h264_cursor_t late = {0};
+    for (size_t i = 0; i < num_aus; i++) {
+        CHECK_OK(app_h264_gop_push(&gop, g_data + g_pos[i], g_len[i], &g_index[i], (int64_t)i * FRAME_US));
+
+        // The live viewer gets every access unit as it arrives, parameter sets ahead of each IDR
+        CHECK_OK(app_h264_gop_read(&gop, &live, out, cap, &out_len, &ts));
+        CHECK(ts == (int64_t)i * FRAME_US);
+        if (i % GOP_LEN == 0) {
+            check_gop_start(out, out_len, &gop, i);
+        } else {
+            CHECK(out_len == g_len[i] && memcmp(out, g_data + g_pos[i], g_len[i]) == 0);
+        }
+        CHECK_ERR(ESP_ERR_NOT_FOUND, app_h264_gop_read(&gop, &live, out, cap, &out_len, NULL));
+
+        // A viewer joining mid-GOP starts at its IDR and catches up
+        if (i == 25) {
+            CHECK_OK(app_h264_gop_read(&gop, &late, out, cap, &out_len, &ts));
+            CHECK(ts == 20 * FRAME_US);
+            check_gop_start(out, out_len, &gop, 20);
+            for (int au = 21; au <= 25; au++) {
+                CHECK_OK(app_h264_gop_read(&gop, &late, out, cap, &out_len, NULL));
+                CHECK(out_len == g_len[au] && memcmp(out, g_data + g_pos[au], g_len[au]) == 0);
+            }
+            CHECK_ERR(ESP_ERR_NOT_FOUND, app_h264_gop_read(&gop, &late, out, cap, &out_len, NULL));
+        }
+    }
+    CHECK(gop.gop_id == NUM_AUS / GOP_LEN);
+    CHECK(gop.num_aus == GOP_LEN && gop.overflows == 0);
+
+    // A viewer with too small a buffer skips to the next IDR
+    h264_cursor_t small = {0};
+    CHECK_ERR(ESP_ERR_INVALID_SIZE, app_h264_gop_read(&gop, &small, out, g_len[20], &out_len, NULL));
+    CHECK_ERR(ESP_ERR_NOT_FOUND, app_h264_gop_read(&gop, &small, out, cap, &out_len, NULL));
+
+    free(out);
+}
+
+static void check_overflow(void)
+{
+    static h264_gop_t gop;
+    CHECK_OK(app_h264_gop_init(&gop, g_len[0] + g_len[1]));
+    CHECK_OK(app_h264_gop_push(&gop, g_data + g_pos[0], g_len[0], &g_index[0], 0));
+    CHECK_OK(app_h264_gop_push(&gop, g_data + g_pos[1], g_len[1], &g_index[1], FRAME_US));
+    CHECK_ERR(ESP_ERR_NO_MEM, app_h264_gop_push(&gop, g_data + g_pos[2], g_len[2], &g_index[2], 2 * FRAME_US));
+    CHECK(gop.overflows == 1 && gop.num_aus == 2);
+    // The next IDR starts over
+    CHECK_OK(app_h264_gop_push(&gop, g_data + g_pos[10], g_len[10], &g_index[10], 10 * FRAME_US));
+    CHECK(gop.num_aus == 1 && gop.gop_id == 2);
+}
+
+static void check_malformed(void)
+{
+    h264_index_t index;
+    static const uint8_t no_start_code[] = { 1, 2, 3, 4, 5 };
+    CHECK_ERR(ESP_ERR_INVALID_RESPONSE, app_h264_build_index(no_start_code, sizeof(no_start_code), &index));
+    // forbidden_zero_bit set
+    static const uint8_t bad_header[] = { 0, 0, 0, 1, 0x85, 0x88 };
+    CHECK_ERR(ESP_ERR_INVALID_RESPONSE, app_h264_build_index(bad_header, sizeof(bad_header), &index));
+    // Parameter sets alone are not a picture; 3 byte start codes are accepted
+    static const uint8_t params[] = { 0, 0, 1, 0x67, 0x42, 0xc0, 0x0d, 0, 0, 1, 0x68, 0xce };
+    CHECK_ERR(ESP_ERR_NOT_FOUND, app_h264_build_index(params, sizeof(params), &index));
+    CHECK(index.num_nals == 2 && index.sps == 0 && index.pps == 1);
+}
+
+int main(void)
+{
+    size_t len;
+    uint8_t *data = test_read_file(TEST_DATA_DIR "/replay_320x240.h264", &len);
+    g_data = data;
+    size_t num_aus = test_split_aus(data, len, g_pos, g_len, MAX_AUS);
+    CHECK(num_aus == NUM_AUS);
+
+    check_index(num_aus);
+    check_gop(num_aus);
+    check_overflow();
+    check_malformed();
+
+    free(data);
+    printf("h264: OK\n");
+    return 0;
+}
@@ -0,0 +1,168 @@
+/*
+ * Mosaic (/mosaic): the grid has the size the reduction gives, every cell matches
+ * its camera downscaled by the same factor, cells without a usable frame are grey,
+ * and the result decodes at every reduction.
+ */
+#include "test_util.h"
+#include "app_jpeg.h"
+#include "app_jpeg_decode.h"
+#include "app_jpeg_encode.h"
+#include "app_jpeg_xform.h"
+
+#include <string.h>
+
+#define WIDTH       640
+#define HEIGHT      480
+#define QUALITY     80
+#define OUT_CAP     (WIDTH * HEIGHT * 4)
+
+typedef struct {
+    uint8_t *data;
+    size_t len;
+    jpeg_index_t index;
+    uint8_t *luma;
+} tile_t;
+
+static uint8_t *decode_gray(const uint8_t *jpeg, size_t len, uint16_t width, uint16_t height)
+{
+    jpeg_index_t index;
+    CHECK_OK(app_jpeg_build_index(jpeg, len, &index));
+    CHECK(index.width == width && index.height == height);
+    jpeg_decode_config_t config = { .format = JPEG_DECODE_GRAY };
+    uint8_t *gray = malloc((size_t)width * height);
+    CHECK_OK(app_jpeg_decode(jpeg, len, &index, &config, gray, (size_t)width * height, NULL));
+    return gray;
+}
+
+// Mean absolute difference between a cell and the tile's luma averaged over n x n pixels
+static double cell_error(const uint8_t *gray, uint16_t width, uint32_t cx, uint32_t cy, uint32_t cw, uint32_t ch,
+                         const uint8_t *luma, int n)
+{
+    uint64_t sum = 0;
+    for (uint32_t y = 0; y < ch; y++) {
+        for (uint32_t x = 0; x < cw; x++) {
+            int avg = 0;
+            for (int j = 0; j < n; j++) {
+                for (int i = 0; i < n; i++) {
+                    avg += luma[(size_t)(y * n + j) * WIDTH + x * n + i];
+                }
+            }
+            avg = (avg + n * n / 2) / (n * n);
+            int d = gray[(size_t)(cy + y) * width + cx + x] - avg;
+            sum += d < 0 ? -d : d;
+        }
+    }
+    return (double)sum / (cw * ch);
+}
+
+static void check_grid(const tile_t *tiles, uint8_t cols, uint8_t rows, uint8_t shift, uint8_t missing)
+{
+    jpeg_mosaic_tile_t in[JPEG_MOSAIC_MAX_TILES] = {0};
+    for (int t = 0; t < cols * rows; t++) {
+        if (!(missing & (1 << t))) {
+            in[t] = (jpeg_mosaic_tile_t){ tiles[t].data, tiles[t].len, &tiles[t].index };
+        }
+    }
+    uint8_t *out = malloc(OUT_CAP);
+    jpeg_mosaic_result_t result;
+    CHECK_OK(app_jpeg_mosaic(in, cols, rows, shift, out, OUT_CAP, &result));
+
+    // 4:2:2 MCUs are 16x8; a cell is the tile's MCUs divided by 1 << shift
+    uint32_t cw = (WIDTH / 16 >> shift) * 16;
+    uint32_t ch = (HEIGHT / 8 >> shift) * 8;
+    CHECK(result.width == cols * cw && result.height == rows * ch);
+    CHECK(result.drawn == (((1 << (cols * rows)) - 1) & ~missing));
+    jpeg_index_t index;
+    CHECK_OK(app_jpeg_build_index(out, result.len, &index));
+    CHECK(index.restart_interval == result.width / 16 && index.num_rst == (uint32_t)result.height / 8 - 1);
+
+    uint8_t *gray = decode_gray(out, result.len, result.width, result.height);
+    double worst = 0;
+    for (int t = 0; t < cols * rows; t++) {
+        uint32_t cx = t % cols * cw;
+        uint32_t cy = t / cols * ch;
+        if (missing & (1 << t)) {
+            for (uint32_t y = 0; y < ch; y++) {
+                for (uint32_t x = 0; x < cw; x++) {
+                    CHECK(gray[(size_t)(cy + y) * result.width + cx + x] == 128);
+                }
+            }
+            continue;
+        }
+        double err = cell_error(gray, result.width, cx, cy, cw, ch, tiles[t].luma, 1 << shift);
+        worst = err > worst ? err : worst;
+        // The figure tells the cameras apart: each cell is in its own place
+        const uint8_t *other = tiles[(t + 1) % (cols * rows)].luma;
+        CHECK(cols * rows == 1 || cell_error(gray, result.width, cx, cy, cw, ch, other, 1 << shift) > err);
+    }
+    printf("%ux%u grid, 1/%d: %ux%u, %zu bytes, worst cell %.2f from the averaged camera\n", cols, rows,
+           1 << shift, result.width, result.height, result.len, worst);
+    // Without reduction the blocks are the tiles' own; reduced, they are the DCT-domain downscale
+    CHECK(shift == 0 ? worst == 0 : worst < 6);
+
+    free(gray);
+    free(out);
+}
+
+static void check_errors(const tile_t *tiles)
+{
+    uint8_t *out = malloc(OUT_CAP);
+    jpeg_mosaic_result_t result;
+    jpeg_mosaic_tile_t in[JPEG_MOSAIC_MAX_TILES + 1] = {0};
+    for (int t = 0; t < JPEG_MOSAIC_MAX_TILES; t++) {
+        in[t] = (jpeg_mosaic_tile_t){ tiles[t].data, tiles[t].len, &tiles[t].index };
+    }
+    CHECK_ERR(ESP_ERR_INVALID_ARG, app_jpeg_mosaic(in, 2, 2, 4, out, OUT_CAP, &result));
+    CHECK_ERR(ESP_ERR_INVALID_ARG, app_jpeg_mosaic(in, 0, 1, 1, out, OUT_CAP, &result));
+    CHECK_ERR(ESP_ERR_INVALID_ARG, app_jpeg_mosaic(in, 5, 1, 1, out, OUT_CAP, &result));
+    CHECK_ERR(ESP_ERR_INVALID_SIZE, app_jpeg_mosaic(in, 2, 2, 1, out, 4096, &result));
+    jpeg_mosaic_tile_t none[2] = {0};
+    CHECK_ERR(ESP_ERR_NOT_FOUND, app_jpeg_mosaic(none, 2, 1, 1, out, OUT_CAP, &result));
+
+    // A grayscale camera (other sampling) and a frame cut off mid-scan are drawn grey, the rest still is
+    size_t gray_len;
+    uint8_t *gray = malloc(tiles[1].len);
+    CHECK_OK(app_jpeg_to_gray(tiles[1].data, tiles[1].len, NULL, gray, tiles[1].len, &gray_len));
+    in[1] = (jpeg_mosaic_tile_t){ gray, gray_len, NULL };
+    in[2] = (jpeg_mosaic_tile_t){ tiles[2].data, tiles[2].len / 2, NULL };
+    CHECK_OK(app_jpeg_mosaic(in, 2, 2, 1, out, OUT_CAP, &result));
+    CHECK(result.drawn == 0x9);
+    uint8_t *decoded = decode_gray(out, result.len, result.width, result.height);
+    CHECK(decoded[(size_t)(HEIGHT / 4) * result.width + WIDTH / 2 + WIDTH / 4] == 128);
+    free(decoded);
+
+    free(gray);
+    free(out);
+}
+
+int main(void)
+{
+    CHECK_OK(app_jpeg_encode_init());
+    CHECK_OK(app_jpeg_decode_init());
+    tile_t tiles[JPEG_MOSAIC_MAX_TILES];
+    for (int t = 0; t < JPEG_MOSAIC_MAX_TILES; t++) {
+        // Each camera sees the figure somewhere else
+        tiles[t].data = test_scene_jpeg(WIDTH, HEIGHT, t * 16, QUALITY, &tiles[t].len);
+        CHECK_OK(app_jpeg_build_index(tiles[t].data, tiles[t].len, &tiles[t].index));
+        tiles[t].luma = decode_gray(tiles[t].data, tiles[t].len, WIDTH, HEIGHT);
+    }
+
+    for (uint8_t shift = 0; shift <= 3; shift++) {
+        check_grid(tiles, 2, 2, shift, 0);
+    }
+    check_grid(tiles, 4, 1, 2, 0);
+    check_grid(tiles, 1, 3, 2, 0);
+    // Missing cameras are grey cells at every reduction
+    for (uint8_t shift = 1; shift <= 3; shift++) {
+        check_grid(tiles, 2, 2, shift, 0x2);
+    }
+    check_grid(tiles, 2, 2, 1, 0xE);
+    check_errors(tiles);
+
+    for (int t = 0; t < JPEG_MOSAIC_MAX_TILES; t++) {
+        free(tiles[t].luma);
+        free(tiles[t].data);
+    }
+    printf("mosaic: OK\n");
+    return 0;
+}
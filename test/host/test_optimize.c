@@ -0,0 +1,98 @@
+/*
+ * Huffman optimization (/stream?optimize=1): the output decodes to exactly the
+ * pixels of the input, keeps its restart markers, and is smaller. Frames that rely
+ * on the standard tables (no DHT) and frames of sizes off the MCU grid give the
+ * same result, with or without a structure index.
+ */
+#include "test_util.h"
+#include "app_jpeg.h"
+#include "app_jpeg_decode.h"
+#include "app_jpeg_encode.h"
+#include "app_jpeg_entropy.h"
+
+#include <string.h>
+
+#define QUALITY     80
+
+static uint8_t *decode_yuy2(const uint8_t *jpeg, size_t len, uint16_t width, uint16_t height)
+{
+    jpeg_index_t index;
+    CHECK_OK(app_jpeg_build_index(jpeg, len, &index));
+    CHECK(index.width == width && index.height == height);
+    jpeg_decode_config_t config = { .format = JPEG_DECODE_YUY2 };
+    size_t out_len = app_jpeg_decode_out_size(width, height, &config);
+    uint8_t *out = malloc(out_len);
+    CHECK_OK(app_jpeg_decode(jpeg, len, &index, &config, out, out_len, NULL));
+    return out;
+}
+
+// Optimize the frame and compare every pixel with its decode; returns the optimized length
+static size_t check_optimize(const uint8_t *frame, size_t len, const uint8_t *pixels, uint16_t width,
+                             uint16_t height)
+{
+    jpeg_index_t index;
+    CHECK_OK(app_jpeg_build_index(frame, len, &index));
+    size_t cap = len + 4096;
+    uint8_t *out = malloc(cap);
+    size_t out_len;
+    CHECK_OK(app_jpeg_optimize_huffman(frame, len, &index, out, cap, &out_len));
+
+    jpeg_index_t out_index;
+    CHECK_OK(app_jpeg_build_index(out, out_len, &out_index));
+    CHECK(out_index.num_dht > 0);
+    CHECK(out_index.restart_interval == index.restart_interval && out_index.rst_total == index.rst_total);
+    uint8_t *decoded = decode_yuy2(out, out_len, width, height);
+    CHECK(memcmp(decoded, pixels, (size_t)width * height * 2) == 0);
+
+    // Without an index: the same bytes
+    uint8_t *again = malloc(cap);
+    size_t again_len;
+    CHECK_OK(app_jpeg_optimize_huffman(frame, len, NULL, again, cap, &again_len));
+    CHECK(again_len == out_len && memcmp(again, out, out_len) == 0);
+
+    free(again);
+    free(decoded);
+    free(out);
+    return out_len;
+}
+
+static void check_frame(uint16_t width, uint16_t height)
+{
+    size_t len;
+    uint8_t *frame = test_scene_jpeg(width, height, 5, QUALITY, &len);
+    uint8_t *pixels = decode_yuy2(frame, len, width, height);
+    size_t out_len = check_optimize(frame, len, pixels, width, height);
+
+    // The same frame as a camera without DHT sends it
+    size_t bare_len;
+    uint8_t *bare = test_strip_dht(frame, len, &bare_len);
+    CHECK(bare_len < len);
+    CHECK(check_optimize(bare, bare_len, pixels, width, height) == out_len);
+
+    printf("%ux%u: %zu -> %zu bytes (%.1f%% smaller)\n", width, height, len, out_len,
+           100.0 - 100.0 * out_len / len);
+    // Tables fitted to the frame beat the Annex K ones
+    CHECK(out_len < len);
+
+    // One byte short of the result
+    uint8_t *small = malloc(out_len - 1);
+    size_t small_len;
+    CHECK_ERR(ESP_ERR_INVALID_SIZE, app_jpeg_optimize_huffman(frame, len, NULL, small, out_len - 1, &small_len));
+    free(small);
+
+    free(bare);
+    free(pixels);
+    free(frame);
+}
+
+int main(void)
+{
+    CHECK_OK(app_jpeg_encode_init());
+    CHECK_OK(app_jpeg_decode_init());
+    check_frame(640, 480);
+    check_frame(1280, 720);
+    check_frame(1010, 566);
+    check_frame(16, 64);
+    printf("optimize: OK\n");
+    return 0;
+}
@@ -0,0 +1,149 @@
+/*
+ * Timestamp and privacy masks in the compressed domain: the blocks under the text
+ * and the masks are replaced, every other MCU row decodes exactly as before, and
+ * frames whose Huffman tables were optimized for their own content (so lack codes
+ * the glyph and mask blocks need) get the same picture as frames with the standard
+ * tables instead of an error.
+ */
+#include "test_util.h"
+#include "app_jpeg.h"
+#include "app_jpeg_decode.h"
+#include "app_jpeg_encode.h"
+#include "app_jpeg_entropy.h"
+#include "app_jpeg_xform.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define QUALITY     80
+
+typedef struct {
+    uint8_t *data;
+    size_t len;
+    jpeg_index_t index;
+} frame_t;
+
+static uint8_t *decode_gray(const uint8_t *jpeg, size_t len, uint16_t width, uint16_t height)
+{
+    jpeg_index_t index;
+    CHECK_OK(app_jpeg_build_index(jpeg, len, &index));
+    CHECK(index.width == width && index.height == height);
+    jpeg_decode_config_t config = { .format = JPEG_DECODE_GRAY };
+    uint8_t *gray = malloc((size_t)width * height);
+    CHECK_OK(app_jpeg_decode(jpeg, len, &index, &config, gray, (size_t)width * height, NULL));
+    return gray;
+}
+
+// Tables built for this frame alone, as cameras and encoders with optimization send
+static frame_t optimized(const frame_t *std)
+{
+    frame_t f = { .data = malloc(std->len + 4096) };
+    CHECK_OK(app_jpeg_optimize_huffman(std->data, std->len, &std->index, f.data, std->len + 4096, &f.len));
+    CHECK_OK(app_jpeg_build_index(f.data, f.len, &f.index));
+    CHECK(f.index.rst_total == std->index.rst_total);
+    return f;
+}
+
+static uint8_t *overlay(const frame_t *f, const jpeg_overlay_t *ov, jpeg_overlay_cache_t *cache, size_t *len)
+{
+    size_t cap = 2 * f->len + 65536;
+    uint8_t *out = malloc(cap);
+    CHECK_OK(app_jpeg_overlay(f->data, f->len, &f->index, ov, cache, out, cap, len));
+    return out;
+}
+
+// MCU rows under no text or mask decode exactly as the input; masks are black (luma 16)
+static void check_pixels(const uint8_t *gray, const uint8_t *input, uint16_t width, uint16_t height,
+                         const jpeg_overlay_t *ov, int text_rows)
+{
+    for (int y = 0; y < height; y++) {
+        bool touched = text_rows > 0 && y >= ov->text_y / 8 * 8 && y < ov->text_y / 8 * 8 + text_rows;
+        for (int m = 0; m < ov->num_masks; m++) {
+            const jpeg_rect_t *r = &ov->masks[m];
+            touched |= y >= r->y / 8 * 8 && y < (r->y + r->h + 7) / 8 * 8;
+        }
+        if (!touched) {
+            CHECK(memcmp(&gray[(size_t)y * width], &input[(size_t)y * width], width) == 0);
+        }
+    }
+    for (int m = 0; m < ov->num_masks; m++) {
+        const jpeg_rect_t *r = &ov->masks[m];
+        for (int y = r->y; y < r->y + r->h && y < height; y++) {
+            for (int x = r->x; x < r->x + r->w && x < width; x++) {
+                CHECK(abs(gray[(size_t)y * width + x] - 16) <= 2);
+            }
+        }
+    }
+}
+
+// The same overlay on the standard-table frame and its optimized twin: same pixels
+static bool check_same(const frame_t *std, const frame_t *opt, const jpeg_overlay_t *ov,
+                       jpeg_overlay_cache_t *cache, const uint8_t *input, int text_rows)
+{
+    uint16_t width = std->index.width, height = std->index.height;
+    size_t std_len, opt_len;
+    uint8_t *std_out = overlay(std, ov, cache, &std_len);
+    uint8_t *opt_out = overlay(opt, ov, cache, &opt_len);
+    uint8_t *std_gray = decode_gray(std_out, std_len, width, height);
+    uint8_t *opt_gray = decode_gray(opt_out, opt_len, width, height);
+    CHECK(memcmp(std_gray, opt_gray, (size_t)width * height) == 0);
+    check_pixels(std_gray, input, width, height, ov, text_rows);
+
+    jpeg_index_t index;
+    CHECK_OK(app_jpeg_build_index(opt_out, opt_len, &index));
+    CHECK(index.restart_interval == opt->index.restart_interval);
+    // Recoded with the standard tables, or the optimized ones were enough
+    bool std_tables = memmem(opt_out, opt_len, app_jpeg_std_dht, JPEG_STD_DHT_LEN) != NULL;
+    free(opt_gray);
+    free(std_gray);
+    free(opt_out);
+    free(std_out);
+    return std_tables;
+}
+
+static void check_frame(uint16_t width, uint16_t height)
+{
+    frame_t std = { .data = test_scene_jpeg(width, height, 3, QUALITY, &std.len) };
+    CHECK_OK(app_jpeg_build_index(std.data, std.len, &std.index));
+    frame_t opt = optimized(&std);
+    uint8_t *input = decode_gray(std.data, std.len, width, height);
+    jpeg_overlay_cache_t cache = {0};
+
+    // Text only, as ts=1 draws it
+    jpeg_overlay_t text = { .text = "2026-10-17 12:34:56 CAM0", .text_x = 8, .text_y = 8 };
+    int text_rows = 8 * (height >= 720 ? 2 : 1);
+    CHECK(check_same(&std, &opt, &text, &cache, input, text_rows));
+
+    // Masks alone, swept over the frame, and masks with text
+    int placements = 0, recoded = 0;
+    for (int y = 0; y + 40 <= height; y += 67) {
+        for (int x = 0; x + 60 <= width; x += 131) {
+            jpeg_overlay_t mask = { .num_masks = 1, .masks = { { x, y, 60, 40 } } };
+            recoded += check_same(&std, &opt, &mask, &cache, input, 0);
+            placements++;
+        }
+    }
+    jpeg_overlay_t both = text;
+    both.num_masks = 2;
+    both.masks[0] = (jpeg_rect_t){ width / 2, height / 2, width / 4, height / 4 };
+    both.masks[1] = (jpeg_rect_t){ 0, height - 16, width, 16 };
+    check_same(&std, &opt, &both, &cache, input, text_rows);
+    printf("%ux%u: %zu bytes with standard tables, %zu optimized, text and %d mask placements match (%d recoded)\n",
+           width, height, std.len, opt.len, placements, recoded);
+
+    app_jpeg_overlay_cache_free(&cache);
+    free(input);
+    free(opt.data);
+    free(std.data);
+}
+
+int main(void)
+{
+    CHECK_OK(app_jpeg_encode_init());
+    CHECK_OK(app_jpeg_decode_init());
+    check_frame(640, 480);
+    check_frame(1280, 720);
+    check_frame(1002, 562);
+    printf("overlay: OK\n");
+    return 0;
+}
@@ -0,0 +1,239 @@
+/*
+ * Rewind history (/stream?from=-10s): frames pushed into the ring read back intact
+ * after it wraps many times, the oldest are the ones dropped, the seek by capture
+ * time finds the first frame at or after any point, and the buffer settles for
+ * less, or nothing, rather than eat into the PSRAM kept for viewers. The benchmark
+ * shows the seek stays logarithmic in the frames kept.
+ */
+#include "test_util.h"
+#include "app_frame_ring.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+
+#include <string.h>
+
+#define BUDGET          (256 * 1024)
+#define FRAME_US        33333
+#define MAX_FRAME       (20 * 1024)
+#define SEEK_RUNS       200000
+
+static uint8_t g_frame[MAX_FRAME];
+static uint8_t g_read[MAX_FRAME];
+
+// Frame n: its length and bytes follow from n, so any misplaced or torn copy shows
+static size_t frame_len(uint32_t n)
+{
+    return 1000 + (n * 7919) % (MAX_FRAME - 1000);
+}
+
+static void fill(uint32_t n, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        g_frame[i] = (uint8_t)(n * 31 + i * 7 + (i >> 8));
+    }
+}
+
+static int64_t frame_time(uint32_t n)
+{
+    return 1000000 + (int64_t)n * FRAME_US;
+}
+
+static void push(frame_ring_t *ring, uint32_t n, uint16_t width)
+{
+    size_t len = frame_len(n);
+    fill(n, len);
+    uint32_t seq;
+    CHECK_OK(app_frame_ring_push(ring, g_frame, len, width, width * 9 / 16, frame_time(n), &seq));
+    CHECK(seq == n + 1);
+}
+
+// Every frame kept reads back as pushed; every frame before them is gone
+static void check_contents(frame_ring_t *ring, uint32_t pushed, bool wrapped)
+{
+    frame_ring_stats_t stats;
+    app_frame_ring_stats(ring, &stats);
+    uint32_t first = pushed + 1 - stats.frames;
+    CHECK(stats.frames > 0 && stats.bytes <= ring->cap);
+    for (uint32_t seq = first; seq <= pushed; seq++) {
+        size_t len;
+        int64_t time_us;
+        CHECK_OK(app_frame_ring_read(ring, seq, g_read, sizeof(g_read), &len, &time_us));
+        fill(seq - 1, frame_len(seq - 1));
+        CHECK(len == frame_len(seq - 1) && memcmp(g_read, g_frame, len) == 0);
+        CHECK(time_us == frame_time(seq - 1));
+    }
+    size_t len;
+    CHECK_ERR(ESP_ERR_INVALID_STATE, app_frame_ring_read(ring, first - 1, g_read, sizeof(g_read), &len, NULL));
+    CHECK_ERR(ESP_ERR_NOT_FOUND, app_frame_ring_read(ring, pushed + 1, g_read, sizeof(g_read), &len, NULL));
+    // Once round, only the gap a frame left at the end and the rest of the one it overwrote are wasted
+    CHECK(!wrapped || stats.bytes + 2 * MAX_FRAME >= ring->cap);
+}
+
+static void check_wrap(void)
+{
+    frame_ring_t ring;
+    CHECK_OK(app_frame_ring_init(&ring, BUDGET, 0));
+    size_t len;
+    CHECK_ERR(ESP_ERR_NOT_FOUND, app_frame_ring_read(&ring, 1, g_read, sizeof(g_read), &len, NULL));
+    CHECK(app_frame_ring_seek(&ring, 0) == 1);
+
+    // About 25 times round the buffer, checking after every push
+    uint32_t wraps = 0;
+    size_t head = 0;
+    for (uint32_t n = 0; n < 600; n++) {
+        push(&ring, n, 1280);
+        CHECK(ring.cap == BUDGET);
+        wraps += ring.head < head;
+        head = ring.head;
+        check_contents(&ring, n + 1, wraps > 0);
+    }
+    CHECK(wraps >= 20);
+
+    // A frame larger than the whole ring is refused and changes nothing
+    frame_ring_stats_t before, after;
+    app_frame_ring_stats(&ring, &before);
+    uint8_t *big = calloc(1, BUDGET + 1);
+    CHECK_ERR(ESP_ERR_INVALID_SIZE, app_frame_ring_push(&ring, big, BUDGET + 1, 1280, 720, frame_time(600), NULL));
+    app_frame_ring_stats(&ring, &after);
+    CHECK(after.frames == before.frames && after.bytes == before.bytes);
+    free(big);
+    CHECK(ring.cap == BUDGET);
+}
+
+// Small frames: the index runs out before the buffer does
+static void check_table_full(void)
+{
+    frame_ring_t ring;
+    CHECK_OK(app_frame_ring_init(&ring, BUDGET, 0));
+    uint8_t tiny[16] = {0};
+    for (uint32_t n = 0; n < 3 * FRAME_RING_MAX_FRAMES; n++) {
+        tiny[0] = (uint8_t)n;
+        CHECK_OK(app_frame_ring_push(&ring, tiny, sizeof(tiny), 320, 240, frame_time(n), NULL));
+    }
+    frame_ring_stats_t stats;
+    app_frame_ring_stats(&ring, &stats);
+    CHECK(stats.frames == FRAME_RING_MAX_FRAMES - 1 || stats.frames == FRAME_RING_MAX_FRAMES);
+    size_t len;
+    CHECK_OK(app_frame_ring_read(&ring, 3 * FRAME_RING_MAX_FRAMES, g_read, sizeof(g_read), &len, NULL));
+    CHECK(len == sizeof(tiny) && g_read[0] == (uint8_t)(3 * FRAME_RING_MAX_FRAMES - 1));
+}
+
+static void check_seek(frame_ring_t *ring, uint32_t pushed)
+{
+    frame_ring_stats_t stats;
+    app_frame_ring_stats(ring, &stats);
+    uint32_t first = pushed + 1 - stats.frames;
+    for (uint32_t seq = first; seq <= pushed; seq++) {
+        int64_t t = frame_time(seq - 1);
+        CHECK(app_frame_ring_seek(ring, t) == seq);
+        CHECK(app_frame_ring_seek(ring, t - FRAME_US / 2) == seq);
+        CHECK(app_frame_ring_seek(ring, t - FRAME_US + 1) == seq);
+    }
+    // Before the oldest frame kept: the oldest; after the newest: the next one to come
+    CHECK(app_frame_ring_seek(ring, INT64_MIN) == first);
+    CHECK(app_frame_ring_seek(ring, 0) == first);
+    CHECK(app_frame_ring_seek(ring, frame_time(pushed)) == pushed + 1);
+    CHECK(app_frame_ring_seek(ring, INT64_MAX) == pushed + 1);
+}
+
+// Average time of a seek to a random point over the frames kept
+static double seek_ns(frame_ring_t *ring, uint32_t pushed)
+{
+    double best = 1e9;
+    uint32_t x = 12345;
+    frame_ring_stats_t stats;
+    app_frame_ring_stats(ring, &stats);
+    for (int run = 0; run < 3; run++) {
+        uint32_t sum = 0;
+        int64_t t0 = esp_timer_get_time();
+        for (int i = 0; i < SEEK_RUNS; i++) {
+            x = x * 1103515245u + 12345u;
+            uint32_t n = pushed - stats.frames + (x >> 8) % stats.frames;
+            sum += app_frame_ring_seek(ring, frame_time(n));
+        }
+        double ns = (double)(esp_timer_get_time() - t0) * 1000 / SEEK_RUNS;
+        best = ns < best ? ns : best;
+        CHECK(sum != 0);
+    }
+    return best;
+}
+
+static void check_seek_and_bench(void)
+{
+    frame_ring_t small, large;
+    CHECK_OK(app_frame_ring_init(&small, 32 * 16, 0));
+    CHECK_OK(app_frame_ring_init(&large, FRAME_RING_MAX_FRAMES * 16, 0));
+    uint8_t tiny[16] = {0};
+    for (uint32_t n = 0; n < 2000; n++) {
+        CHECK_OK(app_frame_ring_push(&small, tiny, sizeof(tiny), 320, 240, frame_time(n), NULL));
+        CHECK_OK(app_frame_ring_push(&large, tiny, sizeof(tiny), 320, 240, frame_time(n), NULL));
+    }
+    check_seek(&small, 2000);
+    check_seek(&large, 2000);
+
+    frame_ring_stats_t stats_small, stats_large;
+    app_frame_ring_stats(&small, &stats_small);
+    app_frame_ring_stats(&large, &stats_large);
+    double small_ns = seek_ns(&small, 2000);
+    double large_ns = seek_ns(&large, 2000);
+    printf("seek over %lu frames %.0f ns, over %lu frames %.0f ns (%.1fx for %.0fx the frames)\n",
+           (unsigned long)stats_small.frames, small_ns, (unsigned long)stats_large.frames, large_ns,
+           large_ns / small_ns, (double)stats_large.frames / stats_small.frames);
+    // Binary search: 32 times the frames is 5 more steps, a linear scan would be 32 times slower
+    CHECK(stats_large.frames >= 16 * stats_small.frames);
+    CHECK(large_ns < 4 * small_ns);
+}
+
+static void check_stats(void)
+{
+    frame_ring_t ring;
+    CHECK_OK(app_frame_ring_init(&ring, BUDGET, 0));
+    for (uint32_t n = 0; n < 30; n++) {
+        push(&ring, n, n < 20 ? 1280 : 640);
+    }
+    frame_ring_stats_t stats;
+    app_frame_ring_stats(&ring, &stats);
+    CHECK(stats.cap == BUDGET && stats.frames > 10 && stats.frames < 30);
+    CHECK(stats.num_res == 2 && stats.res[0].width == 1280 && stats.res[1].width == 640);
+    CHECK(stats.res[0].frames + stats.res[1].frames == stats.frames && stats.res[1].frames == 10);
+    CHECK(stats.span_ms == (uint32_t)((frame_time(29) - frame_time(30 - stats.frames)) / 1000));
+    uint32_t bytes = 0;
+    for (uint32_t n = 30 - stats.frames; n < 30; n++) {
+        bytes += frame_len(n);
+    }
+    CHECK(stats.bytes == bytes && stats.res[0].bytes + stats.res[1].bytes == bytes);
+}
+
+// Sizes that would leave less than the reserve free are passed over, down to an eighth
+static void check_budget(void)
+{
+    size_t free_size = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+    uint8_t frame[64] = {0};
+    frame_ring_t ring;
+
+    CHECK_OK(app_frame_ring_init(&ring, BUDGET, free_size - BUDGET / 4));
+    CHECK_OK(app_frame_ring_push(&ring, frame, sizeof(frame), 320, 240, 0, NULL));
+    CHECK(ring.cap == BUDGET / 4);
+
+    CHECK_OK(app_frame_ring_init(&ring, BUDGET, free_size - BUDGET / 16));
+    CHECK_ERR(ESP_ERR_NO_MEM, app_frame_ring_push(&ring, frame, sizeof(frame), 320, 240, 0, NULL));
+    CHECK(ring.buf == NULL && ring.entries == NULL);
+    CHECK_ERR(ESP_ERR_NO_MEM, app_frame_ring_push(&ring, frame, sizeof(frame), 320, 240, 1, NULL));
+
+    // Rewind turned off
+    CHECK_OK(app_frame_ring_init(&ring, 0, 0));
+    CHECK_ERR(ESP_ERR_NO_MEM, app_frame_ring_push(&ring, frame, sizeof(frame), 320, 240, 0, NULL));
+    CHECK(ring.entries == NULL);
+    CHECK(app_frame_ring_seek(&ring, 0) == 1);
+}
+
+int main(void)
+{
+    check_wrap();
+    check_table_full();
+    check_stats();
+    check_budget();
+    check_seek_and_bench();
+    printf("ring: OK\n");
+    return 0;
+}
@@ -0,0 +1,115 @@
+#include "test_util.h"
+#include "app_jpeg_encode.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+// Fixed detail per 4x4 cell, so every 8x8 block has AC energy like a real scene
+static int detail(int x, int y)
+{
+    uint32_t h = (uint32_t)(x >> 2) * 73856093u ^ (uint32_t)(y >> 2) * 19349663u;
+    h ^= h >> 13;
+    h *= 0x5bd1e995u;
+    h ^= h >> 15;
+    return (int)(h & 31) - 16;
+}
+
+static uint8_t clamp_u8(int v)
+{
+    return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+void test_scene_yuy2(uint16_t width, uint16_t height, int frame, uint8_t *out)
+{
+    int fig_w = width / 10;
+    int fig_h = height / 4;
+    int fig_x = (frame * width / 64) % width;
+    int fig_y = height / 2 - fig_h / 2;
+
+    for (int y = 0; y < height; y++) {
+        uint8_t *row = out + (size_t)y * width * 2;
+        for (int x = 0; x < width; x += 2) {
+            bool figure = (y >= fig_y && y < fig_y + fig_h && x >= fig_x && x < fig_x + fig_w);
+            int base = 40 + x * 120 / width + y * 60 / height;
+            row[2 * x] = figure ? 30 : clamp_u8(base + detail(x, y));
+            row[2 * x + 2] = figure ? 30 : clamp_u8(base + detail(x + 1, y));
+            row[2 * x + 1] = figure ? 110 : clamp_u8(108 + x * 40 / width);
+            row[2 * x + 3] = figure ? 150 : clamp_u8(108 + y * 40 / height);
+        }
+    }
+}
+
+uint8_t *test_scene_jpeg(uint16_t width, uint16_t height, int frame, uint8_t quality, size_t *len)
+{
+    size_t yuy2_len = (size_t)width * height * 2;
+    uint8_t *yuy2 = malloc(yuy2_len);
+    uint8_t *jpeg = malloc(yuy2_len);
+    CHECK(yuy2 != NULL && jpeg != NULL);
+    test_scene_yuy2(width, height, frame, yuy2);
+
+    jpeg_encode_config_t config = { .quality = quality };
+    jpeg_encode_result_t result;
+    CHECK_OK(app_jpeg_encode_yuy2(yuy2, width, height, &config, jpeg, yuy2_len, &result));
+    free(yuy2);
+    *len = result.len;
+    return jpeg;
+}
+
+uint8_t *test_strip_dht(const uint8_t *jpeg, size_t len, size_t *out_len)
+{
+    uint8_t *out = malloc(len);
+    CHECK(out != NULL && len >= 4 && jpeg[0] == 0xFF && jpeg[1] == 0xD8);
+    memcpy(out, jpeg, 2);
+    size_t o = 2;
+    size_t pos = 2;
+    while (pos + 4 <= len && jpeg[pos] == 0xFF && jpeg[pos + 1] != 0xDA) {
+        size_t seg = 2 + ((size_t)jpeg[pos + 2] << 8 | jpeg[pos + 3]);
+        CHECK(pos + seg <= len);
+        if (jpeg[pos + 1] != 0xC4) {
+            memcpy(&out[o], &jpeg[pos], seg);
+            o += seg;
+        }
+        pos += seg;
+    }
+    CHECK(pos + 4 <= len);
+    memcpy(&out[o], &jpeg[pos], len - pos);
+    *out_len = o + len - pos;
+    return out;
+}
+
+size_t test_split_aus(const uint8_t *data, size_t len, size_t *pos, size_t *lens, size_t max)
+{
+    size_t count = 0;
+    for (size_t i = 0; i + 3 < len; i++) {
+        if (data[i] != 0 || data[i + 1] != 0 || data[i + 2] != 1 || (data[i + 3] & 0x1f) != 9) {
+            continue;
+        }
+        size_t start = (i > 0 && data[i - 1] == 0) ? i - 1 : i;
+        if (count > 0) {
+            lens[count - 1] = start - pos[count - 1];
+        }
+        CHECK(count < max);
+        pos[count++] = start;
+    }
+    if (count > 0) {
+        lens[count - 1] = len - pos[count - 1];
+    }
+    return count;
+}
+
+uint8_t *test_read_file(const char *path, size_t *len)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        exit(1);
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = malloc(size > 0 ? size : 1);
+    CHECK(data != NULL && fread(data, 1, size, f) == (size_t)size);
+    fclose(f);
+    *len = size;
+    return data;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "esp_err.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Shared helpers of the host tests: assertions that stop the test with the failing
+ * expression, and a synthetic camera that produces the same pictures on every run.
+ */
+
+#define CHECK(cond) do {                                                                \
+        if (!(cond)) {                                                                  \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond);    \
+            exit(1);                                                                    \
+        }                                                                               \
+    } while (0)
+
+#define CHECK_ERR(expected, expr) do {                                                  \
+        esp_err_t err_ = (expr);                                                        \
+        if (err_ != (expected)) {                                                       \
+            fprintf(stderr, "%s:%d: %s returned %s, expected %s\n", __FILE__, __LINE__, \
+                    #expr, esp_err_to_name(err_), esp_err_to_name(expected));           \
+            exit(1);                                                                    \
+        }                                                                               \
+    } while (0)
+
+#define CHECK_OK(expr) CHECK_ERR(ESP_OK, expr)
+
+/**
+ * @brief Draw one frame of the synthetic camera as YUY2
+ *
+ * A static, textured background (gradients plus fixed detail in every block) with a
+ * dark figure that walks across the middle of the picture, one step per frame.
+ *
+ * @param width Frame width, even
+ * @param height Frame height
+ * @param frame Frame number, selects the position of the figure
+ * @param[out] out width * height * 2 bytes
+ */
+void test_scene_yuy2(uint16_t width, uint16_t height, int frame, uint8_t *out);
+
+/**
+ * @brief Encode one frame of the synthetic camera as it would arrive over USB
+ *
+ * Uses app_jpeg_encode_yuy2(), so the frame is 4:2:2 with a restart marker after
+ * every MCU row, like the MJPEG of the cameras this pipeline is tuned for.
+ * app_jpeg_encode_init() must have been called.
+ *
+ * @param width Frame width, even
+ * @param height Frame height
+ * @param frame Frame number
+ * @param quality JPEG quality, 1-100
+ * @param[out] len JPEG length
+ * @return The frame, to be freed by the caller
+ */
+uint8_t *test_scene_jpeg(uint16_t width, uint16_t height, int frame, uint8_t quality, size_t *len);
+
+/**
+ * @brief Copy a frame without its DHT segments, as cameras that rely on the standard tables send it
+ *
+ * @param jpeg Frame
+ * @param len Frame length
+ * @param[out] out_len Length of the copy
+ * @return The copy, to be freed by the caller
+ */
+uint8_t *test_strip_dht(const uint8_t *jpeg, size_t len, size_t *out_len);
+
+/**
+ * @brief Split an Annex B stream into access units at its access unit delimiters
+ *
+ * @param data Stream, every access unit starting with an AUD
+ * @param len Stream length
+ * @param[out] pos Offset of every access unit (of its start code)
+ * @param[out] lens Length of every access unit
+ * @param max Entries in pos and lens
+ * @return Number of access units
+ */
+size_t test_split_aus(const uint8_t *data, size_t len, size_t *pos, size_t *lens, size_t max);
+
+/**
+ * @brief Read a whole file
+ *
+ * @param path File name
+ * @param[out] len File length
+ * @return File contents, to be freed by the caller; the test fails if the file cannot be read
+ */
+uint8_t *test_read_file(const char *path, size_t *len);
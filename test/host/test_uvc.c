@@ -0,0 +1,192 @@
+/*
+ * Several cameras on one bus (fake_uvc.c): every pipeline finds a camera, the
+ * formats they settle on share the periodic bandwidth without exceeding it, each
+ * camera's frames reach consumers tagged with it, and a camera that is unplugged
+ * leaves the other streaming while its pipeline takes the next camera plugged in.
+ */
+#include "test_util.h"
+#include "fake_uvc.h"
+#include "app_jpeg_codec.h"
+#include "app_uvc.h"
+#include "esp_timer.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#define WAIT_MS     5000
+#define MIN_FRAMES  10
+
+static const fake_uvc_device_t g_mjpeg_cam = {
+    .name = "mjpeg",
+    .format = UVC_VS_FORMAT_MJPEG,
+    .modes = {
+        { 1280, 720, { 20, 5 } },
+        { 640, 480, { 15 } },
+        { 320, 240, { 15 } },
+    },
+};
+
+static const fake_uvc_device_t g_yuy2_cam = {
+    .name = "yuy2",
+    .format = UVC_VS_FORMAT_YUY2,
+    .modes = {
+        { 640, 480, { 15 } },
+        { 320, 240, { 15 } },
+    },
+};
+
+typedef struct {
+    uint32_t frames;
+    uint32_t last_seq;
+    uint16_t width;
+    uint16_t height;
+    uint32_t bad;
+} consumer_stats_t;
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static consumer_stats_t g_seen[APP_UVC_MAX_CAMERAS];
+
+static void on_frame(const app_frame_t *frame, void *user_ctx)
+{
+    (void)user_ctx;
+    pthread_mutex_lock(&g_lock);
+    CHECK(frame->camera < APP_UVC_MAX_CAMERAS);
+    consumer_stats_t *seen = &g_seen[frame->camera];
+    // Every frame handed out is an indexed JPEG, sequence numbers only go up
+    if (frame->format != APP_FRAME_MJPEG || frame->index_status != ESP_OK ||
+        (seen->frames > 0 && frame->seq <= seen->last_seq)) {
+        seen->bad++;
+    }
+    seen->frames++;
+    seen->last_seq = frame->seq;
+    seen->width = frame->index.width;
+    seen->height = frame->index.height;
+    pthread_mutex_unlock(&g_lock);
+}
+
+static consumer_stats_t seen(uint8_t camera)
+{
+    pthread_mutex_lock(&g_lock);
+    consumer_stats_t stats = g_seen[camera];
+    pthread_mutex_unlock(&g_lock);
+    return stats;
+}
+
+static void reset_seen(uint8_t camera)
+{
+    pthread_mutex_lock(&g_lock);
+    uint32_t last_seq = g_seen[camera].last_seq;
+    memset(&g_seen[camera], 0, sizeof(g_seen[camera]));
+    g_seen[camera].last_seq = last_seq;
+    pthread_mutex_unlock(&g_lock);
+}
+
+// Wait until the camera is connected (or not) and, if connected, has delivered MIN_FRAMES
+static bool wait_camera(uint8_t camera, bool connected)
+{
+    int64_t deadline = esp_timer_get_time() + WAIT_MS * 1000LL;
+    while (esp_timer_get_time() < deadline) {
+        uvc_camera_info_t info;
+        app_uvc_get_camera_info(camera, &info);
+        if (info.connected == connected && (!connected || seen(camera).frames >= MIN_FRAMES)) {
+            return true;
+        }
+        usleep(20 * 1000);
+    }
+    return false;
+}
+
+// Both cameras stream within the bus budget; returns the reserved total
+static uint32_t check_cameras(void)
+{
+    uint32_t reserved = 0;
+    for (uint8_t c = 0; c < APP_UVC_MAX_CAMERAS; c++) {
+        uvc_camera_info_t info;
+        app_uvc_get_camera_info(c, &info);
+        consumer_stats_t stats = seen(c);
+        printf("camera %u: %ux%u@%u %s, %lu bytes per USB interval, %lu frames\n", c, info.width, info.height,
+               info.fps, app_uvc_is_encoding(c) ? "YUY2 encoded" : "MJPEG", (unsigned long)info.usb_bytes,
+               (unsigned long)stats.frames);
+        CHECK(info.connected && info.usb_bytes > 0);
+        CHECK(stats.bad == 0);
+        CHECK(stats.width == info.width && stats.height == info.height);
+        stream_stats_snapshot_t ingest;
+        app_uvc_get_stats(c, &ingest);
+        CHECK(ingest.frames_total >= stats.frames);
+        reserved += info.usb_bytes;
+    }
+    printf("reserved %lu of %lu bytes per USB interval\n", (unsigned long)reserved,
+           (unsigned long)app_uvc_get_usb_budget());
+    CHECK(reserved <= app_uvc_get_usb_budget());
+    return reserved;
+}
+
+// The camera whose pipeline streams the given port
+static int camera_of(int port)
+{
+    uvc_host_stream_format_t format;
+    CHECK(fake_uvc_streaming(port, &format));
+    for (uint8_t c = 0; c < APP_UVC_MAX_CAMERAS; c++) {
+        uvc_camera_info_t info;
+        app_uvc_get_camera_info(c, &info);
+        if (info.connected && info.width == format.h_res && info.height == format.v_res) {
+            return c;
+        }
+    }
+    CHECK(false);
+    return -1;
+}
+
+int main(void)
+{
+    CHECK_OK(app_jpeg_codec_init());
+    CHECK_OK(app_uvc_register_frame_callback(on_frame, NULL));
+    int port_a = fake_uvc_plug(&g_mjpeg_cam);
+    int port_b = fake_uvc_plug(&g_mjpeg_cam);
+    CHECK_OK(app_uvc_init());
+
+    // Two identical cameras: the first takes 720p, the second what the bus has left
+    for (uint8_t c = 0; c < APP_UVC_MAX_CAMERAS; c++) {
+        CHECK(wait_camera(c, true));
+    }
+    check_cameras();
+    uvc_host_stream_format_t format_a, format_b;
+    CHECK(fake_uvc_streaming(port_a, &format_a) && fake_uvc_streaming(port_b, &format_b));
+    CHECK(format_a.h_res != format_b.h_res);
+    CHECK(format_a.h_res == 1280 || format_b.h_res == 1280);
+
+    // Unplug the 720p camera: its pipeline lets go of the bandwidth, the other keeps streaming
+    int port_big = format_a.h_res == 1280 ? port_a : port_b;
+    int port_small = port_big == port_a ? port_b : port_a;
+    uint8_t cam_big = camera_of(port_big);
+    uint8_t cam_small = camera_of(port_small);
+    fake_uvc_unplug(port_big);
+    CHECK(wait_camera(cam_big, false));
+    uint32_t small_before = seen(cam_small).frames;
+    usleep(500 * 1000);
+    CHECK(seen(cam_small).frames > small_before);
+    CHECK(fake_uvc_streaming(port_small, NULL));
+
+    // A YUY2-only camera plugged in now is taken by the free pipeline and encoded to JPEG
+    reset_seen(cam_big);
+    int port_yuy2 = fake_uvc_plug(&g_yuy2_cam);
+    CHECK(wait_camera(cam_big, true));
+    CHECK(camera_of(port_yuy2) == cam_big);
+    CHECK(app_uvc_is_encoding(cam_big) && !app_uvc_is_encoding(cam_small));
+    check_cameras();
+    xform_stats_t *encode = app_uvc_get_encode_stats(cam_big);
+    CHECK(encode->failures == 0 && encode->res[0].frames > 0 && encode->res[0].bytes_out < encode->res[0].bytes_in);
+    printf("YUY2 camera: %ux%u, %llu kB raw to %llu kB JPEG over %lu frames\n", encode->res[0].width,
+           encode->res[0].height, (unsigned long long)encode->res[0].bytes_in / 1024,
+           (unsigned long long)encode->res[0].bytes_out / 1024, (unsigned long)encode->res[0].frames);
+
+    // Replugging the first camera finds no free pipeline; nothing else changes
+    int port_again = fake_uvc_plug(&g_mjpeg_cam);
+    usleep(500 * 1000);
+    CHECK(!fake_uvc_streaming(port_again, NULL));
+    check_cameras();
+
+    printf("uvc: OK\n");
+    return 0;
+}